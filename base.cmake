@@ -25,8 +25,8 @@ macro(rg_setup_compile_options)
     endif()
 
     if($ENV{ENABLE_PROFILING})
-        # Still debating whether -fno-inline is necessary or not...
-        component_compile_options(-DENABLE_PROFILING -finstrument-functions)
+        # The profiler samples the PC from a timer interrupt, no instrumentation needed
+        component_compile_options(-DENABLE_PROFILING)
     endif()
 
     if($ENV{ENABLE_NETPLAY})
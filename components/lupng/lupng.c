@@ -56,6 +56,7 @@
 #define BUF_SIZE 8192
 #define MIN(x, y) ((x) < (y) ? (x) : (y))
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define RGB565(r, g, b) ((((r) >> 3) << 11) | (((g) >> 2) << 5) | ((b) >> 3))
 
 #if defined(_MSC_VER)
 #define LU_INLINE __inline /* MS-specific inline */
@@ -119,14 +120,17 @@ static const uint32_t crcTable[] =
 /* Update a running CRC with the bytes buf[0..len-1]--the CRC
  should be initialized to all 1's, and the transmitted value
  is the 1's complement of the final running CRC. */
-static uint32_t crc(const uint8_t *buf, size_t len)
+static uint32_t crcUpdate(uint32_t crc, const uint8_t *buf, size_t len)
 {
-    uint32_t crc = 0xFFFFFFFFL;
-
     for (size_t n = 0; n < len; n++)
         crc = crcTable[(crc ^ buf[n]) & 0xFF] ^ (crc >> 8);
 
-    return crc ^ 0xFFFFFFFFL;
+    return crc;
+}
+
+static uint32_t crc(const uint8_t *buf, size_t len)
+{
+    return crcUpdate(0xFFFFFFFFL, buf, len) ^ 0xFFFFFFFFL;
 }
 
 
@@ -146,6 +150,7 @@ typedef struct
 typedef struct
 {
     const LuUserContext *userCtx;
+    const LuRowReader *rowReader;
     uint32_t chunksFound;
 
     /* IHDR info */
@@ -241,6 +246,12 @@ static LU_INLINE uint16_t swap16(uint16_t n)
     return ((uint16_t)u.np[0] << 8) | (uint16_t)u.np[1];
 }
 
+/* Unaligned safe, chunk data isn't word aligned in the row decoder's buffer */
+static LU_INLINE uint32_t loadBE32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
 static int bytesEqual(const uint8_t *a, const uint8_t *b, size_t count)
 {
     for (size_t i = 0; i < count; ++i)
@@ -416,8 +427,14 @@ static LU_INLINE int parseIhdr(PngInfoStruct *info, PngChunk *chunk)
     }
 
     info->chunksFound |= PNG_IHDR;
-    info->width = swap32(*(uint32_t *)chunk->data);
-    info->height = swap32(*((uint32_t *)chunk->data + 1));
+    if (chunk->length < 13)
+    {
+        LUPNG_WARN(info, "IHDR chunk is too short!");
+        return PNG_ERROR;
+    }
+
+    info->width = loadBE32(chunk->data);
+    info->height = loadBE32(chunk->data + 4);
     info->depth = *(chunk->data + 8);
     info->colorType = *(chunk->data + 9);
     info->compression = *(chunk->data + 10);
@@ -471,9 +488,14 @@ static LU_INLINE int parseIhdr(PngInfoStruct *info, PngChunk *chunk)
         return PNG_ERROR;
     }
 
+    /* the row decoder brings its own buffers, except for interlaced images */
+    if (info->rowReader && !info->interlace)
+        return PNG_OK;
+
     info->img = luImageCreate(info->width, info->height,
                               info->channels, info->depth < 16 ? 8 : 16, NULL, info->userCtx);
-    info->bytesPerPixel = MAX((info->channels * info->depth) >> 3, 1);
+    /* a palette index is a single sample even though it expands to 3 channels */
+    info->bytesPerPixel = MAX(((info->colorType == PNG_PALETTED ? 1 : info->channels) * info->depth) >> 3, 1);
     info->scanlineBytes = info->width * info->bytesPerPixel;
     info->currentScanline = (uint8_t *)info->userCtx->allocProc(info->scanlineBytes, info->userCtx->allocProcUserPtr);
     info->previousScanline = (uint8_t *)info->userCtx->allocProc(info->scanlineBytes, info->userCtx->allocProcUserPtr);
@@ -626,10 +648,13 @@ static LU_INLINE int insertByte(PngInfoStruct *info, uint8_t byte)
             if (info->currentRow >= info->height && info->interlace)
             {
                 ++info->interlacePass;
-                while (startingCol[info->interlacePass] >= info->width ||
-                       startingRow[info->interlacePass] >= info->height)
+                while (info->interlacePass < 8 &&
+                       (startingCol[info->interlacePass] >= info->width ||
+                        startingRow[info->interlacePass] >= info->height))
                     ++info->interlacePass;
-                info->currentRow = startingRow[info->interlacePass];
+                /* past the last pass currentRow stays out of the image, which ends decoding */
+                if (info->interlacePass < 8)
+                    info->currentRow = startingRow[info->interlacePass];
             }
             return 1;
         }
@@ -763,7 +788,7 @@ static LU_INLINE int readChunk(PngInfoStruct *info, PngChunk *chunk)
         return PNG_ERROR;
     }
 
-    chunk_crc = swap32(*((uint32_t*)(buffer + data_len + 4)));
+    chunk_crc = loadBE32(buffer + data_len + 4);
     if (crc(buffer, data_len + 4) != chunk_crc)
     {
         LUPNG_WARN(info, "CRC mismatch in chunk '%.4s'", (char *)buffer);
@@ -899,6 +924,458 @@ LuImage *luPngReadFile(const char *filename)
     return img;
 }
 
+/********************************************************
+ * Row decoder
+ ********************************************************/
+
+typedef struct
+{
+    int32_t width;          /* output size */
+    int32_t height;
+    int32_t samples;        /* per source pixel */
+    int32_t rowBytes;       /* filtered scanline size, without the filter byte */
+    int32_t bytesPerPixel;  /* distance used by the filters, at least 1 */
+    int32_t filled;         /* bytes of the current scanline inflated so far, filter byte included */
+    int32_t srcRow;
+    int32_t outRow;
+    uint8_t *line;          /* filter byte + scanline */
+    uint8_t *prevLine;
+    uint8_t *rgb;           /* the source row expanded to RGB888 */
+    uint32_t *sums;         /* R, G, B accumulated per output column */
+    uint16_t *pixels;       /* the output row */
+} RowState;
+
+/* Output pixel i covers source pixels [boundary(i), boundary(i + 1)) */
+static LU_INLINE uint32_t boundary(uint32_t i, uint32_t srcSize, uint32_t dstSize)
+{
+    return i * srcSize / dstSize;
+}
+
+static int rowsBegin(PngInfoStruct *info, RowState *rs)
+{
+    const LuUserContext *userCtx = info->userCtx;
+    const LuRowReader *reader = info->rowReader;
+    int32_t width = info->width, height = info->height;
+
+    /* rg_image_t and the span math are 16 bit */
+    if (width > 0xFFFF || height > 0xFFFF)
+    {
+        LUPNG_WARN(info, "image is too large for the row decoder");
+        return PNG_ERROR;
+    }
+
+    if (reader->maxWidth > 0 && width > reader->maxWidth)
+    {
+        height = MAX((int64_t)height * reader->maxWidth / width, 1);
+        width = reader->maxWidth;
+    }
+    if (reader->maxHeight > 0 && height > reader->maxHeight)
+    {
+        width = MAX((int64_t)width * reader->maxHeight / height, 1);
+        height = reader->maxHeight;
+    }
+
+    switch (info->colorType)
+    {
+        case PNG_TRUECOLOR: rs->samples = 3; break;
+        case PNG_GRAYSCALE_ALPHA: rs->samples = 2; break;
+        case PNG_TRUECOLOR_ALPHA: rs->samples = 4; break;
+        default: rs->samples = 1; break;
+    }
+
+    rs->width = width;
+    rs->height = height;
+    rs->rowBytes = (info->width * rs->samples * info->depth + 7) >> 3;
+    rs->bytesPerPixel = MAX((rs->samples * info->depth) >> 3, 1);
+    rs->line = (uint8_t *)userCtx->allocProc(rs->rowBytes + 1, userCtx->allocProcUserPtr);
+    rs->prevLine = (uint8_t *)userCtx->allocProc(rs->rowBytes + 1, userCtx->allocProcUserPtr);
+    rs->rgb = (uint8_t *)userCtx->allocProc(info->width * 3, userCtx->allocProcUserPtr);
+    rs->sums = (uint32_t *)userCtx->allocProc(width * 3 * sizeof(uint32_t), userCtx->allocProcUserPtr);
+    rs->pixels = (uint16_t *)userCtx->allocProc(width * sizeof(uint16_t), userCtx->allocProcUserPtr);
+
+    if (!rs->line || !rs->prevLine || !rs->rgb || !rs->sums || !rs->pixels)
+    {
+        LUPNG_WARN(info, "memory allocation failed!");
+        return PNG_ERROR;
+    }
+
+    /* the row above the first one is all zeroes for the filters */
+    memset(rs->prevLine, 0, rs->rowBytes + 1);
+    memset(rs->sums, 0, width * 3 * sizeof(uint32_t));
+
+    if (reader->sizeProc && reader->sizeProc(reader->userPtr, width, height))
+        return PNG_ERROR;
+
+    return PNG_OK;
+}
+
+static void rowsEnd(PngInfoStruct *info, RowState *rs)
+{
+    const LuUserContext *userCtx = info->userCtx;
+
+    userCtx->freeProc(rs->line, userCtx->freeProcUserPtr);
+    userCtx->freeProc(rs->prevLine, userCtx->freeProcUserPtr);
+    userCtx->freeProc(rs->rgb, userCtx->freeProcUserPtr);
+    userCtx->freeProc(rs->sums, userCtx->freeProcUserPtr);
+    userCtx->freeProc(rs->pixels, userCtx->freeProcUserPtr);
+}
+
+static LU_INLINE int unfilterScanline(PngInfoStruct *info, RowState *rs)
+{
+    uint8_t *cur = rs->line + 1;
+    const uint8_t *prev = rs->prevLine + 1;
+    int32_t len = rs->rowBytes, bpp = rs->bytesPerPixel, i;
+
+    switch (rs->line[0])
+    {
+        case PNG_FILTER_NONE:
+            break;
+        case PNG_FILTER_SUB:
+            for (i = bpp; i < len; ++i)
+                cur[i] += cur[i - bpp];
+            break;
+        case PNG_FILTER_UP:
+            for (i = 0; i < len; ++i)
+                cur[i] += prev[i];
+            break;
+        case PNG_FILTER_AVERAGE:
+            for (i = 0; i < bpp; ++i)
+                cur[i] += prev[i] >> 1;
+            for (; i < len; ++i)
+                cur[i] += ((unsigned)cur[i - bpp] + prev[i]) >> 1;
+            break;
+        case PNG_FILTER_PAETH:
+            for (i = 0; i < bpp; ++i)
+                cur[i] += prev[i];
+            for (; i < len; ++i)
+                cur[i] += paethPredictor(cur[i - bpp], prev[i], prev[i - bpp]);
+            break;
+        default:
+            LUPNG_WARN(info, "unknown filter type: %u", rs->line[0]);
+            return PNG_ERROR;
+    }
+
+    return PNG_OK;
+}
+
+static LU_INLINE void paletteColor(const PngInfoStruct *info, unsigned index, uint8_t *dst)
+{
+    if (index < info->paletteItems)
+        memcpy(dst, info->palette[index], 3);
+    else
+        dst[0] = dst[1] = dst[2] = 0;
+}
+
+/* Converts the unfiltered scanline to RGB888, 16 bit samples keep their high byte */
+static LU_INLINE void expandScanline(const PngInfoStruct *info, RowState *rs)
+{
+    const uint8_t scale[] = {0x00, 0xFF, 0x55, 0x00, 0x11};
+    const uint8_t *src = rs->line + 1;
+    uint8_t *dst = rs->rgb;
+    int32_t depth = info->depth;
+
+    if (depth < 8)
+    {
+        unsigned mask = (1 << depth) - 1;
+        for (int32_t x = 0; x < info->width; ++x, dst += 3)
+        {
+            uint32_t bit = x * depth;
+            unsigned value = (src[bit >> 3] >> (8 - depth - (bit & 7))) & mask;
+            if (info->colorType == PNG_PALETTED)
+                paletteColor(info, value, dst);
+            else
+                dst[0] = dst[1] = dst[2] = value * scale[depth];
+        }
+        return;
+    }
+
+    int32_t step = depth >> 3, stride = rs->samples * step;
+    for (int32_t x = 0; x < info->width; ++x, src += stride, dst += 3)
+    {
+        switch (info->colorType)
+        {
+            case PNG_TRUECOLOR:
+            case PNG_TRUECOLOR_ALPHA:
+                dst[0] = src[0];
+                dst[1] = src[step];
+                dst[2] = src[step * 2];
+                break;
+            case PNG_PALETTED:
+                paletteColor(info, src[0], dst);
+                break;
+            default:
+                dst[0] = dst[1] = dst[2] = src[0];
+                break;
+        }
+    }
+}
+
+/* Adds the RGB888 source row to the output, emitting an output row when its span is complete */
+static int pushRow(PngInfoStruct *info, RowState *rs)
+{
+    const LuRowReader *reader = info->rowReader;
+    uint32_t srcWidth = info->width, srcHeight = info->height;
+    const uint8_t *rgb = rs->rgb;
+    uint16_t *pixels = rs->pixels;
+    uint32_t *sums = rs->sums;
+    uint32_t x, out, end;
+
+    ++rs->srcRow;
+
+    if (rs->width == srcWidth && rs->height == srcHeight)
+    {
+        for (x = 0; x < srcWidth; ++x, rgb += 3)
+            pixels[x] = RGB565(rgb[0], rgb[1], rgb[2]);
+    }
+    else
+    {
+        for (x = 0, out = 0, end = boundary(1, srcWidth, rs->width); x < srcWidth; ++x, rgb += 3)
+        {
+            if (x >= end)
+            {
+                end = boundary(++out + 1, srcWidth, rs->width);
+                sums += 3;
+            }
+            sums[0] += rgb[0];
+            sums[1] += rgb[1];
+            sums[2] += rgb[2];
+        }
+
+        uint32_t rowEnd = boundary(rs->outRow + 1, srcHeight, rs->height);
+        if (rs->srcRow < rowEnd)
+            return PNG_OK;
+
+        uint32_t rows = rowEnd - boundary(rs->outRow, srcHeight, rs->height);
+        for (x = 0, sums = rs->sums; x < rs->width; ++x, sums += 3)
+        {
+            uint32_t count = rows * (boundary(x + 1, srcWidth, rs->width) - boundary(x, srcWidth, rs->width));
+            pixels[x] = RGB565(sums[0] / count, sums[1] / count, sums[2] / count);
+            sums[0] = sums[1] = sums[2] = 0;
+        }
+    }
+
+    if (reader->rowProc && reader->rowProc(reader->userPtr, rs->outRow, pixels))
+        return PNG_ERROR;
+
+    ++rs->outRow;
+    return PNG_OK;
+}
+
+static int rowsInflate(PngInfoStruct *info, RowState *rs, uint8_t *data, uint32_t length)
+{
+    info->stream.next_in = data;
+    info->stream.avail_in = length;
+
+    while (info->stream.avail_in > 0 && rs->srcRow < info->height)
+    {
+        info->stream.next_out = rs->line + rs->filled;
+        info->stream.avail_out = rs->rowBytes + 1 - rs->filled;
+
+        int status = inflate(&info->stream, Z_NO_FLUSH);
+        if (status < 0 && status != Z_BUF_ERROR)
+        {
+            LUPNG_WARN(info, "inflate error (%d)!", status);
+            return PNG_ERROR;
+        }
+
+        rs->filled = rs->rowBytes + 1 - info->stream.avail_out;
+        if (rs->filled == rs->rowBytes + 1)
+        {
+            if (unfilterScanline(info, rs) != PNG_OK)
+                return PNG_ERROR;
+            expandScanline(info, rs);
+            if (pushRow(info, rs) != PNG_OK)
+                return PNG_ERROR;
+
+            uint8_t *tmp = rs->line;
+            rs->line = rs->prevLine;
+            rs->prevLine = tmp;
+            rs->filled = 0;
+        }
+        else if (status != Z_OK)
+            break;
+    }
+
+    return PNG_OK;
+}
+
+/* Reads a chunk in BUF_SIZE pieces, IDAT data is inflated straight into the scanline */
+static int readRowsChunk(PngInfoStruct *info, RowState *rs)
+{
+    const LuUserContext *userCtx = info->userCtx;
+    uint8_t header[8], *type = header + 4;
+    uint32_t length, chunkCrc, remaining;
+    int status = PNG_OK;
+
+    if (!userCtx->readProc(header, 8, 1, userCtx->readProcUserPtr))
+    {
+        LUPNG_WARN(info, "read error");
+        return PNG_ERROR;
+    }
+
+    length = loadBE32(header);
+    if (!isalpha(type[0]) || !isalpha(type[1]) || !isalpha(type[2]) || !isalpha(type[3]))
+    {
+        LUPNG_WARN(info, "invalid chunk name, possibly unprintable");
+        return PNG_ERROR;
+    }
+
+    int isIdat = bytesEqual(type, (const uint8_t *)"IDAT", 4);
+    int isCritical = !(type[0] & 0x20);
+
+    if (isIdat)
+    {
+        if (!(info->chunksFound & PNG_IHDR))
+        {
+            LUPNG_WARN(info, "malformed PNG file!");
+            return PNG_ERROR;
+        }
+        if (info->colorType == PNG_PALETTED && !(info->chunksFound & PNG_PLTE))
+        {
+            LUPNG_WARN(info, "palette required but missing!");
+            return PNG_ERROR;
+        }
+        info->chunksFound |= PNG_IDAT;
+    }
+    else if (isCritical && length > BUF_SIZE)
+    {
+        LUPNG_WARN(info, "chunk '%.4s' is too large", (char *)type);
+        return PNG_ERROR;
+    }
+
+    chunkCrc = crcUpdate(0xFFFFFFFFL, type, 4);
+
+    for (remaining = length; remaining > 0;)
+    {
+        uint32_t size = MIN(remaining, BUF_SIZE);
+        if (!userCtx->readProc(info->buffer, size, 1, userCtx->readProcUserPtr))
+        {
+            LUPNG_WARN(info, "chunk data read error");
+            return PNG_ERROR;
+        }
+        chunkCrc = crcUpdate(chunkCrc, info->buffer, size);
+        remaining -= size;
+
+        if (isIdat && rowsInflate(info, rs, info->buffer, size) != PNG_OK)
+            return PNG_ERROR;
+    }
+
+    if (!userCtx->readProc(header, 4, 1, userCtx->readProcUserPtr)
+        || loadBE32(header) != (chunkCrc ^ 0xFFFFFFFFL))
+    {
+        LUPNG_WARN(info, "CRC mismatch in chunk '%.4s'", (char *)type);
+        return PNG_ERROR;
+    }
+
+    if (isCritical && !isIdat)
+    {
+        PngChunk chunk = {length, type, info->buffer, chunkCrc};
+
+        if (bytesEqual(type, (const uint8_t *)"IHDR", 4))
+        {
+            status = parseIhdr(info, &chunk);
+            if (status == PNG_OK)
+                status = rowsBegin(info, rs);
+        }
+        else
+            status = handleChunk(info, &chunk);
+    }
+
+    return status;
+}
+
+/* Interlaced images were decoded in full by the regular decoder, emit them now */
+static int rowsFromImage(PngInfoStruct *info, RowState *rs)
+{
+    const LuImage *img = info->img;
+    int status = PNG_OK;
+
+    for (int32_t y = 0; y < img->height && status == PNG_OK; ++y)
+    {
+        const uint8_t *src = img->data + y * img->pitch;
+        uint8_t *dst = rs->rgb;
+
+        for (int32_t x = 0; x < img->width; ++x)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                size_t idx = x * img->channels + (img->channels < 3 ? 0 : c);
+                *dst++ = img->depth == 16 ? ((const uint16_t *)src)[idx] >> 8 : src[idx];
+            }
+        }
+        status = pushRow(info, rs);
+    }
+
+    return status;
+}
+
+int luPngReadRowsUC(const LuUserContext *userCtx, const LuRowReader *reader)
+{
+    PngInfoStruct *info;
+    RowState rs = {0};
+    int status = PNG_OK;
+
+    if (!userCtx->skipSig)
+    {
+        uint8_t buffer[PNG_SIG_SIZE];
+        if (!userCtx->readProc(buffer, PNG_SIG_SIZE, 1, userCtx->readProcUserPtr)
+            || !bytesEqual(buffer, PNG_SIG, PNG_SIG_SIZE))
+        {
+            LUPNG_WARN_UC(userCtx, "invalid signature");
+            return PNG_ERROR;
+        }
+    }
+
+    info = userCtx->allocProc(sizeof(PngInfoStruct), userCtx->allocProcUserPtr);
+    if (!info)
+        return PNG_ERROR;
+
+    memset(info, 0, sizeof(PngInfoStruct));
+    info->userCtx = userCtx;
+    info->rowReader = reader;
+
+    if (inflateInit(&info->stream) != Z_OK)
+    {
+        LUPNG_WARN(info, "inflateInit failed!");
+        userCtx->freeProc(info, userCtx->freeProcUserPtr);
+        return PNG_ERROR;
+    }
+
+    while (status == PNG_OK)
+    {
+        if (info->img)
+        {
+            PngChunk chunk = {0};
+            status = readChunk(info, &chunk);
+            if (status == PNG_OK)
+            {
+                status = handleChunk(info, &chunk);
+                userCtx->freeProc(chunk.type, userCtx->freeProcUserPtr);
+            }
+        }
+        else
+            status = readRowsChunk(info, &rs);
+    }
+
+    if (status == PNG_DONE && info->img)
+        status = rowsFromImage(info, &rs);
+    else if (status == PNG_DONE && rs.srcRow < info->height)
+    {
+        LUPNG_WARN(info, "image data is truncated");
+        status = PNG_ERROR;
+    }
+
+    inflateEnd(&info->stream);
+    rowsEnd(info, &rs);
+    if (info->img)
+        luImageRelease(info->img, userCtx);
+    userCtx->freeProc(info->currentScanline, userCtx->freeProcUserPtr);
+    userCtx->freeProc(info->previousScanline, userCtx->freeProcUserPtr);
+    userCtx->freeProc(info, userCtx->freeProcUserPtr);
+
+    return status == PNG_ERROR ? PNG_ERROR : PNG_OK;
+}
+
 static LU_INLINE int writeChunk(PngInfoStruct *info, const void *buf, size_t buflen)
 {
     uint32_t chunk_len = swap32((uint32_t)(buflen-4));
@@ -1184,7 +1661,8 @@ int luPngWriteUC(const LuUserContext *userCtx, const LuImage *img)
     info->bytesPerPixel = (img->channels * img->depth) >> 3;
     info->scanlineBytes = info->bytesPerPixel * img->width;
 
-    if (deflateInit(&info->stream, info->userCtx->compressionLevel) != Z_OK)
+    if (deflateInit2(&info->stream, userCtx->compressionLevel, Z_DEFLATED, userCtx->compressionWindowBits,
+                     userCtx->compressionMemLevel, Z_DEFAULT_STRATEGY) != Z_OK)
     {
         LUPNG_WARN(info, "deflateInit failed!");
         goto _cleanup;
@@ -1354,6 +1832,8 @@ void luUserContextInitDefault(LuUserContext *userCtx)
     userCtx->writeProc=NULL;
     userCtx->writeProcUserPtr=NULL;
     userCtx->compressionLevel=6;
+    userCtx->compressionWindowBits=15;
+    userCtx->compressionMemLevel=8;
 
     userCtx->allocProc=internalMalloc;
     userCtx->allocProcUserPtr=NULL;
@@ -62,6 +62,8 @@ typedef size_t (*PngWriteProc)(const void *inPtr, size_t size, size_t count, voi
 typedef void*  (*PngAllocProc)(size_t size, void *userPtr);
 typedef void   (*PngFreeProc)(void *ptr, void *userPtr);
 typedef void   (*PngWarnProc)(void *userPtr, const char *fmt, ...);
+typedef int    (*PngSizeProc)(void *userPtr, int32_t width, int32_t height);
+typedef int    (*PngRowProc)(void *userPtr, int32_t row, const uint16_t *pixels);
 
 typedef struct {
     /* loader */
@@ -73,6 +75,9 @@ typedef struct {
     PngWriteProc writeProc;
     void *writeProcUserPtr;
     int compressionLevel;
+    /* deflate uses (1 << (windowBits + 2)) + (1 << (memLevel + 9)) bytes */
+    int compressionWindowBits;
+    int compressionMemLevel;
 
     /* memory allocation */
     PngAllocProc allocProc;
@@ -165,6 +170,32 @@ LuImage *luPngRead(PngReadProc readProc, void *userPtr, int skipSig);
  */
 LuImage *luPngReadUC(const LuUserContext *userCtx);
 
+typedef struct {
+    /* the output is box filtered down to fit, keeping the aspect ratio, 0 for no limit */
+    int32_t maxWidth;
+    int32_t maxHeight;
+
+    /* called once with the output size, before the first row */
+    PngSizeProc sizeProc;
+    /* called with each output row in order, RGB565 in native byte order */
+    PngRowProc rowProc;
+    /* either proc may return non-zero to abort decoding */
+    void *userPtr;
+} LuRowReader;
+
+/**
+ * Decodes a PNG image with the provided user context one row at a time, to
+ * RGB565. Alpha is ignored. Peak memory is two filtered scanlines, the output
+ * row accumulators and the inflate window: neither the whole file nor the
+ * whole image is ever in memory. Interlaced images are decoded in full first
+ * then emitted the same way.
+ *
+ * @param userCtx the LuUserContext to read with
+ * @param reader the output size limits and callbacks
+ * @return PNG_OK, or PNG_ERROR if the image is invalid or a callback aborted
+ */
+int luPngReadRowsUC(const LuUserContext *userCtx, const LuRowReader *reader);
+
 /**
  * Encodes a LuImage struct to PNG and writes it out to a file.
  *
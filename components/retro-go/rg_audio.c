@@ -1,21 +1,42 @@
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 #include <driver/i2s.h>
 #include <driver/dac.h>
 #include <unistd.h>
 
 #include "rg_system.h"
 #include "rg_audio.h"
+#include "rg_audio_ring.h"
+
+#define AUDIO_LATENCY_MS (40)   // How much audio we try to keep queued between the emulator and the sink
+#define AUDIO_BLOCK_FRAMES (256) // How much audio_task sends to the sink at once
+#define AUDIO_WAIT_LEVEL (audioTarget * 2) // Fill level above which rg_audio_submit waits for the sink
+#define AUDIO_PACED_WAIT_LEVEL(frames) ((frames) + AUDIO_BLOCK_FRAMES) // Same, once the core waits on us
+#define AUDIO_FILTER_CUTOFF (6000) // In Hz, for the optional low-pass filter
 
 static int audioSink = -1;
 static int audioSampleRate = 0;
-static int audioFilter = 0;
+static bool audioFilter = false;
+static rg_audio_filter_t audioFilterState;
 static bool audioMuted = false;
 static int volumeLevel = RG_AUDIO_VOL_DEFAULT;
 static int volumeMap[] = {0, 7, 15, 28, 39, 47, 56, 65, 74, 88, 100};
 
+static rg_audio_ring_t audioRing;
+static SemaphoreHandle_t audioRingSpace; // Given every time audio_task consumes a block
+static size_t audioTarget;               // Fill level the rate controller aims for, in frames
+static bool audioPaced;                  // The core waits on rg_audio_submit instead of a timer
+static size_t audioUnpacedFrames;        // Frames submitted since the core last had to wait
+static volatile bool audioTaskRunning;
+static volatile bool audioTaskStopped;
+static volatile bool audioClear;
+
+static void audio_task(void *arg);
+
 static const char *SETTING_OUTPUT = "AudioSink";
 static const char *SETTING_VOLUME = "Volume";
-// static const char *SETTING_FILTER = "AudioFilter";
+static const char *SETTING_FILTER = "AudioFilter";
 
 #if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(4, 2, 0)
     #define I2S_COMM_FORMAT_STAND_I2S (I2S_COMM_FORMAT_I2S | I2S_COMM_FORMAT_I2S_MSB)
@@ -35,7 +56,7 @@ void rg_audio_init(int sample_rate)
         .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
         .communication_format = I2S_COMM_FORMAT_STAND_MSB,
         .dma_buf_count = 2,
-        .dma_buf_len = RG_MIN(sample_rate / 50 + 1, 640), // The unit is stereo samples (4 bytes)
+        .dma_buf_len = AUDIO_BLOCK_FRAMES,                // The unit is stereo samples (4 bytes)
         .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,         // Interrupt level 1
         .use_apll = 0
     };
@@ -87,10 +108,33 @@ void rg_audio_init(int sample_rate)
 
     rg_audio_set_volume(volume);
     rg_audio_set_mute(false);
+
+    rg_audio_filter_init(&audioFilterState, AUDIO_FILTER_CUTOFF, sample_rate);
+    audioFilter = rg_settings_get_int32(SETTING_FILTER, 0);
+
+    audioTarget = sample_rate * AUDIO_LATENCY_MS / 1000;
+    if (!rg_audio_ring_init(&audioRing, audioTarget * 4, audioTarget))
+        RG_PANIC("Audio buffer allocation failed!");
+    audioRingSpace = xSemaphoreCreateBinary();
+    audioTaskRunning = true;
+    audioTaskStopped = false;
+    audioClear = false;
+    audioPaced = false;
+    audioUnpacedFrames = 0;
+    xTaskCreatePinnedToCore(&audio_task, "audio_task", 2048, NULL, 6, NULL, 1);
 }
 
 void rg_audio_deinit(void)
 {
+    if (audioTaskRunning)
+    {
+        audioTaskRunning = false;
+        while (!audioTaskStopped)
+            usleep(1000);
+        vSemaphoreDelete(audioRingSpace);
+        rg_audio_ring_free(&audioRing);
+    }
+
     rg_audio_set_mute(true);
 
     if (audioSink == RG_AUDIO_SINK_SPEAKER)
@@ -119,95 +163,27 @@ void rg_audio_deinit(void)
     audioSink = -1;
 }
 
-static inline void filter_samples(short *samples, size_t count)
-{
-
-}
-
-void rg_audio_submit(short *stereoAudioBuffer, size_t frameCount)
+static void write_samples(short *stereoAudioBuffer, size_t frameCount)
 {
     size_t sampleCount = frameCount * 2;
     size_t bufferSize = sampleCount * sizeof(short);
     size_t written = 0;
-    float volume = volumeMap[volumeLevel] * 0.01f;
-
-    if (bufferSize == 0)
-    {
-        RG_LOGW("Empty buffer?\n");
-        return;
-    }
-
-    if (audioFilter)
-    {
-        filter_samples(stereoAudioBuffer, bufferSize);
-    }
+    int32_t volume = volumeMap[volumeLevel] * 0x8000 / 100; // Q15
 
     if (audioMuted || audioSink == RG_AUDIO_SINK_DUMMY)
     {
         // Simulate i2s_write_bytes delay
-        usleep((audioSampleRate * 1000) / sampleCount);
+        usleep(frameCount * 1000000LL / audioSampleRate);
     }
     else if (audioSink == RG_AUDIO_SINK_SPEAKER)
     {
-        // In speaker mode we use dac left and right as a single channel
-        // to increase resolution.
-        for (size_t i = 0; i < sampleCount; i += 2)
-        {
-            // Down mix stereo to mono
-            int32_t sample = (stereoAudioBuffer[i] + stereoAudioBuffer[i + 1]) >> 1;
-
-            // Normalize
-            const float sn = (float)sample / 0x8000;
-
-            // Scale
-            const int magnitude = 127 + 127;
-            const float range = magnitude * sn * volume;
-
-            uint16_t dac0, dac1;
-
-            // Convert to differential output
-            if (range > 127.f)
-            {
-                dac1 = (range - 127);
-                dac0 = 127;
-            }
-            else if (range < -127.f)
-            {
-                dac1 = (range + 127);
-                dac0 = -127;
-            }
-            else
-            {
-                dac1 = 0;
-                dac0 = range;
-            }
-
-            dac0 += 0x80;
-            dac1 = 0x80 - dac1;
-
-            dac0 <<= 8;
-            dac1 <<= 8;
-
-            stereoAudioBuffer[i] = (short)dac1;
-            stereoAudioBuffer[i + 1] = (short)dac0;
-        }
+        rg_audio_convert_speaker(stereoAudioBuffer, frameCount, volume);
         i2s_write(I2S_NUM_0, (const void *)stereoAudioBuffer, bufferSize, &written, 1000);
         RG_ASSERT(written > 0, "i2s_write failed.");
     }
     else if (audioSink == RG_AUDIO_SINK_EXT_DAC)
     {
-        for (size_t i = 0; i < sampleCount; ++i)
-        {
-            int32_t sample = stereoAudioBuffer[i] * volume;
-
-            // Clip
-            if (sample > 32767)
-                sample = 32767;
-            else if (sample < -32768)
-                sample = -32767;
-
-            stereoAudioBuffer[i] = (short)sample;
-        }
+        rg_audio_convert_ext_dac(stereoAudioBuffer, frameCount, volume);
         i2s_write(I2S_NUM_0, (const void *)stereoAudioBuffer, bufferSize, &written, 1000);
         RG_ASSERT(written > 0, "i2s_write failed.");
     }
@@ -217,8 +193,81 @@ void rg_audio_submit(short *stereoAudioBuffer, size_t frameCount)
     }
 }
 
+static void audio_task(void *arg)
+{
+    static short buffer[AUDIO_BLOCK_FRAMES * 2];
+
+    while (audioTaskRunning)
+    {
+        if (audioClear)
+        {
+            rg_audio_ring_clear(&audioRing);
+            audioClear = false;
+        }
+
+        // The sink is the clock now, the ring absorbs the emulator's jitter and drift
+        rg_audio_ring_read(&audioRing, buffer, AUDIO_BLOCK_FRAMES);
+        xSemaphoreGive(audioRingSpace);
+        if (audioFilter)
+            rg_audio_filter_apply(&audioFilterState, buffer, AUDIO_BLOCK_FRAMES);
+        write_samples(buffer, AUDIO_BLOCK_FRAMES);
+    }
+
+    audioTaskStopped = true;
+    vTaskDelete(NULL);
+}
+
+void rg_audio_submit(short *stereoAudioBuffer, size_t frameCount)
+{
+    if (frameCount == 0)
+    {
+        RG_LOGW("Empty buffer?\n");
+        return;
+    }
+
+    if (!audioTaskRunning)
+        return;
+
+    rg_phase_t phase = rg_system_set_phase(RG_PHASE_AUDIO);
+
+    // Cores paced by a timer hover around the target and never get near the wait level, the rate
+    // controller absorbs their drift. Cores that wait use us as their clock instead: from then on
+    // they only get to queue about one frame ahead of the sink, like when they wrote to the DMA
+    // buffers directly, and the controller must not try to move the fill level.
+    size_t waitLevel = audioPaced ? AUDIO_PACED_WAIT_LEVEL(frameCount) : AUDIO_WAIT_LEVEL;
+
+    for (size_t remaining = frameCount; remaining > 0;)
+    {
+        if (rg_audio_ring_fill(&audioRing) > waitLevel)
+        {
+            if (xSemaphoreTake(audioRingSpace, pdMS_TO_TICKS(1000)) != pdTRUE)
+                RG_LOGW("Audio sink isn't consuming!\n");
+            waitLevel = AUDIO_PACED_WAIT_LEVEL(frameCount);
+            audioPaced = true;
+            audioUnpacedFrames = 0;
+            continue;
+        }
+
+        size_t written = rg_audio_ring_write(&audioRing, stereoAudioBuffer, remaining);
+        stereoAudioBuffer += written * 2;
+        remaining -= written;
+    }
+
+    // A core that hasn't waited for a second is either paced by a timer or can't keep up anyway
+    audioUnpacedFrames += frameCount;
+    if (audioUnpacedFrames > audioSampleRate)
+        audioPaced = false;
+
+    rg_audio_ring_set_setpoint(&audioRing, audioPaced ? waitLevel + frameCount / 2 : audioTarget);
+
+    rg_system_set_phase(phase);
+}
+
 void rg_audio_clear_buffer()
 {
+    // The ring belongs to audio_task, it will empty it before its next read
+    audioClear = true;
+
     if (audioSink == RG_AUDIO_SINK_SPEAKER || audioSink == RG_AUDIO_SINK_EXT_DAC)
     {
         i2s_zero_dma_buffer(I2S_NUM_0);
@@ -263,6 +312,18 @@ void rg_audio_set_volume(rg_volume_t level)
     RG_LOGI("Volume set to %d%% (%d)\n", volumeMap[volumeLevel], volumeLevel);
 }
 
+bool rg_audio_get_filter(void)
+{
+    return audioFilter;
+}
+
+void rg_audio_set_filter(bool enable)
+{
+    // audio_task picks it up on its next block
+    audioFilter = enable;
+    rg_settings_set_int32(SETTING_FILTER, enable);
+}
+
 void rg_audio_set_mute(bool mute)
 {
     if (RG_GPIO_SND_AMP_ENABLE != GPIO_NUM_NC)
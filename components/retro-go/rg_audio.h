@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum
@@ -34,6 +35,12 @@ typedef enum
 #endif
 } rg_sink_t;
 
+typedef struct
+{
+    int32_t alpha;       // Q15, 1.0 lets everything through
+    int32_t left, right; // Last output, the state carries over between blocks
+} rg_audio_filter_t;
+
 void rg_audio_init(int sample_rate);
 void rg_audio_deinit(void);
 const char *rg_audio_get_sink_name(rg_sink_t sink);
@@ -42,6 +49,14 @@ rg_sink_t rg_audio_get_sink(void);
 void rg_audio_set_volume(rg_volume_t level);
 rg_volume_t rg_audio_get_volume(void);
 void rg_audio_set_mute(bool mute);
+void rg_audio_set_filter(bool enable);
+bool rg_audio_get_filter(void);
 void rg_audio_submit(short *stereoAudioBuffer, size_t frameCount);
 int  rg_audio_get_sample_rate(void);
 void rg_audio_clear_buffer();
+
+// Sample processing (rg_audio_dsp.c), it has no dependency on the hardware. Volume is Q15.
+void rg_audio_filter_init(rg_audio_filter_t *filter, int cutoff, int sample_rate);
+void rg_audio_filter_apply(rg_audio_filter_t *filter, int16_t *stereoAudioBuffer, size_t frameCount);
+void rg_audio_convert_speaker(int16_t *stereoAudioBuffer, size_t frameCount, int32_t volume);
+void rg_audio_convert_ext_dac(int16_t *stereoAudioBuffer, size_t frameCount, int32_t volume);
@@ -0,0 +1,76 @@
+#include <math.h>
+
+#include "rg_audio.h"
+
+// This file must stay free of esp-idf dependencies so that it can be tested on the host.
+
+#define CLAMP(x, min, max) ((x) < (min) ? (min) : ((x) > (max) ? (max) : (x)))
+
+// Stereo pairs are handled as one packed 32-bit word, left channel in the low half
+static inline uint32_t pack_frame(int32_t left, int32_t right)
+{
+    return (uint16_t)left | ((uint32_t)right << 16);
+}
+
+void rg_audio_filter_init(rg_audio_filter_t *filter, int cutoff, int sample_rate)
+{
+    // alpha = 1 - e^(-2pi * fc / fs)
+    filter->alpha = (1.f - expf(-2.f * M_PI * cutoff / sample_rate)) * 0x8000;
+    filter->left = filter->right = 0;
+}
+
+void rg_audio_filter_apply(rg_audio_filter_t *filter, int16_t *stereoAudioBuffer, size_t frameCount)
+{
+    // One-pole low-pass, y += (x - y) * alpha, in Q15. The state carries over between blocks.
+    int32_t left = filter->left, right = filter->right;
+    const int32_t alpha = filter->alpha;
+    uint32_t *frames = (uint32_t *)stereoAudioBuffer;
+
+    for (size_t i = 0; i < frameCount; ++i)
+    {
+        uint32_t frame = frames[i];
+        left += (((int16_t)frame - left) * alpha) >> 15;
+        right += (((int16_t)(frame >> 16) - right) * alpha) >> 15;
+        frames[i] = pack_frame(left, right);
+    }
+
+    filter->left = left;
+    filter->right = right;
+}
+
+void rg_audio_convert_speaker(int16_t *stereoAudioBuffer, size_t frameCount, int32_t volume)
+{
+    uint32_t *frames = (uint32_t *)stereoAudioBuffer;
+
+    // In speaker mode we use dac left and right as a single channel
+    // to increase resolution.
+    for (size_t i = 0; i < frameCount; ++i)
+    {
+        // Down mix stereo to mono
+        uint32_t frame = frames[i];
+        int32_t sample = ((int16_t)frame + (int16_t)(frame >> 16)) >> 1;
+
+        // Scale to -254..254, the range of the two DACs combined
+        int32_t range = (((sample * volume) >> 7) * (127 + 127)) >> 23;
+
+        // Convert to differential output, the first DAC takes what it can and the other the rest
+        int32_t dac0 = CLAMP(range, -127, 127);
+        int32_t dac1 = range - dac0;
+
+        frames[i] = pack_frame((0x80 - dac1) << 8, (0x80 + dac0) << 8);
+    }
+}
+
+void rg_audio_convert_ext_dac(int16_t *stereoAudioBuffer, size_t frameCount, int32_t volume)
+{
+    uint32_t *frames = (uint32_t *)stereoAudioBuffer;
+
+    for (size_t i = 0; i < frameCount; ++i)
+    {
+        // Compiles to min/max instructions, no branches
+        uint32_t frame = frames[i];
+        int32_t left = ((int16_t)frame * volume) >> 15;
+        int32_t right = ((int16_t)(frame >> 16) * volume) >> 15;
+        frames[i] = pack_frame(CLAMP(left, -32768, 32767), CLAMP(right, -32768, 32767));
+    }
+}
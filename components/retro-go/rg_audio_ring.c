@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rg_audio_ring.h"
+
+#define ONE (1 << 16) // Q16
+#define MAX_DEVIATION ((int32_t)(RG_AUDIO_RING_MAX_DEVIATION * ONE))
+#define INTEGRAL_DIVIDER (1024) // Higher is slower to adapt to drift but less prone to overshoot
+#define CLAMP(x, min, max) ((x) < (min) ? (min) : ((x) > (max) ? (max) : (x)))
+
+bool rg_audio_ring_init(rg_audio_ring_t *ring, size_t capacity, size_t setpoint)
+{
+    size_t size = 2;
+
+    while (size < capacity)
+        size <<= 1;
+
+    memset(ring, 0, sizeof(*ring));
+
+    if (!(ring->data = calloc(size, 2 * sizeof(int16_t))))
+        return false;
+
+    ring->capacity = size;
+    ring->step = ONE;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->setpoint, setpoint);
+
+    return true;
+}
+
+void rg_audio_ring_free(rg_audio_ring_t *ring)
+{
+    free(ring->data);
+    ring->data = NULL;
+}
+
+// Producer side. Returns the number of frames that fit, the rest is left to the caller.
+size_t rg_audio_ring_write(rg_audio_ring_t *ring, const int16_t *frames, size_t count)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t pos = head & (ring->capacity - 1);
+
+    if (count > ring->capacity - (head - tail))
+        count = ring->capacity - (head - tail);
+
+    size_t part = ring->capacity - pos < count ? ring->capacity - pos : count;
+    memcpy(ring->data + pos * 2, frames, part * 4);
+    memcpy(ring->data, frames + part * 2, (count - part) * 4);
+
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+
+    return count;
+}
+
+// Consumer side. Always outputs count frames, resampled to keep the fill level near the setpoint.
+// Returns how many of them came from actual data, the rest repeats the last frame (underrun).
+size_t rg_audio_ring_read(rg_audio_ring_t *ring, int16_t *frames, size_t count)
+{
+    const size_t mask = ring->capacity - 1;
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    const int32_t setpoint = atomic_load_explicit(&ring->setpoint, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t done = 0;
+
+    // The fill level moves by whole emulator frames, smooth it before using it to steer the rate
+    ring->fill_avg += ((int32_t)((head - tail) << 8) - ring->fill_avg) >> 4;
+
+    // PI controller: the proportional part reacts to jitter, the integral part slowly learns the
+    // clock drift so that the fill level settles on the setpoint instead of next to it.
+    if (setpoint > 0)
+    {
+        int32_t error = (ring->fill_avg >> 8) - setpoint;
+        int32_t proportional = (int64_t)error * MAX_DEVIATION / setpoint;
+        ring->integral += (int64_t)error * (MAX_DEVIATION << 8) / setpoint / INTEGRAL_DIVIDER;
+        ring->integral = CLAMP(ring->integral, -(MAX_DEVIATION << 8), MAX_DEVIATION << 8);
+        ring->step = ONE + CLAMP(proportional + (ring->integral >> 8), -MAX_DEVIATION, MAX_DEVIATION);
+    }
+
+    for (; done < count && head - tail >= 2; ++done)
+    {
+        const int16_t *a = ring->data + (tail & mask) * 2;
+        const int16_t *b = ring->data + ((tail + 1) & mask) * 2;
+        const int32_t frac = ring->phase >> 4; // Q12 keeps the products within 32 bits
+
+        frames[done * 2 + 0] = a[0] + (((b[0] - a[0]) * frac) >> 12);
+        frames[done * 2 + 1] = a[1] + (((b[1] - a[1]) * frac) >> 12);
+
+        ring->phase += ring->step;
+        tail += ring->phase >> 16;
+        ring->phase &= ONE - 1;
+    }
+
+    if (done > 0)
+    {
+        ring->last[0] = frames[done * 2 - 2];
+        ring->last[1] = frames[done * 2 - 1];
+    }
+
+    if (done < count)
+    {
+        ring->underruns++;
+        for (size_t i = done; i < count; ++i)
+        {
+            frames[i * 2 + 0] = ring->last[0];
+            frames[i * 2 + 1] = ring->last[1];
+        }
+    }
+
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    return done;
+}
+
+size_t rg_audio_ring_fill(rg_audio_ring_t *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire)
+         - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+void rg_audio_ring_set_setpoint(rg_audio_ring_t *ring, size_t setpoint)
+{
+    atomic_store_explicit(&ring->setpoint, setpoint, memory_order_relaxed);
+}
+
+// Consumer side. Drops everything that was queued.
+void rg_audio_ring_clear(rg_audio_ring_t *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    ring->phase = 0;
+    ring->fill_avg = 0;
+    ring->integral = 0;
+    ring->last[0] = ring->last[1] = 0;
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+}
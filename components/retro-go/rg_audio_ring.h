@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Single producer, single consumer ring of interleaved stereo frames. The consumer side resamples
+// on the fly and nudges its rate by up to RG_AUDIO_RING_MAX_DEVIATION to keep the fill level
+// around the setpoint, absorbing the jitter and clock drift between the emulator and the sink.
+// Portable C11, it must stay free of esp-idf dependencies.
+
+#define RG_AUDIO_RING_MAX_DEVIATION (0.005f)
+
+typedef struct {
+    int16_t *data;          // Interleaved stereo frames
+    size_t capacity;        // In frames, a power of two
+    atomic_size_t head;     // Frames written since init, only the producer moves it
+    atomic_size_t tail;     // Frames consumed since init, only the consumer moves it
+    atomic_size_t setpoint; // Fill level the rate controller aims for, in frames
+    uint32_t phase;         // Position between the frames at tail and tail + 1, Q16
+    uint32_t step;          // Input frames consumed per output frame, Q16
+    int32_t fill_avg;       // Smoothed fill level, Q8
+    int32_t integral;       // Accumulated rate correction, Q24
+    int16_t last[2];        // Last frame output, repeated on underrun
+    uint32_t underruns;
+} rg_audio_ring_t;
+
+bool rg_audio_ring_init(rg_audio_ring_t *ring, size_t capacity, size_t setpoint);
+void rg_audio_ring_free(rg_audio_ring_t *ring);
+size_t rg_audio_ring_write(rg_audio_ring_t *ring, const int16_t *frames, size_t count);
+size_t rg_audio_ring_read(rg_audio_ring_t *ring, int16_t *frames, size_t count);
+size_t rg_audio_ring_fill(rg_audio_ring_t *ring);
+void rg_audio_ring_set_setpoint(rg_audio_ring_t *ring, size_t setpoint);
+void rg_audio_ring_clear(rg_audio_ring_t *ring);
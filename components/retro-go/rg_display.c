@@ -5,21 +5,33 @@
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
 #include <driver/ledc.h>
+#include <soc/soc_memory_layout.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "rg_system.h"
 #include "rg_display.h"
+#include "rg_mailbox.h"
+#include "fonts/fonts.h"
 
 #define SPI_TRANSACTION_COUNT (10)
-#define SPI_BUFFER_COUNT (6)
-#define SPI_BUFFER_LENGTH (4 * 320) // In pixels (uint16)
+#define SPI_BUFFER_COUNT (4)
+#define SPI_BUFFER_LENGTH (2040) // In pixels (uint16), the most a single DMA transfer can take (4092 bytes)
+#define SPI_WINDOW_SETUP_COST (512) // Approximate cost of lcd_set_window(), in bytes of pixel data
 
 static spi_transaction_t spi_trans[SPI_TRANSACTION_COUNT];
 static spi_device_handle_t spi_dev;
 static QueueHandle_t spi_buffers_queue;
 static QueueHandle_t spi_queue;
-static QueueHandle_t display_task_queue;
+static SemaphoreHandle_t spi_zero_copy_done;
+static atomic_int spi_zero_copy_pending;
+static bool zero_copy;
+static SemaphoreHandle_t display_task_wake;  // Given when a new update is posted
+static SemaphoreHandle_t display_task_done;  // Given when the display task is done with an update
+static rg_mailbox_t display_mailbox;
+static const rg_video_update_t *last_posted; // Only touched by the emulator task
+static volatile bool display_task_stop;
 
 static rg_display_t display;
 
@@ -39,18 +51,45 @@ static struct {
     uint8_t empty;
 } screen_lines[RG_SCREEN_HEIGHT];
 
+static rg_display_column_t screen_columns[RG_SCREEN_WIDTH];
+static rg_display_scale_line_t scale_line;
+
+// Text drawn by the display task over the frames, see rg_display_show_info(). It has its own font
+// and line buffer, rg_gui's belong to the emulator task and can change under us.
+static struct {
+    char text[128];
+    int64_t expires;
+    bool changed;
+} overlay;
+static portMUX_TYPE overlay_lock = portMUX_INITIALIZER_UNLOCKED;
+static rg_glyph_cache_t overlay_glyphs;
+static uint16_t *overlay_line;
+
 #define lcd_init() ili9341_init()
 #define lcd_deinit() ili9341_deinit()
 #define lcd_set_window(left, top, width, height) ili9341_set_window(left, top, width, height)
 #define lcd_send_data(buffer, length) spi_queue_transaction(buffer, length, 3)
+#define lcd_send_data_zero_copy(buffer, length) spi_queue_transaction(buffer, length, 5)
 #define lcd_set_backlight(percent) ili9341_set_backlight(percent)
 
 
+// Like xQueueReceive but accounts for the time we had to wait, if any
+static inline bool spi_queue_receive(QueueHandle_t queue, void *item, TickType_t timeout)
+{
+    if (xQueueReceive(queue, item, 0) == pdTRUE)
+        return true;
+
+    int64_t start = get_elapsed_time();
+    bool ret = xQueueReceive(queue, item, timeout) == pdTRUE;
+    display.counters.spiWaitTime += get_elapsed_time_since(start);
+    return ret;
+}
+
 static inline uint16_t *spi_get_buffer()
 {
     uint16_t *buffer;
 
-    if (xQueueReceive(spi_buffers_queue, &buffer, pdMS_TO_TICKS(2500)) != pdTRUE)
+    if (!spi_queue_receive(spi_buffers_queue, &buffer, pdMS_TO_TICKS(2500)))
     {
         RG_PANIC("display");
     }
@@ -58,6 +97,20 @@ static inline uint16_t *spi_get_buffer()
     return buffer;
 }
 
+// Picks how many lines of width pixels go in the next transaction. A rect is split in evenly sized
+// transactions instead of full buffers followed by a runt. The first transaction of a rect is kept
+// short so that the bus gets busy while we prepare the next one.
+static inline int spi_chunk_lines(int width, int lines, bool first)
+{
+    int max_lines = RG_MAX(SPI_BUFFER_LENGTH / width, 1);
+    if (first && lines > max_lines)
+        return RG_MAX(max_lines / 4, 1);
+    int chunks = (lines + max_lines - 1) / max_lines;
+    return (lines + chunks - 1) / chunks;
+}
+
+// type bit 0: data (otherwise command), bit 1: data is a bounce buffer, bit 2: data belongs to
+// the caller and must stay untouched until spi_wait_zero_copy() returns
 static inline void spi_queue_transaction(const void *data, size_t length, uint32_t type)
 {
     spi_transaction_t *t;
@@ -65,7 +118,14 @@ static inline void spi_queue_transaction(const void *data, size_t length, uint32
     if (!data || length < 1)
         return;
 
-    xQueueReceive(spi_queue, &t, portMAX_DELAY);
+    spi_queue_receive(spi_queue, &t, portMAX_DELAY);
+
+    display.counters.spiTransactions++;
+    if (type & 6)
+        display.counters.spiBytes += length;
+
+    if (type & 4)
+        atomic_fetch_add(&spi_zero_copy_pending, 1);
 
     *t = (spi_transaction_t) {
         .tx_buffer = NULL,
@@ -74,7 +134,7 @@ static inline void spi_queue_transaction(const void *data, size_t length, uint32
         .flags = 0,
     };
 
-    if (type & 2)
+    if (type & 6)
     {
         t->tx_buffer = data;
     }
@@ -86,6 +146,7 @@ static inline void spi_queue_transaction(const void *data, size_t length, uint32
     else
     {
         t->tx_buffer = memcpy(spi_get_buffer(), data, length);
+        t->user = (void*)(type | 2);
     }
 
     if (spi_device_queue_trans(spi_dev, t, pdMS_TO_TICKS(2500)) != ESP_OK)
@@ -114,6 +175,10 @@ static void spi_task(void *arg)
             {
                 xQueueSend(spi_buffers_queue, &t->tx_buffer, 0);
             }
+            if (((int)t->user & 4) && atomic_fetch_sub(&spi_zero_copy_pending, 1) == 1)
+            {
+                xSemaphoreGive(spi_zero_copy_done);
+            }
             if (xQueueSend(spi_queue, &t, 0) != pdTRUE)
             {
                 RG_PANIC("spi_queue full..?");
@@ -124,10 +189,19 @@ static void spi_task(void *arg)
     vTaskDelete(NULL);
 }
 
+static void spi_wait_zero_copy(void)
+{
+    // The timeout only guards against a missed signal
+    while (atomic_load(&spi_zero_copy_pending) > 0)
+        xSemaphoreTake(spi_zero_copy_done, pdMS_TO_TICKS(10));
+}
+
 static void spi_init()
 {
     spi_queue = xQueueCreate(SPI_TRANSACTION_COUNT, sizeof(spi_transaction_t *));
     spi_buffers_queue = xQueueCreate(SPI_BUFFER_COUNT, sizeof(uint16_t *));
+    spi_zero_copy_done = xSemaphoreCreateBinary();
+    atomic_init(&spi_zero_copy_pending, 0);
 
     for (size_t x = 0; x < SPI_TRANSACTION_COUNT; x++)
     {
@@ -147,6 +221,7 @@ static void spi_init()
         .sclk_io_num = RG_GPIO_LCD_CLK,
         .quadwp_io_num = -1,
         .quadhd_io_num = -1,
+        .max_transfer_sz = SPI_BUFFER_LENGTH * 2,
     };
 
     const spi_device_interface_config_t devcfg = {
@@ -298,6 +373,8 @@ static void ili9341_set_window(int left, int top, int width, int height)
         RG_PANIC("Bad lcd window");
     }
 
+    display.counters.spiWindows++;
+
     ili9341_cmd(0x2A, (uint8_t[]){left >> 8, left & 0xff, right >> 8, right & 0xff}, 4); // Horiz
     ili9341_cmd(0x2B, (uint8_t[]){top >> 8, top & 0xff, bottom >> 8, bottom & 0xff}, 4); // Vert
     ili9341_cmd(0x2C, NULL, 0); // Memory write
@@ -305,33 +382,33 @@ static void ili9341_set_window(int left, int top, int width, int height)
     //     ili9341_cmd(0x3C, NULL, 0); // Memory write continue
 }
 
-static inline uint blend_pixels(uint a, uint b)
+// The source is already in the panel's format and scale, its lines can be DMA'd as they are.
+// Returns false if the framebuffer isn't suitable, in which case we go through the bounce buffers.
+static bool write_rect_zero_copy(int left, int top, int width, int height, const void *framebuffer)
 {
-    // Fast path
-    if (a == b)
-        return a;
-
-    // Input in Big-Endian, swap to Little Endian
-    a = (a << 8) | (a >> 8);
-    b = (b << 8) | (b >> 8);
-
-    // Signed arithmetic is deliberate here
-    int r0 = (a >> 11) & 0x1F;
-    int g0 = (a >> 5) & 0x3F;
-    int b0 = (a) & 0x1F;
+    const int stride = display.source.stride;
+    const uint8_t *buffer = framebuffer + display.source.offset + (top * stride) + (left * 2);
+    const bool contiguous = width * 2 == stride;
 
-    int r1 = (b >> 11) & 0x1F;
-    int g1 = (b >> 5) & 0x3F;
-    int b1 = (b) & 0x1F;
+    if (!esp_ptr_dma_capable(buffer) || ((intptr_t)buffer & 3) || ((width * 2) & 3) || (stride & 3))
+        return false;
 
-    int rv = (((r1 - r0) >> 1) + r0);
-    int gv = (((g1 - g0) >> 1) + g0);
-    int bv = (((b1 - b0) >> 1) + b0);
+    lcd_set_window(
+        display.viewport.x_pos + left + RG_SCREEN_MARGIN_LEFT,
+        display.viewport.y_pos + top + RG_SCREEN_MARGIN_TOP,
+        width,
+        height
+    );
 
-    uint v = (rv << 11) | (gv << 5) | (bv);
+    for (int y = 0; y < height;)
+    {
+        int lines = contiguous ? spi_chunk_lines(width, height - y, y == 0) : 1;
+        lcd_send_data_zero_copy(buffer, width * lines * 2);
+        buffer += stride * lines;
+        y += lines;
+    }
 
-    // Back to Big-Endian
-    return (v << 8) | (v >> 8);
+    return true;
 }
 
 static inline void write_rect(int left, int top, int width, int height,
@@ -350,21 +427,23 @@ static inline void write_rect(int left, int top, int width, int height,
     const int screen_top = display.viewport.y_pos + scaled_top;
     const int screen_left = display.viewport.x_pos + scaled_left;
     const int screen_bottom = RG_MIN(screen_top + scaled_height, screen_height);
-    const int lines_per_buffer = SPI_BUFFER_LENGTH / scaled_width;
-    const int ix_acc = (x_inc * scaled_left) % screen_width;
     const int filter_mode = display.config.scaling ? display.config.filter : 0;
     const bool filter_y = filter_mode == RG_DISPLAY_FILTER_VERT || filter_mode == RG_DISPLAY_FILTER_BOTH;
-    const bool filter_x = filter_mode == RG_DISPLAY_FILTER_HORIZ || filter_mode == RG_DISPLAY_FILTER_BOTH;
-    const int format = display.source.format;
     const int stride = display.source.stride;
-    union { const uint8_t *u8; const uint16_t *u16; } buffer;
+    const uint8_t *buffer;
 
     if (scaled_width < 1 || scaled_height < 1)
     {
         return;
     }
 
-    buffer.u8 = framebuffer + display.source.offset + (top * stride) + (left * display.source.pixlen);
+    if (zero_copy && write_rect_zero_copy(left, top, width, RG_MIN(height, screen_bottom - screen_top), framebuffer))
+    {
+        return;
+    }
+
+    // Columns are resolved through screen_columns, so we only need to point at the first line
+    buffer = framebuffer + display.source.offset + (top * stride);
 
     lcd_set_window(
         screen_left + RG_SCREEN_MARGIN_LEFT,
@@ -375,7 +454,7 @@ static inline void write_rect(int left, int top, int width, int height,
 
     for (int y = 0, screen_y = screen_top; y < height;)
     {
-        int lines_to_copy = RG_MIN(lines_per_buffer, screen_bottom - screen_y);
+        int lines_to_copy = spi_chunk_lines(scaled_width, screen_bottom - screen_y, screen_y == screen_top);
 
         // The vertical filter requires a block to start and end with unscaled lines
         if (filter_y)
@@ -398,80 +477,39 @@ static inline void write_rect(int left, int top, int width, int height,
             if (i > 0 && screen_lines[screen_y].empty)
             {
                 memcpy(line_buffer_ptr, line_buffer_ptr - scaled_width, scaled_width * 2);
-                line_buffer_ptr += scaled_width;
             }
             else
             {
-                for (int x = 0, x_acc = ix_acc; x < width;)
-                {
-                    uint16_t pixel;
-
-                    if (format & RG_PIXEL_PAL)
-                        pixel = palette[buffer.u8[x]];
-                    else if (format & RG_PIXEL_LE)
-                        pixel = (buffer.u16[x] << 8) | (buffer.u16[x] >> 8);
-                    else
-                        pixel = buffer.u16[x];
-
-                    *(line_buffer_ptr++) = pixel;
-
-                    x_acc += x_inc;
-                    while (x_acc >= screen_width) {
-                        x_acc -= screen_width;
-                        ++x;
-                    }
-                }
+                scale_line(line_buffer_ptr, buffer, palette, &screen_columns[screen_left], scaled_width);
             }
+            line_buffer_ptr += scaled_width;
 
             if (!screen_lines[++screen_y].empty)
             {
-                buffer.u8 += stride;
+                buffer += stride;
                 ++y;
             }
         }
 
-        if (filter_y || filter_x)
+        // Filter X is done by scale_line, only the vertical filter needs a second pass
+        if (filter_y)
         {
             const int top = screen_y - lines_to_copy;
 
             for (int y = 0, fill_line = -1; y < lines_to_copy; y++)
             {
-                if (filter_y && y && screen_lines[top + y].empty)
+                if (y && screen_lines[top + y].empty)
                 {
                     fill_line = y;
                     continue;
                 }
 
-                // Filter X
-                if (filter_x)
-                {
-                    uint16_t *buffer = line_buffer + y * scaled_width;
-                    for (int x = 0, frame_x = 0, prev_frame_x = -1, x_acc = ix_acc; x < scaled_width; ++x)
-                    {
-                        if (frame_x == prev_frame_x && x > 0 && x + 1 < scaled_width)
-                        {
-                            buffer[x] = blend_pixels(buffer[x - 1], buffer[x + 1]);
-                        }
-                        prev_frame_x = frame_x;
-
-                        x_acc += x_inc;
-                        while (x_acc >= screen_width) {
-                            x_acc -= screen_width;
-                            ++frame_x;
-                        }
-                    }
-                }
-
-                // Filter Y
-                if (filter_y && fill_line > 0)
+                if (fill_line > 0)
                 {
                     uint16_t *lineA = line_buffer + (fill_line - 1) * scaled_width;
                     uint16_t *lineB = line_buffer + (fill_line + 0) * scaled_width;
                     uint16_t *lineC = line_buffer + (fill_line + 1) * scaled_width;
-                    for (size_t x = 0; x < scaled_width; ++x)
-                    {
-                        lineB[x] = blend_pixels(lineA[x], lineC[x]);
-                    }
+                    rg_display_blend_lines(lineB, lineA, lineC, scaled_width);
                     fill_line = -1;
                 }
             }
@@ -516,7 +554,7 @@ static void update_viewport_scaling(void)
     display.viewport.width = new_width;
     display.viewport.height = new_height;
 
-    // Build boundary tables used by filtering
+    // Build the scaling and boundary tables used by write_rect and filtering
 
     memset(filter_lines, 1, sizeof(filter_lines));
     memset(screen_lines, 0, sizeof(screen_lines));
@@ -538,24 +576,90 @@ static void update_viewport_scaling(void)
         }
     }
 
+    rg_display_scale_columns(screen_columns, display.screen.width, display.viewport.x_pos,
+                             display.viewport.x_inc, src_width);
+
+    const int filter_mode = display.config.scaling ? display.config.filter : 0;
+    const bool filter_x = filter_mode == RG_DISPLAY_FILTER_HORIZ || filter_mode == RG_DISPLAY_FILTER_BOTH;
+    scale_line = rg_display_get_line_scaler(display.source.format, filter_x);
+
+    // At 1:1 a big endian source can be sent as is, the filters have nothing to do either
+    zero_copy = display.source.format == RG_PIXEL_565_BE && display.viewport.width == src_width
+                && display.viewport.height == src_height;
+
     RG_LOGI("%dx%d@%.3f => %dx%d@%.3f x_pos:%d y_pos:%d x_inc:%d y_inc:%d\n",
            src_width, src_height, src_width/(float)src_height, new_width, new_height, new_ratio,
            display.viewport.x_pos, display.viewport.y_pos, display.viewport.x_inc, display.viewport.y_inc);
 }
 
+static void draw_overlay(void)
+{
+    char text[sizeof(overlay.text)];
+    bool expired = false, changed;
+
+    portENTER_CRITICAL(&overlay_lock);
+    if (overlay.text[0] && get_elapsed_time() > overlay.expires)
+    {
+        overlay.text[0] = 0;
+        expired = true;
+    }
+    changed = overlay.changed;
+    overlay.changed = false;
+    memcpy(text, overlay.text, sizeof(text));
+    portEXIT_CRITICAL(&overlay_lock);
+
+    // Frames only redraw what changed, a full one erases what's left of the overlay
+    if (expired)
+        display.changed = true;
+
+    // Frames draw over it, but redrawing every frame would cost more than it's worth
+    if (!text[0] || !(changed || (display.counters.totalFrames % 15) == 0))
+        return;
+
+    const int height = overlay_glyphs.height;
+    int y = 0;
+
+    for (const char *line = text, *end; *line && y + height <= display.screen.height; line = end)
+    {
+        int width;
+        end = rg_glyph_cache_fit(&overlay_glyphs, line, display.screen.width, &width);
+        if (width > 0)
+        {
+            for (int i = 0; i < width * height; ++i)
+                overlay_line[i] = C_BLACK;
+            rg_glyph_cache_draw(&overlay_glyphs, overlay_line, width, 0, line, end - line, C_WHITE);
+            rg_display_write(0, y, width, height, 0, overlay_line);
+        }
+        if (*end != '\n')
+            break; // End of the text, or what's left is wider than the screen
+        end++;
+        y += height;
+    }
+}
+
 IRAM_ATTR
 static void display_task(void *arg)
 {
-    display_task_queue = xQueueCreate(1, sizeof(rg_video_update_t *));
-
-    while (1)
+    while (!display_task_stop)
     {
-        rg_video_update_t *update;
+        bool skipped = false;
+        rg_video_update_t *update = rg_mailbox_take(&display_mailbox, &skipped);
 
-        xQueuePeek(display_task_queue, &update, portMAX_DELAY);
-        // xQueueReceive(display_task_queue, &update, portMAX_DELAY);
+        if (!update)
+        {
+            xSemaphoreTake(display_task_wake, portMAX_DELAY);
+            continue;
+        }
 
-        if (!update) break;
+        int64_t start_time = get_elapsed_time();
+
+        // Updates are diffed against the one posted before them, if it never reached the screen we
+        // can't trust the diff anymore
+        if (skipped)
+        {
+            update->type = RG_UPDATE_FULL;
+            display.counters.coalescedFrames++;
+        }
 
         if (display.changed)
         {
@@ -581,7 +685,15 @@ static void display_task(void *arg)
             display.counters.fullFrames++;
         display.counters.totalFrames++;
 
-        for (int y = 0; y < display.source.height;)
+        if (update->type == RG_UPDATE_PARTIAL && update->rects_count > 0)
+        {
+            for (int i = 0; i < update->rects_count; ++i)
+            {
+                rg_rect_diff_t *rect = &update->rects[i];
+                write_rect(rect->left, rect->top, rect->width, rect->height, update->buffer, update->palette);
+            }
+        }
+        else for (int y = 0; y < display.source.height;)
         {
             rg_line_diff_t *diff = &update->diff[y];
 
@@ -592,10 +704,18 @@ static void display_task(void *arg)
             y += diff->repeat;
         }
 
-        xQueueReceive(display_task_queue, &update, portMAX_DELAY);
-    }
+        // The framebuffer may have been sent as is, it can't be given back until the transfer is done
+        spi_wait_zero_copy();
+
+        rg_system_add_phase_time(RG_PHASE_TRANSFER, get_elapsed_time_since(start_time));
 
-    display_task_queue = NULL;
+        // Still part of the update so that rg_display_sync() also waits for it, but its own
+        // cost isn't accounted in the transfer phase
+        draw_overlay();
+
+        rg_mailbox_release(&display_mailbox);
+        xSemaphoreGive(display_task_done);
+    }
 
     vTaskDelete(NULL);
 }
@@ -687,24 +807,46 @@ int rg_display_get_backlight(void)
 
 bool rg_display_save_frame(const char *filename, const rg_video_update_t *frame, int width, int height)
 {
-    rg_image_t *original = rg_image_alloc(display.source.width, display.source.height);
-    if (!original) return false;
+    // The frame may still be on its way to the screen (and its palette or format about to change)
+    rg_display_sync();
 
-    uint16_t *dst_ptr = original->data;
+    int src_width = display.source.width;
+    int src_height = display.source.height;
 
-    for (int y = 0; y < original->height; y++)
+    if (width <= 0 && height <= 0)
     {
-        const uint8_t *src_ptr8 = frame->buffer + display.source.offset + (y * display.source.stride);
+        width = src_width;
+        height = src_height;
+    }
+    else if (width <= 0)
+    {
+        width = src_width * ((float)height / src_height);
+    }
+    else if (height <= 0)
+    {
+        height = src_height * ((float)width / src_width);
+    }
+
+    // Sampled straight from the frame at the output size, no full size copy is made
+    rg_image_t *img = rg_image_alloc(width, height);
+    if (!img) return false;
+
+    uint16_t *dst_ptr = img->data;
+
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t *src_ptr8 = frame->buffer + display.source.offset + (y * src_height / height) * display.source.stride;
         const uint16_t *src_ptr16 = (const uint16_t *)src_ptr8;
 
-        for (int x = 0; x < original->width; x++)
+        for (int x = 0; x < width; x++)
         {
+            int src_x = x * src_width / width;
             uint16_t pixel;
 
             if (display.source.format & RG_PIXEL_PAL)
-                pixel = frame->palette[src_ptr8[x]];
+                pixel = frame->palette[src_ptr8[src_x]];
             else
-                pixel = src_ptr16[x];
+                pixel = src_ptr16[src_x];
 
             if (!(display.source.format & RG_PIXEL_LE))
                 pixel = (pixel << 8) | (pixel >> 8);
@@ -713,13 +855,16 @@ bool rg_display_save_frame(const char *filename, const rg_video_update_t *frame,
         }
     }
 
-    rg_image_t *img = rg_image_copy_resized(original, width, height);
-    rg_image_free(original);
-
-    bool success = img && rg_image_save_to_file(filename, img, 0);
-    rg_image_free(img);
+    // The frame can change as soon as we return, the copy is encoded and written in the background
+    return rg_image_save_to_file_async(filename, img, RG_IMAGE_SAVE_FAST);
+}
 
-    return success;
+static void wait_for_display(const rg_video_update_t *update)
+{
+    // Wait until update (or anything if NULL) is neither queued nor being drawn. The display task
+    // signals every completed update, the timeout only guards against a missed signal.
+    while (rg_mailbox_pending(&display_mailbox) || rg_mailbox_busy(&display_mailbox, update))
+        xSemaphoreTake(display_task_done, pdMS_TO_TICKS(10));
 }
 
 IRAM_ATTR
@@ -730,17 +875,53 @@ rg_update_t rg_display_queue_update(/*const*/ rg_video_update_t *update, const r
     if (!update)
         return RG_UPDATE_ERROR;
 
+    rg_phase_t phase = rg_system_set_phase(RG_PHASE_DIFF);
+
     update->type = RG_UPDATE_FULL;
+    update->rects_count = 0;
 
-    if (previousUpdate && !display.changed && display.config.update != RG_DISPLAY_UPDATE_FULL)
+    if (previousUpdate && !display.changed && display.config.update == RG_DISPLAY_UPDATE_SMART)
+    {
+        // The window setup cost is in screen bytes, the diff works in source pixels
+        int screen_pixels = display.viewport.width * display.viewport.height;
+        int source_pixels = display.source.width * display.source.height;
+        int setup_cost = (SPI_WINDOW_SETUP_COST / 2) * source_pixels / RG_MAX(screen_pixels, 1);
+        int count = rg_display_diff_tiles(&display, update, previousUpdate, setup_cost);
+
+        if (count == 0)
+        {
+            update->type = RG_UPDATE_EMPTY;
+        }
+        else if (count > 0)
+        {
+            update->type = RG_UPDATE_PARTIAL;
+
+            // If filtering is enabled we must extend our rectangles to appropriate boundaries
+            if (display.config.filter && display.config.scaling)
+            {
+                for (int i = 0; i < count; ++i)
+                {
+                    rg_rect_diff_t *rect = &update->rects[i];
+                    int top = RG_MAX(rect->top - 1, 0);
+                    int bottom = RG_MIN(rect->top + rect->height, display.source.height - 1);
+                    int left = RG_MAX(rect->left - 1, 0);
+                    int right = RG_MIN(rect->left + rect->width + 1, display.source.width);
+
+                    while (top > 0 && !filter_lines[top].start)
+                        top--;
+
+                    while (bottom < display.source.height - 1 && !filter_lines[bottom].stop)
+                        bottom++;
+
+                    *rect = (rg_rect_diff_t){left, top, right - left, bottom + 1 - top};
+                }
+            }
+        }
+    }
+    else if (previousUpdate && !display.changed && display.config.update != RG_DISPLAY_UPDATE_FULL)
     {
-        const int *frame_buffer = update->buffer + display.source.offset; // int64_t is 0.7% faster!
-        const int *prev_buffer = previousUpdate->buffer + display.source.offset;
         const int frame_width = display.source.width;
         const int frame_height = display.source.height;
-        const int stride = display.source.stride;
-        const int blocks = (frame_width * display.source.pixlen) / sizeof(*frame_buffer);
-        const int pixels_per_block = sizeof(*frame_buffer) / display.source.pixlen;
         rg_line_diff_t *out_diff = update->diff;
 
         // If more than 50% of the screen has changed then stop the comparison and assume that the
@@ -748,36 +929,7 @@ rg_update_t rg_display_queue_update(/*const*/ rg_video_update_t *update, const r
         // benefit. The other 23% of cases would have benefited from finishing the diff, so a better
         // heuristic might be preferable (interlaced compare perhaps?).
         int threshold = (frame_width * frame_height) / 2;
-        int changed = 0;
-
-        for (int y = 0; y < frame_height; ++y)
-        {
-            int left = 0, width = 0;
-
-            for (int x = 0; x < blocks && changed < threshold; ++x)
-            {
-                if (frame_buffer[x] != prev_buffer[x])
-                {
-                    for (int xl = blocks - 1; xl >= x; --xl)
-                    {
-                        if (frame_buffer[xl] != prev_buffer[xl]) {
-                            left = x * pixels_per_block;
-                            width = ((xl + 1) - x) * pixels_per_block;
-                            changed += width;
-                            break;
-                        }
-                    }
-                    break;
-                }
-            }
-
-            out_diff[y].left = left;
-            out_diff[y].width = width;
-            out_diff[y].repeat = 1;
-
-            frame_buffer = (void*)frame_buffer + stride;
-            prev_buffer = (void*)prev_buffer + stride;
-        }
+        int changed = rg_display_diff_lines(&display, update, previousUpdate, threshold);
 
         if (changed == 0)
         {
@@ -827,40 +979,52 @@ rg_update_t rg_display_queue_update(/*const*/ rg_video_update_t *update, const r
                 }
             }
 
-            // Combine consecutive lines with similar changes location to optimize the SPI transfer
-            rg_line_diff_t *line = &out_diff[frame_height - 1];
-            rg_line_diff_t *prev_line = line - 1;
-
-            for (; line > out_diff; --line, --prev_line)
-            {
-                int right = line->left + line->width;
-                int right_prev = prev_line->left + prev_line->width;
-
-                if (abs(line->left - prev_line->left) <= 8 && abs(right - right_prev) <= 8)
-                {
-                    if (line->left < prev_line->left) prev_line->left = line->left;
-                    prev_line->width = RG_MAX(right, right_prev) - prev_line->left;
-                    prev_line->repeat = line->repeat + 1;
-                }
-            }
+            rg_display_merge_lines(&display, update);
         }
     }
 
-    xQueueSend(display_task_queue, &update, portMAX_DELAY);
+    // The display task may change the type (and the caller may reuse update) once it's posted
+    rg_update_t type = update->type;
+
+    // The caller will draw its next frame in previousUpdate. Callers that don't diff pass NULL but
+    // still alternate between their buffers, the one they'll reuse is the one posted before this one.
+    const rg_video_update_t *reused = previousUpdate ? previousUpdate : last_posted;
+    last_posted = update;
+
+    // If the display task didn't get to the previous update yet, it is dropped in favor of this one
+    if (rg_mailbox_post(&display_mailbox, update))
+        display.counters.droppedFrames++;
+    xSemaphoreGive(display_task_wake);
+
+    rg_system_set_phase(RG_PHASE_WAIT);
 
     if (update->synchronous)
     {
-        // Wait until display queue is done
-        while (uxQueueMessagesWaiting(display_task_queue));
+        wait_for_display(update);
+    }
+    else if (reused && reused != update)
+    {
+        // The buffer about to be reused must not be on its way to the screen. It can no longer be
+        // queued at this point, we only have to wait if it's being drawn.
+        while (rg_mailbox_busy(&display_mailbox, reused))
+            xSemaphoreTake(display_task_done, pdMS_TO_TICKS(10));
     }
 
-    return update->type;
+    rg_system_set_phase(phase);
+
+    return type;
+}
+
+// Waits until every posted update has been drawn, needed before drawing directly with rg_display_write().
+// Must not be called from the display task itself (see draw_overlay()), it would wait for itself.
+void rg_display_sync(void)
+{
+    wait_for_display(NULL);
 }
 
 void rg_display_set_source_format(int width, int height, int crop_h, int crop_v, int stride, int format)
 {
-    while (uxQueueMessagesWaiting(display_task_queue))
-        ; // Wait until display queue is done
+    wait_for_display(NULL);
 
     if (width % sizeof(int)) // frame diff doesn't handle non word multiple well right now...
     {
@@ -880,8 +1044,13 @@ void rg_display_set_source_format(int width, int height, int crop_h, int crop_v,
 
 void rg_display_show_info(const char *text, int timeout_ms)
 {
-    // Overlay a line of text at the bottom of the screen for approximately timeout_ms
-    // It would make more sense in rg_gui, but for efficiency I think here will be best...
+    // Overlay text at the top of the screen for approximately timeout_ms. It is drawn by the
+    // display task between frames, so the caller never has to wait for (or race) a transfer.
+    portENTER_CRITICAL(&overlay_lock);
+    strncpy(overlay.text, text ? text : "", sizeof(overlay.text) - 1);
+    overlay.expires = get_elapsed_time() + (int64_t)timeout_ms * 1000;
+    overlay.changed = true;
+    portEXIT_CRITICAL(&overlay_lock);
 }
 
 void rg_display_write(int left, int top, int width, int height, int stride, const uint16_t *buffer)
@@ -901,14 +1070,11 @@ void rg_display_write(int left, int top, int width, int height, int stride, cons
 
     lcd_set_window(left + RG_SCREEN_MARGIN_LEFT, top + RG_SCREEN_MARGIN_TOP, width, height);
 
-    size_t lines_per_buffer = SPI_BUFFER_LENGTH / width;
-
-    for (size_t y = 0; y < height; y += lines_per_buffer)
+    for (size_t y = 0, lines_per_buffer; y < height; y += lines_per_buffer)
     {
         uint16_t *line_buffer = spi_get_buffer();
 
-        if (y + lines_per_buffer > height)
-            lines_per_buffer = height - y;
+        lines_per_buffer = spi_chunk_lines(width, height - y, y == 0);
 
         // Copy line by line because stride may not match width
         for (size_t line = 0; line < lines_per_buffer; ++line)
@@ -954,9 +1120,9 @@ void rg_display_clear(uint16_t color_le)
 
 void rg_display_deinit()
 {
-    void *stop = NULL;
-
-    xQueueSend(display_task_queue, &stop, portMAX_DELAY);
+    wait_for_display(NULL);
+    display_task_stop = true;
+    xSemaphoreGive(display_task_wake);
     usleep(100 * 1000U);
     // To do: Stop SPI task...
 
@@ -970,6 +1136,15 @@ void rg_display_init()
     RG_LOGI("Initialization...\n");
     rg_display_reset_config();
     lcd_init();
-    xTaskCreatePinnedToCore(&display_task, "display_task", 2048, NULL, 5, NULL, 1);
+    rg_mailbox_init(&display_mailbox);
+    last_posted = NULL;
+    display_task_wake = xSemaphoreCreateBinary();
+    display_task_done = xSemaphoreCreateBinary();
+    display_task_stop = false;
+    if (!rg_glyph_cache_init(&overlay_glyphs, &font_basic8x8, 8))
+        RG_PANIC("Glyph cache allocation failed!");
+    overlay_line = rg_alloc(RG_SCREEN_WIDTH * overlay_glyphs.height * 2, MEM_ANY);
+    // The frame writes and draw_overlay's text copy and glyph path are the deepest calls
+    xTaskCreatePinnedToCore(&display_task, "display_task", 3072, NULL, 5, NULL, 1);
     RG_LOGI("Display ready.\n");
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum
@@ -16,7 +17,7 @@ typedef enum
     RG_DISPLAY_UPDATE_PARTIAL = 0,
     RG_DISPLAY_UPDATE_FULL,
     // RG_DISPLAY_UPDATE_INTERLACE,
-    // RG_DISPLAY_UPDATE_SMART,
+    RG_DISPLAY_UPDATE_SMART,
     RG_DISPLAY_UPDATE_COUNT,
 } display_update_t;
 
@@ -95,6 +96,12 @@ typedef struct {
     struct {
         uint32_t totalFrames;
         uint32_t fullFrames;
+        uint32_t droppedFrames;   // Replaced by a newer update before the display got to them
+        uint32_t coalescedFrames; // Drawn in full because the update before them was dropped
+        uint32_t spiTransactions; // Everything queued to the SPI driver, commands included
+        uint32_t spiBytes;        // Pixel data sent to the LCD
+        uint32_t spiWindows;      // Window setups, each costs 5 transactions
+        uint32_t spiWaitTime;     // Microseconds spent waiting for a free bounce buffer or transaction
     } counters;
     bool changed;
     bool redraw;
@@ -106,11 +113,31 @@ typedef struct {
     short repeat;   // int32_t repeat:10;
 } rg_line_diff_t;
 
+typedef struct {
+    short left;
+    short top;
+    short width;
+    short height;
+} rg_rect_diff_t;
+
+#define RG_DISPLAY_MAX_RECTS 32
+
+typedef struct {
+    uint16_t src_x; // Source column sampled by this screen column
+    uint8_t blend;  // Column repeats the previous source column and can be blended by the filter
+} rg_display_column_t;
+
+typedef void (*rg_display_scale_line_t)(uint16_t *dst, const void *src, const uint16_t *palette,
+                                        const rg_display_column_t *columns, int width);
+
 typedef struct {
     rg_update_t type;
     void *buffer;           // Should be at least height*stride bytes. expects uint8_t * | uint16_t *
     uint16_t palette[256];  // Used in RG_PIXEL_PAL is set
     rg_line_diff_t diff[256];
+    rg_rect_diff_t rects[RG_DISPLAY_MAX_RECTS]; // Used instead of diff when rects_count > 0
+    int rects_count;
+    uint32_t clean_lines[256 / 32]; // Optional, set bits are lines (before crop) the emulator knows are unchanged
     bool synchronous;       // Updates will block until *buffer is no longer needed
 } rg_video_update_t;
 
@@ -121,12 +148,25 @@ void rg_display_clear(uint16_t color_le);
 void rg_display_reset_config(void);
 void rg_display_force_redraw(void);
 void rg_display_show_info(const char *text, int timeout_ms);
+void rg_display_sync(void);
 bool rg_display_save_frame(const char *filename, const rg_video_update_t *frame, int width, int height);
 void rg_display_set_source_format(int width, int height, int crop_h, int crop_v, int stride, int format);
 void rg_display_set_source_palette(const uint16_t *data, size_t colors);
 rg_update_t rg_display_queue_update(/*const*/ rg_video_update_t *update, const rg_video_update_t *previousUpdate);
 const rg_display_t *rg_display_get_status(void);
 
+// Frame diffing (rg_display_diff.c), they have no dependency on the hardware
+int  rg_display_diff_lines(const rg_display_t *display, rg_video_update_t *update,
+                           const rg_video_update_t *previousUpdate, int threshold);
+void rg_display_merge_lines(const rg_display_t *display, rg_video_update_t *update);
+int  rg_display_diff_tiles(const rg_display_t *display, rg_video_update_t *update,
+                           const rg_video_update_t *previousUpdate, int setup_cost);
+
+// Scaling and filtering (rg_display_scale.c), they have no dependency on the hardware
+void rg_display_scale_columns(rg_display_column_t *columns, int screen_width, int x_pos, int x_inc, int src_width);
+rg_display_scale_line_t rg_display_get_line_scaler(int format, bool filter_x);
+void rg_display_blend_lines(uint16_t *dst, const uint16_t *a, const uint16_t *b, int width);
+
 void rg_display_set_scaling(display_scaling_t scaling);
 display_scaling_t rg_display_get_scaling(void);
 void rg_display_set_filter(display_filter_t filter);
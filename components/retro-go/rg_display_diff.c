@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rg_display.h"
+
+// This file must stay free of esp-idf dependencies, tools/diff-replay.c builds it on the host.
+
+#define TILE_WIDTH  16
+#define TILE_HEIGHT 8
+#define TILE_PIXELS (TILE_WIDTH * TILE_HEIGHT)
+#define TILE_MAX_COLS 32 // One bit per column in a row bitmap
+#define TILE_MAX_ROWS 32
+
+typedef struct {
+    short x0, y0, x1, y1; // In tiles, x1/y1 exclusive
+} tile_box_t;
+
+// Lines the emulator flagged as identical to the previous frame don't need to be compared at all
+static inline bool line_is_clean(const uint32_t *clean_lines, int line)
+{
+    return clean_lines[line >> 5] & (1U << (line & 31));
+}
+
+int rg_display_diff_lines(const rg_display_t *display, rg_video_update_t *update,
+                          const rg_video_update_t *previousUpdate, int threshold)
+{
+    const int *frame_buffer = update->buffer + display->source.offset; // int64_t is 0.7% faster!
+    const int *prev_buffer = previousUpdate->buffer + display->source.offset;
+    const int frame_width = display->source.width;
+    const int frame_height = display->source.height;
+    const int stride = display->source.stride;
+    const int blocks = (frame_width * display->source.pixlen) / sizeof(*frame_buffer);
+    const int pixels_per_block = sizeof(*frame_buffer) / display->source.pixlen;
+    const int crop_v = display->source.crop_v;
+    rg_line_diff_t *out_diff = update->diff;
+    int changed = 0;
+
+    for (int y = 0; y < frame_height; ++y)
+    {
+        int left = 0, width = 0;
+        int x = line_is_clean(update->clean_lines, y + crop_v) ? blocks : 0;
+
+        for (; x < blocks && changed < threshold; ++x)
+        {
+            if (frame_buffer[x] != prev_buffer[x])
+            {
+                for (int xl = blocks - 1; xl >= x; --xl)
+                {
+                    if (frame_buffer[xl] != prev_buffer[xl]) {
+                        left = x * pixels_per_block;
+                        width = ((xl + 1) - x) * pixels_per_block;
+                        changed += width;
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+
+        out_diff[y].left = left;
+        out_diff[y].width = width;
+        out_diff[y].repeat = 1;
+
+        frame_buffer = (void*)frame_buffer + stride;
+        prev_buffer = (void*)prev_buffer + stride;
+    }
+
+    return changed;
+}
+
+void rg_display_merge_lines(const rg_display_t *display, rg_video_update_t *update)
+{
+    // Combine consecutive lines with similar changes location to optimize the SPI transfer
+    rg_line_diff_t *out_diff = update->diff;
+    rg_line_diff_t *line = &out_diff[display->source.height - 1];
+    rg_line_diff_t *prev_line = line - 1;
+
+    for (; line > out_diff; --line, --prev_line)
+    {
+        int right = line->left + line->width;
+        int right_prev = prev_line->left + prev_line->width;
+
+        if (abs(line->left - prev_line->left) <= 8 && abs(right - right_prev) <= 8)
+        {
+            if (line->left < prev_line->left) prev_line->left = line->left;
+            prev_line->width = (right > right_prev ? right : right_prev) - prev_line->left;
+            prev_line->repeat = line->repeat + 1;
+        }
+    }
+}
+
+static inline int box_area(tile_box_t a)
+{
+    return (a.x1 - a.x0) * (a.y1 - a.y0) * TILE_PIXELS;
+}
+
+static inline tile_box_t box_union(tile_box_t a, tile_box_t b)
+{
+    return (tile_box_t){
+        a.x0 < b.x0 ? a.x0 : b.x0,
+        a.y0 < b.y0 ? a.y0 : b.y0,
+        a.x1 > b.x1 ? a.x1 : b.x1,
+        a.y1 > b.y1 ? a.y1 : b.y1,
+    };
+}
+
+static inline bool box_overlap(tile_box_t a, tile_box_t b)
+{
+    return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+
+static int add_span(tile_box_t *boxes, int count, tile_box_t span, int setup_cost)
+{
+    int best = -1, best_extra = setup_cost;
+
+    // Grow the box that absorbs this span for less than the price of a new window. Only boxes
+    // touching the previous or current row are candidates, anything else is too far anyway, and
+    // growing one into another would send their common tiles twice.
+    for (int i = 0; i < count; ++i)
+    {
+        if (boxes[i].y1 < span.y0)
+            continue;
+        tile_box_t grown = box_union(boxes[i], span);
+        bool disjoint = true;
+        for (int j = 0; j < count && disjoint; ++j)
+            disjoint = j == i || !box_overlap(grown, boxes[j]);
+        if (!disjoint)
+            continue;
+        int extra = box_area(grown) - box_area(boxes[i]) - box_area(span);
+        if (extra < best_extra)
+        {
+            best_extra = extra;
+            best = i;
+        }
+    }
+
+    // Out of boxes, merge with whichever box is the cheapest to grow regardless of adjacency
+    if (best < 0 && count == RG_DISPLAY_MAX_RECTS)
+    {
+        best_extra = 0x7FFFFFFF;
+        for (int i = 0; i < count; ++i)
+        {
+            int extra = box_area(box_union(boxes[i], span)) - box_area(boxes[i]);
+            if (extra < best_extra)
+            {
+                best_extra = extra;
+                best = i;
+            }
+        }
+    }
+
+    if (best >= 0)
+        boxes[best] = box_union(boxes[best], span);
+    else
+        boxes[best = count++] = span;
+
+    // Out of boxes, or a new span inside a box that grew over this row, the result can still
+    // overlap others. Absorb them, which may grow it again, until all are disjoint.
+    for (int i = 0; i < count; ++i)
+    {
+        if (i != best && box_overlap(boxes[i], boxes[best]))
+        {
+            boxes[best] = box_union(boxes[best], boxes[i]);
+            boxes[i] = boxes[--count];
+            if (best == count)
+                best = i;
+            i = -1;
+        }
+    }
+
+    return count;
+}
+
+// Tiles are coarse, trim the rectangle down to the bounding box of the words that really changed
+static void shrink_rect(rg_rect_diff_t *rect, const uint8_t *frame_buffer, const uint8_t *prev_buffer,
+                        int stride, int pixlen, const uint32_t *clean_lines, int crop_v)
+{
+    const int pixels_per_word = 4 / pixlen;
+    const int x0 = rect->left / pixels_per_word;
+    const int x1 = (rect->left + rect->width) / pixels_per_word;
+    int left = x1, right = x0, top = -1, bottom = -1;
+
+    for (int y = rect->top; y < rect->top + rect->height; ++y)
+    {
+        const uint32_t *frame = (const uint32_t *)(frame_buffer + y * stride);
+        const uint32_t *prev = (const uint32_t *)(prev_buffer + y * stride);
+        int l = x0, r = x1 - 1;
+
+        if (line_is_clean(clean_lines, y + crop_v))
+            continue;
+
+        while (l < x1 && frame[l] == prev[l])
+            l++;
+
+        if (l == x1)
+            continue;
+
+        while (r > l && r >= right && frame[r] == prev[r])
+            r--;
+
+        if (l < left) left = l;
+        if (r + 1 > right) right = r + 1;
+        if (top < 0) top = y;
+        bottom = y + 1;
+    }
+
+    if (top >= 0)
+    {
+        *rect = (rg_rect_diff_t){
+            .left = left * pixels_per_word,
+            .top = top,
+            .width = (right - left) * pixels_per_word,
+            .height = bottom - top,
+        };
+    }
+}
+
+// Compares the frames in 16x8 tiles and coalesces the changed tiles into at most
+// RG_DISPLAY_MAX_RECTS rectangles. setup_cost is the price of one more window, in source pixels.
+// Returns the number of rectangles or -1 if a full update would be cheaper.
+int rg_display_diff_tiles(const rg_display_t *display, rg_video_update_t *update,
+                          const rg_video_update_t *previousUpdate, int setup_cost)
+{
+    const uint8_t *frame_buffer = update->buffer + display->source.offset;
+    const uint8_t *prev_buffer = previousUpdate->buffer + display->source.offset;
+    const int frame_width = display->source.width;
+    const int frame_height = display->source.height;
+    const int stride = display->source.stride;
+    const int pixlen = display->source.pixlen;
+    const int crop_v = display->source.crop_v;
+    const int cols = (frame_width + TILE_WIDTH - 1) / TILE_WIDTH;
+    const int rows = (frame_height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    const uint32_t all_cols = cols < 32 ? (1U << cols) - 1 : ~0U;
+    tile_box_t boxes[RG_DISPLAY_MAX_RECTS];
+    uint32_t changed[TILE_MAX_ROWS];
+    int count = 0;
+
+    update->rects_count = 0;
+
+    if (cols > TILE_MAX_COLS || rows > TILE_MAX_ROWS)
+        return -1;
+
+    for (int row = 0; row < rows; ++row)
+    {
+        const int y_end = (row + 1) * TILE_HEIGHT < frame_height ? (row + 1) * TILE_HEIGHT : frame_height;
+        uint32_t bits = 0;
+
+        // Once a tile is known to be dirty we skip it for the remaining lines of the row
+        for (int y = row * TILE_HEIGHT; y < y_end && bits != all_cols; ++y)
+        {
+            const uint32_t *frame = (const uint32_t *)(frame_buffer + y * stride);
+            const uint32_t *prev = (const uint32_t *)(prev_buffer + y * stride);
+
+            if (line_is_clean(update->clean_lines, y + crop_v))
+                continue;
+
+            for (int col = 0; col < cols; ++col)
+            {
+                if (bits & (1U << col))
+                    continue;
+
+                int start = (col * TILE_WIDTH * pixlen) / 4;
+                int end = (((col + 1) * TILE_WIDTH < frame_width ? (col + 1) * TILE_WIDTH : frame_width) * pixlen) / 4;
+
+                for (int x = start; x < end; ++x)
+                {
+                    if (frame[x] != prev[x])
+                    {
+                        bits |= 1U << col;
+                        break;
+                    }
+                }
+            }
+        }
+
+        changed[row] = bits;
+    }
+
+    for (int row = 0; row < rows; ++row)
+    {
+        uint32_t bits = changed[row];
+
+        for (int col = 0; col < cols && (bits >> col); )
+        {
+            while (!(bits & (1U << col)))
+                col++;
+            int start = col;
+            while (col < cols && (bits & (1U << col)))
+                col++;
+            count = add_span(boxes, count, (tile_box_t){start, row, col, row + 1}, setup_cost);
+        }
+    }
+
+    if (count == 0)
+        return 0;
+
+    // Fixed thresholds don't work well, let the cost model decide if a full update is cheaper
+    int total_cost = 0;
+    for (int i = 0; i < count; ++i)
+        total_cost += setup_cost + box_area(boxes[i]);
+
+    if (total_cost >= setup_cost + frame_width * frame_height)
+        return -1;
+
+    for (int i = 0; i < count; ++i)
+    {
+        int right = boxes[i].x1 * TILE_WIDTH;
+        int bottom = boxes[i].y1 * TILE_HEIGHT;
+        update->rects[i] = (rg_rect_diff_t){
+            .left = boxes[i].x0 * TILE_WIDTH,
+            .top = boxes[i].y0 * TILE_HEIGHT,
+            .width = (right < frame_width ? right : frame_width) - boxes[i].x0 * TILE_WIDTH,
+            .height = (bottom < frame_height ? bottom : frame_height) - boxes[i].y0 * TILE_HEIGHT,
+        };
+        shrink_rect(&update->rects[i], frame_buffer, prev_buffer, stride, pixlen, update->clean_lines, crop_v);
+    }
+
+    update->rects_count = count;
+
+    return count;
+}
@@ -0,0 +1,118 @@
+#include <string.h>
+
+#include "rg_display.h"
+
+// This file must stay free of esp-idf dependencies, tools/scaler-bench.c builds it on the host.
+
+// Averages two pairs of big-endian RGB565 pixels packed in a 32-bit word. Each channel is
+// rounded down exactly like the original per-channel version, without unpacking anything.
+static inline uint32_t blend_pixels32(uint32_t a, uint32_t b)
+{
+    // Fast path
+    if (a == b)
+        return a;
+
+    // Input in Big-Endian, swap to Little Endian so that channels are contiguous
+    a = ((a & 0x00FF00FF) << 8) | ((a >> 8) & 0x00FF00FF);
+    b = ((b & 0x00FF00FF) << 8) | ((b >> 8) & 0x00FF00FF);
+
+    // (a + b) / 2 per channel: the mask drops the low bit of each channel before the shift
+    uint32_t v = (a & b) + (((a ^ b) & 0xF7DEF7DE) >> 1);
+
+    // Back to Big-Endian
+    return ((v & 0x00FF00FF) << 8) | ((v >> 8) & 0x00FF00FF);
+}
+
+static inline uint32_t blend_pixels(uint32_t a, uint32_t b)
+{
+    return blend_pixels32(a, b) & 0xFFFF;
+}
+
+void rg_display_blend_lines(uint16_t *dst, const uint16_t *a, const uint16_t *b, int width)
+{
+    typedef uint32_t __attribute__((__may_alias__)) pixel_pair_t;
+    int x = 0;
+
+    // Two pixels at a time when all three lines are word aligned (always true for even widths)
+    if ((((uintptr_t)dst | (uintptr_t)a | (uintptr_t)b) & 3) == 0)
+    {
+        for (; x + 1 < width; x += 2)
+            *(pixel_pair_t *)&dst[x] = blend_pixels32(*(pixel_pair_t *)&a[x], *(pixel_pair_t *)&b[x]);
+    }
+
+    for (; x < width; ++x)
+        dst[x] = blend_pixels(a[x], b[x]);
+}
+
+void rg_display_scale_columns(rg_display_column_t *columns, int screen_width, int x_pos, int x_inc, int src_width)
+{
+    int x_acc = 0;
+
+    memset(columns, 0, screen_width * sizeof(*columns));
+
+    for (int x = 0, screen_x = x_pos; x < src_width && screen_x < screen_width; ++screen_x)
+    {
+        columns[screen_x].src_x = x;
+        columns[screen_x].blend = screen_x > x_pos && columns[screen_x - 1].src_x == x;
+
+        x_acc += x_inc;
+        while (x_acc >= screen_width) {
+            x_acc -= screen_width;
+            ++x;
+        }
+    }
+}
+
+static inline __attribute__((always_inline))
+uint16_t convert_pixel(const void *src, int x, const uint16_t *palette, const int format)
+{
+    if (format & RG_PIXEL_PAL)
+        return palette[((const uint8_t *)src)[x]];
+
+    uint16_t pixel = ((const uint16_t *)src)[x];
+    if (format & RG_PIXEL_LE)
+        return (pixel << 8) | (pixel >> 8);
+    return pixel;
+}
+
+// Generic line scaler, it is only meant to be instantiated with constant format and filter
+// arguments by the SCALE_LINE() functions below, so that the branches get folded at compile time.
+static inline __attribute__((always_inline))
+void scale_line_impl(uint16_t *dst, const void *src, const uint16_t *palette,
+                     const rg_display_column_t *columns, int width, const int format, const bool filter_x)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        // The horizontal filter blends repeated columns with their neighbours. The right one
+        // hasn't been written yet so we fetch it from the source directly.
+        if (filter_x && columns[x].blend && x > 0 && x + 1 < width)
+            dst[x] = blend_pixels(dst[x - 1], convert_pixel(src, columns[x + 1].src_x, palette, format));
+        else
+            dst[x] = convert_pixel(src, columns[x].src_x, palette, format);
+    }
+}
+
+#define SCALE_LINE(name, format, filter_x)                                                  \
+    static void name(uint16_t *dst, const void *src, const uint16_t *palette,               \
+                     const rg_display_column_t *columns, int width)                         \
+    {                                                                                       \
+        scale_line_impl(dst, src, palette, columns, width, format, filter_x);               \
+    }
+
+SCALE_LINE(scale_line_pal565, RG_PIXEL_PAL565_BE, false)
+SCALE_LINE(scale_line_pal565_filtered, RG_PIXEL_PAL565_BE, true)
+SCALE_LINE(scale_line_565_le, RG_PIXEL_565_LE, false)
+SCALE_LINE(scale_line_565_le_filtered, RG_PIXEL_565_LE, true)
+SCALE_LINE(scale_line_565_be, RG_PIXEL_565_BE, false)
+SCALE_LINE(scale_line_565_be_filtered, RG_PIXEL_565_BE, true)
+
+rg_display_scale_line_t rg_display_get_line_scaler(int format, bool filter_x)
+{
+    // Palette entries are always big endian, RG_PIXEL_LE only matters for direct color
+    if (format & RG_PIXEL_PAL)
+        return filter_x ? scale_line_pal565_filtered : scale_line_pal565;
+    else if (format & RG_PIXEL_LE)
+        return filter_x ? scale_line_565_le_filtered : scale_line_565_le;
+    else
+        return filter_x ? scale_line_565_be_filtered : scale_line_565_be;
+}
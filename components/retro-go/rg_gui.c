@@ -1,6 +1,9 @@
 // This saves almost 10KB when the rest is compiled with -O3!
 #pragma GCC optimize ("-O2")
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -16,6 +19,7 @@
 #include "rg_gui.h"
 
 static uint16_t *overlay_buffer = NULL;
+static SemaphoreHandle_t save_lock; // Held while a background image save is in progress
 
 static const rg_gui_theme_t default_theme = {
     .box_background = C_NAVY,
@@ -28,6 +32,7 @@ static const rg_gui_theme_t default_theme = {
 
 static rg_gui_theme_t theme;
 static rg_gui_font_t font_info = {0, 8, 8, 8, &font_basic8x8};
+static rg_glyph_cache_t glyphs;
 
 static int screen_width = -1;
 static int screen_height = -1;
@@ -43,6 +48,8 @@ void rg_gui_init(void)
     RG_ASSERT(screen_width && screen_height, "Bad screen res");
 
     overlay_buffer = (uint16_t *)rg_alloc(RG_MAX(screen_width, screen_height) * 32 * 2, MEM_SLOW);
+    save_lock = xSemaphoreCreateBinary();
+    xSemaphoreGive(save_lock);
     rg_gui_set_font_type(rg_settings_get_int32(SETTING_FONTTYPE, 0));
     rg_gui_set_theme(&default_theme);
 }
@@ -56,80 +63,6 @@ bool rg_gui_set_theme(const rg_gui_theme_t *new_theme)
     return true;
 }
 
-static rg_glyph_t get_glyph(const rg_font_t *font, int points, int c)
-{
-    rg_glyph_t out = {
-        .width  = font->width ? font->width : 8,
-        .height = font->height,
-        .bitmap = {0},
-    };
-
-    if (c == '\n') // Some glyphs are always zero width
-    {
-        out.width = 0;
-    }
-    else if (font->type == 0) // bitmap
-    {
-        if (c < font->chars)
-        {
-            for (int y = 0; y < font->height; y++) {
-                out.bitmap[y] = font->data[(c * font->height) + y];
-            }
-        }
-    }
-    else // Proportional
-    {
-        // Based on code by Boris Lovosevic (https://github.com/loboris)
-        int charCode, adjYOffset, width, height, xOffset, xDelta;
-        const uint8_t *data = font->data;
-        do {
-            charCode = *data++;
-            adjYOffset = *data++;
-            width = *data++;
-            height = *data++;
-            xOffset = *data++;
-            xOffset = xOffset < 0x80 ? xOffset : -(0xFF - xOffset);
-            xDelta = *data++;
-
-            if (c != charCode && charCode != 0xFF && width != 0) {
-                data += (((width * height) - 1) / 8) + 1;
-            }
-        } while ((c != charCode) && (charCode != 0xFF));
-
-        if (c == charCode)
-        {
-            out.width = ((width > xDelta) ? width : xDelta);
-            // out.height = height;
-
-            int ch = 0, mask = 0x80;
-
-            for (int y = 0; y < height; y++) {
-                for (int x = 0; x < width; x++) {
-                    if (((x + (y * width)) % 8) == 0) {
-                        mask = 0x80;
-                        ch = *data++;
-                    }
-                    if ((ch & mask) != 0) {
-                        out.bitmap[adjYOffset + y] |= (1 << (xOffset + x));
-                    }
-                    mask >>= 1;
-                }
-            }
-        }
-    }
-
-    if (points && points != font->height)
-    {
-        float scale = (float)points / font->height;
-        rg_glyph_t out2 = out;
-        out.height = points;
-        for (int y = 0; y < out.height; y++)
-            out.bitmap[y] = out2.bitmap[(int)(y / scale)];
-    }
-
-    return out;
-}
-
 bool rg_gui_set_font_type(int type)
 {
     if (type < 0)
@@ -144,6 +77,9 @@ bool rg_gui_set_font_type(int type)
     font_info.width  = RG_MAX(font_info.font->width, 4);
     font_info.height = font_info.points;
 
+    if (!rg_glyph_cache_init(&glyphs, font_info.font, font_info.points))
+        RG_PANIC("Glyph cache allocation failed!");
+
     rg_settings_set_int32(SETTING_FONTTYPE, font_info.type);
 
     RG_LOGI("Font set to: points=%d, size=%dx%d, scaling=%.2f\n",
@@ -166,6 +102,21 @@ rg_rect_t rg_gui_calc_text_size(const char *text, int wrap_width)
         return rg_gui_draw_text(0, 0, 0, text, 0, 0, RG_TEXT_DUMMY_DRAW);
 }
 
+static void fill_pixels(uint16_t *buffer, uint16_t color, size_t count)
+{
+    uint32_t color32 = (color << 16) | color;
+
+    if (((uintptr_t)buffer & 2) && count)
+    {
+        *buffer++ = color;
+        count--;
+    }
+    for (size_t i = 0; i < count / 2; i++)
+        ((uint32_t *)buffer)[i] = color32;
+    if (count & 1)
+        buffer[count - 1] = color;
+}
+
 rg_rect_t rg_gui_draw_text(int x_pos, int y_pos, int width, const char *text,
                            rg_color_t color_fg, rg_color_t color_bg, uint32_t flags)
 {
@@ -173,23 +124,14 @@ rg_rect_t rg_gui_draw_text(int x_pos, int y_pos, int width, const char *text,
     if (y_pos < 0) y_pos += screen_height;
     if (!text || *text == 0) text = " ";
 
-    // FIX ME: We should cache get_glyph().width to avoid calling it up to 3 times.
-
     if (width == 0)
     {
         // Find the longest line to determine our box width
-        int line_width = 0;
-        const char *ptr = text;
-        while (*ptr)
+        for (const char *ptr = text; *ptr;)
         {
-            int chr = *ptr++;
-            line_width += get_glyph(font_info.font, font_info.points, chr).width;
-
-            if (chr == '\n' || *ptr == 0)
-            {
-                width = RG_MAX(line_width, width);
-                line_width = 0;
-            }
+            int line_width;
+            ptr = rg_glyph_cache_fit(&glyphs, ptr + (*ptr == '\n'), INT16_MAX, &line_width);
+            width = RG_MAX(line_width, width);
         }
     }
 
@@ -198,63 +140,36 @@ rg_rect_t rg_gui_draw_text(int x_pos, int y_pos, int width, const char *text,
     int y_offset = 0;
     const char *ptr = text;
 
+    // Our writes must not interleave with a frame still being sent
+    if (!(flags & RG_TEXT_DUMMY_DRAW))
+        rg_display_sync();
+
     while (*ptr)
     {
-        int x_offset = 0;
-
-        size_t p = draw_width * font_height;
-        while (p--)
-            overlay_buffer[p] = color_bg;
+        // A line's newline is consumed by the next one
+        if (*ptr == '\n')
+            ptr++;
 
-        if (flags & (RG_TEXT_ALIGN_LEFT|RG_TEXT_ALIGN_CENTER))
-        {
-            // Find the current line's text width
-            const char *line = ptr;
-            while (x_offset < draw_width && *line && *line != '\n')
-            {
-                int width = get_glyph(font_info.font, font_info.points, *line++).width;
-                if (draw_width - x_offset < width) // Do not truncate glyphs
-                    break;
-                x_offset += width;
-            }
-            if (flags & RG_TEXT_ALIGN_CENTER)
-                x_offset = (draw_width - x_offset) / 2;
-            else if (flags & RG_TEXT_ALIGN_LEFT)
-                x_offset = draw_width - x_offset;
-        }
+        // A glyph wider than the box would never fit, skip it
+        if (*ptr && *ptr != '\n' && rg_glyph_cache_fit(&glyphs, ptr, draw_width, NULL) == ptr)
+            ptr++;
 
-        while (x_offset < draw_width)
-        {
-            rg_glyph_t glyph = get_glyph(font_info.font, font_info.points, *ptr++);
+        const char *line = ptr;
+        int line_width, x_offset = 0;
 
-            if (draw_width - x_offset < glyph.width) // Do not truncate glyphs
-            {
-                if (flags & RG_TEXT_MULTILINE)
-                    ptr--;
-                break;
-            }
+        ptr = rg_glyph_cache_fit(&glyphs, line, draw_width, &line_width);
 
-            if (!(flags & RG_TEXT_DUMMY_DRAW))
-            {
-                for (int y = 0; y < font_height; y++)
-                {
-                    uint16_t *output = &overlay_buffer[x_offset + (draw_width * y)];
-
-                    for (int x = 0; x < glyph.width; x++)
-                    {
-                        output[x] = (glyph.bitmap[y] & (1 << x)) ? color_fg : color_bg;
-                    }
-                }
-            }
-
-            x_offset += glyph.width;
-
-            if (*ptr == 0 || *ptr == '\n')
-                break;
-        }
+        if (flags & RG_TEXT_ALIGN_CENTER)
+            x_offset = (draw_width - line_width) / 2;
+        else if (flags & RG_TEXT_ALIGN_LEFT)
+            x_offset = draw_width - line_width;
 
         if (!(flags & RG_TEXT_DUMMY_DRAW))
+        {
+            fill_pixels(overlay_buffer, color_bg, draw_width * font_height);
+            rg_glyph_cache_draw(&glyphs, overlay_buffer, draw_width, x_offset, line, ptr - line, color_fg);
             rg_display_write(x_pos, y_pos + y_offset, draw_width, font_height, 0, overlay_buffer);
+        }
 
         y_offset += font_height;
 
@@ -276,6 +191,8 @@ void rg_gui_draw_rect(int x_pos, int y_pos, int width, int height, int border_si
     if (y_pos < 0)
         y_pos += screen_height;
 
+    rg_display_sync();
+
     if (border_size > 0)
     {
         size_t p = border_size * RG_MAX(width, height);
@@ -313,6 +230,7 @@ void rg_gui_draw_image(int x_pos, int y_pos, int width, int height, const rg_ima
     if (height <= 0)
         height = img->height;
 
+    rg_display_sync();
     rg_display_write(x_pos, y_pos, width, height, img->width * 2, img->data);
 }
 
@@ -347,6 +265,7 @@ void rg_gui_draw_battery(int x_pos, int y_pos)
 
 void rg_gui_draw_hourglass(void)
 {
+    rg_display_sync();
     rg_display_write((screen_width / 2) - (image_hourglass.width / 2),
         (screen_height / 2) - (image_hourglass.height / 2),
         image_hourglass.width,
@@ -734,6 +653,17 @@ static dialog_return_t audio_update_cb(dialog_option_t *option, dialog_event_t e
     return RG_DIALOG_IGNORE;
 }
 
+static dialog_return_t audio_filter_update_cb(dialog_option_t *option, dialog_event_t event)
+{
+    bool enabled = rg_audio_get_filter();
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT) enabled = !enabled;
+
+    rg_audio_set_filter(enabled);
+    strcpy(option->value, enabled ? "On " : "Off");
+
+    return RG_DIALOG_IGNORE;
+}
+
 static dialog_return_t filter_update_cb(dialog_option_t *option, dialog_event_t event)
 {
     int8_t max = RG_DISPLAY_FILTER_COUNT - 1;
@@ -791,6 +721,7 @@ static dialog_return_t update_mode_update_cb(dialog_option_t *option, dialog_eve
 
     if (mode == RG_DISPLAY_UPDATE_PARTIAL)   strcpy(option->value, "Partial");
     if (mode == RG_DISPLAY_UPDATE_FULL)      strcpy(option->value, "Full   ");
+    if (mode == RG_DISPLAY_UPDATE_SMART)     strcpy(option->value, "Smart  ");
     // if (mode == RG_DISPLAY_UPDATE_INTERLACE) strcpy(option->value, "Interlace");
 
     return RG_DIALOG_IGNORE;
@@ -807,6 +738,17 @@ static dialog_return_t speedup_update_cb(dialog_option_t *option, dialog_event_t
     return RG_DIALOG_IGNORE;
 }
 
+static dialog_return_t timing_overlay_cb(dialog_option_t *option, dialog_event_t event)
+{
+    bool enabled = rg_system_get_timing_overlay();
+    if (event == RG_DIALOG_PREV || event == RG_DIALOG_NEXT) enabled = !enabled;
+
+    rg_system_set_timing_overlay(enabled);
+    strcpy(option->value, enabled ? "On " : "Off");
+
+    return RG_DIALOG_IGNORE;
+}
+
 static dialog_return_t more_settings_cb(dialog_option_t *option, dialog_event_t event)
 {
     rg_app_t *app = rg_system_get_app();
@@ -826,6 +768,7 @@ int rg_gui_settings_menu(const dialog_option_t *extra_options)
     *opt++ = (dialog_option_t){0, "Brightness", "50%",  1, &brightness_update_cb};
     *opt++ = (dialog_option_t){0, "Volume    ", "50%",  1, &volume_update_cb};
     *opt++ = (dialog_option_t){0, "Audio out ", "Speaker", 1, &audio_update_cb};
+    *opt++ = (dialog_option_t){0, "Low-pass  ", "Off", 1, &audio_filter_update_cb};
 
     if (!app->isLauncher)
     {
@@ -925,6 +868,8 @@ int rg_gui_debug_menu(const dialog_option_t *extra_options)
         RG_DIALOG_SEPARATOR,
         {1000, "Save screenshot", NULL, 1, NULL},
         {2000, "Save trace", NULL, 1, NULL},
+        {2100, "Save timings", NULL, 1, NULL},
+        {2200, "Timing overlay", "Off", 1, &timing_overlay_cb},
         {3000, "Cheats", NULL, 1, NULL},
         {4000, "Crash", NULL, 1, NULL},
         {5000, "Random time", NULL, 1, NULL},
@@ -954,6 +899,10 @@ int rg_gui_debug_menu(const dialog_option_t *extra_options)
     {
         rg_system_save_trace(RG_BASE_PATH "/trace.txt", 0);
     }
+    else if (sel == 2100)
+    {
+        rg_system_save_timings(RG_BASE_PATH "/timings.csv");
+    }
     else if (sel == 4000)
     {
         RG_PANIC("Crash test!");
@@ -1063,7 +1012,71 @@ int rg_gui_game_menu(void)
     return sel;
 }
 
+typedef struct
+{
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} png_stream_t;
+
+static size_t png_read_file(void *ptr, size_t size, size_t count, void *arg)
+{
+    return fread(ptr, size, count, (FILE *)arg);
+}
+
+static size_t png_read_memory(void *ptr, size_t size, size_t count, void *arg)
+{
+    png_stream_t *stream = (png_stream_t *)arg;
+    size_t total = RG_MIN(size * count, stream->size - stream->pos);
+
+    memcpy(ptr, stream->data + stream->pos, total);
+    stream->pos += total;
+
+    return total / size;
+}
+
+static int png_size_callback(void *arg, int32_t width, int32_t height)
+{
+    rg_image_t **img = (rg_image_t **)arg;
+    *img = rg_image_alloc(width, height);
+    return *img == NULL;
+}
+
+static int png_row_callback(void *arg, int32_t row, const uint16_t *pixels)
+{
+    rg_image_t *img = *(rg_image_t **)arg;
+    memcpy(img->data + row * img->width, pixels, img->width * 2);
+    return 0;
+}
+
+// Decodes straight into the rg_image_t, a row at a time. Downscaling happens during the decode
+// so neither the file nor the full size image is ever in memory.
+static rg_image_t *load_png(PngReadProc read_proc, void *arg, int max_width, int max_height)
+{
+    rg_image_t *img = NULL;
+    LuRowReader reader = {max_width, max_height, &png_size_callback, &png_row_callback, &img};
+    LuUserContext ctx;
+
+    luUserContextInitDefault(&ctx);
+    ctx.readProc = read_proc;
+    ctx.readProcUserPtr = arg;
+
+    if (luPngReadRowsUC(&ctx, &reader) != PNG_OK)
+    {
+        RG_LOGE("PNG parsing failed!\n");
+        rg_image_free(img);
+        return NULL;
+    }
+
+    return img;
+}
+
 rg_image_t *rg_image_load_from_file(const char *filename, uint32_t flags)
+{
+    return rg_image_load_scaled(filename, 0, 0, flags);
+}
+
+rg_image_t *rg_image_load_scaled(const char *filename, int max_width, int max_height, uint32_t flags)
 {
     RG_ASSERT(filename, "bad param");
 
@@ -1074,6 +1087,17 @@ rg_image_t *rg_image_load_from_file(const char *filename, uint32_t flags)
         return NULL;
     }
 
+    uint8_t header[4] = {0};
+    fread(header, 4, 1, fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (memcmp(header, "\x89PNG", 4) == 0)
+    {
+        rg_image_t *img = load_png(&png_read_file, fp, max_width, max_height);
+        fclose(fp);
+        return img;
+    }
+
     fseek(fp, 0, SEEK_END);
 
     size_t data_len = ftell(fp);
@@ -1092,6 +1116,25 @@ rg_image_t *rg_image_load_from_file(const char *filename, uint32_t flags)
     rg_image_t *img = rg_image_load_from_memory(data, data_len, flags);
     free(data);
 
+    // RAW565 is small and rare enough that resizing it afterwards is fine
+    if (img && ((max_width > 0 && img->width > max_width) || (max_height > 0 && img->height > max_height)))
+    {
+        int width = img->width, height = img->height;
+        if (max_width > 0 && width > max_width)
+        {
+            height = RG_MAX(height * max_width / width, 1);
+            width = max_width;
+        }
+        if (max_height > 0 && height > max_height)
+        {
+            width = RG_MAX(width * max_height / height, 1);
+            height = max_height;
+        }
+        rg_image_t *resized = rg_image_copy_resized(img, width, height);
+        rg_image_free(img);
+        img = resized;
+    }
+
     return img;
 }
 
@@ -1101,32 +1144,8 @@ rg_image_t *rg_image_load_from_memory(const uint8_t *data, size_t data_len, uint
 
     if (memcmp(data, "\x89PNG", 4) == 0)
     {
-        LuImage *png = luPngReadMem(data, data_len);
-        if (!png)
-        {
-            RG_LOGE("PNG parsing failed!\n");
-            return NULL;
-        }
-
-        rg_image_t *img = rg_image_alloc(png->width, png->height);
-        if (img)
-        {
-            size_t pixel_count = img->width * img->height;
-            size_t pixel_size = png->channels;
-            const uint8_t *src = png->data;
-            uint16_t *dest = img->data;
-
-            // RGB888 or RGBA8888 to RGB565
-            for (int i = 0; i < pixel_count; ++i)
-            {
-                dest[i] = (((src[0] >> 3) & 0x1F) << 11)
-                        | (((src[1] >> 2) & 0x3F) << 5)
-                        | (((src[2] >> 3) & 0x1F));
-                src += pixel_size;
-            }
-        }
-        luImageRelease(png, NULL);
-        return img;
+        png_stream_t stream = {data, data_len, 0};
+        return load_png(&png_read_memory, &stream, 0, 0);
     }
     else // RAW565 (uint16 width, uint16 height, uint16 data[])
     {
@@ -1151,6 +1170,11 @@ rg_image_t *rg_image_load_from_memory(const uint8_t *data, size_t data_len, uint
     return NULL;
 }
 
+static size_t png_write_file(const void *ptr, size_t size, size_t count, void *arg)
+{
+    return fwrite(ptr, size, count, (FILE *)arg);
+}
+
 bool rg_image_save_to_file(const char *filename, const rg_image_t *img, uint32_t flags)
 {
     RG_ASSERT(filename && img, "bad param");
@@ -1175,15 +1199,97 @@ bool rg_image_save_to_file(const char *filename, const rg_image_t *img, uint32_t
         dest += 3;
     }
 
-    if (luPngWriteFile(filename, png) != PNG_OK)
+    FILE *fp = fopen(filename, "wb");
+    if (!fp)
     {
-        RG_LOGE("luPngWriteFile failed!\n");
+        RG_LOGE("Unable to open '%s'!\n", filename);
         luImageRelease(png, 0);
         return false;
     }
 
+    LuUserContext ctx;
+    luUserContextInitDefault(&ctx);
+    ctx.writeProc = &png_write_file;
+    ctx.writeProcUserPtr = fp;
+
+    if (flags & RG_IMAGE_SAVE_FAST)
+    {
+        // ~48KB of deflate state instead of ~256KB, screenshots are a few rows per window anyway
+        ctx.compressionLevel = 1;
+        ctx.compressionWindowBits = 12;
+        ctx.compressionMemLevel = 6;
+    }
+
+    bool success = luPngWriteUC(&ctx, png) == PNG_OK;
+    success = (fclose(fp) == 0) && success;
+
+    if (!success)
+    {
+        RG_LOGE("luPngWriteUC failed!\n");
+        unlink(filename);
+    }
+
     luImageRelease(png, 0);
-    return true;
+    return success;
+}
+
+typedef struct
+{
+    char filename[PATH_MAX + 1];
+    rg_image_t *img;
+    uint32_t flags;
+} save_job_t;
+
+static void save_task(void *arg)
+{
+    save_job_t *job = (save_job_t *)arg;
+
+    if (!rg_image_save_to_file(job->filename, job->img, job->flags))
+        RG_LOGE("Background save of '%s' failed!\n", job->filename);
+
+    rg_image_free(job->img);
+    free(job);
+
+    xSemaphoreGive(save_lock);
+    vTaskDelete(NULL);
+}
+
+bool rg_image_save_to_file_async(const char *filename, rg_image_t *img, uint32_t flags)
+{
+    RG_ASSERT(filename && img, "bad param");
+
+    save_job_t *job = malloc(sizeof(save_job_t));
+
+    // One save at a time, a new one waits for the previous one to be written
+    xSemaphoreTake(save_lock, portMAX_DELAY);
+
+    if (job)
+    {
+        snprintf(job->filename, sizeof(job->filename), "%s", filename);
+        job->img = img;
+        job->flags = flags;
+
+        // Low priority on the display's core, the emulation task carries on meanwhile
+        if (xTaskCreatePinnedToCore(&save_task, "rg_save", 8192, job, 1, NULL, 1) == pdPASS)
+            return true;
+
+        free(job);
+    }
+
+    RG_LOGW("Unable to save in the background, saving now.\n");
+    xSemaphoreGive(save_lock);
+
+    bool success = rg_image_save_to_file(filename, img, flags);
+    rg_image_free(img);
+    return success;
+}
+
+void rg_image_save_wait(void)
+{
+    if (!save_lock)
+        return;
+    xSemaphoreTake(save_lock, portMAX_DELAY);
+    xSemaphoreGive(save_lock);
 }
 
 rg_image_t *rg_image_copy_resized(const rg_image_t *img, int new_width, int new_height)
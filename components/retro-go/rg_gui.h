@@ -31,6 +31,11 @@ enum
     RG_TEXT_DUMMY_DRAW   = (1 << 4),
 };
 
+enum
+{
+    RG_IMAGE_SAVE_FAST   = (1 << 0), // Fastest deflate level with a small window, for screenshots
+};
+
 typedef struct
 {
     uint8_t type;
@@ -68,6 +73,18 @@ typedef struct
     uint16_t bitmap[24];
 } rg_glyph_t;
 
+// Glyphs of one font at one size, decoded once. ASCII has its own entries, every byte above shares
+// the last one (none of our fonts go past 0x7F).
+#define RG_GLYPH_CACHE_SIZE 129
+
+typedef struct
+{
+    const rg_font_t *font;
+    int height;
+    uint8_t widths[RG_GLYPH_CACHE_SIZE];
+    uint16_t *rows; // height rows per glyph, bit x is column x
+} rg_glyph_cache_t;
+
 typedef struct
 {
     uint16_t width;
@@ -116,11 +133,20 @@ void rg_gui_draw_dialog(const char *header, const dialog_option_t *options, int
 void rg_gui_draw_image(int x_pos, int y_pos, int width, int height, const rg_image_t *img);
 void rg_gui_draw_hourglass(void);
 
+bool rg_glyph_cache_init(rg_glyph_cache_t *cache, const rg_font_t *font, int points);
+void rg_glyph_cache_free(rg_glyph_cache_t *cache);
+const char *rg_glyph_cache_fit(const rg_glyph_cache_t *cache, const char *text, int max_width, int *width);
+void rg_glyph_cache_draw(const rg_glyph_cache_t *cache, uint16_t *buffer, int stride, int x_pos,
+                         const char *text, size_t count, uint16_t color);
+
 rg_image_t *rg_image_load_from_file(const char *filename, uint32_t flags);
+rg_image_t *rg_image_load_scaled(const char *filename, int max_width, int max_height, uint32_t flags);
 rg_image_t *rg_image_load_from_memory(const uint8_t *data, size_t data_len, uint32_t flags);
 rg_image_t *rg_image_alloc(size_t width, size_t height);
 rg_image_t *rg_image_copy_resized(const rg_image_t *img, int new_width, int new_height);
 bool rg_image_save_to_file(const char *filename, const rg_image_t *img, uint32_t flags);
+bool rg_image_save_to_file_async(const char *filename, rg_image_t *img, uint32_t flags); // Takes img over
+void rg_image_save_wait(void);
 void rg_image_free(rg_image_t *img);
 
 int  rg_gui_dialog(const char *header, const dialog_option_t *options, int selected_initial);
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rg_gui.h"
+
+// Glyph cache and text renderer of rg_gui. Glyphs are decoded and scaled once per font change,
+// drawing a line then only looks up rows of bits and fills their runs of set pixels.
+// This file must stay free of esp-idf dependencies, tools/text-bench.c builds it on the host.
+
+static inline int glyph_index(int c)
+{
+    return (uint8_t)c < RG_GLYPH_CACHE_SIZE ? (uint8_t)c : RG_GLYPH_CACHE_SIZE - 1;
+}
+
+static rg_glyph_t get_glyph(const rg_font_t *font, int points, int c)
+{
+    rg_glyph_t out = {
+        .width  = font->width ? font->width : 8,
+        .height = font->height,
+        .bitmap = {0},
+    };
+
+    if (c == '\n') // Some glyphs are always zero width
+    {
+        out.width = 0;
+    }
+    else if (font->type == 0) // bitmap
+    {
+        if (c < font->chars)
+        {
+            for (int y = 0; y < font->height; y++) {
+                out.bitmap[y] = font->data[(c * font->height) + y];
+            }
+        }
+    }
+    else // Proportional
+    {
+        // Based on code by Boris Lovosevic (https://github.com/loboris)
+        int charCode, adjYOffset, width, height, xOffset, xDelta;
+        const uint8_t *data = font->data;
+        do {
+            charCode = *data++;
+            adjYOffset = *data++;
+            width = *data++;
+            height = *data++;
+            xOffset = *data++;
+            xOffset = xOffset < 0x80 ? xOffset : -(0xFF - xOffset);
+            xDelta = *data++;
+
+            if (c != charCode && charCode != 0xFF && width != 0) {
+                data += (((width * height) - 1) / 8) + 1;
+            }
+        } while ((c != charCode) && (charCode != 0xFF));
+
+        if (c == charCode)
+        {
+            out.width = ((width > xDelta) ? width : xDelta);
+            // out.height = height;
+
+            int ch = 0, mask = 0x80;
+
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    if (((x + (y * width)) % 8) == 0) {
+                        mask = 0x80;
+                        ch = *data++;
+                    }
+                    if ((ch & mask) != 0) {
+                        out.bitmap[adjYOffset + y] |= (1 << (xOffset + x));
+                    }
+                    mask >>= 1;
+                }
+            }
+        }
+    }
+
+    if (points && points != font->height)
+    {
+        float scale = (float)points / font->height;
+        rg_glyph_t out2 = out;
+        out.height = points;
+        for (int y = 0; y < out.height; y++)
+            out.bitmap[y] = out2.bitmap[(int)(y / scale)];
+    }
+
+    return out;
+}
+
+bool rg_glyph_cache_init(rg_glyph_cache_t *cache, const rg_font_t *font, int points)
+{
+    int height = points ? points : font->height;
+
+    if (height < 1 || height > 24) // rg_glyph_t.bitmap
+        return false;
+
+    uint16_t *rows = calloc(RG_GLYPH_CACHE_SIZE * height, sizeof(uint16_t));
+    if (!rows)
+        return false;
+
+    for (int c = 0; c < RG_GLYPH_CACHE_SIZE; c++)
+    {
+        rg_glyph_t glyph = get_glyph(font, points, c);
+        uint16_t mask = glyph.width < 16 ? (1 << glyph.width) - 1 : 0xFFFF; // Never draw past the advance
+
+        cache->widths[c] = glyph.width;
+        for (int y = 0; y < height; y++)
+            rows[c * height + y] = glyph.bitmap[y] & mask;
+    }
+
+    free(cache->rows);
+    cache->font = font;
+    cache->height = height;
+    cache->rows = rows;
+
+    return true;
+}
+
+void rg_glyph_cache_free(rg_glyph_cache_t *cache)
+{
+    free(cache->rows);
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Returns the end of the longest run of text, up to a newline, whose glyphs all fit in max_width
+const char *rg_glyph_cache_fit(const rg_glyph_cache_t *cache, const char *text, int max_width, int *width)
+{
+    int line_width = 0;
+
+    while (*text && *text != '\n')
+    {
+        int glyph_width = cache->widths[glyph_index(*text)];
+        if (max_width - line_width < glyph_width) // Do not truncate glyphs
+            break;
+        line_width += glyph_width;
+        text++;
+    }
+
+    if (width)
+        *width = line_width;
+
+    return text;
+}
+
+// Draws the foreground pixels of count glyphs, the caller fills the background. The buffer must
+// be stride pixels wide and cache->height rows high.
+void rg_glyph_cache_draw(const rg_glyph_cache_t *cache, uint16_t *buffer, int stride, int x_pos,
+                         const char *text, size_t count, uint16_t color)
+{
+    for (int y = 0; y < cache->height; y++)
+    {
+        const uint16_t *rows = cache->rows + y;
+        uint16_t *output = buffer + y * stride + x_pos;
+
+        for (size_t i = 0; i < count; i++)
+        {
+            int index = glyph_index(text[i]);
+            uint32_t bits = rows[index * cache->height];
+
+            while (bits)
+            {
+                int start = __builtin_ctz(bits);
+                int length = __builtin_ctz(~(bits >> start));
+                for (int x = start; x < start + length; x++)
+                    output[x] = color;
+                bits &= ~(((1u << length) - 1) << start);
+            }
+
+            output += cache->widths[index];
+        }
+    }
+}
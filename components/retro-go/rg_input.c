@@ -1,5 +1,6 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/semphr.h>
 #include <esp_adc_cal.h>
 #include <driver/gpio.h>
 #include <driver/adc.h>
@@ -9,6 +10,11 @@
 #include "rg_input.h"
 #include "rg_i2c.h"
 
+#define INPUT_POLL_INTERVAL   (10)   // In ms, background polling for when nobody reads us
+#define INPUT_SYNC_MAX_AGE    (2000) // In us, older samples are refreshed when the core reads the gamepad
+#define INPUT_RELEASE_DELAY   (8000) // In us, how long a release must hold to be believed
+#define INPUT_LATENCY_SAMPLES (64)
+
 static bool input_initialized = false;
 static int64_t last_gamepad_read = 0;
 // Keep the following <= 32bit to ensure atomic access without mutexes
@@ -16,6 +22,15 @@ static uint32_t gamepad_state = 0;
 static float battery_level = -1;
 static float battery_volts = 0;
 
+// Everything below is protected by gamepad_lock
+static SemaphoreHandle_t gamepad_lock;
+static rg_debounce_t gamepad_debounce;
+static int64_t gamepad_sample_time;
+static uint32_t pending_edges;                  // Edges the core hasn't seen yet
+static int64_t edge_time[RG_KEY_COUNT];
+static uint32_t latency_samples[INPUT_LATENCY_SAMPLES];
+static uint32_t latency_count;
+
 
 static inline uint32_t gamepad_read(void)
 {
@@ -66,37 +81,34 @@ static inline uint32_t gamepad_read(void)
     return state;
 }
 
-static void input_task(void *arg)
+static void gamepad_sample(int64_t now)
 {
-    const uint8_t debounce_level = 0x03;
-    uint8_t debounce[RG_KEY_COUNT];
-    uint32_t new_gamepad_state = 0;
+    uint32_t state = rg_debounce_update(&gamepad_debounce, gamepad_read(), now);
+    uint32_t changed = state ^ gamepad_state;
 
-    // Initialize debounce state
-    memset(debounce, 0xFF, sizeof(debounce));
-
-    while (input_initialized)
+    // Timestamp the edges so that we can tell how long they take to reach the core
+    for (int i = 0; changed; ++i, changed >>= 1)
     {
-        uint32_t state = gamepad_read();
-
-        for (int i = 0; i < RG_KEY_COUNT; ++i)
+        if (changed & 1)
         {
-            debounce[i] = ((debounce[i] << 1) | ((state >> i) & 1));
-            debounce[i] &= debounce_level;
-
-            if (debounce[i] == debounce_level) // Pressed
-            {
-                new_gamepad_state |= (1 << i);
-            }
-            else if (debounce[i] == 0x00) // Released
-            {
-                new_gamepad_state &= ~(1 << i);
-            }
+            edge_time[i] = now;
+            pending_edges |= 1 << i;
         }
+    }
 
-        gamepad_state = new_gamepad_state;
+    gamepad_state = state;
+    gamepad_sample_time = now;
+}
 
-        vTaskDelay(pdMS_TO_TICKS(10));
+static void input_task(void *arg)
+{
+    while (input_initialized)
+    {
+        xSemaphoreTake(gamepad_lock, portMAX_DELAY);
+        gamepad_sample(get_elapsed_time());
+        xSemaphoreGive(gamepad_lock);
+
+        vTaskDelay(pdMS_TO_TICKS(INPUT_POLL_INTERVAL));
     }
 
     vTaskDelete(NULL);
@@ -149,10 +161,12 @@ void rg_input_init(void)
 
 #endif
 
-    // Start background polling
-    xTaskCreatePinnedToCore(&input_task, "input_task", 1024, NULL, 5, NULL, 1);
+    gamepad_lock = xSemaphoreCreateMutex();
+    rg_debounce_init(&gamepad_debounce, INPUT_RELEASE_DELAY);
 
+    // Start background polling (input_task exits as soon as input_initialized is false)
     input_initialized = true;
+    xTaskCreatePinnedToCore(&input_task, "input_task", 1024, NULL, 5, NULL, 1);
 
     RG_LOGI("Input ready. driver='%s'\n", driver);
 }
@@ -173,8 +187,34 @@ long rg_input_gamepad_last_read(void)
 
 uint32_t rg_input_read_gamepad(void)
 {
-    last_gamepad_read = get_elapsed_time();
-    return gamepad_state;
+    int64_t now = get_elapsed_time();
+
+    last_gamepad_read = now;
+
+    if (!input_initialized)
+        return gamepad_state;
+
+    xSemaphoreTake(gamepad_lock, portMAX_DELAY);
+
+    // Cores read the gamepad right before emulating a frame, sampling it now instead of using
+    // input_task's last sample saves up to a full polling interval of lag.
+    if (now - gamepad_sample_time > INPUT_SYNC_MAX_AGE)
+        gamepad_sample(now);
+
+    uint32_t state = rg_debounce_read(&gamepad_debounce);
+
+    for (int i = 0; pending_edges; ++i)
+    {
+        if (pending_edges & (1 << i))
+        {
+            latency_samples[latency_count++ % INPUT_LATENCY_SAMPLES] = get_elapsed_time() - edge_time[i];
+            pending_edges &= ~(1 << i);
+        }
+    }
+
+    xSemaphoreGive(gamepad_lock);
+
+    return state;
 }
 
 bool rg_input_key_is_pressed(rg_key_t key)
@@ -190,6 +230,41 @@ void rg_input_wait_for_key(rg_key_t key, bool pressed)
     }
 }
 
+bool rg_input_get_latency(rg_input_latency_t *out)
+{
+    uint32_t samples[INPUT_LATENCY_SAMPLES];
+    size_t count;
+
+    if (!input_initialized || !out)
+        return false;
+
+    xSemaphoreTake(gamepad_lock, portMAX_DELAY);
+    count = RG_MIN(latency_count, INPUT_LATENCY_SAMPLES);
+    memcpy(samples, latency_samples, count * sizeof(uint32_t));
+    xSemaphoreGive(gamepad_lock);
+
+    if (count == 0)
+        return false;
+
+    // Insertion sort, it's only a few dozen entries
+    for (size_t i = 1; i < count; ++i)
+    {
+        uint32_t value = samples[i];
+        size_t j = i;
+        for (; j > 0 && samples[j - 1] > value; --j)
+            samples[j] = samples[j - 1];
+        samples[j] = value;
+    }
+
+    out->count = count;
+    out->p50 = samples[count * 50 / 100];
+    out->p90 = samples[count * 90 / 100];
+    out->p99 = samples[count * 99 / 100];
+    out->max = samples[count - 1];
+
+    return true;
+}
+
 bool rg_input_read_battery(float *percent, float *volts)
 {
 #if defined(RG_BATT_ADC_CHANNEL)
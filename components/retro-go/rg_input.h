@@ -22,6 +22,24 @@ typedef enum
     RG_KEY_COUNT   = 12,
 } rg_key_t;
 
+typedef struct
+{
+    uint32_t state;                         // Debounced keys
+    uint32_t releasing;                     // Keys that read released but aren't confirmed yet
+    uint32_t latched;                       // Keys pressed since the last rg_debounce_read()
+    uint32_t release_delay;                 // How long a key must read released before we believe it, in us
+    int64_t released_since[RG_KEY_COUNT];   // When each releasing key was first seen released
+} rg_debounce_t;
+
+typedef struct
+{
+    uint32_t count; // Number of edges the percentiles are computed from
+    uint32_t p50;   // All in us, from the sample that saw the edge to the core reading it
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+} rg_input_latency_t;
+
 void rg_input_init(void);
 void rg_input_deinit(void);
 long rg_input_gamepad_last_read(void);
@@ -29,3 +47,9 @@ bool rg_input_key_is_pressed(rg_key_t key);
 void rg_input_wait_for_key(rg_key_t key, bool pressed);
 uint32_t rg_input_read_gamepad(void);
 bool rg_input_read_battery(float *percent, float *volts);
+bool rg_input_get_latency(rg_input_latency_t *out);
+
+// Debouncing (rg_input_debounce.c), it has no dependency on the hardware
+void rg_debounce_init(rg_debounce_t *db, uint32_t release_delay);
+uint32_t rg_debounce_update(rg_debounce_t *db, uint32_t raw_state, int64_t now);
+uint32_t rg_debounce_read(rg_debounce_t *db);
@@ -0,0 +1,53 @@
+#include <string.h>
+
+#include "rg_input.h"
+
+// This file must stay free of esp-idf dependencies so that it can be tested on the host.
+
+void rg_debounce_init(rg_debounce_t *db, uint32_t release_delay)
+{
+    memset(db, 0, sizeof(*db));
+    db->release_delay = release_delay;
+}
+
+// Presses are reported as soon as they are sampled, a bouncing contact can't fake a press anyway.
+// Releases must hold for release_delay, which hides the bounces of both the press and the release.
+uint32_t rg_debounce_update(rg_debounce_t *db, uint32_t raw_state, int64_t now)
+{
+    for (int i = 0; i < RG_KEY_COUNT; ++i)
+    {
+        uint32_t key = 1 << i;
+
+        if (raw_state & key)
+        {
+            if (!(db->state & key))
+                db->latched |= key;
+            db->state |= key;
+            db->releasing &= ~key;
+        }
+        else if (db->state & key)
+        {
+            if (!(db->releasing & key))
+            {
+                db->releasing |= key;
+                db->released_since[i] = now;
+            }
+            if (now - db->released_since[i] >= db->release_delay)
+            {
+                db->state &= ~key;
+                db->releasing &= ~key;
+            }
+        }
+    }
+
+    return db->state;
+}
+
+// The debounced state plus every key pressed since the last read. A tap can be pressed and
+// released between two reads of a core, this way it is still seen at least once.
+uint32_t rg_debounce_read(rg_debounce_t *db)
+{
+    uint32_t state = db->state | db->latched;
+    db->latched = 0;
+    return state;
+}
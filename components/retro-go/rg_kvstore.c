@@ -0,0 +1,443 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rg_kvstore.h"
+
+// File layout: a header followed by records, each one overriding any previous record for its key.
+//   header: "RGKV", u16 version, u16 reserved, u32 size of the log when it was written
+//   record: u8 type, u8 ns_len, u8 key_len, u8 reserved, u16 value_len, u16 checksum, ns, key, value
+// Everything is little endian. The checksum covers the record minus the checksum itself.
+
+#define KV_MAGIC        "RGKV"
+#define KV_VERSION      1
+#define KV_HEADER_SIZE  12
+#define KV_RECORD_SIZE  8
+#define KV_MIN_CAPACITY 64
+#define KV_SLACK        4096 // Garbage we tolerate in the log regardless of its size
+#define KV_MAX_VALUE    4096 // Longer strings aren't stored, it keeps the load buffer small
+
+static inline uint32_t hash_key(const char *ns, const char *key)
+{
+    uint32_t hash = 2166136261u;
+    while (*ns)
+        hash = (hash ^ (uint8_t)*ns++) * 16777619u;
+    hash = (hash ^ 0xFF) * 16777619u;
+    while (*key)
+        hash = (hash ^ (uint8_t)*key++) * 16777619u;
+    return hash;
+}
+
+static inline void put_u16(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v)
+{
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+}
+
+static inline uint32_t get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | (get_u16(p + 2) << 16);
+}
+
+// Fletcher-16, it only has to catch a torn or garbled record
+static uint32_t checksum(uint32_t sum, const void *data, size_t length)
+{
+    uint32_t a = sum & 0xFF, b = sum >> 8;
+    for (const uint8_t *p = data; length--; p++)
+    {
+        a = (a + *p) % 255;
+        b = (b + a) % 255;
+    }
+    return (b << 8) | a;
+}
+
+static rg_kv_entry_t *find_slot(const rg_kvstore_t *kv, const char *ns, const char *key, uint32_t hash)
+{
+    size_t mask = kv->capacity - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+        rg_kv_entry_t *entry = &kv->entries[i];
+        if (!entry->ns)
+            return entry;
+        if (entry->hash == hash && strcmp(entry->key, key) == 0 && strcmp(entry->ns, ns) == 0)
+            return entry;
+    }
+}
+
+static bool grow(rg_kvstore_t *kv)
+{
+    size_t capacity = kv->capacity ? kv->capacity * 2 : KV_MIN_CAPACITY;
+    rg_kv_entry_t *entries = calloc(capacity, sizeof(rg_kv_entry_t));
+    rg_kv_entry_t *old_entries = kv->entries;
+    size_t old_capacity = kv->capacity;
+
+    if (!entries)
+        return false;
+
+    kv->entries = entries;
+    kv->capacity = capacity;
+
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (old_entries[i].ns)
+            *find_slot(kv, old_entries[i].ns, old_entries[i].key, old_entries[i].hash) = old_entries[i];
+    }
+
+    free(old_entries);
+    return true;
+}
+
+// Returns the entry for ns/key, creating it if needed
+static rg_kv_entry_t *get_entry(rg_kvstore_t *kv, const char *ns, const char *key)
+{
+    uint32_t hash = hash_key(ns, key);
+
+    if (kv->capacity)
+    {
+        rg_kv_entry_t *entry = find_slot(kv, ns, key, hash);
+        if (entry->ns)
+            return entry;
+    }
+
+    // Keep the load factor under 3/4
+    if ((kv->count + 1) * 4 > kv->capacity * 3 && !grow(kv))
+        return NULL;
+
+    size_t ns_len = strlen(ns), key_len = strlen(key);
+    char *name = malloc(ns_len + key_len + 2);
+    if (!name)
+        return NULL;
+
+    memcpy(name, ns, ns_len + 1);
+    memcpy(name + ns_len + 1, key, key_len + 1);
+
+    rg_kv_entry_t *entry = find_slot(kv, ns, key, hash);
+    *entry = (rg_kv_entry_t){.ns = name, .key = name + ns_len + 1, .hash = hash};
+    kv->count++;
+
+    return entry;
+}
+
+static bool set_value(rg_kvstore_t *kv, rg_kv_entry_t *entry, uint8_t type, int32_t value_int, const char *value_str)
+{
+    if (entry->type == type && (type == RG_KV_INT32 ? entry->value_int == value_int
+                                                    : strcmp(entry->value_str, value_str) == 0))
+        return false;
+
+    char *copy = NULL;
+    if (type == RG_KV_STRING && !(copy = strdup(value_str)))
+        return false;
+
+    free(entry->value_str);
+    entry->type = type;
+    entry->value_int = value_int;
+    entry->value_str = copy;
+
+    if (!entry->dirty)
+        kv->dirty++;
+    entry->dirty = true;
+
+    return true;
+}
+
+static bool write_record(FILE *fp, const rg_kv_entry_t *entry, size_t *size)
+{
+    uint8_t header[KV_RECORD_SIZE];
+    uint8_t value_int[4];
+    size_t ns_len = strlen(entry->ns);
+    size_t key_len = strlen(entry->key);
+    const void *value = value_int;
+    size_t value_len = 4;
+
+    if (entry->type == RG_KV_STRING)
+    {
+        value = entry->value_str;
+        value_len = strlen(entry->value_str);
+    }
+    else
+    {
+        put_u32(value_int, entry->value_int);
+    }
+
+    if (ns_len > 255 || key_len > 255 || value_len > KV_MAX_VALUE)
+        return true; // Can't be stored, skip it rather than fail everything
+
+    header[0] = entry->type;
+    header[1] = ns_len;
+    header[2] = key_len;
+    header[3] = 0;
+    put_u16(header + 4, value_len);
+
+    uint32_t sum = checksum(0, header, 6);
+    sum = checksum(sum, entry->ns, ns_len);
+    sum = checksum(sum, entry->key, key_len);
+    sum = checksum(sum, value, value_len);
+    put_u16(header + 6, sum);
+
+    if (fwrite(header, KV_RECORD_SIZE, 1, fp) != 1
+        || fwrite(entry->ns, 1, ns_len, fp) != ns_len
+        || fwrite(entry->key, 1, key_len, fp) != key_len
+        || fwrite(value, 1, value_len, fp) != value_len)
+        return false;
+
+    *size += KV_RECORD_SIZE + ns_len + key_len + value_len;
+    return true;
+}
+
+void rg_kv_init(rg_kvstore_t *kv)
+{
+    memset(kv, 0, sizeof(*kv));
+}
+
+void rg_kv_free(rg_kvstore_t *kv)
+{
+    for (size_t i = 0; i < kv->capacity; i++)
+    {
+        free(kv->entries[i].ns);
+        free(kv->entries[i].value_str);
+    }
+    free(kv->entries);
+    free(kv->ns);
+    rg_kv_init(kv);
+}
+
+// Replaces the content of kv with the global namespace and ns (or every namespace if ns is NULL).
+// fp may be NULL when there is no log yet. Returns false only if we ran out of memory, a damaged
+// log is loaded up to the damage and flagged.
+bool rg_kv_load(rg_kvstore_t *kv, FILE *fp, const char *ns)
+{
+    uint8_t header[KV_HEADER_SIZE];
+    char *buffer = malloc(255 + 255 + KV_MAX_VALUE + 3);
+    bool success = buffer != NULL;
+
+    char *ns_copy = ns ? strdup(ns) : NULL; // ns might be kv->ns
+    rg_kv_free(kv);
+    kv->ns = ns_copy;
+
+    if (!fp || !buffer)
+        goto done;
+
+    fseek(fp, 0, SEEK_END);
+    long file_size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (file_size <= 0)
+        goto done;
+
+    if (fread(header, KV_HEADER_SIZE, 1, fp) != 1 || memcmp(header, KV_MAGIC, 4) != 0
+        || get_u16(header + 4) != KV_VERSION)
+    {
+        kv->damaged = true;
+        goto done;
+    }
+
+    size_t ns_filter_len = kv->ns ? strlen(kv->ns) : 0;
+    long offset = KV_HEADER_SIZE;
+
+    kv->base_size = get_u32(header + 8);
+
+    while (offset < file_size)
+    {
+        uint8_t record[KV_RECORD_SIZE];
+
+        if (fread(record, KV_RECORD_SIZE, 1, fp) != 1)
+            break;
+
+        uint8_t type = record[0];
+        size_t ns_len = record[1], key_len = record[2], value_len = get_u16(record + 4);
+        size_t payload = ns_len + key_len + value_len;
+
+        if ((type != RG_KV_INT32 && type != RG_KV_STRING) || (type == RG_KV_INT32 && value_len != 4)
+            || value_len > KV_MAX_VALUE || offset + KV_RECORD_SIZE + (long)payload > file_size)
+            break;
+
+        // We need the namespace to know if we want the record, the rest is only read if we do
+        if (fread(buffer, 1, ns_len, fp) != ns_len)
+            break;
+
+        if (ns_len > 0 && kv->ns && (ns_len != ns_filter_len || memcmp(buffer, kv->ns, ns_len) != 0))
+        {
+            fseek(fp, key_len + value_len, SEEK_CUR);
+            offset += KV_RECORD_SIZE + payload;
+            continue;
+        }
+
+        if (fread(buffer + ns_len, 1, key_len + value_len, fp) != key_len + value_len)
+            break;
+
+        uint32_t sum = checksum(checksum(0, record, 6), buffer, payload);
+        if (sum != get_u16(record + 6))
+            break;
+
+        // Turn ns, key and a string value into NUL terminated strings in place
+        char *rec_value = buffer + ns_len + key_len + 2;
+        memmove(rec_value, buffer + ns_len + key_len, value_len);
+        rec_value[value_len] = 0;
+        memmove(buffer + ns_len + 1, buffer + ns_len, key_len);
+        buffer[ns_len + 1 + key_len] = 0;
+        buffer[ns_len] = 0;
+
+        rg_kv_entry_t *entry = get_entry(kv, buffer, buffer + ns_len + 1);
+        if (!entry)
+        {
+            success = false;
+            goto done;
+        }
+
+        if (type == RG_KV_INT32)
+            set_value(kv, entry, type, get_u32((uint8_t *)rec_value), NULL);
+        else
+            set_value(kv, entry, type, 0, rec_value);
+
+        entry->dirty = false;
+        offset += KV_RECORD_SIZE + payload;
+    }
+
+    kv->dirty = 0;
+    kv->log_size = offset;
+    kv->damaged = offset != file_size;
+
+done:
+    free(buffer);
+    return success;
+}
+
+// Appends the changed entries to the log, fp must be opened for appending. The log must not be damaged.
+bool rg_kv_flush(rg_kvstore_t *kv, FILE *fp)
+{
+    size_t size = kv->log_size;
+
+    if (kv->dirty == 0)
+        return true;
+
+    if (kv->log_size == 0)
+    {
+        uint8_t header[KV_HEADER_SIZE] = KV_MAGIC;
+        put_u16(header + 4, KV_VERSION);
+        put_u16(header + 6, 0);
+        put_u32(header + 8, 0);
+        if (fwrite(header, KV_HEADER_SIZE, 1, fp) != 1)
+            return false;
+        size = KV_HEADER_SIZE;
+    }
+
+    for (size_t i = 0; i < kv->capacity; i++)
+    {
+        if (kv->entries[i].ns && kv->entries[i].dirty && !write_record(fp, &kv->entries[i], &size))
+            return false;
+    }
+
+    if (fflush(fp) != 0)
+        return false;
+
+    for (size_t i = 0; i < kv->capacity; i++)
+        kv->entries[i].dirty = false;
+    kv->dirty = 0;
+    kv->log_size = size;
+
+    return true;
+}
+
+// Writes a fresh log to out, made of every live record of in (may be NULL) updated with kv's entries.
+bool rg_kv_compact(rg_kvstore_t *kv, FILE *in, FILE *out)
+{
+    rg_kvstore_t full;
+    uint8_t header[KV_HEADER_SIZE] = KV_MAGIC;
+    size_t size = KV_HEADER_SIZE;
+    size_t iterator = 0;
+    const rg_kv_entry_t *entry;
+    bool success = true;
+
+    rg_kv_init(&full);
+
+    if (!rg_kv_load(&full, in, NULL))
+    {
+        rg_kv_free(&full);
+        return false;
+    }
+
+    while ((entry = rg_kv_next(kv, &iterator)))
+    {
+        rg_kv_entry_t *dst = get_entry(&full, entry->ns, entry->key);
+        if (!dst)
+            success = false;
+        else if (entry->type)
+            set_value(&full, dst, entry->type, entry->value_int, entry->value_str);
+    }
+
+    // The final size isn't known yet, the header is patched at the end
+    put_u16(header + 4, KV_VERSION);
+    if (!success || fwrite(header, KV_HEADER_SIZE, 1, out) != 1)
+        success = false;
+
+    iterator = 0;
+    while (success && (entry = rg_kv_next(&full, &iterator)))
+        success = write_record(out, entry, &size);
+
+    put_u32(header + 8, size);
+    if (success && (fseek(out, 0, SEEK_SET) != 0 || fwrite(header, KV_HEADER_SIZE, 1, out) != 1
+        || fflush(out) != 0))
+        success = false;
+
+    rg_kv_free(&full);
+
+    if (success)
+    {
+        for (size_t i = 0; i < kv->capacity; i++)
+            kv->entries[i].dirty = false;
+        kv->dirty = 0;
+        kv->log_size = kv->base_size = size;
+        kv->damaged = false;
+    }
+
+    return success;
+}
+
+bool rg_kv_needs_compaction(const rg_kvstore_t *kv)
+{
+    return kv->damaged || (kv->log_size > 0 && kv->log_size > kv->base_size * 2 + KV_SLACK);
+}
+
+const rg_kv_entry_t *rg_kv_get(const rg_kvstore_t *kv, const char *ns, const char *key)
+{
+    if (!kv->capacity)
+        return NULL;
+
+    const rg_kv_entry_t *entry = find_slot(kv, ns, key, hash_key(ns, key));
+    return entry->ns ? entry : NULL;
+}
+
+bool rg_kv_set_int32(rg_kvstore_t *kv, const char *ns, const char *key, int32_t value)
+{
+    rg_kv_entry_t *entry = get_entry(kv, ns, key);
+    return entry && set_value(kv, entry, RG_KV_INT32, value, NULL);
+}
+
+bool rg_kv_set_string(rg_kvstore_t *kv, const char *ns, const char *key, const char *value)
+{
+    rg_kv_entry_t *entry = get_entry(kv, ns, key);
+    return entry && set_value(kv, entry, RG_KV_STRING, 0, value ? value : "");
+}
+
+// Iterates over all entries, *iterator must start at 0
+const rg_kv_entry_t *rg_kv_next(const rg_kvstore_t *kv, size_t *iterator)
+{
+    while (*iterator < kv->capacity)
+    {
+        const rg_kv_entry_t *entry = &kv->entries[(*iterator)++];
+        if (entry->ns)
+            return entry;
+    }
+    return NULL;
+}
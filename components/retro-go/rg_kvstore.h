@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Key-value store backed by an append-only log. Keys live in a namespace ("" being the global
+// namespace), values are int32 or strings. Loading only indexes the namespaces asked for, the
+// others are skipped over. Saving appends the changed entries, the log is rewritten (compacted)
+// only when it has grown well past its live size or when its tail was found damaged.
+// Portable C, it must stay free of esp-idf dependencies.
+
+#define RG_KV_INT32  1
+#define RG_KV_STRING 2
+
+typedef struct
+{
+    char *ns;       // Namespace and key share one allocation
+    char *key;
+    uint32_t hash;
+    uint8_t type;
+    bool dirty;     // Changed since the last flush
+    int32_t value_int;
+    char *value_str;
+} rg_kv_entry_t;
+
+typedef struct
+{
+    rg_kv_entry_t *entries; // Open addressing, capacity is a power of two
+    size_t capacity;
+    size_t count;
+    size_t dirty;
+    char *ns;               // Namespace loaded besides the global one, NULL means all of them
+    size_t log_size;        // Bytes of valid log
+    size_t base_size;       // Size of the log right after its last compaction
+    bool damaged;           // The log has a bad tail, appending to it would lose the new records
+} rg_kvstore_t;
+
+void rg_kv_init(rg_kvstore_t *kv);
+void rg_kv_free(rg_kvstore_t *kv);
+bool rg_kv_load(rg_kvstore_t *kv, FILE *fp, const char *ns);
+bool rg_kv_flush(rg_kvstore_t *kv, FILE *fp);
+bool rg_kv_compact(rg_kvstore_t *kv, FILE *in, FILE *out);
+bool rg_kv_needs_compaction(const rg_kvstore_t *kv);
+
+const rg_kv_entry_t *rg_kv_get(const rg_kvstore_t *kv, const char *ns, const char *key);
+bool rg_kv_set_int32(rg_kvstore_t *kv, const char *ns, const char *key, int32_t value);
+bool rg_kv_set_string(rg_kvstore_t *kv, const char *ns, const char *key, const char *value);
+const rg_kv_entry_t *rg_kv_next(const rg_kvstore_t *kv, size_t *iterator);
@@ -0,0 +1,81 @@
+#include <stddef.h>
+
+#include "rg_mailbox.h"
+
+// Everything the two sides need to agree on lives in a single word so that it can be updated atomically
+#define SHARED_MASK  (0x03) // Slot holding the last posted item
+#define FRONT_SHIFT  (2)    // Slot holding the item the consumer took
+#define FRONT_MASK   (0x03 << FRONT_SHIFT)
+#define FLAG_FRESH   (0x10) // Shared slot hasn't been taken yet
+#define FLAG_BUSY    (0x20) // Consumer hasn't released its item yet
+#define FLAG_SKIPPED (0x40) // At least one item was replaced before being taken
+
+#define SHARED(state) ((state) & SHARED_MASK)
+#define FRONT(state)  (((state) & FRONT_MASK) >> FRONT_SHIFT)
+
+void rg_mailbox_init(rg_mailbox_t *mb)
+{
+    mb->slots[0] = mb->slots[1] = mb->slots[2] = NULL;
+    mb->back = 0;
+    atomic_init(&mb->state, 1 | (2 << FRONT_SHIFT));
+}
+
+// Producer side. Returns the item that got replaced without ever being taken, if any.
+void *rg_mailbox_post(rg_mailbox_t *mb, void *item)
+{
+    unsigned state = atomic_load_explicit(&mb->state, memory_order_relaxed);
+    unsigned new_state;
+
+    mb->slots[mb->back] = item;
+
+    do {
+        new_state = (state & (FRONT_MASK | FLAG_BUSY | FLAG_SKIPPED)) | mb->back | FLAG_FRESH;
+        if (state & FLAG_FRESH)
+            new_state |= FLAG_SKIPPED;
+    } while (!atomic_compare_exchange_weak_explicit(&mb->state, &state, new_state,
+                                                    memory_order_acq_rel, memory_order_relaxed));
+
+    mb->back = SHARED(state);
+
+    return (state & FLAG_FRESH) ? mb->slots[mb->back] : NULL;
+}
+
+// Consumer side. Returns the most recent item, or NULL if nothing new was posted since the last take.
+// The item is considered busy until rg_mailbox_release() is called. *skipped tells if older items
+// were replaced since the last take, meaning the consumer never saw the item posted just before this one.
+void *rg_mailbox_take(rg_mailbox_t *mb, bool *skipped)
+{
+    unsigned state = atomic_load_explicit(&mb->state, memory_order_acquire);
+    unsigned new_state;
+
+    do {
+        if (!(state & FLAG_FRESH))
+            return NULL;
+        new_state = FRONT(state) | (SHARED(state) << FRONT_SHIFT) | FLAG_BUSY;
+    } while (!atomic_compare_exchange_weak_explicit(&mb->state, &state, new_state,
+                                                    memory_order_acq_rel, memory_order_acquire));
+
+    if (skipped)
+        *skipped = (state & FLAG_SKIPPED) != 0;
+
+    return mb->slots[SHARED(state)];
+}
+
+void rg_mailbox_release(rg_mailbox_t *mb)
+{
+    atomic_fetch_and_explicit(&mb->state, ~FLAG_BUSY, memory_order_release);
+}
+
+// Producer side. Tells if an item is waiting to be taken.
+bool rg_mailbox_pending(rg_mailbox_t *mb)
+{
+    return atomic_load_explicit(&mb->state, memory_order_acquire) & FLAG_FRESH;
+}
+
+// Producer side. Tells if the consumer is still using item (or any item if NULL).
+bool rg_mailbox_busy(rg_mailbox_t *mb, const void *item)
+{
+    unsigned state = atomic_load_explicit(&mb->state, memory_order_acquire);
+
+    return (state & FLAG_BUSY) && (!item || mb->slots[FRONT(state)] == item);
+}
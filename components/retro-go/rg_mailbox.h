@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Single producer, single consumer triple buffer of pointers. Posting never blocks: if the consumer
+// hasn't taken the previous item yet it is simply replaced by the newer one. The consumer always
+// gets the most recent item and holds it (busy) until it releases it.
+// Portable C11, it must stay free of esp-idf dependencies.
+
+typedef struct {
+    void *slots[3];
+    atomic_uint state;  // Shared slot, front slot and flags, see rg_mailbox.c
+    unsigned back;      // Only touched by the producer
+} rg_mailbox_t;
+
+void rg_mailbox_init(rg_mailbox_t *mb);
+void *rg_mailbox_post(rg_mailbox_t *mb, void *item);
+void *rg_mailbox_take(rg_mailbox_t *mb, bool *skipped);
+void rg_mailbox_release(rg_mailbox_t *mb);
+bool rg_mailbox_pending(rg_mailbox_t *mb);
+bool rg_mailbox_busy(rg_mailbox_t *mb, const void *item);
@@ -2,146 +2,392 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <freertos/xtensa_context.h>
+#include <soc/soc_memory_layout.h>
+#include <driver/timer.h>
+#include <esp_debug_helpers.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "rg_system.h"
 #include "rg_profiler.h"
 
-// Note this profiler might be inaccurate because of:
-// https://gcc.gnu.org/bugzilla/show_bug.cgi?id=28205
+// Sampling profiler: a timer interrupt records the interrupted PC and a few return addresses
+// into a lock-free ring, a low priority task folds the ring into a hash table of unique stacks.
+// Only the core that called rg_profiler_init() is sampled (the emulator's core).
+// rg_profiler_push/pop additionally time named scopes, they're meant for coarse phases
+// (a frame, a scanline batch) of the emulator task, not for individual small functions.
 
-// We also need to add multi-core support. Currently it's not an issue
-// because all our profiled code runs on the same core.
+#define SAMPLE_RATE       (1000) // Hz
+#define SAMPLE_RING_SIZE  (1024) // Must be a power of two, holds one second worth of samples
+#define STACK_TABLE_SIZE  (2048) // Must be a power of two
+#define SCOPE_TABLE_SIZE  (64)   // Must be a power of two
+#define SCOPE_STACK_DEPTH (16)
 
-static rg_profile_t *profile;
+typedef struct
+{
+    rg_profile_sample_t key;
+    uint32_t count;
+} stack_entry_t;
+
+typedef struct
+{
+    rg_profile_scope_t *scope;
+    int64_t start_time;
+    int64_t child_time;
+} scope_frame_t;
+
+extern void *pxCurrentTCB[portNUM_PROCESSORS];
+extern unsigned port_interruptNesting[portNUM_PROCESSORS];
+
+static rg_profile_sample_t *ring;
+static atomic_uint ring_head; // Only the ISR moves it
+static atomic_uint ring_tail; // Only the collector moves it (with the lock held)
+static stack_entry_t *stacks;
 static SemaphoreHandle_t lock;
+static intr_handle_t timer_handle;
+static int sampled_core = -1;
 static bool enabled = false;
 
-#define LOCK_PROFILE()   xSemaphoreTake(lock, pdMS_TO_TICKS(10000)); // {while(lock);lock=true;}
-#define UNLOCK_PROFILE() xSemaphoreGive(lock);                       // {lock = false;}
+static int64_t time_started;
+static uint32_t total_samples;
+static uint32_t dropped_samples; // Ring full (collector starved) or stack table full
+static uint32_t isr_samples;     // Interrupted code was itself an interrupt handler
+
+static rg_profile_scope_t scopes[SCOPE_TABLE_SIZE];
+static scope_frame_t scope_stack[SCOPE_STACK_DEPTH];
+static volatile int scope_depth = 0;
+static int scope_overflow = 0; // Pushes that didn't fit on the stack, their pops are ignored
+static void *volatile scope_task = NULL; // Task the scope stack belongs to
+static portMUX_TYPE scopes_lock = portMUX_INITIALIZER_UNLOCKED;
+
+
+static inline uint32_t hash_words(const uint32_t *words, size_t count)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < count; ++i)
+        hash = (hash ^ words[i]) * 16777619u;
+    return hash;
+}
+
+// Return addresses carry the caller's window increment in their top two bits
+static inline uint32_t fix_return_address(uint32_t addr)
+{
+    return (addr & 0x80000000) ? ((addr & 0x3FFFFFFF) | 0x40000000) : addr;
+}
 
-NO_PROFILE static inline rg_profile_frame_t *find_frame(void *this_fn, void *call_site)
+static IRAM_ATTR void sample_isr(void *arg)
 {
-    for (int i = 0; i < 512; ++i)
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(4, 1, 0)
+    timer_group_intr_clr_in_isr(TIMER_GROUP_1, TIMER_0);
+#else
+    timer_group_clr_intr_status_in_isr(TIMER_GROUP_1, TIMER_0);
+#endif
+    timer_group_enable_alarm_in_isr(TIMER_GROUP_1, TIMER_0);
+
+    if (!enabled)
+        return;
+
+    int core = xPortGetCoreID();
+    unsigned head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+
+    if (head - tail >= SAMPLE_RING_SIZE)
+    {
+        dropped_samples++;
+        return;
+    }
+
+    rg_profile_sample_t *sample = &ring[head & (SAMPLE_RING_SIZE - 1)];
+    memset(sample, 0, sizeof(*sample));
+
+    // Our own level is 1, anything above means we preempted another handler and the task's
+    // saved context is stale. Those samples are only counted.
+    if (port_interruptNesting[core] > 1)
+    {
+        isr_samples++;
+    }
+    else
     {
-        rg_profile_frame_t *frame = &profile->frames[i];
+        void *task = pxCurrentTCB[core];
+        XtExcFrame *frame = *(XtExcFrame **)task; // pxTopOfStack is the first member of the TCB
+        esp_backtrace_frame_t bt = {.pc = frame->pc, .sp = frame->a1, .next_pc = frame->a0};
 
-        if (frame->func_ptr == 0)
+        if (task == scope_task && scope_depth > 0 && scope_depth <= SCOPE_STACK_DEPTH)
+            sample->scope = scope_stack[scope_depth - 1].scope->name;
+
+        sample->pc[0] = bt.pc;
+        for (int i = 1; i < RG_PROFILER_DEPTH; ++i)
         {
-            profile->total_frames = RG_MAX(profile->total_frames, i + 1);
-            frame->func_ptr = this_fn;
-            // frame->caller_ptr = call_site;
+            if (!bt.next_pc || !esp_stack_ptr_is_sane(bt.sp) || !esp_backtrace_get_next_frame(&bt))
+                break;
+            sample->pc[i] = fix_return_address(bt.pc);
         }
+    }
+
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+// Must be called with the lock held
+static void collect_samples(void)
+{
+    unsigned head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    unsigned tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
 
-        if (frame->func_ptr == this_fn) // && frame->caller_ptr == call_site)
+    for (; tail != head; ++tail)
+    {
+        const rg_profile_sample_t *sample = &ring[tail & (SAMPLE_RING_SIZE - 1)];
+        uint32_t hash = hash_words((const uint32_t *)sample, sizeof(*sample) / 4);
+
+        total_samples++;
+
+        for (int probe = 0; probe < STACK_TABLE_SIZE; ++probe)
         {
-            return frame;
+            stack_entry_t *entry = &stacks[(hash + probe) & (STACK_TABLE_SIZE - 1)];
+            if (entry->count == 0)
+            {
+                entry->key = *sample;
+                entry->count = 1;
+                break;
+            }
+            if (memcmp(&entry->key, sample, sizeof(*sample)) == 0)
+            {
+                entry->count++;
+                break;
+            }
+            if (probe == STACK_TABLE_SIZE - 1)
+                dropped_samples++;
         }
     }
 
-    RG_PANIC("Profile memory exhausted!");
+    atomic_store_explicit(&ring_tail, tail, memory_order_release);
+}
+
+static void collector_task(void *arg)
+{
+    while (1)
+    {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        collect_samples();
+        xSemaphoreGive(lock);
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+}
+
+static bool start_timer(void)
+{
+    timer_config_t config = {
+        .alarm_en = TIMER_ALARM_EN,
+        .counter_en = TIMER_PAUSE,
+        .intr_type = TIMER_INTR_LEVEL,
+        .counter_dir = TIMER_COUNT_UP,
+        .auto_reload = TIMER_AUTORELOAD_EN,
+        .divider = 80, // 1MHz
+    };
+
+    // The interrupt is allocated on the calling core. It isn't flagged ESP_INTR_FLAG_IRAM
+    // because the ring lives in PSRAM, samples are simply skipped while the cache is disabled.
+    if (timer_init(TIMER_GROUP_1, TIMER_0, &config) != ESP_OK
+        || timer_set_counter_value(TIMER_GROUP_1, TIMER_0, 0) != ESP_OK
+        || timer_set_alarm_value(TIMER_GROUP_1, TIMER_0, 1000000 / SAMPLE_RATE) != ESP_OK
+        || timer_enable_intr(TIMER_GROUP_1, TIMER_0) != ESP_OK
+        || timer_isr_register(TIMER_GROUP_1, TIMER_0, &sample_isr, NULL, 0, &timer_handle) != ESP_OK
+        || timer_start(TIMER_GROUP_1, TIMER_0) != ESP_OK)
+    {
+        return false;
+    }
+
+    return true;
 }
 
-NO_PROFILE void rg_profiler_init(void)
+void rg_profiler_init(void)
 {
-    profile = rg_alloc(sizeof(rg_profile_t), MEM_SLOW);
+    if (ring)
+        return;
+
+    ring = rg_alloc(SAMPLE_RING_SIZE * sizeof(rg_profile_sample_t), MEM_SLOW);
+    stacks = rg_alloc(STACK_TABLE_SIZE * sizeof(stack_entry_t), MEM_SLOW);
     lock = xSemaphoreCreateMutex();
-    RG_LOGI("init done.\n");
+    sampled_core = xPortGetCoreID();
+
+    if (!start_timer())
+    {
+        RG_LOGE("Failed to start the sampling timer!\n");
+        return;
+    }
+
+    // The collector shares the core so that it never races the ISR through the PSRAM cache
+    xTaskCreatePinnedToCore(&collector_task, "profiler", 2048, NULL, 1, NULL, sampled_core);
+
+    RG_LOGI("init done. Sampling core %d at %dHz.\n", sampled_core, SAMPLE_RATE);
+}
+
+void rg_profiler_free(void)
+{
+    // The profiler lives as long as the application, there is nothing to gain from tearing it down
 }
 
-NO_PROFILE void rg_profiler_start(void)
+void rg_profiler_start(void)
 {
-    LOCK_PROFILE();
+    if (!ring)
+        return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    atomic_store(&ring_tail, atomic_load(&ring_head));
+    memset(stacks, 0, STACK_TABLE_SIZE * sizeof(stack_entry_t));
+    total_samples = dropped_samples = isr_samples = 0;
+
+    portENTER_CRITICAL(&scopes_lock);
+    for (int i = 0; i < SCOPE_TABLE_SIZE; ++i)
+    {
+        scopes[i].calls = 0;
+        scopes[i].total_time = 0;
+        scopes[i].self_time = 0;
+        scopes[i].max_time = 0;
+    }
+    portEXIT_CRITICAL(&scopes_lock);
 
-    memset(profile, 0, sizeof(rg_profile_t));
-    profile->time_started = get_elapsed_time();
+    time_started = get_elapsed_time();
     enabled = true;
 
-    UNLOCK_PROFILE();
+    xSemaphoreGive(lock);
 }
 
-NO_PROFILE void rg_profiler_stop(void)
+void rg_profiler_stop(void)
 {
     enabled = false;
 }
 
-NO_PROFILE void rg_profiler_print(void)
+// The stacks are printed root first, ready to be folded into a flame graph by rg_tool.py
+void rg_profiler_print(void)
 {
-    if (!profile)
+    if (!ring)
         return;
 
-    LOCK_PROFILE();
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    collect_samples();
 
-    printf("RGD:PROF:BEGIN %d %lld\n", profile->total_frames, get_elapsed_time_since(profile->time_started));
+    printf("RGD:PROF:BEGIN %u %lld %u %u\n", total_samples, get_elapsed_time_since(time_started),
+           dropped_samples, isr_samples);
 
-    for (int i = 0; i < profile->total_frames; ++i)
+    for (int i = 0; i < STACK_TABLE_SIZE; ++i)
     {
-        rg_profile_frame_t *frame = &profile->frames[i];
-
-        printf(
-            "RGD:PROF:DATA %p\t%p\t%u\t%u\n",
-            frame->caller_ptr,
-            frame->func_ptr,
-            frame->num_calls,
-            frame->run_time
-        );
+        const stack_entry_t *entry = &stacks[i];
+        if (entry->count == 0)
+            continue;
+
+        printf("RGD:PROF:STACK %s", entry->key.scope ? entry->key.scope : "-");
+        for (int j = RG_PROFILER_DEPTH - 1; j >= 0; --j)
+        {
+            if (entry->key.pc[j])
+                printf(";0x%08x", entry->key.pc[j]);
+        }
+        printf(" %u\n", entry->count);
     }
 
-    printf("RGD:PROF:END\n");
+    rg_profile_scope_t snapshot[SCOPE_TABLE_SIZE];
+    portENTER_CRITICAL(&scopes_lock);
+    memcpy(snapshot, scopes, sizeof(snapshot));
+    portEXIT_CRITICAL(&scopes_lock);
 
-    UNLOCK_PROFILE();
-}
+    for (int i = 0; i < SCOPE_TABLE_SIZE; ++i)
+    {
+        const rg_profile_scope_t *scope = &snapshot[i];
+        if (scope->calls == 0)
+            continue;
 
-NO_PROFILE void rg_profiler_push(char *section_name)
-{
+        printf("RGD:PROF:SCOPE %s %u %lld %lld %lld\n", scope->name, scope->calls,
+               scope->total_time, scope->self_time, scope->max_time);
+    }
+
+    printf("RGD:PROF:END\n");
 
+    xSemaphoreGive(lock);
 }
 
-NO_PROFILE void rg_profiler_pop(void)
+// Scopes are identified by name, the pointer is compared first so string literals are cheap
+static rg_profile_scope_t *find_scope(const char *name)
 {
+    uint32_t hash = ((uintptr_t)name >> 2) * 2654435761u;
 
+    for (int probe = 0; probe < SCOPE_TABLE_SIZE; ++probe)
+    {
+        rg_profile_scope_t *scope = &scopes[(hash + probe) & (SCOPE_TABLE_SIZE - 1)];
+        if (scope->name == name)
+            return scope;
+        if (scope->name == NULL)
+        {
+            scope->name = name;
+            return scope;
+        }
+    }
+
+    return NULL;
 }
 
-NO_PROFILE void __cyg_profile_func_enter(void *this_fn, void *call_site)
+void rg_profiler_push(const char *scope_name)
 {
-    if (!enabled)
-        return;
-
     int64_t now = get_elapsed_time();
+    void *task = xTaskGetCurrentTaskHandle();
 
-    LOCK_PROFILE();
-
-    rg_profile_frame_t *fn = find_frame(this_fn, call_site);
+    portENTER_CRITICAL(&scopes_lock);
 
-    // Recursion will need a real stack, this is absurd
-    if (fn->enter_time != 0)
-        fn->run_time += now - fn->enter_time;
+    // Scopes are tracked for a single task, the first one to push
+    if (scope_depth == 0)
+        scope_task = task;
 
-    fn->enter_time = get_elapsed_time(); // not now, because we delayed execution
-    fn->num_calls++;
+    if (task == scope_task)
+    {
+        rg_profile_scope_t *scope = find_scope(scope_name);
+        if (scope && scope_depth < SCOPE_STACK_DEPTH && scope_overflow == 0)
+        {
+            scope_stack[scope_depth] = (scope_frame_t){scope, now, 0};
+            scope->depth++;
+            scope_depth++;
+        }
+        else
+        {
+            scope_overflow++;
+        }
+    }
 
-    UNLOCK_PROFILE();
+    portEXIT_CRITICAL(&scopes_lock);
 }
 
-NO_PROFILE void __cyg_profile_func_exit(void *this_fn, void *call_site)
+void rg_profiler_pop(void)
 {
-    if (!enabled)
-        return;
-
     int64_t now = get_elapsed_time();
+    void *task = xTaskGetCurrentTaskHandle();
 
-    LOCK_PROFILE();
+    portENTER_CRITICAL(&scopes_lock);
 
-    rg_profile_frame_t *fn = find_frame(this_fn, call_site);
+    if (task == scope_task && scope_overflow > 0)
+    {
+        scope_overflow--;
+    }
+    else if (task == scope_task && scope_depth > 0)
+    {
+        scope_frame_t *frame = &scope_stack[--scope_depth];
+        rg_profile_scope_t *scope = frame->scope;
+        int64_t elapsed = now - frame->start_time;
 
-    // Ignore if profiler was disabled when function entered
-    if (fn->enter_time != 0)
-        fn->run_time += now - fn->enter_time;
+        scope->calls++;
+        scope->self_time += elapsed - frame->child_time;
+        if (--scope->depth == 0)
+        {
+            scope->total_time += elapsed;
+            scope->max_time = RG_MAX(scope->max_time, elapsed);
+        }
 
-    fn->enter_time = 0;
+        if (scope_depth > 0)
+            scope_stack[scope_depth - 1].child_time += elapsed;
+    }
 
-    UNLOCK_PROFILE();
+    portEXIT_CRITICAL(&scopes_lock);
 }
 
 #endif
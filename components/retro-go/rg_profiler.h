@@ -3,23 +3,23 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#define RG_PROFILER_DEPTH 6 // Call frames recorded per sample, innermost first
+
 typedef struct
 {
-    void *func_ptr;
-    void *caller_ptr;
-    uint32_t enter_time;
-    uint32_t num_calls;
-    uint32_t run_time;
-} rg_profile_frame_t;
+    const char *scope;  // Innermost rg_profiler_push() scope active when the sample was taken
+    uint32_t pc[RG_PROFILER_DEPTH];
+} rg_profile_sample_t;
 
 typedef struct
 {
-    int64_t time_started;
-    int64_t time_stopped;
-    int32_t total_frames;
-    int32_t locked;
-    rg_profile_frame_t frames[512];
-} rg_profile_t;
+    const char *name;
+    uint32_t calls;
+    uint32_t depth;     // Current recursion level, only the outermost level is timed
+    int64_t total_time; // Inclusive
+    int64_t self_time;  // Exclusive of nested scopes
+    int64_t max_time;
+} rg_profile_scope_t;
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,14 +30,12 @@ void rg_profiler_free(void);
 void rg_profiler_start(void);
 void rg_profiler_stop(void);
 void rg_profiler_print(void);
-void rg_profiler_push(char *section_name);
+void rg_profiler_push(const char *scope_name);
 void rg_profiler_pop(void);
 
-void __cyg_profile_func_enter(void *this_fn, void *call_site);
-void __cyg_profile_func_exit(void *this_fn, void *call_site);
-
 #ifdef __cplusplus
 }
 #endif
 
+// Kept for source compatibility, the profiler no longer relies on -finstrument-functions
 #define NO_PROFILE __attribute((no_instrument_function))
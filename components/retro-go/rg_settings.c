@@ -5,11 +5,18 @@
 
 #include "rg_system.h"
 #include "rg_settings.h"
-
-#define CONFIG_FILE_PATH RG_BASE_PATH_CONFIG "/retro-go.json"
-#define CONFIG_NAMESPACE "retro-go"
-#define CONFIG_NVS_STORE "config"
+#include "rg_kvstore.h"
+
+// The settings live in an append-only key-value log (see rg_kvstore.c), only the global keys and
+// the current app's keys are loaded. retro-go.json is imported on first boot and exported whenever
+// the log is compacted, so that it stays usable by external tools.
+#define CONFIG_FILE_PATH  RG_BASE_PATH_CONFIG "/retro-go.json"
+#define CONFIG_STORE_PATH RG_BASE_PATH_CONFIG "/retro-go.kv"
+#define CONFIG_STORE_TEMP RG_BASE_PATH_CONFIG "/retro-go.kv.new"
+#define CONFIG_NAMESPACE  "retro-go"
+#define CONFIG_NVS_STORE  "config.kv"
 #define CONFIG_VERSION    0x01
+#define GLOBAL_NAMESPACE  ""
 
 #if RG_SETTINGS_USE_NVS
     #include <esp_err.h>
@@ -17,51 +24,158 @@
     static nvs_handle my_handle = 0;
 #endif
 
-static int unsaved_changes = 0;
-static cJSON *root = NULL;
-static cJSON *app_root = NULL;
+static rg_kvstore_t store;
+static char *app_namespace = NULL;
+static bool ready = false;
+
 
+#if RG_SETTINGS_USE_NVS
+// The log is kept in a single blob, every save is a compaction
+static void *nvs_blob = NULL;
+static size_t nvs_blob_size = 0;
 
-static cJSON *json_get(cJSON *root, const char *key)
+static FILE *open_store(void)
 {
-    if (!root)
-    {
-        RG_LOGW("Trying to get key '%s' before rg_settings_init() was called!\n", key);
+    free(nvs_blob);
+    nvs_blob = NULL;
+    nvs_blob_size = 0;
+
+    if (nvs_get_blob(my_handle, CONFIG_NVS_STORE, NULL, &nvs_blob_size) != ESP_OK || nvs_blob_size == 0)
+        return NULL;
+
+    nvs_blob = malloc(nvs_blob_size);
+    if (!nvs_blob || nvs_get_blob(my_handle, CONFIG_NVS_STORE, nvs_blob, &nvs_blob_size) != ESP_OK)
         return NULL;
+
+    return fmemopen(nvs_blob, nvs_blob_size, "rb");
+}
+
+static bool write_store(rg_kvstore_t *kv)
+{
+    char *buffer = NULL;
+    size_t length = 0;
+    FILE *in = open_store();
+    FILE *out = open_memstream(&buffer, &length);
+    bool success = out && rg_kv_compact(kv, in, out);
+
+    if (in)
+        fclose(in);
+    if (out)
+        fclose(out);
+
+    success = success && nvs_set_blob(my_handle, CONFIG_NVS_STORE, buffer, length) == ESP_OK
+                      && nvs_commit(my_handle) == ESP_OK;
+    free(buffer);
+
+    return success;
+}
+#else
+static FILE *open_store(void)
+{
+    FILE *fp = fopen(CONFIG_STORE_PATH, "rb");
+
+    // A compaction was interrupted after the old log was removed, the new one is complete
+    if (!fp && access(CONFIG_STORE_TEMP, F_OK) == 0)
+    {
+        rename(CONFIG_STORE_TEMP, CONFIG_STORE_PATH);
+        fp = fopen(CONFIG_STORE_PATH, "rb");
     }
 
-    return cJSON_GetObjectItem(root, key);
+    return fp;
 }
 
-static void json_set(cJSON *root, const char *key, cJSON *value)
+static bool write_store(rg_kvstore_t *kv)
 {
-    if (!root)
+    FILE *in = open_store();
+    FILE *out = fopen(CONFIG_STORE_TEMP, "wb");
+    bool success = out && rg_kv_compact(kv, in, out);
+
+    if (in)
+        fclose(in);
+    if (out)
+        fclose(out);
+
+    if (success)
     {
-        RG_LOGW("Trying to set key '%s' before rg_settings_init() was called!\n", key);
-        return;
+        unlink(CONFIG_STORE_PATH);
+        success = rename(CONFIG_STORE_TEMP, CONFIG_STORE_PATH) == 0;
     }
 
-    cJSON *obj = cJSON_GetObjectItem(root, key);
+    return success;
+}
+#endif
+
+static bool import_json(const char *filename)
+{
+    rg_kvstore_t imported;
+    cJSON *root = NULL;
+    cJSON *item, *child;
 
-    if (obj == NULL)
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return false;
+
+    fseek(fp, 0, SEEK_END);
+    size_t length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *buffer = calloc(1, length + 1);
+    if (buffer && fread(buffer, 1, length, fp) == length)
+        root = cJSON_Parse(buffer);
+    free(buffer);
+    fclose(fp);
+
+    if (!root)
     {
-        cJSON_AddItemToObject(root, key, value);
-        unsaved_changes++;
+        RG_LOGE("Failed to parse '%s'.\n", filename);
+        return false;
     }
-    else if (cJSON_Compare(obj, value, 0) == false)
+
+    rg_kv_init(&imported);
+
+    cJSON_ArrayForEach(item, root)
     {
-        // cJSON_ReplaceItemViaPointer(root, obj, value);
-        cJSON_ReplaceItemInObject(root, key, value);
-        unsaved_changes++;
+        if (cJSON_IsNumber(item))
+            rg_kv_set_int32(&imported, GLOBAL_NAMESPACE, item->string, item->valueint);
+        else if (cJSON_IsString(item))
+            rg_kv_set_string(&imported, GLOBAL_NAMESPACE, item->string, item->valuestring);
+        else if (cJSON_IsObject(item))
+        {
+            cJSON_ArrayForEach(child, item)
+            {
+                if (cJSON_IsNumber(child))
+                    rg_kv_set_int32(&imported, item->string, child->string, child->valueint);
+                else if (cJSON_IsString(child))
+                    rg_kv_set_string(&imported, item->string, child->string, child->valuestring);
+            }
+        }
     }
+
+    cJSON_Delete(root);
+
+    bool success = write_store(&imported);
+    RG_LOGI("Imported %d keys from '%s'.\n", (int)imported.count, filename);
+    rg_kv_free(&imported);
+
+    return success;
 }
 
+static void load_store(void)
+{
+    FILE *fp = open_store();
+
+    if (!rg_kv_load(&store, fp, app_namespace))
+        RG_LOGE("Out of memory while loading settings!\n");
+
+    if (fp)
+        fclose(fp);
+
+    if (store.damaged)
+        RG_LOGW("Settings store is damaged, it will be rebuilt on the next save.\n");
+}
 
 void rg_settings_init(const char *app_name)
 {
-    char *buffer = NULL;
-    const char *source;
-    size_t length = 0;
+    const char *source = "sdcard";
 
 #if RG_SETTINGS_USE_NVS
     if (nvs_flash_init() != ESP_OK)
@@ -69,163 +183,215 @@ void rg_settings_init(const char *app_name)
         nvs_flash_erase();
         nvs_flash_init();
     }
-    if (nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &my_handle) == ESP_OK)
-    {
-        if (nvs_get_str(my_handle, CONFIG_NVS_STORE, NULL, &length) == ESP_OK)
-        {
-            buffer = calloc(1, length + 1);
-            nvs_get_str(my_handle, CONFIG_NVS_STORE, buffer, &length);
-        }
-    }
+    nvs_open(CONFIG_NAMESPACE, NVS_READWRITE, &my_handle);
     source = "NVS";
-#else
-    FILE *fp = fopen(CONFIG_FILE_PATH, "rb");
-    if (fp)
-    {
-        fseek(fp, 0, SEEK_END);
-        length = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
-        buffer = calloc(1, length + 1);
-        fread(buffer, 1, length, fp);
-        fclose(fp);
-    }
-    source = "sdcard";
 #endif
 
-    if (buffer)
-    {
-        root = cJSON_Parse(buffer);
-        free(buffer);
-    }
+    rg_kv_init(&store);
+    app_namespace = strdup(app_name ? app_name : "__app__");
 
-    if (root)
-    {
-        RG_LOGI("Settings ready. source=%s\n", source);
-    }
-    else
-    {
-        RG_LOGE("Failed to initialize settings. source=%s!\n", source);
-        root = cJSON_CreateObject();
-    }
+    FILE *fp = open_store();
+    if (fp)
+        fclose(fp);
+    else if (access(CONFIG_FILE_PATH, F_OK) == 0)
+        import_json(CONFIG_FILE_PATH);
 
-    rg_settings_set_app_name(app_name);
+    load_store();
+    ready = true;
 
-    json_set(root, "version", cJSON_CreateNumber(CONFIG_VERSION));
+    RG_LOGI("Settings ready. source=%s, keys=%d, log=%d bytes\n", source, (int)store.count, (int)store.log_size);
+
+    rg_settings_set_int32("version", CONFIG_VERSION);
 }
 
 void rg_settings_set_app_name(const char *app_name)
 {
     app_name = app_name ? app_name : "__app__";
-    app_root = cJSON_GetObjectItem(root, app_name);
 
-    if (!app_root)
+    if (app_namespace && strcmp(app_namespace, app_name) == 0)
+        return;
+
+    // Pending changes would be lost by the reload
+    rg_settings_save();
+
+    free(app_namespace);
+    app_namespace = strdup(app_name);
+    load_store();
+}
+
+bool rg_settings_save(void)
+{
+    if (!ready)
+        return false;
+
+    if (store.dirty == 0)
+        return true;
+
+#if RG_SETTINGS_USE_NVS
+    return write_store(&store);
+#else
+    if (!rg_kv_needs_compaction(&store))
     {
-        app_root = cJSON_AddObjectToObject(root, app_name);
+        FILE *fp = fopen(CONFIG_STORE_PATH, "ab");
+        bool success = fp && rg_kv_flush(&store, fp);
+        if (fp)
+            fclose(fp);
+        if (success)
+            return true;
+        // A failed append leaves the log in an unknown state, compacting will fix it
+        RG_LOGW("Append failed, compacting.\n");
     }
-    else if (!cJSON_IsObject(app_root))
+
+    if (!write_store(&store))
     {
-        app_root = cJSON_CreateObject();
-        cJSON_ReplaceItemInObject(root, app_name, app_root);
+        RG_LOGE("Failed to write the settings store.\n");
+        return false;
     }
+
+    rg_settings_export(CONFIG_FILE_PATH);
+    return true;
+#endif
 }
 
-bool rg_settings_save(void)
+// Writes every namespace, not just the loaded ones, in the legacy JSON format
+bool rg_settings_export(const char *filename)
 {
-    if (unsaved_changes == 0)
-        return true;
+    rg_kvstore_t full;
+    const rg_kv_entry_t *entry;
+    size_t iterator = 0;
+
+    rg_settings_save();
+
+    FILE *fp = open_store();
+    rg_kv_init(&full);
+    bool loaded = rg_kv_load(&full, fp, NULL);
+    if (fp)
+        fclose(fp);
+
+    cJSON *root = cJSON_CreateObject();
+
+    while (loaded && (entry = rg_kv_next(&full, &iterator)))
+    {
+        cJSON *parent = root;
+        if (entry->ns[0])
+        {
+            parent = cJSON_GetObjectItem(root, entry->ns);
+            if (!parent)
+                parent = cJSON_AddObjectToObject(root, entry->ns);
+        }
+        if (entry->type == RG_KV_INT32)
+            cJSON_AddNumberToObject(parent, entry->key, entry->value_int);
+        else if (entry->type == RG_KV_STRING)
+            cJSON_AddStringToObject(parent, entry->key, entry->value_str);
+    }
+
+    rg_kv_free(&full);
+
+    char *buffer = loaded ? cJSON_Print(root) : NULL;
+    cJSON_Delete(root);
 
-    char *buffer = cJSON_Print(root);
     if (!buffer)
     {
         RG_LOGE("cJSON_Print() failed.\n");
         return false;
     }
 
-#if RG_SETTINGS_USE_NVS
-    if (nvs_set_str(my_handle, CONFIG_NVS_STORE, buffer) == ESP_OK
-        && nvs_commit(my_handle) == ESP_OK) unsaved_changes = 0;
-#else
-    FILE *fp = fopen(CONFIG_FILE_PATH, "wb");
-    if (!fp)
-    {
-        // Sometimes the FAT is left in an inconsistent state and this might help
-        unlink(CONFIG_FILE_PATH);
-        fp = fopen(CONFIG_FILE_PATH, "wb");
-    }
+    bool success = false;
+    fp = fopen(filename, "wb");
     if (fp)
     {
-        if (fputs(buffer, fp) > 0)
-            unsaved_changes = 0;
+        success = fputs(buffer, fp) > 0;
         fclose(fp);
     }
-#endif
-
     cJSON_free(buffer);
 
-    return (unsaved_changes == 0);
+    return success;
 }
 
 void rg_settings_reset(void)
 {
-    cJSON_Delete(root);
-    root = cJSON_CreateObject();
-    unsaved_changes++;
-    rg_settings_save();
+#if RG_SETTINGS_USE_NVS
+    nvs_erase_key(my_handle, CONFIG_NVS_STORE);
+    nvs_commit(my_handle);
+#else
+    unlink(CONFIG_STORE_PATH);
+    unlink(CONFIG_STORE_TEMP);
+#endif
+    // The JSON would otherwise be imported again on the next boot
+    unlink(CONFIG_FILE_PATH);
+
+    load_store();
 }
 
 bool rg_settings_ready(void)
 {
-    return root != NULL;
+    return ready;
+}
+
+static const rg_kv_entry_t *get_entry(const char *ns, const char *key, int type)
+{
+    if (!ready)
+    {
+        RG_LOGW("Trying to get key '%s' before rg_settings_init() was called!\n", key);
+        return NULL;
+    }
+
+    const rg_kv_entry_t *entry = rg_kv_get(&store, ns, key);
+    return (entry && entry->type == type) ? entry : NULL;
 }
 
 int32_t rg_settings_get_int32(const char *key, int32_t default_value)
 {
-    cJSON *obj = json_get(root, key);
-    return obj ? obj->valueint : default_value;
+    const rg_kv_entry_t *entry = get_entry(GLOBAL_NAMESPACE, key, RG_KV_INT32);
+    return entry ? entry->value_int : default_value;
 }
 
 void rg_settings_set_int32(const char *key, int32_t value)
 {
-    json_set(root, key, cJSON_CreateNumber(value));
+    if (ready)
+        rg_kv_set_int32(&store, GLOBAL_NAMESPACE, key, value);
 }
 
 char *rg_settings_get_string(const char *key, const char *default_value)
 {
-    cJSON *obj = json_get(root, key);
+    const rg_kv_entry_t *entry = get_entry(GLOBAL_NAMESPACE, key, RG_KV_STRING);
 
-    if (obj && obj->valuestring)
-        return strdup(obj->valuestring);
+    if (entry)
+        return strdup(entry->value_str);
 
     return default_value ? strdup(default_value) : NULL;
 }
 
 void rg_settings_set_string(const char *key, const char *value)
 {
-    json_set(root, key, cJSON_CreateString(value));
+    if (ready)
+        rg_kv_set_string(&store, GLOBAL_NAMESPACE, key, value);
 }
 
 int32_t rg_settings_get_app_int32(const char *key, int32_t default_value)
 {
-    cJSON *obj = json_get(app_root, key);
-    return obj ? obj->valueint : default_value;
+    const rg_kv_entry_t *entry = get_entry(app_namespace, key, RG_KV_INT32);
+    return entry ? entry->value_int : default_value;
 }
 
 void rg_settings_set_app_int32(const char *key, int32_t value)
 {
-    json_set(app_root, key, cJSON_CreateNumber(value));
+    if (ready)
+        rg_kv_set_int32(&store, app_namespace, key, value);
 }
 
 char *rg_settings_get_app_string(const char *key, const char *default_value)
 {
-    cJSON *obj = json_get(app_root, key);
+    const rg_kv_entry_t *entry = get_entry(app_namespace, key, RG_KV_STRING);
 
-    if (obj && obj->valuestring)
-        return strdup(obj->valuestring);
+    if (entry)
+        return strdup(entry->value_str);
 
     return default_value ? strdup(default_value) : NULL;
 }
 
 void rg_settings_set_app_string(const char *key, const char *value)
 {
-    json_set(app_root, key, cJSON_CreateString(value));
+    if (ready)
+        rg_kv_set_string(&store, app_namespace, key, value);
 }
@@ -7,6 +7,7 @@ void rg_settings_init(const char *app_name);
 void rg_settings_reset(void);
 bool rg_settings_load(void);
 bool rg_settings_save(void);
+bool rg_settings_export(const char *filename);
 bool rg_settings_ready(void);
 void rg_settings_set_app_name(const char *app_name);
 
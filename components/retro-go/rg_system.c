@@ -7,9 +7,11 @@
 #include <esp_event.h>
 #include <esp_sleep.h>
 #include <driver/gpio.h>
+#include <xtensa/hal.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <assert.h>
 #include <string.h>
 
@@ -51,6 +53,17 @@ static int inputTimeout = -1;
 static int ledValue = 0;
 static bool initialized = false;
 
+// Phases are timed with the cycle counter, it's much cheaper than esp_timer and some are marked per scanline
+#define PHASE_CYCLES_PER_US CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+
+static atomic_uint phaseCycles[RG_PHASE_COUNT]; // Accumulated during the current frame
+static uint32_t phaseHistory[RG_PHASE_HISTORY][RG_PHASE_COUNT]; // Microseconds per frame, a ring
+static uint32_t phaseFrames = 0;
+static rg_phase_t phaseCurrent = RG_PHASE_NONE;
+static uint32_t phaseStart = 0;
+static bool timingOverlay = false;
+static portMUX_TYPE statsLock = portMUX_INITIALIZER_UNLOCKED; // statistics.phases is read by other tasks
+
 
 static const char *htime(time_t ts)
 {
@@ -86,9 +99,65 @@ IRAM_ATTR void esp_panic_putchar_hook(char c)
     logbuf_print(&panicTrace.log, (char[2]){c, 0});
 }
 
+static int compare_uint32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void update_phase_stats(void)
+{
+    uint32_t values[RG_PHASE_HISTORY];
+    size_t count = RG_MIN(phaseFrames, RG_PHASE_HISTORY);
+    typeof(statistics.phases) phases = {0};
+
+    for (int phase = 0; phase < RG_PHASE_COUNT && count > 0; ++phase)
+    {
+        uint64_t total = 0;
+
+        // The emulator keeps writing while we copy, we might get a few values from the next frame
+        for (size_t i = 0; i < count; ++i)
+        {
+            values[i] = phaseHistory[i][phase];
+            total += values[i];
+        }
+
+        qsort(values, count, sizeof(uint32_t), compare_uint32);
+
+        phases[phase].min = values[0];
+        phases[phase].avg = total / count;
+        phases[phase].p99 = values[RG_MIN(count * 99 / 100, count - 1)];
+    }
+
+    portENTER_CRITICAL(&statsLock);
+    memcpy(statistics.phases, phases, sizeof(phases));
+    portEXIT_CRITICAL(&statsLock);
+}
+
+static void update_timing_overlay(void)
+{
+    const rg_stats_t stats = rg_system_get_stats();
+    const char *format = "%s E%.1f R%.1f D%.1f W%.1f T%.1f A%.1f";
+    char text[128];
+    int len = 0;
+
+    #define PHASES(x) stats.phases[RG_PHASE_EMULATE].x / 1000.f, stats.phases[RG_PHASE_RENDER].x / 1000.f, \
+        stats.phases[RG_PHASE_DIFF].x / 1000.f, stats.phases[RG_PHASE_WAIT].x / 1000.f, \
+        stats.phases[RG_PHASE_TRANSFER].x / 1000.f, stats.phases[RG_PHASE_AUDIO].x / 1000.f
+    len += snprintf(text + len, sizeof(text) - len, format, "avg", PHASES(avg));
+    len += snprintf(text + len, sizeof(text) - len, "\n");
+    len += snprintf(text + len, sizeof(text) - len, format, "p99", PHASES(p99));
+    #undef PHASES
+
+    // The display task draws it after its frame transfers, the stats are only refreshed every
+    // second anyway. It outlives the next refresh so that it doesn't blink.
+    rg_display_show_info(text, 2500);
+}
+
 static void system_monitor_task(void *arg)
 {
     rg_counters_t current = {0};
+    rg_display_t display_prev = {0};
     multi_heap_info_t heap_info = {0};
     time_t lastTime = time(NULL);
     bool ledState = false;
@@ -107,7 +176,7 @@ static void system_monitor_task(void *arg)
         // Make a copy and reset counters immediately because processing could take 1-2ms
         current = counters;
         counters.totalFrames = counters.fullFrames = 0;
-        counters.skippedFrames = counters.busyTime = 0;
+        counters.skippedFrames = counters.droppedFrames = counters.busyTime = 0;
         counters.resetTime = get_elapsed_time();
 
         rg_input_read_battery(&statistics.batteryPercent, &statistics.batteryVoltage);
@@ -116,6 +185,10 @@ static void system_monitor_task(void *arg)
         statistics.skippedFPS = current.skippedFrames / (tickTime / 1000000.f);
         statistics.totalFPS = current.totalFrames / (tickTime / 1000000.f);
         statistics.freeStackMain = uxTaskGetStackHighWaterMark(app.mainTaskHandle);
+        update_phase_stats();
+
+        if (timingOverlay && current.totalFrames > 0)
+            update_timing_overlay();
 
         heap_caps_get_info(&heap_info, MALLOC_CAP_INTERNAL|MALLOC_CAP_8BIT);
         statistics.freeMemoryInt = heap_info.total_free_bytes;
@@ -136,7 +209,7 @@ static void system_monitor_task(void *arg)
             rg_system_set_led(ledState);
         }
 
-        RG_LOGX("STACK:%d, HEAP:%d+%d (%d+%d), BUSY:%.2f, FPS:%.2f (SKIP:%d, PART:%d, FULL:%d), BATT:%.2f\n",
+        RG_LOGX("STACK:%d, HEAP:%d+%d (%d+%d), BUSY:%.2f, FPS:%.2f (SKIP:%d, PART:%d, FULL:%d, DROP:%d), BATT:%.2f\n",
             statistics.freeStackMain,
             statistics.freeMemoryInt / 1024,
             statistics.freeMemoryExt / 1024,
@@ -147,8 +220,36 @@ static void system_monitor_task(void *arg)
             current.skippedFrames,
             current.totalFrames - current.fullFrames - current.skippedFrames,
             current.fullFrames,
+            current.droppedFrames,
             statistics.batteryPercent);
 
+        const rg_display_t *display = rg_display_get_status();
+        int frames = RG_MAX(display->counters.totalFrames - display_prev.counters.totalFrames, 1);
+
+        RG_LOGX("SPI per frame: TRANS:%d, BYTES:%d, WINDOWS:%d, WAIT:%dus\n",
+            (display->counters.spiTransactions - display_prev.counters.spiTransactions) / frames,
+            (display->counters.spiBytes - display_prev.counters.spiBytes) / frames,
+            (display->counters.spiWindows - display_prev.counters.spiWindows) / frames,
+            (display->counters.spiWaitTime - display_prev.counters.spiWaitTime) / frames);
+        display_prev = *display;
+
+        rg_input_latency_t latency;
+        if (rg_input_get_latency(&latency))
+            RG_LOGX("Input latency (last %d edges): P50:%dus, P90:%dus, P99:%dus, MAX:%dus\n",
+                latency.count, latency.p50, latency.p90, latency.p99, latency.max);
+
+        if (current.totalFrames > 0)
+        {
+            const char *names[RG_PHASE_COUNT] = {"EMU", "RENDER", "DIFF", "WAIT", "SPI", "AUDIO"};
+            char buffer[160];
+            int len = 0;
+            for (int i = 0; i < RG_PHASE_COUNT; ++i)
+                len += snprintf(buffer + len, sizeof(buffer) - len, "%s:%d/%d/%d%s", names[i],
+                    statistics.phases[i].min, statistics.phases[i].avg, statistics.phases[i].p99,
+                    i < RG_PHASE_COUNT - 1 ? ", " : "");
+            RG_LOGX("Frame phases (min/avg/p99 us): %s\n", buffer);
+        }
+
         // if (statistics.freeStackMain < 1024)
         // {
         //     RG_LOGW("Running out of stack space!");
@@ -193,6 +294,7 @@ IRAM_ATTR void rg_system_tick(int busyTime)
 {
     static uint32_t totalFrames = 0;
     static uint32_t fullFrames = 0;
+    static uint32_t droppedFrames = 0;
 
     const rg_display_t *disp = rg_display_get_status();
 
@@ -201,12 +303,22 @@ IRAM_ATTR void rg_system_tick(int busyTime)
     else if (disp->counters.fullFrames > fullFrames)
         counters.fullFrames++;
 
+    counters.droppedFrames += disp->counters.droppedFrames - droppedFrames;
+
     totalFrames = disp->counters.totalFrames;
     fullFrames = disp->counters.fullFrames;
+    droppedFrames = disp->counters.droppedFrames;
 
     counters.totalFrames++;
     counters.busyTime += busyTime;
 
+    // Close the frame's phases, the current one carries over into the next frame
+    rg_system_set_phase(phaseCurrent);
+    uint32_t *record = phaseHistory[phaseFrames % RG_PHASE_HISTORY];
+    for (int i = 0; i < RG_PHASE_COUNT; ++i)
+        record[i] = atomic_exchange_explicit(&phaseCycles[i], 0, memory_order_relaxed) / PHASE_CYCLES_PER_US;
+    phaseFrames++;
+
     // Reduce the inputTimeout once the emulation is running
     if (counters.totalFrames == 1)
     {
@@ -214,9 +326,76 @@ IRAM_ATTR void rg_system_tick(int busyTime)
     }
 }
 
+// Must be called from the emulator task. Returns the phase that was running, so that code that can
+// run in any phase (rg_display_queue_update, rg_audio_submit...) can restore it when it's done.
+IRAM_ATTR rg_phase_t rg_system_set_phase(rg_phase_t phase)
+{
+    uint32_t now = xthal_get_ccount();
+    rg_phase_t previous = phaseCurrent;
+
+    if (previous != RG_PHASE_NONE)
+        atomic_fetch_add_explicit(&phaseCycles[previous], now - phaseStart, memory_order_relaxed);
+
+    phaseCurrent = phase;
+    phaseStart = now;
+
+    return previous;
+}
+
+// For time measured by other tasks, it's added to the emulator's current frame
+void rg_system_add_phase_time(rg_phase_t phase, uint32_t usec)
+{
+    if (phase > RG_PHASE_NONE && phase < RG_PHASE_COUNT)
+        atomic_fetch_add_explicit(&phaseCycles[phase], usec * PHASE_CYCLES_PER_US, memory_order_relaxed);
+}
+
+bool rg_system_save_timings(const char *filename)
+{
+    RG_ASSERT(filename, "bad param");
+
+    FILE *fp = fopen(filename, "w");
+    if (!fp)
+    {
+        RG_LOGE("Failed to open '%s'\n", filename);
+        return false;
+    }
+
+    // Oldest frame first, microseconds
+    uint32_t last = phaseFrames;
+    uint32_t first = last > RG_PHASE_HISTORY ? last - RG_PHASE_HISTORY : 0;
+
+    fprintf(fp, "frame,emulate,render,diff,wait,transfer,audio\n");
+    for (uint32_t frame = first; frame < last; ++frame)
+    {
+        const uint32_t *record = phaseHistory[frame % RG_PHASE_HISTORY];
+        fprintf(fp, "%u", frame);
+        for (int i = 0; i < RG_PHASE_COUNT; ++i)
+            fprintf(fp, ",%u", record[i]);
+        fprintf(fp, "\n");
+    }
+
+    fclose(fp);
+    RG_LOGI("Saved %d frames to '%s'\n", last - first, filename);
+
+    return true;
+}
+
+void rg_system_set_timing_overlay(bool enable)
+{
+    timingOverlay = enable;
+}
+
+bool rg_system_get_timing_overlay(void)
+{
+    return timingOverlay;
+}
+
 rg_stats_t rg_system_get_stats()
 {
-    return statistics;
+    portENTER_CRITICAL(&statsLock);
+    rg_stats_t stats = statistics;
+    portEXIT_CRITICAL(&statsLock);
+    return stats;
 }
 
 void rg_system_time_init()
@@ -592,6 +771,8 @@ static void shutdown_cleanup()
     // Wait for all keys to be released, they could interfer with the restart process
     rg_input_wait_for_key(RG_KEY_ALL, false);
     rg_system_event(RG_EVENT_SHUTDOWN, NULL);
+    // A screenshot may still be written in the background
+    rg_image_save_wait();
     rg_system_time_save();
     rg_settings_save();
     rg_audio_deinit();
@@ -70,6 +70,22 @@ typedef enum
 #define RG_APP_LAUNCHER "launcher"
 #define RG_APP_FACTORY  NULL
 
+// Where the time of a frame goes. The emulator task moves between phases with rg_system_set_phase(),
+// the display task reports its transfers separately because they overlap with the emulation.
+typedef enum
+{
+    RG_PHASE_NONE = -1,
+    RG_PHASE_EMULATE = 0,   // CPU and everything else the core does
+    RG_PHASE_RENDER,        // Scanline rendering, for cores that report it
+    RG_PHASE_DIFF,          // Frame diff in rg_display_queue_update()
+    RG_PHASE_WAIT,          // Emulator blocked until the display is done with a buffer
+    RG_PHASE_TRANSFER,      // Display task drawing the frame (in parallel)
+    RG_PHASE_AUDIO,         // rg_audio_submit(), including waiting for room in the buffer
+    RG_PHASE_COUNT
+} rg_phase_t;
+
+#define RG_PHASE_HISTORY 128 // Frames kept for the phase statistics
+
 typedef bool (*rg_state_handler_t)(const char *filename);
 typedef bool (*rg_reset_handler_t)(bool hard);
 typedef void (*rg_event_handler_t)(int event, void *arg);
@@ -104,6 +120,7 @@ typedef struct
     uint32_t totalFrames;
     uint32_t skippedFrames;
     uint32_t fullFrames;
+    uint32_t droppedFrames;
     uint32_t busyTime;
     uint64_t resetTime;
 } rg_counters_t;
@@ -140,6 +157,9 @@ typedef struct
     uint32_t freeBlockInt;
     uint32_t freeBlockExt;
     uint32_t freeStackMain;
+    struct {
+        uint32_t min, avg, p99; // Microseconds per frame over the last RG_PHASE_HISTORY frames
+    } phases[RG_PHASE_COUNT];
 } rg_stats_t;
 
 rg_app_t *rg_system_init(int sampleRate, const rg_emu_proc_t *handlers);
@@ -153,6 +173,11 @@ bool rg_system_find_app(const char *app);
 void rg_system_set_led(int value);
 int  rg_system_get_led(void);
 void rg_system_tick(int busyTime);
+rg_phase_t rg_system_set_phase(rg_phase_t phase);
+void rg_system_add_phase_time(rg_phase_t phase, uint32_t usec);
+bool rg_system_save_timings(const char *filename);
+void rg_system_set_timing_overlay(bool enable);
+bool rg_system_get_timing_overlay(void);
 void rg_system_log(int level, const char *context, const char *format, ...);
 bool rg_system_save_trace(const char *filename, bool append);
 void rg_system_event(rg_event_t event, void *arg);
@@ -8,6 +8,13 @@
 // Anything above 10 have diminishing returns
 #define COUNTERS_TICK_PERIOD 8
 
+// Threaded dispatch: every instruction jumps straight to the next one through a table of label
+// addresses instead of going back to the switch. The interrupt and halt checks only run when
+// something could have changed their outcome: counters ticked, EI/DI/RETI/HALT/STOP ran, or a
+// write went through hw_write(). Emulation is identical to the switch, tools/gnuboy-bench.c -c
+// verifies it.
+#define CPU_JUMPTABLE
+
 static const byte cycles_table[256] =
 {
 	1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
@@ -118,11 +125,51 @@ static const byte swap_table[256] =
 #define HFLAG(n) ( (n) ? 0 : FH )
 #define CFLAG(n) ( (n) ? 0 : FC )
 
-#define PUSH(w) ( (SP -= 2), (writew(SP, (w))) )
+#define PUSH(w) ( (SP -= 2), (WRITEW(SP, (w))) )
 #define POP(w)  ( ((w) = readw(SP)), (SP += 2) )
 
 #define FETCH (readb(PC++))
 
+#ifdef CPU_JUMPTABLE
+
+/* Writes that reach hw_write() can change IF, IE, the LCD state... */
+#define WRITEB(a, b) ({ \
+uint _a = (a); byte *_p = hw.wmap[_a >> 12]; \
+if (_p) _p[_a] = (b); else { hw_write(_a, (b)); check = 1; } })
+
+#define WRITEW(a, w) ({ \
+uint _a = (a); byte *_p = hw.wmap[_a >> 12]; \
+if (_p && (_a & 0xFFF) != 0xFFF) *(un16 *)(_p + _a) = (w); else { writew(_a, (w)); check = 1; } })
+
+#define OPCODE(n) op##n
+#define OPCODE_DEFAULT op_invalid
+#define OPCODE_DISPATCH goto *opcode_table[op]; do
+#define OPCODE_END while (0);
+
+/* Next instruction without going through the checks at next: when nothing requires them */
+#define NEXT { \
+remaining -= clen; count += clen; \
+if (count >= COUNTERS_TICK_PERIOD || remaining <= 0 || check) goto _counted; \
+op = FETCH; clen = cycles_table[op]; goto *opcode_table[op]; }
+
+/* DEC r followed by JR NZ is a delay loop more often than not, see _dec_jr_nz */
+#define NEXT_DEC(r) { if (readb(PC) == 0x20) { spin_reg = &(r); spin_pc = PC - 1; goto _dec_jr_nz; } NEXT; }
+
+#else
+
+#define WRITEB(a, b) writeb((a), (b))
+#define WRITEW(a, w) writew((a), (w))
+
+#define OPCODE(n) case n
+#define OPCODE_DEFAULT default
+#define OPCODE_DISPATCH switch (op)
+#define OPCODE_END
+
+#define NEXT break
+#define NEXT_DEC(r) break
+
+#endif
+
 #define INC(r) { ((r)++); F = (F & (FL|FC)) | incflag_table[(r)]; }
 #define DEC(r) { ((r)--); F = (F & (FL|FC)) | decflag_table[(r)]; }
 
@@ -196,6 +243,9 @@ A = LB(acc); }
 #define JP ( PC = readw(PC) )
 
 #define NOJR   ( clen--,  PC++ )
+
+/* JR back to a LDH A,(n); CP/AND d just before it, see _idle_poll */
+#define IDLE_POLL if (readb(PC) == 0xFA) { spin_pc = PC - 5; goto _idle_poll; }
 #define NOJP   ( clen--,  PC+=2 )
 #define NOCALL ( clen-=3, PC+=2 )
 #define NORET  ( clen-=3 )
@@ -245,17 +295,17 @@ case 0xF0|(n): SET(6, r); break; \
 case 0xF8|(n): SET(7, r); break;
 
 
-#define ALU_CASES(base, imm, op, label) \
-case (imm): b = FETCH; goto label; \
-case (base): b = B; goto label; \
-case (base)+1: b = C; goto label; \
-case (base)+2: b = D; goto label; \
-case (base)+3: b = E; goto label; \
-case (base)+4: b = H; goto label; \
-case (base)+5: b = L; goto label; \
-case (base)+6: b = readb(HL); goto label; \
-case (base)+7: b = A; \
-label: op(b); break;
+#define ALU_CASES(imm, rb, rc, rd, re, rh, rl, rhl, ra, op, label) \
+OPCODE(imm): b = FETCH; goto label; \
+OPCODE(rb): b = B; goto label; \
+OPCODE(rc): b = C; goto label; \
+OPCODE(rd): b = D; goto label; \
+OPCODE(re): b = E; goto label; \
+OPCODE(rh): b = H; goto label; \
+OPCODE(rl): b = L; goto label; \
+OPCODE(rhl): b = readb(HL); goto label; \
+OPCODE(ra): b = A; \
+label: op(b); NEXT;
 
 
 cpu_t cpu;
@@ -331,6 +381,42 @@ static inline void serial_advance(int cycles)
 	}
 }
 
+/* cnt - time to emulate, expressed in double-speed cycles */
+static inline void counters_advance(int cycles)
+{
+	/* Advance clock-bound counters */
+	timer_advance(cycles);
+	serial_advance(cycles);
+
+	if (!cpu.double_speed)
+		cycles <<= 1;
+
+	/* Advance fixed-speed counters */
+	lcd_emulate(cycles);
+	snd.cycles += cycles;
+	// sound_emulate(cycles);
+}
+
+/* Cycles until the next counter event (LCD mode change, timer overflow, end of serial transfer),
+   counted from the last tick. Ticking up to there at once gives the same result as ticking often. */
+static inline int counters_next_event(void)
+{
+	int cycles = cpu.double_speed ? lcd.cycles : (lcd.cycles + 1) >> 1;
+
+	if (R_TAC & 0x04)
+	{
+		int shift = (((-R_TAC) & 3) << 1) + 1;
+		int timer = (((256 - R_TIMA) << 9) - cpu.timer + (1 << shift) - 1) >> shift;
+		if (timer < cycles)
+			cycles = timer;
+	}
+
+	if (hw.serial > 0 && (hw.serial + 1) >> 1 < cycles)
+		cycles = (hw.serial + 1) >> 1;
+
+	return cycles > 0 ? cycles : 1;
+}
+
 /* cpu_emulate()
 	Emulate CPU for time no less than specified
 
@@ -347,14 +433,58 @@ int cpu_emulate(int cycles)
 	int count = 0;
 	byte op, b;
 	cpu_reg_t acc;
+#ifdef CPU_JUMPTABLE
+	static const void *const opcode_table[256] =
+	{
+		&&op0x00, &&op0x01, &&op0x02, &&op0x03, &&op0x04, &&op0x05, &&op0x06, &&op0x07,
+		&&op0x08, &&op0x09, &&op0x0A, &&op0x0B, &&op0x0C, &&op0x0D, &&op0x0E, &&op0x0F,
+		&&op0x10, &&op0x11, &&op0x12, &&op0x13, &&op0x14, &&op0x15, &&op0x16, &&op0x17,
+		&&op0x18, &&op0x19, &&op0x1A, &&op0x1B, &&op0x1C, &&op0x1D, &&op0x1E, &&op0x1F,
+		&&op0x20, &&op0x21, &&op0x22, &&op0x23, &&op0x24, &&op0x25, &&op0x26, &&op0x27,
+		&&op0x28, &&op0x29, &&op0x2A, &&op0x2B, &&op0x2C, &&op0x2D, &&op0x2E, &&op0x2F,
+		&&op0x30, &&op0x31, &&op0x32, &&op0x33, &&op0x34, &&op0x35, &&op0x36, &&op0x37,
+		&&op0x38, &&op0x39, &&op0x3A, &&op0x3B, &&op0x3C, &&op0x3D, &&op0x3E, &&op0x3F,
+		&&op0x40, &&op0x41, &&op0x42, &&op0x43, &&op0x44, &&op0x45, &&op0x46, &&op0x47,
+		&&op0x48, &&op0x49, &&op0x4A, &&op0x4B, &&op0x4C, &&op0x4D, &&op0x4E, &&op0x4F,
+		&&op0x50, &&op0x51, &&op0x52, &&op0x53, &&op0x54, &&op0x55, &&op0x56, &&op0x57,
+		&&op0x58, &&op0x59, &&op0x5A, &&op0x5B, &&op0x5C, &&op0x5D, &&op0x5E, &&op0x5F,
+		&&op0x60, &&op0x61, &&op0x62, &&op0x63, &&op0x64, &&op0x65, &&op0x66, &&op0x67,
+		&&op0x68, &&op0x69, &&op0x6A, &&op0x6B, &&op0x6C, &&op0x6D, &&op0x6E, &&op0x6F,
+		&&op0x70, &&op0x71, &&op0x72, &&op0x73, &&op0x74, &&op0x75, &&op0x76, &&op0x77,
+		&&op0x78, &&op0x79, &&op0x7A, &&op0x7B, &&op0x7C, &&op0x7D, &&op0x7E, &&op0x7F,
+		&&op0x80, &&op0x81, &&op0x82, &&op0x83, &&op0x84, &&op0x85, &&op0x86, &&op0x87,
+		&&op0x88, &&op0x89, &&op0x8A, &&op0x8B, &&op0x8C, &&op0x8D, &&op0x8E, &&op0x8F,
+		&&op0x90, &&op0x91, &&op0x92, &&op0x93, &&op0x94, &&op0x95, &&op0x96, &&op0x97,
+		&&op0x98, &&op0x99, &&op0x9A, &&op0x9B, &&op0x9C, &&op0x9D, &&op0x9E, &&op0x9F,
+		&&op0xA0, &&op0xA1, &&op0xA2, &&op0xA3, &&op0xA4, &&op0xA5, &&op0xA6, &&op0xA7,
+		&&op0xA8, &&op0xA9, &&op0xAA, &&op0xAB, &&op0xAC, &&op0xAD, &&op0xAE, &&op0xAF,
+		&&op0xB0, &&op0xB1, &&op0xB2, &&op0xB3, &&op0xB4, &&op0xB5, &&op0xB6, &&op0xB7,
+		&&op0xB8, &&op0xB9, &&op0xBA, &&op0xBB, &&op0xBC, &&op0xBD, &&op0xBE, &&op0xBF,
+		&&op0xC0, &&op0xC1, &&op0xC2, &&op0xC3, &&op0xC4, &&op0xC5, &&op0xC6, &&op0xC7,
+		&&op0xC8, &&op0xC9, &&op0xCA, &&op0xCB, &&op0xCC, &&op0xCD, &&op0xCE, &&op0xCF,
+		&&op0xD0, &&op0xD1, &&op0xD2, &&op_invalid, &&op0xD4, &&op0xD5, &&op0xD6, &&op0xD7,
+		&&op0xD8, &&op0xD9, &&op0xDA, &&op_invalid, &&op0xDC, &&op_invalid, &&op0xDE, &&op0xDF,
+		&&op0xE0, &&op0xE1, &&op0xE2, &&op_invalid, &&op_invalid, &&op0xE5, &&op0xE6, &&op0xE7,
+		&&op0xE8, &&op0xE9, &&op0xEA, &&op_invalid, &&op_invalid, &&op_invalid, &&op0xEE, &&op0xEF,
+		&&op0xF0, &&op0xF1, &&op0xF2, &&op0xF3, &&op_invalid, &&op0xF5, &&op0xF6, &&op0xF7,
+		&&op0xF8, &&op0xF9, &&op0xFA, &&op0xFB, &&op_invalid, &&op_invalid, &&op0xFE, &&op0xFF
+	};
+	byte *spin_reg;
+	int check = 0;
+#endif
+	un16 spin_pc;
 
 	if (!cpu.double_speed)
 		remaining >>= 1;
 
 next:
-	/* Skip idle cycles */
+	/* Skip idle cycles: nothing can wake us up before the tick that reaches the next event */
 	if (cpu.halted) {
-		clen = 1;
+		temp = counters_next_event() + COUNTERS_TICK_PERIOD - 1;
+		temp -= temp % COUNTERS_TICK_PERIOD;
+		if (temp > count + remaining)
+			temp = count + remaining;
+		clen = temp - count;
 		goto _skip;
 	}
 
@@ -367,6 +497,10 @@ next:
 		COND_EXEC_INT(IF_SERIAL, 3);
 		COND_EXEC_INT(IF_PAD, 4);
 	}
+#ifdef CPU_JUMPTABLE
+	/* The instruction after EI must come back here */
+	check = (IME != IMA);
+#endif
 	IME = IMA;
 
 	// if (cpu.disassemble)
@@ -375,197 +509,197 @@ next:
 	op = FETCH;
 	clen = cycles_table[op];
 
-	switch(op)
+	OPCODE_DISPATCH
 	{
-	case 0x00: /* NOP */
-	case 0x40: /* LD B,B */
-	case 0x49: /* LD C,C */
-	case 0x52: /* LD D,D */
-	case 0x5B: /* LD E,E */
-	case 0x64: /* LD H,H */
-	case 0x6D: /* LD L,L */
-	case 0x7F: /* LD A,A */
-		break;
-
-	case 0x41: /* LD B,C */
-		B = C; break;
-	case 0x42: /* LD B,D */
-		B = D; break;
-	case 0x43: /* LD B,E */
-		B = E; break;
-	case 0x44: /* LD B,H */
-		B = H; break;
-	case 0x45: /* LD B,L */
-		B = L; break;
-	case 0x46: /* LD B,(HL) */
-		B = readb(HL); break;
-	case 0x47: /* LD B,A */
-		B = A; break;
-
-	case 0x48: /* LD C,B */
-		C = B; break;
-	case 0x4A: /* LD C,D */
-		C = D; break;
-	case 0x4B: /* LD C,E */
-		C = E; break;
-	case 0x4C: /* LD C,H */
-		C = H; break;
-	case 0x4D: /* LD C,L */
-		C = L; break;
-	case 0x4E: /* LD C,(HL) */
-		C = readb(HL); break;
-	case 0x4F: /* LD C,A */
-		C = A; break;
-
-	case 0x50: /* LD D,B */
-		D = B; break;
-	case 0x51: /* LD D,C */
-		D = C; break;
-	case 0x53: /* LD D,E */
-		D = E; break;
-	case 0x54: /* LD D,H */
-		D = H; break;
-	case 0x55: /* LD D,L */
-		D = L; break;
-	case 0x56: /* LD D,(HL) */
-		D = readb(HL); break;
-	case 0x57: /* LD D,A */
-		D = A; break;
-
-	case 0x58: /* LD E,B */
-		E = B; break;
-	case 0x59: /* LD E,C */
-		E = C; break;
-	case 0x5A: /* LD E,D */
-		E = D; break;
-	case 0x5C: /* LD E,H */
-		E = H; break;
-	case 0x5D: /* LD E,L */
-		E = L; break;
-	case 0x5E: /* LD E,(HL) */
-		E = readb(HL); break;
-	case 0x5F: /* LD E,A */
-		E = A; break;
-
-	case 0x60: /* LD H,B */
-		H = B; break;
-	case 0x61: /* LD H,C */
-		H = C; break;
-	case 0x62: /* LD H,D */
-		H = D; break;
-	case 0x63: /* LD H,E */
-		H = E; break;
-	case 0x65: /* LD H,L */
-		H = L; break;
-	case 0x66: /* LD H,(HL) */
-		H = readb(HL); break;
-	case 0x67: /* LD H,A */
-		H = A; break;
-
-	case 0x68: /* LD L,B */
-		L = B; break;
-	case 0x69: /* LD L,C */
-		L = C; break;
-	case 0x6A: /* LD L,D */
-		L = D; break;
-	case 0x6B: /* LD L,E */
-		L = E; break;
-	case 0x6C: /* LD L,H */
-		L = H; break;
-	case 0x6E: /* LD L,(HL) */
-		L = readb(HL); break;
-	case 0x6F: /* LD L,A */
-		L = A; break;
-
-	case 0x70: /* LD (HL),B */
-		writeb(HL, B); break;
-	case 0x71: /* LD (HL),C */
-		writeb(HL, C); break;
-	case 0x72: /* LD (HL),D */
-		writeb(HL, D); break;
-	case 0x73: /* LD (HL),E */
-		writeb(HL, E); break;
-	case 0x74: /* LD (HL),H */
-		writeb(HL, H); break;
-	case 0x75: /* LD (HL),L */
-		writeb(HL, L); break;
-	case 0x77: /* LD (HL),A */
-		writeb(HL, A); break;
-
-	case 0x78: /* LD A,B */
-		A = B; break;
-	case 0x79: /* LD A,C */
-		A = C; break;
-	case 0x7A: /* LD A,D */
-		A = D; break;
-	case 0x7B: /* LD A,E */
-		A = E; break;
-	case 0x7C: /* LD A,H */
-		A = H; break;
-	case 0x7D: /* LD A,L */
-		A = L; break;
-	case 0x7E: /* LD A,(HL) */
-		A = readb(HL); break;
-
-	case 0x01: /* LD BC,imm */
-		BC = readw(PC); PC += 2; break;
-	case 0x11: /* LD DE,imm */
-		DE = readw(PC); PC += 2; break;
-	case 0x21: /* LD HL,imm */
-		HL = readw(PC); PC += 2; break;
-	case 0x31: /* LD SP,imm */
-		SP = readw(PC); PC += 2; break;
-
-	case 0x02: /* LD (BC),A */
-		writeb(BC, A); break;
-	case 0x0A: /* LD A,(BC) */
-		A = readb(BC); break;
-	case 0x12: /* LD (DE),A */
-		writeb(DE, A); break;
-	case 0x1A: /* LD A,(DE) */
-		A = readb(DE); break;
-
-	case 0x22: /* LDI (HL),A */
-		writeb(HL, A); HL++; break;
-	case 0x2A: /* LDI A,(HL) */
-		A = readb(HL); HL++; break;
-	case 0x32: /* LDD (HL),A */
-		writeb(HL, A); HL--; break;
-	case 0x3A: /* LDD A,(HL) */
-		A = readb(HL); HL--; break;
-
-	case 0x06: /* LD B,imm */
-		B = FETCH; break;
-	case 0x0E: /* LD C,imm */
-		C = FETCH; break;
-	case 0x16: /* LD D,imm */
-		D = FETCH; break;
-	case 0x1E: /* LD E,imm */
-		E = FETCH; break;
-	case 0x26: /* LD H,imm */
-		H = FETCH; break;
-	case 0x2E: /* LD L,imm */
-		L = FETCH; break;
-	case 0x36: /* LD (HL),imm */
-		writeb(HL, FETCH); break;
-	case 0x3E: /* LD A,imm */
-		A = FETCH; break;
-
-	case 0x08: /* LD (imm),SP */
-		writew(readw(PC), SP); PC += 2; break;
-	case 0xEA: /* LD (imm),A */
-		writeb(readw(PC), A); PC += 2; break;
-
-	case 0xE0: /* LDH (imm),A */
-		writeb(0xff00 + FETCH, A); break;
-	case 0xE2: /* LDH (C),A */
-		writeb(0xff00 + C, A); break;
-	case 0xF0: /* LDH A,(imm) */
-		A = readb(0xff00 + FETCH); break;
-	case 0xF2: /* LDH A,(C) (undocumented) */
-		A = readb(0xff00 + C); break;
-
-	case 0xF8: /* LD HL,SP+imm */
+	OPCODE(0x00): /* NOP */
+	OPCODE(0x40): /* LD B,B */
+	OPCODE(0x49): /* LD C,C */
+	OPCODE(0x52): /* LD D,D */
+	OPCODE(0x5B): /* LD E,E */
+	OPCODE(0x64): /* LD H,H */
+	OPCODE(0x6D): /* LD L,L */
+	OPCODE(0x7F): /* LD A,A */
+		NEXT;
+
+	OPCODE(0x41): /* LD B,C */
+		B = C; NEXT;
+	OPCODE(0x42): /* LD B,D */
+		B = D; NEXT;
+	OPCODE(0x43): /* LD B,E */
+		B = E; NEXT;
+	OPCODE(0x44): /* LD B,H */
+		B = H; NEXT;
+	OPCODE(0x45): /* LD B,L */
+		B = L; NEXT;
+	OPCODE(0x46): /* LD B,(HL) */
+		B = readb(HL); NEXT;
+	OPCODE(0x47): /* LD B,A */
+		B = A; NEXT;
+
+	OPCODE(0x48): /* LD C,B */
+		C = B; NEXT;
+	OPCODE(0x4A): /* LD C,D */
+		C = D; NEXT;
+	OPCODE(0x4B): /* LD C,E */
+		C = E; NEXT;
+	OPCODE(0x4C): /* LD C,H */
+		C = H; NEXT;
+	OPCODE(0x4D): /* LD C,L */
+		C = L; NEXT;
+	OPCODE(0x4E): /* LD C,(HL) */
+		C = readb(HL); NEXT;
+	OPCODE(0x4F): /* LD C,A */
+		C = A; NEXT;
+
+	OPCODE(0x50): /* LD D,B */
+		D = B; NEXT;
+	OPCODE(0x51): /* LD D,C */
+		D = C; NEXT;
+	OPCODE(0x53): /* LD D,E */
+		D = E; NEXT;
+	OPCODE(0x54): /* LD D,H */
+		D = H; NEXT;
+	OPCODE(0x55): /* LD D,L */
+		D = L; NEXT;
+	OPCODE(0x56): /* LD D,(HL) */
+		D = readb(HL); NEXT;
+	OPCODE(0x57): /* LD D,A */
+		D = A; NEXT;
+
+	OPCODE(0x58): /* LD E,B */
+		E = B; NEXT;
+	OPCODE(0x59): /* LD E,C */
+		E = C; NEXT;
+	OPCODE(0x5A): /* LD E,D */
+		E = D; NEXT;
+	OPCODE(0x5C): /* LD E,H */
+		E = H; NEXT;
+	OPCODE(0x5D): /* LD E,L */
+		E = L; NEXT;
+	OPCODE(0x5E): /* LD E,(HL) */
+		E = readb(HL); NEXT;
+	OPCODE(0x5F): /* LD E,A */
+		E = A; NEXT;
+
+	OPCODE(0x60): /* LD H,B */
+		H = B; NEXT;
+	OPCODE(0x61): /* LD H,C */
+		H = C; NEXT;
+	OPCODE(0x62): /* LD H,D */
+		H = D; NEXT;
+	OPCODE(0x63): /* LD H,E */
+		H = E; NEXT;
+	OPCODE(0x65): /* LD H,L */
+		H = L; NEXT;
+	OPCODE(0x66): /* LD H,(HL) */
+		H = readb(HL); NEXT;
+	OPCODE(0x67): /* LD H,A */
+		H = A; NEXT;
+
+	OPCODE(0x68): /* LD L,B */
+		L = B; NEXT;
+	OPCODE(0x69): /* LD L,C */
+		L = C; NEXT;
+	OPCODE(0x6A): /* LD L,D */
+		L = D; NEXT;
+	OPCODE(0x6B): /* LD L,E */
+		L = E; NEXT;
+	OPCODE(0x6C): /* LD L,H */
+		L = H; NEXT;
+	OPCODE(0x6E): /* LD L,(HL) */
+		L = readb(HL); NEXT;
+	OPCODE(0x6F): /* LD L,A */
+		L = A; NEXT;
+
+	OPCODE(0x70): /* LD (HL),B */
+		WRITEB(HL, B); NEXT;
+	OPCODE(0x71): /* LD (HL),C */
+		WRITEB(HL, C); NEXT;
+	OPCODE(0x72): /* LD (HL),D */
+		WRITEB(HL, D); NEXT;
+	OPCODE(0x73): /* LD (HL),E */
+		WRITEB(HL, E); NEXT;
+	OPCODE(0x74): /* LD (HL),H */
+		WRITEB(HL, H); NEXT;
+	OPCODE(0x75): /* LD (HL),L */
+		WRITEB(HL, L); NEXT;
+	OPCODE(0x77): /* LD (HL),A */
+		WRITEB(HL, A); NEXT;
+
+	OPCODE(0x78): /* LD A,B */
+		A = B; NEXT;
+	OPCODE(0x79): /* LD A,C */
+		A = C; NEXT;
+	OPCODE(0x7A): /* LD A,D */
+		A = D; NEXT;
+	OPCODE(0x7B): /* LD A,E */
+		A = E; NEXT;
+	OPCODE(0x7C): /* LD A,H */
+		A = H; NEXT;
+	OPCODE(0x7D): /* LD A,L */
+		A = L; NEXT;
+	OPCODE(0x7E): /* LD A,(HL) */
+		A = readb(HL); NEXT;
+
+	OPCODE(0x01): /* LD BC,imm */
+		BC = readw(PC); PC += 2; NEXT;
+	OPCODE(0x11): /* LD DE,imm */
+		DE = readw(PC); PC += 2; NEXT;
+	OPCODE(0x21): /* LD HL,imm */
+		HL = readw(PC); PC += 2; NEXT;
+	OPCODE(0x31): /* LD SP,imm */
+		SP = readw(PC); PC += 2; NEXT;
+
+	OPCODE(0x02): /* LD (BC),A */
+		WRITEB(BC, A); NEXT;
+	OPCODE(0x0A): /* LD A,(BC) */
+		A = readb(BC); NEXT;
+	OPCODE(0x12): /* LD (DE),A */
+		WRITEB(DE, A); NEXT;
+	OPCODE(0x1A): /* LD A,(DE) */
+		A = readb(DE); NEXT;
+
+	OPCODE(0x22): /* LDI (HL),A */
+		WRITEB(HL, A); HL++; NEXT;
+	OPCODE(0x2A): /* LDI A,(HL) */
+		A = readb(HL); HL++; NEXT;
+	OPCODE(0x32): /* LDD (HL),A */
+		WRITEB(HL, A); HL--; NEXT;
+	OPCODE(0x3A): /* LDD A,(HL) */
+		A = readb(HL); HL--; NEXT;
+
+	OPCODE(0x06): /* LD B,imm */
+		B = FETCH; NEXT;
+	OPCODE(0x0E): /* LD C,imm */
+		C = FETCH; NEXT;
+	OPCODE(0x16): /* LD D,imm */
+		D = FETCH; NEXT;
+	OPCODE(0x1E): /* LD E,imm */
+		E = FETCH; NEXT;
+	OPCODE(0x26): /* LD H,imm */
+		H = FETCH; NEXT;
+	OPCODE(0x2E): /* LD L,imm */
+		L = FETCH; NEXT;
+	OPCODE(0x36): /* LD (HL),imm */
+		WRITEB(HL, FETCH); NEXT;
+	OPCODE(0x3E): /* LD A,imm */
+		A = FETCH; NEXT;
+
+	OPCODE(0x08): /* LD (imm),SP */
+		WRITEW(readw(PC), SP); PC += 2; NEXT;
+	OPCODE(0xEA): /* LD (imm),A */
+		WRITEB(readw(PC), A); PC += 2; NEXT;
+
+	OPCODE(0xE0): /* LDH (imm),A */
+		WRITEB(0xff00 + FETCH, A); NEXT;
+	OPCODE(0xE2): /* LDH (C),A */
+		WRITEB(0xff00 + C, A); NEXT;
+	OPCODE(0xF0): /* LDH A,(imm) */
+		A = readb(0xff00 + FETCH); NEXT;
+	OPCODE(0xF2): /* LDH A,(C) (undocumented) */
+		A = readb(0xff00 + C); NEXT;
+
+	OPCODE(0xF8): /* LD HL,SP+imm */
 		// https://gammpei.github.io/blog/posts/2018-03-04/how-to-write-a-game-boy-emulator-part-8-blarggs-cpu-test-roms-1-3-4-5-7-8-9-10-11.html
 		b = FETCH;
 		temp = (int)(SP) + (signed char)b;
@@ -576,98 +710,98 @@ next:
 		if ((SP & 0xff) + b > 0xff) F |= FC;
 
 		HL = temp;
-		break;
-	case 0xF9: /* LD SP,HL */
-		SP = HL; break;
-	case 0xFA: /* LD A,(imm) */
-		A = readb(readw(PC)); PC += 2; break;
-
-		ALU_CASES(0x80, 0xC6, ADD, __ADD)
-		ALU_CASES(0x88, 0xCE, ADC, __ADC)
-		ALU_CASES(0x90, 0xD6, SUB, __SUB)
-		ALU_CASES(0x98, 0xDE, SBC, __SBC)
-		ALU_CASES(0xA0, 0xE6, AND, __AND)
-		ALU_CASES(0xA8, 0xEE, XOR, __XOR)
-		ALU_CASES(0xB0, 0xF6, OR, __OR)
-		ALU_CASES(0xB8, 0xFE, CP, __CP)
-
-	case 0x09: /* ADD HL,BC */
-		ADDW(BC); break;
-	case 0x19: /* ADD HL,DE */
-		ADDW(DE); break;
-	case 0x39: /* ADD HL,SP */
-		ADDW(SP); break;
-	case 0x29: /* ADD HL,HL */
-		ADDW(HL); break;
-
-	case 0x04: /* INC B */
-		INC(B); break;
-	case 0x0C: /* INC C */
-		INC(C); break;
-	case 0x14: /* INC D */
-		INC(D); break;
-	case 0x1C: /* INC E */
-		INC(E); break;
-	case 0x24: /* INC H */
-		INC(H); break;
-	case 0x2C: /* INC L */
-		INC(L); break;
-	case 0x34: /* INC (HL) */
+		NEXT;
+	OPCODE(0xF9): /* LD SP,HL */
+		SP = HL; NEXT;
+	OPCODE(0xFA): /* LD A,(imm) */
+		A = readb(readw(PC)); PC += 2; NEXT;
+
+		ALU_CASES(0xC6, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, ADD, __ADD)
+		ALU_CASES(0xCE, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, 0x8E, 0x8F, ADC, __ADC)
+		ALU_CASES(0xD6, 0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, SUB, __SUB)
+		ALU_CASES(0xDE, 0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9D, 0x9E, 0x9F, SBC, __SBC)
+		ALU_CASES(0xE6, 0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, AND, __AND)
+		ALU_CASES(0xEE, 0xA8, 0xA9, 0xAA, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, XOR, __XOR)
+		ALU_CASES(0xF6, 0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, OR, __OR)
+		ALU_CASES(0xFE, 0xB8, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF, CP, __CP)
+
+	OPCODE(0x09): /* ADD HL,BC */
+		ADDW(BC); NEXT;
+	OPCODE(0x19): /* ADD HL,DE */
+		ADDW(DE); NEXT;
+	OPCODE(0x39): /* ADD HL,SP */
+		ADDW(SP); NEXT;
+	OPCODE(0x29): /* ADD HL,HL */
+		ADDW(HL); NEXT;
+
+	OPCODE(0x04): /* INC B */
+		INC(B); NEXT;
+	OPCODE(0x0C): /* INC C */
+		INC(C); NEXT;
+	OPCODE(0x14): /* INC D */
+		INC(D); NEXT;
+	OPCODE(0x1C): /* INC E */
+		INC(E); NEXT;
+	OPCODE(0x24): /* INC H */
+		INC(H); NEXT;
+	OPCODE(0x2C): /* INC L */
+		INC(L); NEXT;
+	OPCODE(0x34): /* INC (HL) */
 		b = readb(HL);
 		INC(b);
-		writeb(HL, b);
-		break;
-	case 0x3C: /* INC A */
-		INC(A); break;
-
-	case 0x03: /* INC BC */
-		INCW(BC); break;
-	case 0x13: /* INC DE */
-		INCW(DE); break;
-	case 0x23: /* INC HL */
-		INCW(HL); break;
-	case 0x33: /* INC SP */
-		INCW(SP); break;
-
-	case 0x05: /* DEC B */
-		DEC(B); break;
-	case 0x0D: /* DEC C */
-		DEC(C); break;
-	case 0x15: /* DEC D */
-		DEC(D); break;
-	case 0x1D: /* DEC E */
-		DEC(E); break;
-	case 0x25: /* DEC H */
-		DEC(H); break;
-	case 0x2D: /* DEC L */
-		DEC(L); break;
-	case 0x35: /* DEC (HL) */
+		WRITEB(HL, b);
+		NEXT;
+	OPCODE(0x3C): /* INC A */
+		INC(A); NEXT;
+
+	OPCODE(0x03): /* INC BC */
+		INCW(BC); NEXT;
+	OPCODE(0x13): /* INC DE */
+		INCW(DE); NEXT;
+	OPCODE(0x23): /* INC HL */
+		INCW(HL); NEXT;
+	OPCODE(0x33): /* INC SP */
+		INCW(SP); NEXT;
+
+	OPCODE(0x05): /* DEC B */
+		DEC(B); NEXT_DEC(B);
+	OPCODE(0x0D): /* DEC C */
+		DEC(C); NEXT_DEC(C);
+	OPCODE(0x15): /* DEC D */
+		DEC(D); NEXT_DEC(D);
+	OPCODE(0x1D): /* DEC E */
+		DEC(E); NEXT_DEC(E);
+	OPCODE(0x25): /* DEC H */
+		DEC(H); NEXT;
+	OPCODE(0x2D): /* DEC L */
+		DEC(L); NEXT;
+	OPCODE(0x35): /* DEC (HL) */
 		b = readb(HL);
 		DEC(b);
-		writeb(HL, b);
-		break;
-	case 0x3D: /* DEC A */
-		DEC(A); break;
-
-	case 0x0B: /* DEC BC */
-		DECW(BC); break;
-	case 0x1B: /* DEC DE */
-		DECW(DE); break;
-	case 0x2B: /* DEC HL */
-		DECW(HL); break;
-	case 0x3B: /* DEC SP */
-		DECW(SP); break;
-
-	case 0x07: /* RLCA */
-		RLCA(A); break;
-	case 0x0F: /* RRCA */
-		RRCA(A); break;
-	case 0x17: /* RLA */
-		RLA(A); break;
-	case 0x1F: /* RRA */
-		RRA(A); break;
-
-	case 0x27: /* DAA */
+		WRITEB(HL, b);
+		NEXT;
+	OPCODE(0x3D): /* DEC A */
+		DEC(A); NEXT_DEC(A);
+
+	OPCODE(0x0B): /* DEC BC */
+		DECW(BC); NEXT;
+	OPCODE(0x1B): /* DEC DE */
+		DECW(DE); NEXT;
+	OPCODE(0x2B): /* DEC HL */
+		DECW(HL); NEXT;
+	OPCODE(0x3B): /* DEC SP */
+		DECW(SP); NEXT;
+
+	OPCODE(0x07): /* RLCA */
+		RLCA(A); NEXT;
+	OPCODE(0x0F): /* RRCA */
+		RRCA(A); NEXT;
+	OPCODE(0x17): /* RLA */
+		RLA(A); NEXT;
+	OPCODE(0x1F): /* RRA */
+		RRA(A); NEXT;
+
+	OPCODE(0x27): /* DAA */
 		//http://forums.nesdev.com/viewtopic.php?t=9088
 		temp = A;
 
@@ -687,96 +821,96 @@ next:
 
 		if (temp & 0x100)   F |= FC;
 		if (!(temp & 0xff)) F |= FZ;
-		break;
-
-	case 0x2F: /* CPL */
-		CPL(A); break;
-
-	case 0x18: /* JR */
-		JR; break;
-	case 0x20: /* JR NZ */
-		if (!(F&FZ)) JR; else NOJR; break;
-	case 0x28: /* JR Z */
-		if (F&FZ) JR; else NOJR; break;
-	case 0x30: /* JR NC */
-		if (!(F&FC)) JR; else NOJR; break;
-	case 0x38: /* JR C */
-		if (F&FC) JR; else NOJR; break;
-
-	case 0xC3: /* JP */
-		JP; break;
-	case 0xC2: /* JP NZ */
-		if (!(F&FZ)) JP; else NOJP; break;
-	case 0xCA: /* JP Z */
-		if (F&FZ) JP; else NOJP; break;
-	case 0xD2: /* JP NC */
-		if (!(F&FC)) JP; else NOJP; break;
-	case 0xDA: /* JP C */
-		if (F&FC) JP; else NOJP; break;
-	case 0xE9: /* JP HL */
-		PC = HL; break;
-
-	case 0xC9: /* RET */
-		RET; break;
-	case 0xC0: /* RET NZ */
-		if (!(F&FZ)) RET; else NORET; break;
-	case 0xC8: /* RET Z */
-		if (F&FZ) RET; else NORET; break;
-	case 0xD0: /* RET NC */
-		if (!(F&FC)) RET; else NORET; break;
-	case 0xD8: /* RET C */
-		if (F&FC) RET; else NORET; break;
-	case 0xD9: /* RETI */
+		NEXT;
+
+	OPCODE(0x2F): /* CPL */
+		CPL(A); NEXT;
+
+	OPCODE(0x18): /* JR */
+		JR; NEXT;
+	OPCODE(0x20): /* JR NZ */
+		if (!(F&FZ)) { IDLE_POLL; JR; } else NOJR; NEXT;
+	OPCODE(0x28): /* JR Z */
+		if (F&FZ) { IDLE_POLL; JR; } else NOJR; NEXT;
+	OPCODE(0x30): /* JR NC */
+		if (!(F&FC)) { IDLE_POLL; JR; } else NOJR; NEXT;
+	OPCODE(0x38): /* JR C */
+		if (F&FC) { IDLE_POLL; JR; } else NOJR; NEXT;
+
+	OPCODE(0xC3): /* JP */
+		JP; NEXT;
+	OPCODE(0xC2): /* JP NZ */
+		if (!(F&FZ)) JP; else NOJP; NEXT;
+	OPCODE(0xCA): /* JP Z */
+		if (F&FZ) JP; else NOJP; NEXT;
+	OPCODE(0xD2): /* JP NC */
+		if (!(F&FC)) JP; else NOJP; NEXT;
+	OPCODE(0xDA): /* JP C */
+		if (F&FC) JP; else NOJP; NEXT;
+	OPCODE(0xE9): /* JP HL */
+		PC = HL; NEXT;
+
+	OPCODE(0xC9): /* RET */
+		RET; NEXT;
+	OPCODE(0xC0): /* RET NZ */
+		if (!(F&FZ)) RET; else NORET; NEXT;
+	OPCODE(0xC8): /* RET Z */
+		if (F&FZ) RET; else NORET; NEXT;
+	OPCODE(0xD0): /* RET NC */
+		if (!(F&FC)) RET; else NORET; NEXT;
+	OPCODE(0xD8): /* RET C */
+		if (F&FC) RET; else NORET; NEXT;
+	OPCODE(0xD9): /* RETI */
 		IME = IMA = 1; RET; break;
 
-	case 0xCD: /* CALL */
-		CALL; break;
-	case 0xC4: /* CALL NZ */
-		if (!(F&FZ)) CALL; else NOCALL; break;
-	case 0xCC: /* CALL Z */
-		if (F&FZ) CALL; else NOCALL; break;
-	case 0xD4: /* CALL NC */
-		if (!(F&FC)) CALL; else NOCALL; break;
-	case 0xDC: /* CALL C */
-		if (F&FC) CALL; else NOCALL; break;
-
-	case 0xC7: /* RST 0 */
-		RST(0x00); break;
-	case 0xCF: /* RST 8 */
-		RST(0x08); break;
-	case 0xD7: /* RST 10 */
-		RST(0x10); break;
-	case 0xDF: /* RST 18 */
-		RST(0x18); break;
-	case 0xE7: /* RST 20 */
-		RST(0x20); break;
-	case 0xEF: /* RST 28 */
-		RST(0x28); break;
-	case 0xF7: /* RST 30 */
-		RST(0x30); break;
-	case 0xFF: /* RST 38 */
-		RST(0x38); break;
-
-	case 0xC1: /* POP BC */
-		POP(BC); break;
-	case 0xC5: /* PUSH BC */
-		PUSH(BC); break;
-	case 0xD1: /* POP DE */
-		POP(DE); break;
-	case 0xD5: /* PUSH DE */
-		PUSH(DE); break;
-	case 0xE1: /* POP HL */
-		POP(HL); break;
-	case 0xE5: /* PUSH HL */
-		PUSH(HL); break;
-	case 0xF1: /* POP AF */
-		POP(AF); AF &= 0xfff0; break;
-	case 0xF5: /* PUSH AF */
-		PUSH(AF); break;
-
-	case 0xE8: /* ADD SP,imm */
+	OPCODE(0xCD): /* CALL */
+		CALL; NEXT;
+	OPCODE(0xC4): /* CALL NZ */
+		if (!(F&FZ)) CALL; else NOCALL; NEXT;
+	OPCODE(0xCC): /* CALL Z */
+		if (F&FZ) CALL; else NOCALL; NEXT;
+	OPCODE(0xD4): /* CALL NC */
+		if (!(F&FC)) CALL; else NOCALL; NEXT;
+	OPCODE(0xDC): /* CALL C */
+		if (F&FC) CALL; else NOCALL; NEXT;
+
+	OPCODE(0xC7): /* RST 0 */
+		RST(0x00); NEXT;
+	OPCODE(0xCF): /* RST 8 */
+		RST(0x08); NEXT;
+	OPCODE(0xD7): /* RST 10 */
+		RST(0x10); NEXT;
+	OPCODE(0xDF): /* RST 18 */
+		RST(0x18); NEXT;
+	OPCODE(0xE7): /* RST 20 */
+		RST(0x20); NEXT;
+	OPCODE(0xEF): /* RST 28 */
+		RST(0x28); NEXT;
+	OPCODE(0xF7): /* RST 30 */
+		RST(0x30); NEXT;
+	OPCODE(0xFF): /* RST 38 */
+		RST(0x38); NEXT;
+
+	OPCODE(0xC1): /* POP BC */
+		POP(BC); NEXT;
+	OPCODE(0xC5): /* PUSH BC */
+		PUSH(BC); NEXT;
+	OPCODE(0xD1): /* POP DE */
+		POP(DE); NEXT;
+	OPCODE(0xD5): /* PUSH DE */
+		PUSH(DE); NEXT;
+	OPCODE(0xE1): /* POP HL */
+		POP(HL); NEXT;
+	OPCODE(0xE5): /* PUSH HL */
+		PUSH(HL); NEXT;
+	OPCODE(0xF1): /* POP AF */
+		POP(AF); AF &= 0xfff0; NEXT;
+	OPCODE(0xF5): /* PUSH AF */
+		PUSH(AF); NEXT;
+
+	OPCODE(0xE8): /* ADD SP,imm */
 		// https://gammpei.github.io/blog/posts/2018-03-04/how-to-write-a-game-boy-emulator-part-8-blarggs-cpu-test-roms-1-3-4-5-7-8-9-10-11.html
-		b = FETCH; // ADDSP(b); break;
+		b = FETCH; // ADDSP(b); NEXT;
 		temp = SP + (signed char)b;
 
 		F &= ~(FZ | FN | FH | FC);
@@ -785,19 +919,19 @@ next:
 		if ((SP & 0xff) + b > 0xff) F |= FC;
 
 		SP = temp;
-		break;
+		NEXT;
 
-	case 0xF3: /* DI */
+	OPCODE(0xF3): /* DI */
 		DI; break;
-	case 0xFB: /* EI */
+	OPCODE(0xFB): /* EI */
 		EI; break;
 
-	case 0x37: /* SCF */
-		SCF; break;
-	case 0x3F: /* CCF */
-		CCF; break;
+	OPCODE(0x37): /* SCF */
+		SCF; NEXT;
+	OPCODE(0x3F): /* CCF */
+		CCF; NEXT;
 
-	case 0x10: /* STOP */
+	OPCODE(0x10): /* STOP */
 		PC++;
 		if (R_KEY1 & 1)
 		{
@@ -808,7 +942,7 @@ next:
 		/* NOTE - we do not implement dmg STOP whatsoever */
 		break;
 
-	case 0x76: /* HALT */
+	OPCODE(0x76): /* HALT */
 		cpu.halted = 1;
 		if (!IME)
 		{
@@ -816,7 +950,7 @@ next:
 		}
 		break;
 
-	case 0xCB: /* CB prefix */
+	OPCODE(0xCB): /* CB prefix */
 		op = FETCH;
 		clen = cb_cycles_table[op];
 		switch (op)
@@ -835,42 +969,31 @@ next:
 				CB_REG_CASES(b, 6);
 			}
 			if ((op & 0xC0) != 0x40) /* exclude BIT */
-				writeb(HL, b);
+				WRITEB(HL, b);
 			break;
 		}
-		break;
+		NEXT;
 
-	default:
+	OPCODE_DEFAULT:
 		gnuboy_die(
 			"invalid opcode 0x%02X at address 0x%04X, rombank = %d\n",
 			op, (PC-1) & 0xffff, cart.rombank);
 		break;
 	}
+	OPCODE_END
 
 _skip:
 
 	remaining -= clen;
 	count += clen;
 
+_counted:
+
 #if COUNTERS_TICK_PERIOD > 1
 	if (count >= COUNTERS_TICK_PERIOD || remaining <= 0)
 #endif
 	{
-		/* Advance clock-bound counters */
-		timer_advance(count);
-		serial_advance(count);
-
-		if (!cpu.double_speed)
-			count <<= 1;
-
-		/* Advance fixed-speed counters */
-		lcd_emulate(count);
-		snd.cycles += count;
-		// sound_emulate(count);
-
-		// Here we could calculate when the next event is going to happen
-		// So that we can skip even more cycles, but it doesn't seem to save
-		// much more CPU and adds lots of complexity...
+		counters_advance(count);
 		count = 0;
 	}
 
@@ -878,4 +1001,98 @@ _skip:
 		goto next;
 
 	return cycles + -remaining;
+
+_idle_poll:
+	/* LDH A,(LY or STAT); CP/AND d; JR cc back to the LDH. Until the next counter event every
+	   iteration reads the same value and leaves the same A and F, so we only count the cycles and
+	   postpone the ticks until the one that reaches the event. The CPU is left where the loop
+	   would have been at that tick. */
+	{
+		byte reg = readb(spin_pc + 1), alu = readb(spin_pc + 2), a = A, f = F;
+		int lens[3], pending, event, i;
+
+		if (readb(spin_pc) != 0xF0 || (reg != 0x41 && reg != 0x44)
+			|| (alu != 0xFE && alu != 0xE6) || (IME && (R_IF & R_IE)))
+		{
+			JR;
+			goto _skip;
+		}
+
+		/* Run the iteration once on the side, it must not change anything */
+		b = readb(spin_pc + 3);
+		A = REG(reg);
+		if (alu == 0xFE) {
+			CP(b);
+		} else {
+			AND(b);
+		}
+		if (A != a || F != f)
+		{
+			A = a;
+			F = f;
+			JR;
+			goto _skip;
+		}
+
+		lens[0] = cycles_table[0xF0];
+		lens[1] = cycles_table[alu];
+		lens[2] = clen;
+		event = counters_next_event();
+		pending = count;
+
+		for (i = 2;; i = (i + 1) % 3)
+		{
+			remaining -= lens[i];
+			count += lens[i];
+			pending += lens[i];
+			if (count >= COUNTERS_TICK_PERIOD || remaining <= 0)
+			{
+				if (pending >= event || remaining <= 0)
+					break;
+				count = 0;
+			}
+		}
+
+		if (i == 0)
+		{
+			A = REG(reg);
+			PC = spin_pc + 2;
+		}
+		else if (i == 1)
+			PC = spin_pc + 4;
+		else
+			PC = spin_pc;
+		count = pending;
+		goto _counted;
+	}
+
+#ifdef CPU_JUMPTABLE
+/* DEC r; JR NZ. When the jump lands back on the DEC we keep spinning here, ticking the
+   counters as usual, until the register reaches zero or an interrupt becomes pending. */
+#define SPIN_ACCOUNT() \
+	remaining -= clen; count += clen; \
+	if (check || remaining <= 0) goto _counted; \
+	if (count >= COUNTERS_TICK_PERIOD) { \
+		counters_advance(count); \
+		count = 0; \
+		if (cpu.halted || (IME && (R_IF & R_IE))) goto next; \
+	}
+
+_dec_jr_nz:
+	SPIN_ACCOUNT();
+	PC++;
+	clen = cycles_table[0x20];
+	if (F & FZ) {
+		NOJR;
+		NEXT;
+	}
+	JR;
+	if (PC != spin_pc)
+		NEXT;
+	SPIN_ACCOUNT();
+	PC++;
+	clen = cycles_table[0x05];
+	DEC(*spin_reg);
+	goto _dec_jr_nz;
+#endif
 }
@@ -55,6 +55,7 @@ void gnuboy_reset(bool hard)
 void gnuboy_run(bool draw)
 {
 	lcd.out.enabled = draw;
+	lcd.out.pal_bank = -1;
 	snd.output.pos = 0;
 
 	/* FIXME: judging by the time specified this was intended
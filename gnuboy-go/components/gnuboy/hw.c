@@ -119,7 +119,14 @@ static void hw_dma(uint b)
 {
 	uint a = b << 8;
 	for (int i = 0; i < 160; i++, a++)
-		lcd.oam.mem[i] = readb(a);
+	{
+		byte value = readb(a);
+		if (lcd.oam.mem[i] != value)
+		{
+			lcd.oam.mem[i] = value;
+			lcd.changes++;
+		}
+	}
 }
 
 
@@ -271,9 +278,10 @@ void hw_updatemap(void)
 	hw.rmap[0x6] = hw.rmap[0x4];
 	hw.rmap[0x7] = hw.rmap[0x4];
 
-	// Video RAM
-	hw.rmap[0x8] = hw.wmap[0x8] = lcd.vbank[R_VBK & 1] - 0x8000;
-	hw.rmap[0x9] = hw.wmap[0x9] = lcd.vbank[R_VBK & 1] - 0x8000;
+	// Video RAM (writes go through hw_write so that we can track changes)
+	hw.rmap[0x8] = lcd.vbank[R_VBK & 1] - 0x8000;
+	hw.rmap[0x9] = lcd.vbank[R_VBK & 1] - 0x8000;
+	hw.wmap[0x8] = hw.wmap[0x9] = NULL;
 
 	// Cartridge RAM
 	hw.rmap[0xA] = hw.wmap[0xA] = NULL;
@@ -436,7 +444,16 @@ void hw_write(uint a, byte b)
 		break;
 
 	case 0x8000: // Video RAM
-		lcd.vbank[R_VBK&1][a & 0x1FFF] = b;
+		if (lcd.vbank[R_VBK&1][a & 0x1FFF] != b)
+		{
+			lcd.vbank[R_VBK&1][a & 0x1FFF] = b;
+			lcd.changes++;
+			if ((a & 0x1FFF) < 0x1800)
+			{
+				uint tile = (R_VBK & 1) * 384 + ((a & 0x1FFF) >> 4);
+				lcd.patdirty[tile >> 5] |= 1 << (tile & 31);
+			}
+		}
 		break;
 
 	case 0xA000: // Save RAM or RTC
@@ -473,7 +490,11 @@ void hw_write(uint a, byte b)
 		// Video: 0xFE00 - 0xFE9F
 		else if ((a & 0xFF00) == 0xFE00)
 		{
-			if (a < 0xFEA0) lcd.oam.mem[a & 0xFF] = b;
+			if (a < 0xFEA0 && lcd.oam.mem[a & 0xFF] != b)
+			{
+				lcd.oam.mem[a & 0xFF] = b;
+				lcd.changes++;
+			}
 		}
 		// Sound: 0xFF10 - 0xFF3F
 		else if (a >= 0xFF10 && a <= 0xFF3F)
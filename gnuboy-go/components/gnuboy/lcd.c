@@ -85,29 +85,67 @@ gb_lcd_t lcd;
  * Drawing routines
  */
 
+/* Decoded tile data for the 384 tiles of each vram bank, one 16-bit row of 2-bit pixels, leftmost
+   pixel in the low bits (12KB). A tile is decoded again on first use after a write to it
+   (lcd.patdirty). Rows are expanded to one byte per pixel when drawn, four pixels at a time with
+   patexpand (2KB), whose second half has the pixels in reverse order for x-flipped rows. */
+static un16 patcache[2 * 384][8];
+static un32 patexpand[2][256];
+
+static void patexpand_init(void)
+{
+	for (int i = 0; i < 256; ++i)
+	{
+		un32 p0 = i & 3, p1 = (i >> 2) & 3, p2 = (i >> 4) & 3, p3 = (i >> 6) & 3;
+		patexpand[0][i] = p0 | (p1 << 8) | (p2 << 16) | (p3 << 24);
+		patexpand[1][i] = p3 | (p2 << 8) | (p1 << 16) | (p0 << 24);
+	}
+}
+
 __attribute__((optimize("unroll-loops")))
+static void patcache_decode(int index)
+{
+	const byte *vram = lcd.vbank[0] + (index / 384) * 8192 + (index % 384) * 16;
+	un16 *row = patcache[index];
+
+	for (int x = 0; x < 8; ++x, vram += 2)
+	{
+		un16 packed = 0;
+		for (int k = 0; k < 8; ++k)
+		{
+			packed |= (((vram[0] >> k) & 1) | (((vram[1] >> k) & 1) << 1)) << ((7 - k) * 2);
+		}
+		row[x] = packed;
+	}
+
+	lcd.patdirty[index >> 5] &= ~(1 << (index & 31));
+}
+
 static inline byte *get_patpix(int tile, int x)
 {
-	const byte *vram = lcd.vbank[0];
-	static byte pix[8];
+	static un32 pix[2];
+	int index = (tile & 0x1FF) + ((tile & (1 << 9)) ? 384 : 0);
+	un32 row;
+
+	if (lcd.patdirty[index >> 5] & (1 << (index & 31)))
+		patcache_decode(index);
 
 	if (tile & (1 << 11)) // Vertical Flip
-		vram += ((tile & 0x3FF) << 4) | ((7 - x) << 1);
+		row = patcache[index][7 - x];
 	else
-		vram += ((tile & 0x3FF) << 4) | (x << 1);
+		row = patcache[index][x];
 
 	if (tile & (1 << 10)) // Horizontal Flip
-		for (int k = 0; k < 8; ++k)
-		{
-			pix[k] = ((vram[0] >> k) & 1) | (((vram[1] >> k) & 1) << 1);
-		}
+	{
+		pix[0] = patexpand[1][row >> 8];
+		pix[1] = patexpand[1][row & 0xFF];
+	}
 	else
-		for (int k = 0; k < 8; ++k)
-		{
-			pix[7 - k] = ((vram[0] >> k) & 1) | (((vram[1] >> k) & 1) << 1);
-		}
-
-	return pix;
+	{
+		pix[0] = patexpand[0][row & 0xFF];
+		pix[1] = patexpand[0][row >> 8];
+	}
+	return (byte *)pix;
 }
 
 static inline void tilebuf()
@@ -512,6 +550,8 @@ void lcd_reset(bool hard)
 		memset(&lcd.pal, 0, sizeof(lcd.pal));
 	}
 
+	patexpand_init();
+
 	memset(BG, 0, sizeof(BG));
 	memset(WND, 0, sizeof(WND));
 	memset(BUF, 0, sizeof(BUF));
@@ -543,25 +583,34 @@ static inline void pal_update(byte i)
 	}
 
 	lcd.out.cgb_pal[i] = out;
+	lcd.out.pal_dirty = 1;
 }
 
-void pal_write_cgb(byte i, byte b)
+static inline bool pal_write(byte i, byte b)
 {
-	if (lcd.pal[i] == b) return;
+	if (lcd.pal[i] == b) return false;
 	lcd.pal[i] = b;
 	pal_update(i >> 1);
+	return true;
+}
+
+void pal_write_cgb(byte i, byte b)
+{
+	if (pal_write(i, b))
+		lcd.changes++;
 }
 
 void pal_write_dmg(byte i, byte mapnum, byte d)
 {
 	un16 *map = lcd.out.dmg_pal[mapnum & 3];
 
+	// DMG palettes are tracked through their registers in lcd_renderline, no need to count changes
 	for (int j = 0; j < 8; j += 2)
 	{
 		int c = map[(d >> j) & 3];
 		/* FIXME - handle directly without faking cgb */
-		pal_write_cgb(i+j, c & 0xff);
-		pal_write_cgb(i+j+1, c >> 8);
+		pal_write(i+j, c & 0xff);
+		pal_write(i+j+1, c >> 8);
 	}
 }
 
@@ -614,6 +663,10 @@ void lcd_rebuildpal()
 	{
 		pal_update(i);
 	}
+
+	// The palette or the whole state may have changed, nothing can be assumed clean anymore
+	memset(lcd.patdirty, 0xFF, sizeof(lcd.patdirty));
+	lcd.changes++;
 }
 
 
@@ -753,6 +806,41 @@ static inline void lcd_renderline()
 		WT %= 12;
 	}
 
+	// Paletted output: when the palette changes mid-frame the following lines move to a new bank
+	// of the frame's palette, so that the lines already drawn keep their colors
+	if (lcd.out.format == GB_PIXEL_PALETTED && lcd.out.palette
+		&& (lcd.out.pal_bank < 0 || lcd.out.pal_dirty))
+	{
+		if (lcd.out.pal_bank < 3)
+			lcd.out.pal_bank++;
+		else
+			lcd.out.pal_overflow++;
+		memcpy(lcd.out.palette + lcd.out.pal_bank * 64, lcd.out.cgb_pal, sizeof(lcd.out.cgb_pal));
+		lcd.out.pal_dirty = 0;
+	}
+	int bank = lcd.out.palette ? lcd.out.pal_bank : 0;
+
+	// If nothing that affects this line changed since we last drew it, tell the frontend
+	if (lcd.out.clean_lines)
+	{
+		un32 regs0 = R_SCX | (R_SCY << 8) | (R_LCDC << 16) | (R_WX << 24);
+		un32 regs1 = (WY & 0xFF) | (R_BGP << 8) | (R_OBP0 << 16) | (R_OBP1 << 24);
+
+		if (lcd.lines[SL].changes == lcd.changes && lcd.lines[SL].regs[0] == regs0
+			&& lcd.lines[SL].regs[1] == regs1 && lcd.lines[SL].pal_bank == bank)
+		{
+			lcd.out.clean_lines[SL >> 5] |= 1 << (SL & 31);
+		}
+		else
+		{
+			lcd.out.clean_lines[SL >> 5] &= ~(1 << (SL & 31));
+			lcd.lines[SL].changes = lcd.changes;
+			lcd.lines[SL].regs[0] = regs0;
+			lcd.lines[SL].regs[1] = regs1;
+			lcd.lines[SL].pal_bank = bank;
+		}
+	}
+
 	NS = spr_enum();
 	tilebuf();
 
@@ -777,15 +865,25 @@ static inline void lcd_renderline()
 
 	if (lcd.out.format == GB_PIXEL_PALETTED)
 	{
-		memcpy(lcd.out.buffer + SL * 160 , BUF, 160);
+		un32 *dst = (un32*)(lcd.out.buffer + SL * 160);
+		un32 *src = (un32*)BUF;
+		un32 offset = bank * 0x40404040;
+
+		for (int i = 0; i < 40; ++i)
+			dst[i] = src[i] | offset;
 	}
 	else
 	{
-		un16 *dst = (un16*)lcd.out.buffer + SL * 160;
-		un16 *pal = (un16*)lcd.out.cgb_pal;
+		// Two pixels per store
+		un32 *dst = (un32*)(lcd.out.buffer + SL * 320);
+		un16 *pal = lcd.out.cgb_pal;
 
-		for (int i = 0; i < 160; ++i)
-			dst[i] = pal[BUF[i]];
+		for (int i = 0; i < 160; i += 2)
+#ifdef IS_LITTLE_ENDIAN
+			*dst++ = pal[BUF[i]] | ((un32)pal[BUF[i + 1]] << 16);
+#else
+			*dst++ = ((un32)pal[BUF[i]] << 16) | pal[BUF[i + 1]];
+#endif
 	}
 }
 
@@ -887,7 +985,11 @@ void lcd_emulate(int cycles)
 			break;
 		case 2:
 			/* search -> */
+			if (lcd.out.render_hook)
+				lcd.out.render_hook(1);
 			lcd_renderline();
+			if (lcd.out.render_hook)
+				lcd.out.render_hook(0);
 			stat_change(3); /* -> transfer */
 			CYCLES += 86;
 			break;
@@ -38,8 +38,26 @@ typedef struct
 	// Fix for Fushigi no Dungeon - Fuurai no Shiren GB2 and Donkey Kong
 	int enable_window_offset_hack;
 
+	// Tiles (bank * 384 + tile) whose data changed since they were last decoded
+	un32 patdirty[2 * 384 / 32];
+
+	// Bumped whenever vram, oam or cgb palettes are modified. Along with the registers
+	// it lets us know if a line will render exactly like it did in the previous frame.
+	un32 changes;
+	struct {
+		un32 regs[2];
+		un32 changes;
+		int pal_bank;
+	} lines[144];
+
 	struct {
 		byte *buffer;
+		un32 *clean_lines; // Optional bitmap, bits are set for lines identical to the previous frame
+		void (*render_hook)(int begin); // Optional, called around each scanline render for profiling
+		un16 *palette;     // GB_PIXEL_PALETTED: the frame's colors, up to 4 banks of cgb_pal (256 entries)
+		int pal_bank;      // Bank of the lines drawn so far in this frame, -1 before the first one
+		int pal_dirty;     // cgb_pal changed since it was copied to the bank
+		int pal_overflow;  // Palette changes that didn't fit in the banks, earlier lines got the new colors
 		un16 cgb_pal[64];
 		un16 dmg_pal[4][4];
 		int colorize;
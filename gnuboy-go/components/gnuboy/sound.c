@@ -194,6 +194,9 @@ void sound_emulate(void)
 	if (!snd.rate || snd.cycles < snd.rate)
 		return;
 
+	if (snd.output.mix_hook)
+		snd.output.mix_hook(1);
+
 	for (; snd.cycles >= snd.rate; snd.cycles -= snd.rate)
 	{
 		int l = 0;
@@ -339,6 +342,9 @@ void sound_emulate(void)
 		}
 	}
 	R_NR52 = (R_NR52&0xf0) | S1.on | (S2.on<<1) | (S3.on<<2) | (S4.on<<3);
+
+	if (snd.output.mix_hook)
+		snd.output.mix_hook(0);
 }
 
 void sound_write(byte r, byte b)
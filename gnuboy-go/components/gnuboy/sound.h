@@ -10,6 +10,7 @@ typedef struct
 	struct {
 		int pos, len;
 		n16* buf;
+		void (*mix_hook)(int begin); // Optional, called around sample mixing for profiling
 	} output;
 
 	int rate, cycles;
@@ -215,12 +215,51 @@ static void settings_handler(void)
 static void vblank_callback(void)
 {
     rg_video_update_t *previousUpdate = &updates[currentUpdate == &updates[0]];
+    rg_video_update_t *nextUpdate = previousUpdate;
 
-    fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
+    if (lcd.out.pal_overflow)
+    {
+        // More mid-frame palette changes than the frame's palette can hold (raster effects), this
+        // frame has wrong colors. Drop it and stay on direct color from now on.
+        RG_LOGI("Too many palette changes in a frame, switching to RGB565 output\n");
+        lcd.out.pal_overflow = 0;
+        lcd.out.format = GB_PIXEL_565_BE;
+        lcd_rebuildpal();
+        rg_display_set_source_format(GB_WIDTH, GB_HEIGHT, 0, 0, GB_WIDTH * 2, RG_PIXEL_565_BE);
+        nextUpdate = currentUpdate;
+    }
+    else
+    {
+        if (lcd.out.format == GB_PIXEL_PALETTED)
+        {
+            // The core copies its palette to the banks used by the frame in native order
+            int colors = (lcd.out.pal_bank + 1) * 64;
+            uint16_t *palette = currentUpdate->palette;
+            for (int i = 0; i < colors; i++)
+                palette[i] = (palette[i] << 8) | (palette[i] >> 8);
+
+            // Same indexes don't mean same colors anymore
+            if (memcmp(palette, previousUpdate->palette, colors * 2) != 0)
+                previousUpdate = NULL;
+        }
+
+        fullFrame = rg_display_queue_update(currentUpdate, previousUpdate) == RG_UPDATE_FULL;
+    }
 
     // swap buffers
-    currentUpdate = previousUpdate;
+    currentUpdate = nextUpdate;
     lcd.out.buffer = currentUpdate->buffer;
+    // Direct color frames have no palette, the core must not keep filling one
+    lcd.out.palette = lcd.out.format == GB_PIXEL_PALETTED ? currentUpdate->palette : NULL;
+    lcd.out.clean_lines = currentUpdate->clean_lines;
+
+    // Lines that won't be drawn (lcd off) must not keep the previous frame's hints
+    memset(currentUpdate->clean_lines, 0, sizeof(currentUpdate->clean_lines));
+}
+
+static void render_hook(int begin)
+{
+    rg_system_set_phase(begin ? RG_PHASE_RENDER : RG_PHASE_EMULATE);
 }
 
 static void auto_sram_update(void)
@@ -249,10 +288,11 @@ void app_main(void)
 
     app = rg_system_init(AUDIO_SAMPLE_RATE, &handlers);
 
+    // Room for 565 in case a game changes its palette too often for paletted frames
     updates[0].buffer = rg_alloc(GB_WIDTH * GB_HEIGHT * 2, MEM_ANY);
     updates[1].buffer = rg_alloc(GB_WIDTH * GB_HEIGHT * 2, MEM_ANY);
 
-    rg_display_set_source_format(GB_WIDTH, GB_HEIGHT, 0, 0, GB_WIDTH * 2, RG_PIXEL_565_BE);
+    rg_display_set_source_format(GB_WIDTH, GB_HEIGHT, 0, 0, GB_WIDTH, RG_PIXEL_PAL565_BE);
 
     autoSaveSRAM = rg_settings_get_app_int32(SETTING_SAVESRAM, 0);
     sramFile = rg_emu_get_path(RG_PATH_SAVE_SRAM, 0);
@@ -261,7 +301,8 @@ void app_main(void)
         RG_LOGW("Unable to create SRAM folder...");
 
     // Initialize the emulator
-    gnuboy_init(AUDIO_SAMPLE_RATE, true, GB_PIXEL_565_BE, vblank_callback);
+    gnuboy_init(AUDIO_SAMPLE_RATE, true, GB_PIXEL_PALETTED, vblank_callback);
+    lcd.out.render_hook = render_hook;
 
     // Load ROM
     if (gnuboy_load_rom(app->romPath) < 0)
@@ -321,7 +362,9 @@ void app_main(void)
         int64_t startTime = get_elapsed_time();
         bool drawFrame = !skipFrames;
 
+        rg_system_set_phase(RG_PHASE_EMULATE);
         gnuboy_run(drawFrame);
+        rg_system_set_phase(RG_PHASE_NONE);
 
         // if (rtc.dirty)
         // {
@@ -7,6 +7,7 @@
 #include "bookmarks.h"
 #include "images.h"
 #include "gui.h"
+#include "preview.h"
 
 static book_t books[BOOK_TYPE_COUNT];
 
@@ -47,10 +48,8 @@ static void event_handler(gui_event_t event, tab_t *tab)
     }
     else if (event == TAB_IDLE)
     {
-        if (file && gui.show_preview && gui.idle_counter == (gui.show_preview_fast ? 1 : 8))
+        if (file && gui.show_preview && gui.idle_counter >= (gui.show_preview_fast ? 1 : 8))
             gui_draw_preview(tab, file);
-        else if ((gui.idle_counter % 100) == 0)
-            crc_cache_idle_task(tab);
     }
     else if (event == KEY_PRESS_A)
     {
@@ -217,11 +216,15 @@ bool bookmark_add(book_type_t book, retro_emulator_file_t *file)
     // code decide what to do, but deleting the old entry is simpler for most book types who try
     // to update something... For the RECENT type we also don't want to disturb the order
     retro_emulator_file_t *bookmark;
+
+    // book_append() may move the items the preview worker is using
+    preview_suspend();
     while ((bookmark = bookmark_find(book, file)))
         bookmark->is_valid = false;
-
     book_append(book, file);
     tab_refresh(book);
+    preview_resume();
+
     book_save(book);
 
     return true;
@@ -243,7 +246,10 @@ bool bookmark_remove(book_type_t book, retro_emulator_file_t *file)
     if (found == 0)
         return false;
 
+    preview_suspend();
     tab_refresh(book);
+    preview_resume();
+
     book_save(book);
 
     return true;
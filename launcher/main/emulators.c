@@ -1,3 +1,5 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <rg_system.h>
 #include <sys/stat.h>
 #include <dirent.h>
@@ -8,177 +10,359 @@
 #include <errno.h>
 
 #include "emulators.h"
+#include "library.h"
 #include "bookmarks.h"
 #include "images.h"
 #include "gui.h"
+#include "preview.h"
 
 static retro_emulator_t emulators[32];
 static int emulators_count = 0;
 static retro_crc_cache_t *crc_cache;
-static bool crc_cache_dirty = false;
+static SemaphoreHandle_t crc_cache_lock; // The preview worker also uses the cache and inits emulators
 
+#define LOCK_CACHE()   xSemaphoreTakeRecursive(crc_cache_lock, portMAX_DELAY)
+#define UNLOCK_CACHE() xSemaphoreGiveRecursive(crc_cache_lock)
 
-void crc_cache_init(void)
+
+// The library doesn't stat files when scanning (see library.h), it's done on first use
+static bool emulator_stat_file(retro_emulator_file_t *file)
 {
-    crc_cache = calloc(1, sizeof(retro_crc_cache_t));
-    crc_cache_dirty = true;
+    char path[PATH_MAX + 1];
+    struct stat st;
 
-    if (!crc_cache)
+    if (file->size || file->mtime)
+        return true;
+
+    snprintf(path, sizeof(path), "%s/%s", file->folder, file->name);
+    if (stat(path, &st) != 0)
+        return false;
+
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    if (file->emulator->library)
+        file->emulator->library->dirty = true;
+
+    return true;
+}
+
+static uint32_t crc_cache_calc_key(retro_emulator_file_t *file)
+{
+    const char *system = file->emulator->short_name;
+    uint32_t key = crc32_le(0, (const uint8_t *)system, strlen(system));
+    key = crc32_le(key, (const uint8_t *)file->folder, strlen(file->folder));
+    key = crc32_le(key, (const uint8_t *)"/", 1);
+    return crc32_le(key, (const uint8_t *)file->name, strlen(file->name));
+}
+
+static size_t crc_cache_find_slot(uint32_t key)
+{
+    size_t pos = key & (CRC_CACHE_TABLE_SIZE - 1);
+
+    while (crc_cache->table[pos] && crc_cache->entries[crc_cache->table[pos] - 1].key != key)
+        pos = (pos + 1) & (CRC_CACHE_TABLE_SIZE - 1);
+
+    return pos;
+}
+
+// Backward shift deletion, linear probing doesn't need tombstones
+static void crc_cache_remove_slot(size_t pos)
+{
+    const size_t mask = CRC_CACHE_TABLE_SIZE - 1;
+    size_t next = pos;
+
+    crc_cache->table[pos] = 0;
+
+    while (crc_cache->table[next = (next + 1) & mask])
     {
-        RG_LOGE("Failed to allocate crc_cache!\n");
-        return;
+        size_t home = crc_cache->entries[crc_cache->table[next] - 1].key & mask;
+        if (((next - home) & mask) >= ((next - pos) & mask))
+        {
+            crc_cache->table[pos] = crc_cache->table[next];
+            crc_cache->table[next] = 0;
+            pos = next;
+        }
     }
+}
 
-    FILE *fp = fopen(CRC_CACHE_PATH, "rb");
-    if (fp)
-    {
-        fread(crc_cache, offsetof(retro_crc_cache_t, entries), 1, fp);
+static void crc_cache_unlink(uint16_t index)
+{
+    uint16_t prev = crc_cache->links[index].prev;
+    uint16_t next = crc_cache->links[index].next;
+
+    if (prev != CRC_CACHE_NONE)
+        crc_cache->links[prev].next = next;
+    else
+        crc_cache->head = next;
+
+    if (next != CRC_CACHE_NONE)
+        crc_cache->links[next].prev = prev;
+    else
+        crc_cache->tail = prev;
+}
+
+static void crc_cache_push_front(uint16_t index)
+{
+    crc_cache->links[index].prev = CRC_CACHE_NONE;
+    crc_cache->links[index].next = crc_cache->head;
+
+    if (crc_cache->head != CRC_CACHE_NONE)
+        crc_cache->links[crc_cache->head].prev = index;
+    else
+        crc_cache->tail = index;
+
+    crc_cache->head = index;
+}
 
-        if (crc_cache->magic == CRC_CACHE_MAGIC && crc_cache->count <= CRC_CACHE_MAX_ENTRIES)
+// Inserts or replaces, evicting the least recently used entry when full
+static void crc_cache_put(const retro_crc_entry_t *record)
+{
+    size_t pos = crc_cache_find_slot(record->key);
+    uint16_t index;
+
+    if (crc_cache->table[pos])
+    {
+        index = crc_cache->table[pos] - 1;
+        crc_cache_unlink(index);
+    }
+    else
+    {
+        if (crc_cache->count < CRC_CACHE_MAX_ENTRIES)
         {
-            RG_LOGI("Loaded CRC cache (entries: %d)\n", crc_cache->count);
-            fread(crc_cache->entries, crc_cache->count, sizeof(crc_cache->entries), fp);
-            crc_cache_dirty = false;
+            index = crc_cache->count++;
         }
         else
         {
-            crc_cache->count = 0;
+            index = crc_cache->tail;
+            crc_cache_unlink(index);
+            crc_cache_remove_slot(crc_cache_find_slot(crc_cache->entries[index].key));
+            pos = crc_cache_find_slot(record->key);
         }
-        fclose(fp);
+        crc_cache->table[pos] = index + 1;
     }
+
+    crc_cache->entries[index] = *record;
+    crc_cache_push_front(index);
 }
 
-static uint32_t crc_cache_calc_key(retro_emulator_file_t *file)
+void crc_cache_init(void)
 {
-    // return ((uint64_t)crc32_le(0, (void *)file->name, strlen(file->name)) << 33 | file->size);
-    // This should be reasonably unique
-    return crc32_le(0, (void *)file->name, strlen(file->name));
+    retro_crc_entry_t records[64];
+    uint32_t magic = 0;
+    size_t count;
+
+    crc_cache = rg_alloc(sizeof(retro_crc_cache_t), MEM_SLOW);
+    crc_cache_lock = xSemaphoreCreateRecursiveMutex();
+    crc_cache->head = crc_cache->tail = CRC_CACHE_NONE;
+    crc_cache->journal_damaged = true;
+
+    FILE *fp = fopen(CRC_CACHE_PATH, "rb");
+    if (!fp)
+    {
+        // The previous format can't be converted, it only had a hash of the file name
+        unlink(CRC_CACHE_LEGACY_PATH);
+        return;
+    }
+
+    if (fread(&magic, sizeof(magic), 1, fp) == 1 && magic == CRC_CACHE_MAGIC)
+    {
+        // Records are replayed oldest first, which also rebuilds the LRU order
+        while ((count = fread(records, sizeof(retro_crc_entry_t), 64, fp)) > 0)
+        {
+            for (size_t i = 0; i < count; i++)
+                crc_cache_put(&records[i]);
+            crc_cache->journal_records += count;
+        }
+        // A partial record at the end means an append was interrupted
+        crc_cache->journal_damaged = ftell(fp) != sizeof(magic) + crc_cache->journal_records * sizeof(retro_crc_entry_t);
+    }
+
+    fclose(fp);
+
+    RG_LOGI("Loaded CRC cache (entries: %d, journal: %d%s)\n", (int)crc_cache->count,
+        (int)crc_cache->journal_records, crc_cache->journal_damaged ? ", damaged" : "");
 }
 
 uint32_t crc_cache_lookup(retro_emulator_file_t *file)
 {
-    uint32_t key = crc_cache_calc_key(file);
+    uint32_t crc = 0;
 
-    if (!crc_cache)
+    if (!crc_cache || !emulator_stat_file(file))
         return 0;
 
-    for (int i = 0; i < crc_cache->count; i++)
+    LOCK_CACHE();
+
+    size_t pos = crc_cache_find_slot(crc_cache_calc_key(file));
+    if (crc_cache->table[pos])
     {
-        if (crc_cache->entries[i].key == key)
-            return crc_cache->entries[i].crc;
+        uint16_t index = crc_cache->table[pos] - 1;
+        retro_crc_entry_t *entry = &crc_cache->entries[index];
+        if (entry->size == file->size && entry->mtime == file->mtime)
+        {
+            crc_cache_unlink(index);
+            crc_cache_push_front(index);
+            crc = entry->crc;
+        }
     }
 
-    return 0;
+    UNLOCK_CACHE();
+
+    return crc;
 }
 
-void crc_cache_save(void)
+// Appends the pending records, the journal is rewritten from the live entries when it has
+// grown to twice their maximum or when it can't be appended to.
+static bool crc_cache_write_journal(void)
 {
-    if (!crc_cache || !crc_cache_dirty)
-        return;
+    uint32_t magic = CRC_CACHE_MAGIC;
+    bool success = false;
+    FILE *fp;
 
-    RG_LOGI("Saving cache\n");
+    if (!crc_cache->journal_damaged
+        && crc_cache->journal_records + crc_cache->pending_count <= CRC_CACHE_MAX_ENTRIES * 2)
+    {
+        if ((fp = fopen(CRC_CACHE_PATH, "ab")))
+        {
+            success = fwrite(crc_cache->pending, sizeof(retro_crc_entry_t), crc_cache->pending_count, fp)
+                        == crc_cache->pending_count;
+            success = (fclose(fp) == 0) && success;
+        }
+        if (success)
+        {
+            crc_cache->journal_records += crc_cache->pending_count;
+            return true;
+        }
+        RG_LOGW("Append failed, rewriting the CRC cache.\n");
+    }
 
-    FILE *fp = fopen(CRC_CACHE_PATH, "wb");
-    if (fp)
+    if ((fp = fopen(CRC_CACHE_PATH ".new", "wb")))
     {
-        size_t unused = CRC_CACHE_MAX_ENTRIES - RG_MIN(crc_cache->count, CRC_CACHE_MAX_ENTRIES);
-        size_t minsize = sizeof(retro_crc_cache_t) - (unused * sizeof(retro_crc_entry_t));
+        setvbuf(fp, NULL, _IOFBF, 0x1000);
+        success = fwrite(&magic, sizeof(magic), 1, fp) == 1;
+        for (uint16_t i = crc_cache->tail; success && i != CRC_CACHE_NONE; i = crc_cache->links[i].prev)
+            success = fwrite(&crc_cache->entries[i], sizeof(retro_crc_entry_t), 1, fp) == 1;
+        success = (fclose(fp) == 0) && success;
+    }
 
-        fwrite(crc_cache, minsize, 1, fp);
-        fclose(fp);
-        crc_cache_dirty = false;
+    if (success)
+    {
+        unlink(CRC_CACHE_PATH);
+        success = rename(CRC_CACHE_PATH ".new", CRC_CACHE_PATH) == 0;
     }
+
+    crc_cache->journal_records = crc_cache->count;
+    crc_cache->journal_damaged = !success;
+
+    return success;
 }
 
-void crc_cache_update(retro_emulator_file_t *file)
+void crc_cache_save(void)
 {
-    uint32_t key = crc_cache_calc_key(file);
-    size_t index = 0;
+    char path[PATH_MAX + 1];
 
     if (!crc_cache)
         return;
 
-    if (crc_cache->count < CRC_CACHE_MAX_ENTRIES)
-        index = crc_cache->count++;
-    else
-        index = rand() % CRC_CACHE_MAX_ENTRIES;
+    LOCK_CACHE();
 
-    crc_cache->magic = CRC_CACHE_MAGIC;
-    crc_cache->entries[index].key = key;
-    crc_cache->entries[index].crc = file->checksum;
-    crc_cache_dirty = true;
+    // The library indexes also hold computed CRCs and deleted files
+    for (int i = 0; i < emulators_count; i++)
+    {
+        library_t *lib = emulators[i].library;
+        if (lib && lib->dirty)
+        {
+            snprintf(path, sizeof(path), LIBRARY_INDEX_PATH, emulators[i].short_name);
+            if (!library_save(lib, path))
+                RG_LOGE("Failed to save library index '%s'\n", path);
+        }
+    }
 
-    RG_LOGI("Adding %08X => %08X to cache (new total: %d)\n",
-        key, file->checksum, crc_cache->count);
+    if (crc_cache->pending_count > 0)
+    {
+        RG_LOGI("Saving cache\n");
+
+        if (crc_cache_write_journal())
+            crc_cache->pending_count = 0;
+        else
+            RG_LOGE("Failed to write the CRC cache.\n");
+    }
 
-    // crc_cache_save();
+    UNLOCK_CACHE();
 }
 
-void crc_cache_idle_task(tab_t *tab)
+void crc_cache_update(retro_emulator_file_t *file)
 {
-    if (!crc_cache)
+    if (!crc_cache || !emulator_stat_file(file))
         return;
 
-    if (gui.idle_counter >= 2000 && crc_cache->count < CRC_CACHE_MAX_ENTRIES)
-    {
-        int start_offset = 0;
-        int remaining = 20;
+    retro_crc_entry_t record = {crc_cache_calc_key(file), file->size, file->mtime, file->checksum};
 
-        // Find the currently focused emulator, if any
-        for (int i = 0; i < emulators_count; i++)
-        {
-            if (tab && tab->arg == &emulators[i])
-            {
-                start_offset = i;
-                break;
-            }
-        }
+    LOCK_CACHE();
 
-        for (int i = 0; i < emulators_count && remaining > 0; i++)
-        {
-            retro_emulator_t *emulator = &emulators[(start_offset + i) % emulators_count];
-            int processed = 0;
+    crc_cache_put(&record);
 
-            if (emulator->crc_scan_done)
-                continue;
+    if (crc_cache->pending_count == CRC_CACHE_PENDING)
+        crc_cache_save();
 
-            gui_set_status(tab, "BUILDING CACHE...", "SCANNING");
-            gui_draw_status(tab);
+    // If that save failed the journal is marked damaged and its rewrite will include this entry
+    if (crc_cache->pending_count < CRC_CACHE_PENDING)
+        crc_cache->pending[crc_cache->pending_count++] = record;
 
-            if (!emulator->initialized)
-                emulator_init(emulator);
+    RG_LOGI("Adding %08X => %08X to cache (new total: %d)\n",
+        record.key, file->checksum, (int)crc_cache->count);
 
-            for (int j = 0; j < emulator->roms.files_count && remaining > 0; j++)
-            {
-                retro_emulator_file_t *file = &emulator->roms.files[j];
+    UNLOCK_CACHE();
+}
 
-                if (file->checksum == 0)
-                    file->checksum = crc_cache_lookup(file);
+// One step of the background CRC scan: computes at most one CRC, starting with the system
+// given as a hint (the current tab's). Returns false once every system is done.
+bool crc_cache_background_step(const void *hint, bool (*should_stop)(void *arg), void *arg)
+{
+    int start_offset = 0;
 
-                if (file->checksum == 0 && emulator_get_file_crc32(file))
-                {
-                    processed++;
-                    remaining--;
-                }
+    if (!crc_cache)
+        return false;
 
-                if (gui.joystick & RG_KEY_ANY)
-                    remaining = -1;
-            }
+    for (int i = 0; i < emulators_count; i++)
+    {
+        if (hint == &emulators[i])
+            start_offset = i;
+    }
 
-            if (processed == 0 && remaining != -1)
-                emulator->crc_scan_done = true;
+    for (int i = 0; i < emulators_count; i++)
+    {
+        retro_emulator_t *emulator = &emulators[(start_offset + i) % emulators_count];
 
-            gui_set_status(tab, "", "");
-            gui_draw_status(tab);
+        if (emulator->crc_scan_done)
+            continue;
+
+        emulator_init(emulator);
+
+        while (emulator->crc_scan_next < emulator->roms.files_count)
+        {
+            retro_emulator_file_t *file = &emulator->roms.files[emulator->crc_scan_next];
+
+            if (file->is_valid && file->checksum == 0)
+            {
+                // Unreadable files are skipped, interrupted ones are tried again
+                if (!emulator_compute_crc32(file, should_stop, arg) && should_stop && should_stop(arg))
+                    return true;
+                emulator->crc_scan_next++;
+                return true;
+            }
+
+            emulator->crc_scan_next++;
         }
+
+        emulator->crc_scan_done = true;
     }
 
-    crc_cache_save();
+    return false;
 }
 
+// Only used for bookmarks, the library keeps its own folders
 static const char *roms_folder(retro_emulator_t *emu, const char* path)
 {
-    // To do : use hashmap or something faster
     for (int i = 0; i < emu->roms.folders_count; i++)
     {
         if (strcmp(emu->roms.folders[i], path) == 0)
@@ -240,67 +424,33 @@ int emulator_scan_folder(retro_emulator_t *emu, const char* path, int flags)
 {
     RG_ASSERT(emu && path, "Bad param");
 
-    RG_LOGI("Scanning directory %s\n", path);
+    char index_path[PATH_MAX + 1];
+    int64_t start_time = get_elapsed_time();
 
-    DIR* dir = opendir(path);
-    if (!dir)
-        return -1;
+    snprintf(index_path, sizeof(index_path), LIBRARY_INDEX_PATH, emu->short_name);
 
-    const char *folder = roms_folder(emu, path);
-    char pathbuf[PATH_MAX + 1];
-    struct dirent* ent;
-
-    while ((ent = readdir(dir)))
+    if (!emu->library)
     {
-        const char *name = ent->d_name;
+        emu->library = calloc(1, sizeof(library_t));
+        RG_ASSERT(emu->library, "alloc failed");
+        library_init(emu->library, path, emu);
+        if (!library_load(emu->library, index_path))
+            RG_LOGI("No valid library index for %s, full scan\n", emu->short_name);
+    }
 
-        if (name[0] == '.')
-            continue;
+    library_t *lib = emu->library;
 
-        if (ent->d_type == DT_REG)
-        {
-            const char *ext = strrchr(name, '.') + 1;
-            const char **emu_ext = emu->extensions;
-            bool ext_match = false;
-
-            while (ext > name && *emu_ext && !ext_match)
-            {
-                ext_match = strcasecmp(ext, *emu_ext++) == 0;
-            }
+    library_scan(lib, flags);
 
-            if (!ext_match)
-                continue;
+    emu->roms.files = lib->files;
+    emu->roms.files_count = lib->files_count;
 
-            if ((emu->roms.files_count % 10) == 0)
-            {
-                size_t new_size = (emu->roms.files_count + 10 + 2) * sizeof(retro_emulator_file_t);
-                retro_emulator_file_t *new_buf = realloc(emu->roms.files, new_size);
-                if (!new_buf)
-                {
-                    RG_LOGW("Ran out of memory, file scanning stopped at %d entries ...\n", emu->roms.files_count);
-                    break;
-                }
-                emu->roms.files = new_buf;
-            }
-
-            retro_emulator_file_t *file = &emu->roms.files[emu->roms.files_count++];
-            *file = (retro_emulator_file_t) {
-                .name = strdup(name), // TO DO: Use a memory pool instead?
-                .folder = folder,
-                .emulator = (void*)emu,
-                .is_valid = true,
-            };
-        }
-        else if (ent->d_type == DT_DIR)
-        {
-            strcpy(pathbuf, path);
-            strcat(pathbuf, "/");
-            strcat(pathbuf, name);
-            emulator_scan_folder(emu, pathbuf, flags);
-        }
-    }
+    RG_LOGI("Library %s: %d files, %d folders (%d rescanned) in %dms\n", emu->short_name,
+        (int)lib->files_count, (int)lib->folders_count, (int)lib->stats.folders_scanned,
+        (int)((get_elapsed_time() - start_time) / 1000));
 
-    closedir(dir);
+    if (lib->dirty && !library_save(lib, index_path))
+        RG_LOGE("Failed to save library index '%s'\n", index_path);
 
     return 0;
 }
@@ -309,6 +459,9 @@ static void tab_refresh(tab_t *tab)
 {
     retro_emulator_t *emu = (retro_emulator_t *)tab->arg;
 
+    // Files may have been dropped or replaced since the previews were made
+    preview_suspend();
+
     memset(&tab->status, 0, sizeof(tab->status));
 
     size_t base_len = strlen(RG_BASE_PATH_ROMS) + 1 + strlen(emu->short_name);
@@ -360,6 +513,8 @@ static void tab_refresh(tab_t *tab)
         sprintf(tab->listbox.items[4].text, "Use SELECT and START to navigate.");
         tab->listbox.cursor = 3;
     }
+
+    preview_resume();
 }
 
 static void event_handler(gui_event_t event, tab_t *tab)
@@ -399,10 +554,8 @@ static void event_handler(gui_event_t event, tab_t *tab)
     }
     else if (event == TAB_IDLE)
     {
-        if (file && gui.show_preview && gui.idle_counter == (gui.show_preview_fast ? 1 : 8))
+        if (file && gui.show_preview && gui.idle_counter >= (gui.show_preview_fast ? 1 : 8))
             gui_draw_preview(tab, file);
-        else if ((gui.idle_counter % 100) == 0)
-            crc_cache_idle_task(tab);
     }
     else if (event == KEY_PRESS_A)
     {
@@ -434,8 +587,6 @@ static void add_emulator(const char *system_name, const char *short_name, const
         .short_name = strdup(short_name),
         .crc_offset = crc_offset,
         .roms.folders = calloc(1, sizeof(char *)),
-        // .roms.files = calloc(10, sizeof(retro_emulator_file_t *)),
-        .roms.files = calloc(10, sizeof(retro_emulator_file_t)),
         .initialized = false,
     };
 
@@ -464,9 +615,21 @@ void emulator_init(retro_emulator_t *emu)
     if (emu->initialized)
         return;
 
-    RG_LOGI("Initializing emulator '%s'\n", emu->system_name);
+    // The scan replaces the files array. The worker takes its job lock before the cache lock,
+    // so must we.
+    preview_suspend();
 
-    emu->initialized = true;
+    // The preview worker may be initializing it for its background scan
+    LOCK_CACHE();
+
+    if (emu->initialized)
+    {
+        UNLOCK_CACHE();
+        preview_resume();
+        return;
+    }
+
+    RG_LOGI("Initializing emulator '%s'\n", emu->system_name);
 
     sprintf(path, RG_BASE_PATH_SAVES "/%s", emu->short_name);
     rg_mkdir(path);
@@ -475,6 +638,11 @@ void emulator_init(retro_emulator_t *emu)
     rg_mkdir(path);
 
     emulator_scan_folder(emu, path, 0);
+
+    emu->initialized = true;
+
+    UNLOCK_CACHE();
+    preview_resume();
 }
 
 const char *emulator_get_file_path(retro_emulator_file_t *file)
@@ -487,8 +655,11 @@ const char *emulator_get_file_path(retro_emulator_file_t *file)
     return (const char*)buffer;
 }
 
-bool emulator_get_file_crc32(retro_emulator_file_t *file)
+// Safe to call from the preview worker. should_stop is polled between chunks, if it returns
+// true the computation is abandoned and false is returned.
+bool emulator_compute_crc32(retro_emulator_file_t *file, bool (*should_stop)(void *arg), void *arg)
 {
+    char path[PATH_MAX + 1];
     uint8_t buffer[0x1000];
     uint32_t crc_tmp = 0;
     int count = -1;
@@ -503,41 +674,69 @@ bool emulator_get_file_crc32(retro_emulator_file_t *file)
     if ((crc_tmp = crc_cache_lookup(file)))
     {
         file->checksum = crc_tmp;
+        return true;
     }
-    else
+
+    snprintf(path, sizeof(path), "%s/%s", file->folder, file->name);
+
+    if ((fp = fopen(path, "rb")))
     {
-        tab_t *tab = gui_get_current_tab();
-        gui_set_status(tab, NULL, "CRC32...");
-        gui_draw_status(tab);
+        fseek(fp, file->emulator->crc_offset, SEEK_SET);
 
-        if ((fp = fopen(emulator_get_file_path(file), "rb")))
+        while (count != 0)
         {
-            fseek(fp, file->emulator->crc_offset, SEEK_SET);
+            if (should_stop && should_stop(arg))
+                break;
 
-            while (count != 0)
-            {
-                gui.joystick = rg_input_read_gamepad();
+            count = fread(buffer, 1, sizeof(buffer), fp);
+            crc_tmp = crc32_le(crc_tmp, buffer, count);
+        }
 
-                if (gui.joystick & RG_KEY_ANY)
-                    break;
+        if (feof(fp))
+        {
+            file->checksum = crc_tmp;
+            crc_cache_update(file);
+            if (file->emulator->library)
+                file->emulator->library->dirty = true;
+        }
 
-                count = fread(buffer, 1, sizeof(buffer), fp);
-                crc_tmp = crc32_le(crc_tmp, buffer, count);
-            }
+        fclose(fp);
+    }
 
-            if (feof(fp))
-            {
-                file->checksum = crc_tmp;
-                crc_cache_update(file);
-            }
+    return file->checksum > 0;
+}
 
-            fclose(fp);
-        }
+static bool stop_on_key_press(void *arg)
+{
+    gui.joystick = rg_input_read_gamepad();
+    return (gui.joystick & RG_KEY_ANY) != 0;
+}
 
-        gui_set_status(tab, NULL, "");
-        gui_draw_status(tab);
+bool emulator_get_file_crc32(retro_emulator_file_t *file)
+{
+    uint32_t crc_tmp;
+
+    if (file == NULL)
+        return false;
+
+    if (file->checksum > 0)
+        return true;
+
+    if ((crc_tmp = crc_cache_lookup(file)))
+    {
+        file->checksum = crc_tmp;
+        return true;
     }
 
+    tab_t *tab = gui_get_current_tab();
+    gui_set_status(tab, NULL, "CRC32...");
+    gui_draw_status(tab);
+
+    emulator_compute_crc32(file, &stop_on_key_press, NULL);
+
+    gui_set_status(tab, NULL, "");
+    gui_draw_status(tab);
+
     return file->checksum > 0;
 }
 
@@ -643,6 +842,8 @@ void emulator_show_file_menu(retro_emulator_file_t *file, bool advanced)
             }
             if (unlink(emulator_get_file_path(file)) == 0)
             {
+                if (file->emulator->library)
+                    library_remove_file(file->emulator->library, file->folder, file->name);
                 file->is_valid = false;
                 gui_event(TAB_REFRESH, gui_get_current_tab());
             }
@@ -667,6 +868,19 @@ void emulator_start(retro_emulator_file_t *file, bool load_state)
     rg_emu_start_game(file->emulator->partition, emulator_get_file_path(file), action);
 }
 
+void emulators_clear_cache(void)
+{
+    char path[PATH_MAX + 1];
+
+    unlink(CRC_CACHE_PATH);
+
+    for (int i = 0; i < emulators_count; i++)
+    {
+        snprintf(path, sizeof(path), LIBRARY_INDEX_PATH, emulators[i].short_name);
+        unlink(path);
+    }
+}
+
 void emulators_init()
 {
     add_emulator("Nintendo Entertainment System", "nes",  "nes fds nsf", "nofrendo-go", 16, &logo_nes, &header_nes);
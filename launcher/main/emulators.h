@@ -3,31 +3,49 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define CRC_CACHE_MAGIC 0x21112222
-#define CRC_CACHE_MAX_ENTRIES (0x10000 / sizeof(retro_crc_entry_t) - 1)
-#define CRC_CACHE_PATH RG_BASE_PATH_CACHE "/crc32.bin"
+#define CRC_CACHE_MAGIC 0x4A435243 // "CRCJ"
+#define CRC_CACHE_MAX_ENTRIES 8192
+#define CRC_CACHE_TABLE_SIZE (CRC_CACHE_MAX_ENTRIES * 2)
+#define CRC_CACHE_PENDING 32
+#define CRC_CACHE_NONE 0xFFFF
+#define CRC_CACHE_PATH RG_BASE_PATH_CACHE "/crc32.log"
+#define CRC_CACHE_LEGACY_PATH RG_BASE_PATH_CACHE "/crc32.bin"
+#define LIBRARY_INDEX_PATH RG_BASE_PATH_CACHE "/%s.idx"
 
+// Also the record format of the journal, which is the magic followed by records, oldest first
 typedef struct __attribute__((__packed__))
 {
-    // uint64_t key;
-    uint32_t key;
+    uint32_t key;   // Hash of the system and the file's path
+    uint32_t size;  // Size and mtime must match too, or the file has changed
+    uint32_t mtime;
     uint32_t crc;
 } retro_crc_entry_t;
 
-typedef struct __attribute__((__packed__))
+typedef struct
 {
-    uint32_t magic;
-    uint32_t count;
+    uint16_t table[CRC_CACHE_TABLE_SIZE];   // Open addressing on key, entry index + 1
+    struct {
+        uint16_t prev, next;
+    } links[CRC_CACHE_MAX_ENTRIES];         // LRU list, head is the most recently used
+    uint16_t head, tail;
     retro_crc_entry_t entries[CRC_CACHE_MAX_ENTRIES];
+    size_t count;
+    retro_crc_entry_t pending[CRC_CACHE_PENDING]; // Not yet appended to the journal
+    size_t pending_count;
+    size_t journal_records;
+    bool journal_damaged;                   // Missing or has a bad tail, rewrite it before appending
 } retro_crc_cache_t;
 
 typedef struct retro_emulator_s retro_emulator_t;
+typedef struct library_s library_t;
 
 typedef struct
 {
     const char *name;
     const char *folder;
     // uint32_t type;
+    uint32_t size;
+    uint32_t mtime;
     uint32_t checksum;
     uint16_t missing_cover;
     uint8_t  is_valid;
@@ -47,6 +65,8 @@ typedef struct retro_emulator_s
         const char **folders;
         size_t folders_count;
     } roms;
+    library_t *library;
+    size_t crc_scan_next;
     bool crc_scan_done;
     bool initialized;
 } retro_emulator_t;
@@ -54,17 +74,19 @@ typedef struct retro_emulator_s
 typedef struct tab_s tab_t;
 
 void emulators_init();
+void emulators_clear_cache(void);
 void emulator_init(retro_emulator_t *emu);
 void emulator_start(retro_emulator_file_t *file, bool load_state);
 int  emulator_scan_folder(retro_emulator_t *emu, const char* path, int flags);
 void emulator_show_file_menu(retro_emulator_file_t *file, bool simplified);
 void emulator_show_file_info(retro_emulator_file_t *file);
 bool emulator_get_file_crc32(retro_emulator_file_t *file);
+bool emulator_compute_crc32(retro_emulator_file_t *file, bool (*should_stop)(void *arg), void *arg);
 const char *emulator_get_file_path(retro_emulator_file_t *file);
 bool emulator_build_file_object(const char *path, retro_emulator_file_t *out_file);
 
 void crc_cache_init(void);
-void crc_cache_idle_task(tab_t *tab);
+bool crc_cache_background_step(const void *hint, bool (*should_stop)(void *arg), void *arg);
 uint32_t crc_cache_lookup(retro_emulator_file_t *file);
 void crc_cache_update(retro_emulator_file_t *file);
 void crc_cache_save(void);
@@ -6,6 +6,7 @@
 #include <unistd.h>
 
 #include "gui.h"
+#include "preview.h"
 
 #define IMAGE_LOGO_WIDTH    (47)
 #define IMAGE_LOGO_HEIGHT   (51)
@@ -18,9 +19,6 @@
 #define LIST_X_OFFSET       (0)
 #define LIST_Y_OFFSET       (48 + 8)
 
-#define COVER_MAX_HEIGHT    ((int)(gui.height * 0.70f))
-#define COVER_MAX_WIDTH     ((int)(gui.width * 0.50f))
-
 static const theme_t gui_themes[] = {
     {0, C_GRAY, C_WHITE, C_AQUA},
     {0, C_GRAY, C_GREEN, C_AQUA},
@@ -42,6 +40,8 @@ const int gui_themes_count = sizeof(gui_themes) / sizeof(theme_t);
 
 retro_gui_t gui;
 
+static const retro_emulator_file_t *preview_shown; // Cleared when the list is drawn over it
+
 #define CONCAT(a, b) ({char buffer[128]; strcat(strcpy(buffer, a), b);})
 #define SETTING_SELECTED_TAB    "SelectedTab"
 #define SETTING_GUI_THEME       "ColorTheme"
@@ -391,99 +391,54 @@ void gui_draw_list(tab_t *tab)
 
     if (y < y_max)
         rg_gui_draw_rect(0, y, LIST_WIDTH, y_max - y, 0, 0, color_bg);
+
+    preview_shown = NULL;
 }
 
+// Called on every idle tick once the preview delay has passed. The covers are loaded by the
+// preview worker, this only draws them when they're ready.
 void gui_draw_preview(tab_t *tab, retro_emulator_file_t *file)
 {
-    const char *dirname = file->emulator->short_name;
-    bool show_missing_cover = false;
-    uint32_t order;
-    char path[256];
-
-    switch (gui.show_preview)
-    {
-        case PREVIEW_MODE_COVER_SAVE:
-            show_missing_cover = true;
-            order = 0x3412;
-            break;
-        case PREVIEW_MODE_SAVE_COVER:
-            show_missing_cover = true;
-            order = 0x4123;
-            break;
-        case PREVIEW_MODE_COVER_ONLY:
-            show_missing_cover = true;
-            order = 0x0412;
-            break;
-        case PREVIEW_MODE_SAVE_ONLY:
-            show_missing_cover = false;
-            order = 0x0003;
-            break;
-        default:
-            show_missing_cover = false;
-            order = 0x0000;
-    }
+    const listbox_t *list = &tab->listbox;
+    retro_emulator_file_t *files[PREVIEW_PREFETCH_COUNT];
+    size_t count = 0;
 
-    rg_image_t *img = NULL;
-    uint32_t errors = 0;
+    if (file == preview_shown)
+        return;
 
-    while (order && !img)
+    // The cursor's file first, then its neighbours by distance
+    files[count++] = file;
+    for (int i = 1; i <= PREVIEW_PREFETCH_RADIUS; i++)
     {
-        int type = order & 0xF;
-
-        order >>= 4;
-
-        if (file->missing_cover & (1 << type))
-        {
-            continue;
-        }
-
-        gui.joystick = rg_input_read_gamepad();
-
-        if (type == 0x1 || type == 0x2)
-        {
-            emulator_get_file_crc32(file);
-        }
+        if (list->cursor + i < list->length && list->items[list->cursor + i].arg)
+            files[count++] = list->items[list->cursor + i].arg;
+        if (list->cursor - i >= 0 && list->items[list->cursor - i].arg)
+            files[count++] = list->items[list->cursor - i].arg;
+    }
 
-        if (gui.joystick & RG_KEY_ANY)
-        {
-            break;
-        }
+    preview_request(files, count, gui.show_preview);
 
-        if (type == 0x1) // Game cover (old format)
-            sprintf(path, RG_BASE_PATH_ROMART "/%s/%X/%08X.art", dirname, file->checksum >> 28, file->checksum);
-        else if (type == 0x2) // Game cover (png)
-            sprintf(path, RG_BASE_PATH_ROMART "/%s/%X/%08X.png", dirname, file->checksum >> 28, file->checksum);
-        else if (type == 0x3) // Save state screenshot (png)
-            sprintf(path, RG_BASE_PATH_SAVES "/%s/%s.png", file->folder + strlen(RG_BASE_PATH_ROMS), file->name);
-        else if (type == 0x4) // Game cover (based on filename)
-            sprintf(path, RG_BASE_PATH_ROMART "/%s/%s.png", dirname, file->name);
-        else if (type == 0xF) // use generic cover image (not currently used)
-            sprintf(path, RG_BASE_PATH_ROMART "/%s/default.png", dirname);
-        else
-            continue;
-
-        if (access(path, F_OK) == 0)
-        {
-            img = rg_image_load_from_file(path, 0);
-            if (!img)
-                errors++;
-        }
+    const preview_t *preview = preview_acquire(file, gui.show_preview);
+    if (!preview)
+        return;
 
-        file->missing_cover |= (img ? 0 : 1) << type;
-    }
+    bool show_missing_cover = gui.show_preview != PREVIEW_MODE_SAVE_ONLY;
 
-    if (img)
+    if (preview->img)
     {
-        int height = RG_MIN(img->height, COVER_MAX_HEIGHT);
-        int width = RG_MIN(img->width, COVER_MAX_WIDTH);
+        int height = RG_MIN(preview->img->height, COVER_MAX_HEIGHT);
+        int width = RG_MIN(preview->img->width, COVER_MAX_WIDTH);
 
-        rg_gui_draw_image(-width, -height, width, height, img);
-        rg_image_free(img);
+        rg_gui_draw_image(-width, -height, width, height, preview->img);
     }
-    else if (file->checksum && (show_missing_cover || errors))
+    else if (file->checksum && (show_missing_cover || preview->errors))
     {
         RG_LOGI("No image found for '%s'\n", file->name);
-        gui_set_status(tab, NULL, errors ? "Bad cover" : "No cover");
+        gui_set_status(tab, NULL, preview->errors ? "Bad cover" : "No cover");
         gui_draw_status(tab);
     }
+
+    preview_release();
+
+    preview_shown = file;
 }
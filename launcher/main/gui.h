@@ -4,6 +4,9 @@
 #include <stdbool.h>
 #include "emulators.h"
 
+#define COVER_MAX_HEIGHT    ((int)(gui.height * 0.70f))
+#define COVER_MAX_WIDTH     ((int)(gui.width * 0.50f))
+
 typedef enum {
     KEY_PRESS_A,
     KEY_PRESS_B,
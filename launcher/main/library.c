@@ -0,0 +1,602 @@
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "library.h"
+
+#define LIBRARY_MAGIC    0x494C4752 // "RGLI"
+#define LIBRARY_VERSION  1
+#define LIBRARY_MAX_PATH 256
+#define POOL_BLOCK_SIZE  0x4000
+#define FNV_OFFSET       2166136261u
+#define FNV_PRIME        16777619u
+
+struct library_block_s
+{
+    library_block_t *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+// Index file: header, folders, files, then the strings they point to (offsets)
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t signature;
+    uint32_t folders_count;
+    uint32_t files_count;
+    uint32_t strings_size;
+    uint32_t checksum;      // FNV-1a of everything after the header
+} index_header_t;
+
+typedef struct
+{
+    uint32_t path;
+    uint32_t mtime;
+    uint32_t parent;
+    uint32_t files_count;
+} index_folder_t;
+
+typedef struct
+{
+    uint32_t name;
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t checksum;
+} index_file_t;
+
+typedef struct
+{
+    const library_t *old;
+    uint32_t *folders;      // Open addressing over old->folders by path hash, index + 1
+    size_t mask;
+    int flags;
+} scan_t;
+
+
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t size)
+{
+    const uint8_t *ptr = data;
+    while (size--)
+        hash = (hash ^ *ptr++) * FNV_PRIME;
+    return hash;
+}
+
+static uint32_t hash_string(uint32_t hash, const char *str)
+{
+    while (*str)
+        hash = (hash ^ (uint8_t)*str++) * FNV_PRIME;
+    return hash;
+}
+
+static size_t table_size(size_t count)
+{
+    size_t size = 16;
+    while (size < count * 2)
+        size <<= 1;
+    return size;
+}
+
+static const char *pool_strdup(library_t *lib, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    library_block_t *block = lib->pool;
+
+    if (!block || block->used + len > block->size)
+    {
+        size_t size = len > POOL_BLOCK_SIZE ? len : POOL_BLOCK_SIZE;
+        if (!(block = malloc(sizeof(library_block_t) + size)))
+            return NULL;
+        block->next = lib->pool;
+        block->used = 0;
+        block->size = size;
+        lib->pool = block;
+    }
+
+    char *ptr = memcpy(block->data + block->used, str, len);
+    block->used += len;
+    return ptr;
+}
+
+static library_folder_t *add_folder(library_t *lib)
+{
+    if (lib->folders_count == lib->folders_capacity)
+    {
+        size_t capacity = lib->folders_capacity ? lib->folders_capacity * 2 : 16;
+        library_folder_t *folders = realloc(lib->folders, capacity * sizeof(library_folder_t));
+        if (!folders)
+            return NULL;
+        lib->folders = folders;
+        lib->folders_capacity = capacity;
+    }
+    return &lib->folders[lib->folders_count++];
+}
+
+static retro_emulator_file_t *add_file(library_t *lib)
+{
+    if (lib->files_count == lib->files_capacity)
+    {
+        size_t capacity = lib->files_capacity ? lib->files_capacity * 2 : 64;
+        retro_emulator_file_t *files = realloc(lib->files, capacity * sizeof(retro_emulator_file_t));
+        if (!files)
+            return NULL;
+        lib->files = files;
+        lib->files_capacity = capacity;
+    }
+    return &lib->files[lib->files_count++];
+}
+
+static bool match_extension(const retro_emulator_t *emu, const char *name)
+{
+    const char *ext = strrchr(name, '.');
+
+    if (!ext || ext == name)
+        return false;
+
+    for (const char *const *emu_ext = emu->extensions; *emu_ext; emu_ext++)
+    {
+        if (strcasecmp(ext + 1, *emu_ext) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static const library_folder_t *find_old_folder(const scan_t *scan, const char *path)
+{
+    size_t pos = hash_string(FNV_OFFSET, path) & scan->mask;
+
+    while (scan->folders && scan->folders[pos])
+    {
+        const library_folder_t *folder = &scan->old->folders[scan->folders[pos] - 1];
+        if (strcmp(folder->path, path) == 0)
+            return folder;
+        pos = (pos + 1) & scan->mask;
+    }
+
+    return NULL;
+}
+
+static void scan_folder(library_t *lib, const scan_t *scan, const char *path, uint32_t parent)
+{
+    char child_path[LIBRARY_MAX_PATH];
+    struct stat st;
+
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return;
+
+    const library_folder_t *old = find_old_folder(scan, path);
+    const char *folder_path = old ? old->path : pool_strdup(lib, path);
+    library_folder_t *folder = add_folder(lib);
+    if (!folder || !folder_path)
+        return;
+
+    uint32_t index = lib->folders_count - 1;
+    *folder = (library_folder_t){folder_path, st.st_mtime, parent, lib->files_count, 0};
+
+    // Nothing was added, removed or renamed in this folder, the old entries are still valid.
+    // Subfolders have their own mtime and must still be checked.
+    if (old && old->mtime == (uint32_t)st.st_mtime)
+    {
+        uint32_t old_index = old - scan->old->folders;
+
+        for (size_t i = 0; i < old->files_count; i++)
+        {
+            retro_emulator_file_t *file = add_file(lib);
+            if (!file)
+                break;
+            *file = scan->old->files[old->first_file + i];
+            file->folder = folder_path;
+        }
+        lib->folders[index].files_count = lib->files_count - lib->folders[index].first_file;
+        lib->stats.folders_reused++;
+
+        for (size_t i = old_index + 1; i < scan->old->folders_count; i++)
+        {
+            if (scan->old->folders[i].parent == old_index)
+                scan_folder(lib, scan, scan->old->folders[i].path, index);
+        }
+        return;
+    }
+
+    lib->stats.folders_scanned++;
+    lib->dirty = true;
+
+    DIR *dir = opendir(path);
+    if (!dir)
+        return;
+
+    // Entries of the old folder by name, so that known files keep their CRC
+    size_t old_mask = 0;
+    uint32_t *old_files = NULL;
+    if (old && old->files_count > 0)
+    {
+        old_mask = table_size(old->files_count) - 1;
+        old_files = calloc(old_mask + 1, sizeof(uint32_t));
+        for (size_t i = 0; old_files && i < old->files_count; i++)
+        {
+            size_t pos = hash_string(FNV_OFFSET, scan->old->files[old->first_file + i].name) & old_mask;
+            while (old_files[pos])
+                pos = (pos + 1) & old_mask;
+            old_files[pos] = old->first_file + i + 1;
+        }
+    }
+
+    // Subfolders are visited after closedir(), so that this folder's files stay contiguous
+    // and only one directory handle is open at a time.
+    char **subfolders = NULL;
+    size_t subfolders_count = 0;
+    struct dirent *ent;
+
+    while ((ent = readdir(dir)))
+    {
+        const char *name = ent->d_name;
+
+        if (name[0] == '.')
+            continue;
+
+        if (ent->d_type == DT_REG)
+        {
+            if (!match_extension(lib->emu, name))
+                continue;
+
+            const retro_emulator_file_t *old_file = NULL;
+            if (old_files)
+            {
+                size_t pos = hash_string(FNV_OFFSET, name) & old_mask;
+                while (old_files[pos] && strcmp(scan->old->files[old_files[pos] - 1].name, name) != 0)
+                    pos = (pos + 1) & old_mask;
+                if (old_files[pos])
+                    old_file = &scan->old->files[old_files[pos] - 1];
+            }
+
+            retro_emulator_file_t *file = add_file(lib);
+            const char *file_name = old_file ? old_file->name : pool_strdup(lib, name);
+            if (!file || !file_name)
+            {
+                lib->files_count -= (file != NULL);
+                break;
+            }
+
+            *file = (retro_emulator_file_t) {
+                .name = file_name,
+                .folder = folder_path,
+                .emulator = lib->emu,
+                .is_valid = true,
+            };
+
+            if (old_file)
+            {
+                file->size = old_file->size;
+                file->mtime = old_file->mtime;
+                file->checksum = old_file->checksum;
+            }
+
+            if ((scan->flags & LIBRARY_STAT_FILES)
+                && snprintf(child_path, sizeof(child_path), "%s/%s", path, name) < sizeof(child_path)
+                && stat(child_path, &st) == 0)
+            {
+                if (file->size != (uint32_t)st.st_size || file->mtime != (uint32_t)st.st_mtime)
+                    file->checksum = 0;
+                file->size = st.st_size;
+                file->mtime = st.st_mtime;
+            }
+        }
+        else if (ent->d_type == DT_DIR)
+        {
+            char **ptr = realloc(subfolders, (subfolders_count + 1) * sizeof(char *));
+            if (!ptr || !(ptr[subfolders_count] = strdup(name)))
+            {
+                subfolders = ptr ? ptr : subfolders;
+                break;
+            }
+            subfolders = ptr;
+            subfolders_count++;
+        }
+    }
+
+    closedir(dir);
+    free(old_files);
+
+    lib->folders[index].files_count = lib->files_count - lib->folders[index].first_file;
+
+    for (size_t i = 0; i < subfolders_count; i++)
+    {
+        if (snprintf(child_path, sizeof(child_path), "%s/%s", path, subfolders[i]) < sizeof(child_path))
+            scan_folder(lib, scan, child_path, index);
+        free(subfolders[i]);
+    }
+    free(subfolders);
+}
+
+void library_init(library_t *lib, const char *root, retro_emulator_t *emu)
+{
+    memset(lib, 0, sizeof(library_t));
+    lib->root = pool_strdup(lib, root);
+    lib->emu = emu;
+    lib->signature = hash_string(FNV_OFFSET, root);
+    for (const char *const *ext = emu->extensions; *ext; ext++)
+        lib->signature = hash_string(lib->signature * FNV_PRIME, *ext);
+}
+
+static void free_entries(library_t *lib)
+{
+    free(lib->folders);
+    free(lib->files);
+    lib->folders = NULL;
+    lib->files = NULL;
+    lib->folders_count = lib->folders_capacity = 0;
+    lib->files_count = lib->files_capacity = 0;
+}
+
+void library_free(library_t *lib)
+{
+    free_entries(lib);
+    while (lib->pool)
+    {
+        library_block_t *next = lib->pool->next;
+        free(lib->pool);
+        lib->pool = next;
+    }
+    memset(lib, 0, sizeof(library_t));
+}
+
+// Rebuilds the entries, reusing the current ones for every folder whose mtime is unchanged.
+// Strings are never moved, the old pool is kept and the next save/load cycle compacts it.
+void library_scan(library_t *lib, int flags)
+{
+    library_t old = *lib;
+    scan_t scan = {.old = &old, .flags = flags};
+
+    if (old.folders_count > 0)
+    {
+        size_t size = table_size(old.folders_count);
+        if ((scan.folders = calloc(size, sizeof(uint32_t))))
+        {
+            scan.mask = size - 1;
+            for (size_t i = 0; i < old.folders_count; i++)
+            {
+                size_t pos = hash_string(FNV_OFFSET, old.folders[i].path) & scan.mask;
+                while (scan.folders[pos])
+                    pos = (pos + 1) & scan.mask;
+                scan.folders[pos] = i + 1;
+            }
+        }
+    }
+
+    lib->folders = NULL;
+    lib->files = NULL;
+    lib->folders_count = lib->folders_capacity = 0;
+    lib->files_count = lib->files_capacity = 0;
+    lib->stats.folders_scanned = lib->stats.folders_reused = 0;
+
+    scan_folder(lib, &scan, lib->root, LIBRARY_NO_PARENT);
+
+    // The root itself may have disappeared
+    if (lib->folders_count != old.folders_count)
+        lib->dirty = true;
+
+    // Shrink to fit, nothing is added until the next scan and entries are handed out by pointer
+    if (lib->files_count > 0 && lib->files_count < lib->files_capacity)
+    {
+        retro_emulator_file_t *files = realloc(lib->files, lib->files_count * sizeof(retro_emulator_file_t));
+        if (files)
+        {
+            lib->files = files;
+            lib->files_capacity = lib->files_count;
+        }
+    }
+
+    free(scan.folders);
+    free(old.folders);
+    free(old.files);
+}
+
+static bool read_chunk(FILE *fp, void *data, size_t size, uint32_t *hash)
+{
+    if (size > 0 && fread(data, size, 1, fp) != 1)
+        return false;
+    *hash = hash_bytes(*hash, data, size);
+    return true;
+}
+
+static bool write_chunk(FILE *fp, const void *data, size_t size, uint32_t *hash)
+{
+    *hash = hash_bytes(*hash, data, size);
+    return size == 0 || fwrite(data, size, 1, fp) == 1;
+}
+
+bool library_load(library_t *lib, const char *filename)
+{
+    index_header_t header;
+    index_folder_t *folders = NULL;
+    index_file_t *files = NULL;
+    library_block_t *block = NULL;
+    uint32_t hash = FNV_OFFSET;
+    bool valid = false;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+        return false;
+
+    // The default stdio buffer is tiny on the device, one read per record would be slow
+    setvbuf(fp, NULL, _IOFBF, 0x2000);
+
+    if (fread(&header, sizeof(header), 1, fp) == 1 && header.magic == LIBRARY_MAGIC
+        && header.version == LIBRARY_VERSION && header.signature == lib->signature
+        && header.folders_count > 0 && header.folders_count < 0x10000 && header.files_count < 0x100000)
+    {
+        folders = malloc(header.folders_count * sizeof(index_folder_t));
+        files = malloc(header.files_count * sizeof(index_file_t) + 1);
+        block = malloc(sizeof(library_block_t) + header.strings_size + 1);
+        valid = folders && files && block
+            && read_chunk(fp, folders, header.folders_count * sizeof(index_folder_t), &hash)
+            && read_chunk(fp, files, header.files_count * sizeof(index_file_t), &hash)
+            && read_chunk(fp, block->data, header.strings_size, &hash)
+            && hash == header.checksum;
+    }
+
+    fclose(fp);
+
+    size_t files_total = 0;
+    for (size_t i = 0; valid && i < header.folders_count; i++)
+    {
+        valid = folders[i].path < header.strings_size
+            && (folders[i].parent < i || (i == 0 && folders[i].parent == LIBRARY_NO_PARENT));
+        files_total += folders[i].files_count;
+    }
+    for (size_t i = 0; valid && i < header.files_count; i++)
+        valid = files[i].name < header.strings_size;
+    valid = valid && files_total == header.files_count;
+
+    if (valid)
+    {
+        free_entries(lib);
+        lib->folders = calloc(header.folders_count, sizeof(library_folder_t));
+        lib->files = calloc(header.files_count + 1, sizeof(retro_emulator_file_t));
+        valid = lib->folders && lib->files;
+    }
+
+    if (valid)
+    {
+        block->data[header.strings_size] = 0;
+        block->used = block->size = header.strings_size + 1;
+        block->next = lib->pool;
+        lib->pool = block;
+        block = NULL;
+
+        lib->folders_count = lib->folders_capacity = header.folders_count;
+        lib->files_count = lib->files_capacity = header.files_count;
+
+        for (size_t i = 0, file = 0; i < header.folders_count; i++)
+        {
+            library_folder_t *folder = &lib->folders[i];
+            *folder = (library_folder_t) {
+                .path = lib->pool->data + folders[i].path,
+                .mtime = folders[i].mtime,
+                .parent = folders[i].parent,
+                .first_file = file,
+                .files_count = folders[i].files_count,
+            };
+            for (size_t j = 0; j < folder->files_count; j++, file++)
+            {
+                lib->files[file] = (retro_emulator_file_t) {
+                    .name = lib->pool->data + files[file].name,
+                    .folder = folder->path,
+                    .size = files[file].size,
+                    .mtime = files[file].mtime,
+                    .checksum = files[file].checksum,
+                    .emulator = lib->emu,
+                    .is_valid = true,
+                };
+            }
+        }
+        lib->dirty = false;
+    }
+    else
+    {
+        free_entries(lib);
+    }
+
+    free(folders);
+    free(files);
+    free(block);
+
+    return valid;
+}
+
+// Files marked invalid (deleted) are left out. Strings are written in the order of the entries,
+// which is also what compacts the pool on the next load.
+bool library_save(library_t *lib, const char *filename)
+{
+    index_header_t header = {LIBRARY_MAGIC, LIBRARY_VERSION, lib->signature, lib->folders_count, 0, 0, 0};
+    uint32_t hash = FNV_OFFSET;
+    bool success = true;
+    char temp[LIBRARY_MAX_PATH];
+
+    if (snprintf(temp, sizeof(temp), "%s.new", filename) >= sizeof(temp))
+        return false;
+
+    FILE *fp = fopen(temp, "wb");
+    if (!fp)
+        return false;
+
+    setvbuf(fp, NULL, _IOFBF, 0x2000);
+    success = fwrite(&header, sizeof(header), 1, fp) == 1;
+
+    for (size_t i = 0; success && i < lib->folders_count; i++)
+    {
+        const library_folder_t *folder = &lib->folders[i];
+        index_folder_t entry = {header.strings_size, folder->mtime, folder->parent, 0};
+        for (size_t j = 0; j < folder->files_count; j++)
+            entry.files_count += lib->files[folder->first_file + j].is_valid ? 1 : 0;
+        header.strings_size += strlen(folder->path) + 1;
+        header.files_count += entry.files_count;
+        success = write_chunk(fp, &entry, sizeof(entry), &hash);
+    }
+
+    for (size_t i = 0; success && i < lib->files_count; i++)
+    {
+        const retro_emulator_file_t *file = &lib->files[i];
+        if (!file->is_valid)
+            continue;
+        index_file_t entry = {header.strings_size, file->size, file->mtime, file->checksum};
+        header.strings_size += strlen(file->name) + 1;
+        success = write_chunk(fp, &entry, sizeof(entry), &hash);
+    }
+
+    for (size_t i = 0; success && i < lib->folders_count; i++)
+        success = write_chunk(fp, lib->folders[i].path, strlen(lib->folders[i].path) + 1, &hash);
+
+    for (size_t i = 0; success && i < lib->files_count; i++)
+    {
+        if (lib->files[i].is_valid)
+            success = write_chunk(fp, lib->files[i].name, strlen(lib->files[i].name) + 1, &hash);
+    }
+
+    header.checksum = hash;
+    success = success && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+    success = (fclose(fp) == 0) && success;
+
+    if (success)
+    {
+        remove(filename);
+        success = rename(temp, filename) == 0;
+    }
+    else
+    {
+        remove(temp);
+    }
+
+    if (success)
+        lib->dirty = false;
+
+    return success;
+}
+
+// FAT doesn't update a folder's mtime when a file is deleted, the entry must be dropped here
+bool library_remove_file(library_t *lib, const char *folder, const char *name)
+{
+    for (size_t i = 0; i < lib->folders_count; i++)
+    {
+        const library_folder_t *entry = &lib->folders[i];
+        if (strcmp(entry->path, folder) != 0)
+            continue;
+        for (size_t j = 0; j < entry->files_count; j++)
+        {
+            retro_emulator_file_t *file = &lib->files[entry->first_file + j];
+            if (file->is_valid && strcmp(file->name, name) == 0)
+            {
+                file->is_valid = false;
+                lib->dirty = true;
+                return true;
+            }
+        }
+    }
+    return false;
+}
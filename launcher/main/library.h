@@ -0,0 +1,48 @@
+#pragma once
+
+#include "emulators.h"
+
+// Persistent index of a system's ROM folder tree. Names and paths live in a pooled string arena,
+// files are grouped by folder. On startup the index is validated by stat'ing each known folder:
+// a folder whose mtime didn't change reuses its entries, only changed folders are read again.
+// Portable C, it must stay free of esp-idf dependencies.
+
+#define LIBRARY_NO_PARENT  0xFFFFFFFF
+#define LIBRARY_STAT_FILES 0x01 // Fill size/mtime when scanning, it costs a directory search per file on FAT
+
+typedef struct library_block_s library_block_t;
+
+typedef struct
+{
+    const char *path;
+    uint32_t mtime;
+    uint32_t parent;        // Index of the parent folder, LIBRARY_NO_PARENT for the root
+    uint32_t first_file;    // A folder's files are contiguous and folders are in scan order
+    uint32_t files_count;
+} library_folder_t;
+
+struct library_s
+{
+    const char *root;
+    retro_emulator_t *emu;
+    uint32_t signature;     // Root path and extensions, a change invalidates the index
+    library_folder_t *folders;
+    size_t folders_count;
+    size_t folders_capacity;
+    retro_emulator_file_t *files;
+    size_t files_count;
+    size_t files_capacity;
+    library_block_t *pool;
+    bool dirty;             // Differs from the index file
+    struct {
+        size_t folders_scanned;
+        size_t folders_reused;
+    } stats;
+};
+
+void library_init(library_t *lib, const char *root, retro_emulator_t *emu);
+void library_free(library_t *lib);
+bool library_load(library_t *lib, const char *filename);
+bool library_save(library_t *lib, const char *filename);
+void library_scan(library_t *lib, int flags);
+bool library_remove_file(library_t *lib, const char *folder, const char *name);
@@ -8,6 +8,7 @@
 #include "ftp_server.h"
 #include "emulators.h"
 #include "bookmarks.h"
+#include "preview.h"
 #include "gui.h"
 
 
@@ -188,7 +189,7 @@ void retro_loop()
                 RG_DIALOG_CHOICE_LAST
             };
             if (rg_gui_about_menu(options) == 1) {
-                unlink(CRC_CACHE_PATH);
+                emulators_clear_cache();
                 rg_system_restart();
             }
             gui_redraw();
@@ -252,6 +253,7 @@ void app_main(void)
 
     emulators_init();
     bookmarks_init();
+    preview_init();
 
     ftp_server_start();
 
@@ -0,0 +1,298 @@
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <rg_system.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "preview.h"
+#include "gui.h"
+
+#define PREVIEW_SCAN_DELAY    (2000 * 1000) // In us without requests before the background scan runs
+#define PREVIEW_SAVE_INTERVAL (10000 * 1000) // In us, how often the worker flushes the caches
+
+static SemaphoreHandle_t lock;
+static SemaphoreHandle_t job_lock; // Held by the worker for as long as it uses a file pointer
+static TaskHandle_t worker;
+static retro_emulator_file_t *wanted[PREVIEW_PREFETCH_COUNT]; // By priority, the cursor's first
+static size_t wanted_count;
+static int wanted_mode;
+static volatile uint32_t generation; // Bumped on every new request
+static int64_t last_request;
+static preview_t cache[PREVIEW_CACHE_SIZE];
+static uint32_t cache_clock;
+
+
+static uint32_t preview_order(int mode)
+{
+    switch (mode)
+    {
+        case PREVIEW_MODE_COVER_SAVE: return 0x3412;
+        case PREVIEW_MODE_SAVE_COVER: return 0x4123;
+        case PREVIEW_MODE_COVER_ONLY: return 0x0412;
+        case PREVIEW_MODE_SAVE_ONLY:  return 0x0003;
+        default:                      return 0x0000;
+    }
+}
+
+// Must hold the lock
+static preview_t *find_entry(const retro_emulator_file_t *file, int mode)
+{
+    for (int i = 0; i < PREVIEW_CACHE_SIZE; i++)
+    {
+        if (cache[i].file == file && cache[i].mode == mode)
+            return &cache[i];
+    }
+    return NULL;
+}
+
+// Must hold the lock
+static bool is_wanted(const retro_emulator_file_t *file)
+{
+    for (size_t i = 0; i < wanted_count; i++)
+    {
+        if (wanted[i] == file)
+            return true;
+    }
+    return false;
+}
+
+static bool job_cancelled(void *arg)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool cancelled = !is_wanted(arg);
+    xSemaphoreGive(lock);
+    return cancelled;
+}
+
+static bool background_cancelled(void *arg)
+{
+    return generation != *(uint32_t *)arg;
+}
+
+// Returns false if the file stopped being wanted before its preview was complete
+static bool load_preview(retro_emulator_file_t *file, preview_t *out)
+{
+    const char *dirname = file->emulator->short_name;
+    uint32_t order = preview_order(out->mode);
+    char path[256];
+
+    while (order && !out->img)
+    {
+        int type = order & 0xF;
+
+        order >>= 4;
+
+        if (file->missing_cover & (1 << type))
+            continue;
+
+        if (type == 0x1 || type == 0x2)
+        {
+            if (!emulator_compute_crc32(file, &job_cancelled, file))
+            {
+                if (job_cancelled(file))
+                    return false;
+                continue;
+            }
+        }
+
+        if (type == 0x1) // Game cover (old format)
+            sprintf(path, RG_BASE_PATH_ROMART "/%s/%X/%08X.art", dirname, file->checksum >> 28, file->checksum);
+        else if (type == 0x2) // Game cover (png)
+            sprintf(path, RG_BASE_PATH_ROMART "/%s/%X/%08X.png", dirname, file->checksum >> 28, file->checksum);
+        else if (type == 0x3) // Save state screenshot (png)
+            sprintf(path, RG_BASE_PATH_SAVES "/%s/%s.png", file->folder + strlen(RG_BASE_PATH_ROMS), file->name);
+        else if (type == 0x4) // Game cover (based on filename)
+            sprintf(path, RG_BASE_PATH_ROMART "/%s/%s.png", dirname, file->name);
+        else if (type == 0xF) // use generic cover image (not currently used)
+            sprintf(path, RG_BASE_PATH_ROMART "/%s/default.png", dirname);
+        else
+            continue;
+
+        if (access(path, F_OK) == 0)
+        {
+            out->img = rg_image_load_scaled(path, COVER_MAX_WIDTH, COVER_MAX_HEIGHT, 0);
+            if (!out->img)
+                out->errors++;
+        }
+
+        file->missing_cover |= (out->img ? 0 : 1) << type;
+    }
+
+    return true;
+}
+
+static void store_entry(const preview_t *entry)
+{
+    preview_t *same = NULL, *unused = NULL, *oldest = NULL;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    // Replace the file's entry for another mode, else use a free slot, else evict the least
+    // recently used entry that isn't wanted
+    for (int i = 0; i < PREVIEW_CACHE_SIZE; i++)
+    {
+        if (cache[i].file == entry->file)
+            same = &cache[i];
+        else if (!cache[i].file)
+            unused = &cache[i];
+        else if (!is_wanted(cache[i].file) && (!oldest || cache[i].last_used < oldest->last_used))
+            oldest = &cache[i];
+    }
+
+    preview_t *slot = same ? same : (unused ? unused : oldest);
+
+    if (slot)
+    {
+        rg_image_free(slot->img);
+        *slot = *entry;
+        slot->last_used = ++cache_clock;
+    }
+    else
+    {
+        rg_image_free(entry->img);
+    }
+
+    xSemaphoreGive(lock);
+}
+
+static void preview_task(void *arg)
+{
+    int64_t last_save = get_elapsed_time();
+
+    while (true)
+    {
+        retro_emulator_file_t *file = NULL;
+        uint32_t current_generation;
+        int mode;
+
+        xSemaphoreTakeRecursive(job_lock, portMAX_DELAY);
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        current_generation = generation;
+        mode = wanted_mode;
+        for (size_t i = 0; i < wanted_count && !file; i++)
+        {
+            if (!find_entry(wanted[i], mode))
+                file = wanted[i];
+        }
+        xSemaphoreGive(lock);
+
+        if (file)
+        {
+            preview_t entry = {file, NULL, 0, mode, 0};
+            if (load_preview(file, &entry))
+                store_entry(&entry);
+            else
+                rg_image_free(entry.img);
+            xSemaphoreGiveRecursive(job_lock);
+            continue;
+        }
+
+        if (get_elapsed_time() - last_save > PREVIEW_SAVE_INTERVAL)
+        {
+            crc_cache_save();
+            last_save = get_elapsed_time();
+        }
+
+        if (get_elapsed_time() - last_request > PREVIEW_SCAN_DELAY)
+        {
+            tab_t *tab = gui_get_current_tab();
+            bool more = crc_cache_background_step(tab ? tab->arg : NULL, &background_cancelled, &current_generation);
+            xSemaphoreGiveRecursive(job_lock);
+            if (more)
+                continue;
+        }
+        else
+        {
+            xSemaphoreGiveRecursive(job_lock);
+        }
+
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(500));
+    }
+}
+
+void preview_request(retro_emulator_file_t **files, size_t count, int mode)
+{
+    count = RG_MIN(count, PREVIEW_PREFETCH_COUNT);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    // Asked again for the same thing until it's ready, that's not new work
+    if (count == wanted_count && mode == wanted_mode && memcmp(wanted, files, count * sizeof(*files)) == 0)
+    {
+        xSemaphoreGive(lock);
+        return;
+    }
+
+    memcpy(wanted, files, count * sizeof(*files));
+    wanted_count = count;
+    wanted_mode = mode;
+    generation++;
+    last_request = get_elapsed_time();
+
+    xSemaphoreGive(lock);
+
+    xTaskNotifyGive(worker);
+}
+
+// Returns the file's preview with the lock held, it must be released with preview_release().
+// Returns NULL if it isn't ready yet.
+const preview_t *preview_acquire(retro_emulator_file_t *file, int mode)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    preview_t *entry = find_entry(file, mode);
+    if (!entry)
+    {
+        xSemaphoreGive(lock);
+        return NULL;
+    }
+
+    entry->last_used = ++cache_clock;
+    return entry;
+}
+
+void preview_release(void)
+{
+    xSemaphoreGive(lock);
+}
+
+// The cache and the requests are keyed by file pointer, they must all be forgotten before an array
+// of files is reallocated or rewritten. Waits for the worker's current job, which is cancelled.
+// The worker itself may call it (the background scan inits emulators), the job lock is recursive.
+void preview_suspend(void)
+{
+    if (!worker)
+        return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    wanted_count = 0;
+    generation++;
+    xSemaphoreGive(lock);
+
+    xSemaphoreTakeRecursive(job_lock, portMAX_DELAY);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < PREVIEW_CACHE_SIZE; i++)
+        rg_image_free(cache[i].img);
+    memset(cache, 0, sizeof(cache));
+    xSemaphoreGive(lock);
+}
+
+void preview_resume(void)
+{
+    if (!worker)
+        return;
+
+    xSemaphoreGiveRecursive(job_lock);
+}
+
+void preview_init(void)
+{
+    lock = xSemaphoreCreateMutex();
+    job_lock = xSemaphoreCreateRecursiveMutex();
+    last_request = get_elapsed_time();
+    // Low priority, on the same core as the display so that the UI task keeps its own
+    xTaskCreatePinnedToCore(&preview_task, "preview_task", 12288, NULL, 1, &worker, 1);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <rg_system.h>
+#include "emulators.h"
+
+// Preview worker: computes CRCs and decodes covers off the UI task. The UI asks for the cursor's
+// file and its neighbours, the worker fills a small LRU of ready-to-blit images in that order.
+// Work for a file that is no longer asked for is abandoned. When nothing has been asked for a
+// while, the worker runs the background CRC scan.
+
+#define PREVIEW_PREFETCH_RADIUS 2
+#define PREVIEW_PREFETCH_COUNT  (1 + PREVIEW_PREFETCH_RADIUS * 2)
+#define PREVIEW_CACHE_SIZE      8
+
+typedef struct
+{
+    retro_emulator_file_t *file;
+    rg_image_t *img;    // NULL if there is no cover to show
+    uint32_t errors;    // Covers that exist but failed to decode
+    int mode;           // gui.show_preview it was made for
+    uint32_t last_used;
+} preview_t;
+
+void preview_init(void);
+void preview_request(retro_emulator_file_t **files, size_t count, int mode);
+const preview_t *preview_acquire(retro_emulator_file_t *file, int mode);
+void preview_release(void);
+// Brackets any change that moves or rewrites file objects, see preview.c
+void preview_suspend(void);
+void preview_resume(void);
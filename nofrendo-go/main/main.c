@@ -338,7 +338,9 @@ void app_main(void)
 
         input_update(0, input);
 
+        rg_system_set_phase(RG_PHASE_EMULATE);
         nes_emulate(drawframe);
+        rg_system_set_phase(RG_PHASE_NONE);
 
         int elapsed = get_elapsed_time_since(startTime);
 
@@ -57,22 +57,6 @@ class Symbol:
         return text.replace("\n", "\n  ")
 
 
-class CallBranch:
-    def __init__(self, name, parent=None):
-        self.name = name
-        self.parent = parent
-        self.run_time = 0;
-        self.children = dict()
-
-    def add_frame(self, caller, callee, num_calls, run_time):
-        if callee.hash not in self.children:
-            self.children[callee.hash] = [caller, callee, num_calls, run_time]
-        else:
-            self.children[callee.hash][2] += num_calls
-            self.children[callee.hash][3] += run_time
-        self.run_time += run_time
-
-
 def find_symbol(elf_file, addr):
     try:
         if addr not in symbols_cache:
@@ -87,33 +71,40 @@ def find_symbol(elf_file, addr):
     return symbols_cache[addr]
 
 
-def analyze_profile(frames):
-    flatten = True # False is currently not working correctly
-    tree = dict()
-
-    for caller, callee, num_calls, run_time in frames:
-        branch = '*' if flatten else caller.name + "@" + os.path.basename(caller.source)
-        if branch not in tree:
-            tree[branch] = CallBranch(branch, caller)
-        tree[branch].add_frame(caller, callee, num_calls, run_time)
-
-    tree_sorted = sorted(tree.values(), key=lambda x: x.run_time, reverse=True)
-
-    for branch in tree_sorted:
-        if branch.run_time < 100_000:
-            continue
-
-        debug_print("%-68s %dms" % (branch.name, branch.run_time / 1000))
-        children = sorted(branch.children.values(), key=lambda x: x[3], reverse=True)
-
-        for caller, callee, num_calls, run_time in children:
-            if run_time < 10_000:
-                continue
-            debug_print("    %-32s %-20s %-10d %dms"
-                % (callee.name, os.path.basename(callee.source), num_calls, run_time / 1000))
-
+def analyze_profile(samples, stacks, scopes, folded_file):
+    # stacks is a list of [scope, [symbols root first], count] as sampled by rg_profiler.c
+    folded = dict()
+    self_samples = dict()
+    total_samples = dict()
+
+    for scope, symbols, count in stacks:
+        names = [scope] + [symbol.name for symbol in symbols]
+        key = ";".join(names)
+        folded[key] = folded.get(key, 0) + count
+        if symbols:
+            self_samples[symbols[-1].name] = self_samples.get(symbols[-1].name, 0) + count
+        for name in set(names):
+            total_samples[name] = total_samples.get(name, 0) + count
+
+    with open(folded_file, "w") as f:
+        for key, count in sorted(folded.items()):
+            f.write("%s %d\n" % (key, count))
+
+    samples = max(samples, 1)
+    debug_print("%-48s %8s %8s" % ("Function (%d samples)" % samples, "self", "total"))
+    for name, count in sorted(self_samples.items(), key=lambda x: x[1], reverse=True)[:20]:
+        debug_print("%-48s %7.1f%% %7.1f%%" % (name[:48], count * 100 / samples, total_samples[name] * 100 / samples))
+    debug_print("")
+
+    if scopes:
+        debug_print("%-32s %10s %10s %10s %10s" % ("Scope", "calls", "total", "self", "max"))
+        for name, calls, total_time, self_time, max_time in sorted(scopes, key=lambda x: x[2], reverse=True):
+            debug_print("%-32s %10d %8dms %8dms %8dus" % (name, calls, total_time / 1000, self_time / 1000, max_time))
         debug_print("")
 
+    debug_print("Folded stacks written to %s (use flamegraph.pl or speedscope)" % folded_file)
+    debug_print("")
+
 
 def build_firmware(targets, shrink=False, device_type=None):
     os.chdir(PRJ_PATH)
@@ -210,7 +201,10 @@ def monitor_app(target, port, baudrate=115200):
 
     # To do: detect ctrl+r ctrl+c etc
 
-    profile_frames = list()
+    folded = os.path.join(PRJ_PATH, target, "build", target + ".folded")
+    profile_samples = 0
+    profile_stacks = list()
+    profile_scopes = list()
 
     line_bytes = b''
     while 1:
@@ -239,18 +233,24 @@ def monitor_app(target, port, baudrate=115200):
 
                 if rg_debug_ns == "PROF":
                     if rg_debug_cmd == "BEGIN":
-                        profile_frames.clear()
+                        profile_stacks.clear()
+                        profile_scopes.clear()
+                        profile_samples = int(rg_debug_arg.split()[0])
                     if rg_debug_cmd == "END":
-                        analyze_profile(profile_frames)
-                    if rg_debug_cmd == "DATA":
-                        m = re.match(r"([x0-9a-f]+)\s([x0-9a-f]+)\s(\d+)\s(\d+)", rg_debug_arg)
+                        analyze_profile(profile_samples, profile_stacks, profile_scopes, folded)
+                    if rg_debug_cmd == "STACK":
+                        m = re.match(r"(\S+)\s(\d+)$", rg_debug_arg)
                         if m:
-                            profile_frames.append([
-                                find_symbol(elf, m.group(1)),
-                                find_symbol(elf, m.group(2)),
-                                int(m.group(3)),
-                                int(m.group(4)),
+                            scope, *addresses = m.group(1).split(";")
+                            profile_stacks.append([
+                                scope,
+                                [find_symbol(elf, addr) for addr in addresses],
+                                int(m.group(2)),
                             ])
+                    if rg_debug_cmd == "SCOPE":
+                        m = re.match(r"(\S+)\s(\d+)\s(\d+)\s(\d+)\s(\d+)", rg_debug_arg)
+                        if m:
+                            profile_scopes.append([m.group(1)] + [int(x) for x in m.groups()[1:]])
                     continue
 
             sys.stdout.buffer.write(b"\n")
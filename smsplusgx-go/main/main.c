@@ -283,7 +283,9 @@ void app_main(void)
             }
         }
 
+        rg_system_set_phase(RG_PHASE_EMULATE);
         system_frame(!drawFrame);
+        rg_system_set_phase(RG_PHASE_NONE);
 
         if (drawFrame)
         {
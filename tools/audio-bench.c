@@ -0,0 +1,224 @@
+// Benchmarks the sample processing of rg_audio_dsp.c over one second of 32kHz stereo and checks
+// it against the float conversions it replaced. Also checks the step response of the low-pass.
+// Built with -O3 like the retro-go component.
+//
+// Build (host):
+//   gcc -O3 -o audio-bench tools/audio-bench.c components/retro-go/rg_audio_dsp.c -Icomponents/retro-go -lm
+//
+// Usage:
+//   audio-bench [volume_percent]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rg_audio.h"
+
+#define SAMPLE_RATE 32000
+#define FILTER_CUTOFF 6000 // Same as AUDIO_FILTER_CUTOFF in rg_audio.c
+#define RUNS 200
+
+static int16_t source[SAMPLE_RATE * 2], buffer[SAMPLE_RATE * 2], reference[SAMPLE_RATE * 2];
+static int failures;
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void fail(const char *what, long a, long b)
+{
+    printf("  FAILED: %s (%ld, %ld)\n", what, a, b);
+    failures++;
+}
+
+// The float conversions rg_audio.c used before, as the baseline
+static void speaker_float(int16_t *buf, size_t frameCount, float volume)
+{
+    for (size_t i = 0; i < frameCount * 2; i += 2)
+    {
+        int32_t sample = (buf[i] + buf[i + 1]) >> 1;
+        const float range = (127 + 127) * ((float)sample / 0x8000) * volume;
+        uint16_t dac0, dac1;
+
+        if (range > 127.f)
+        {
+            dac1 = (range - 127);
+            dac0 = 127;
+        }
+        else if (range < -127.f)
+        {
+            dac1 = (range + 127);
+            dac0 = -127;
+        }
+        else
+        {
+            dac1 = 0;
+            dac0 = range;
+        }
+
+        buf[i] = (int16_t)((uint16_t)(0x80 - dac1) << 8);
+        buf[i + 1] = (int16_t)((uint16_t)(dac0 + 0x80) << 8);
+    }
+}
+
+static void ext_dac_float(int16_t *buf, size_t frameCount, float volume)
+{
+    for (size_t i = 0; i < frameCount * 2; ++i)
+    {
+        int32_t sample = buf[i] * volume;
+        if (sample > 32767)
+            sample = 32767;
+        else if (sample < -32768)
+            sample = -32767;
+        buf[i] = sample;
+    }
+}
+
+typedef void (*fixed_fn)(int16_t *, size_t, int32_t);
+typedef void (*float_fn)(int16_t *, size_t, float);
+
+static double time_fixed(fixed_fn fn, int32_t volume)
+{
+    double best = 1e30;
+    for (int run = 0; run < RUNS; run++)
+    {
+        memcpy(buffer, source, sizeof(buffer));
+        double start = now_us();
+        fn(buffer, SAMPLE_RATE, volume);
+        double elapsed = now_us() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    return SAMPLE_RATE * 2 / best;
+}
+
+static double time_float(float_fn fn, float volume)
+{
+    double best = 1e30;
+    for (int run = 0; run < RUNS; run++)
+    {
+        memcpy(reference, source, sizeof(reference));
+        double start = now_us();
+        fn(reference, SAMPLE_RATE, volume);
+        double elapsed = now_us() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    return SAMPLE_RATE * 2 / best;
+}
+
+// The speaker output is two DACs, the sum of their offsets from 0x80 is what matters
+static int speaker_level(const int16_t *frame)
+{
+    return (0x80 - ((uint16_t)frame[0] >> 8)) + (((uint16_t)frame[1] >> 8) - 0x80);
+}
+
+static void check_conversions(int percent)
+{
+    int32_t volume = percent * 0x8000 / 100;
+    int worst_speaker = 0, worst_dac = 0;
+
+    memcpy(buffer, source, sizeof(buffer));
+    memcpy(reference, source, sizeof(reference));
+    rg_audio_convert_speaker(buffer, SAMPLE_RATE, volume);
+    speaker_float(reference, SAMPLE_RATE, percent * 0.01f);
+    for (size_t i = 0; i < SAMPLE_RATE; i++)
+    {
+        int diff = abs(speaker_level(&buffer[i * 2]) - speaker_level(&reference[i * 2]));
+        worst_speaker = diff > worst_speaker ? diff : worst_speaker;
+    }
+
+    memcpy(buffer, source, sizeof(buffer));
+    memcpy(reference, source, sizeof(reference));
+    rg_audio_convert_ext_dac(buffer, SAMPLE_RATE, volume);
+    ext_dac_float(reference, SAMPLE_RATE, percent * 0.01f);
+    for (size_t i = 0; i < SAMPLE_RATE * 2; i++)
+    {
+        int diff = abs(buffer[i] - reference[i]);
+        worst_dac = diff > worst_dac ? diff : worst_dac;
+    }
+
+    if (worst_speaker > 1)
+        fail("speaker output differs from the float version", percent, worst_speaker);
+    if (worst_dac > 1)
+        fail("ext DAC output differs from the float version", percent, worst_dac);
+}
+
+static void check_filter(void)
+{
+    const int level = 16000;
+    const double a = 1 - exp(-2 * M_PI * FILTER_CUTOFF / SAMPLE_RATE);
+    int16_t frames[64 * 2];
+    rg_audio_filter_t filter;
+    double worst = 0;
+
+    rg_audio_filter_init(&filter, FILTER_CUTOFF, SAMPLE_RATE);
+
+    // y[n] = level * (1 - (1 - a)^(n + 1)), fed in two blocks to cover the carried over state
+    for (int i = 0; i < 64; i++)
+    {
+        frames[i * 2 + 0] = level;
+        frames[i * 2 + 1] = -level;
+    }
+    rg_audio_filter_apply(&filter, frames, 20);
+    rg_audio_filter_apply(&filter, frames + 40, 44);
+
+    for (int i = 0; i < 64; i++)
+    {
+        double expected = level * (1 - pow(1 - a, i + 1));
+        double error = fmax(fabs(frames[i * 2] - expected), fabs(-frames[i * 2 + 1] - expected));
+        worst = error > worst ? error : worst;
+        if (error > 4)
+            fail("step response", i, frames[i * 2]);
+    }
+
+    if (abs(frames[63 * 2] - level) > 2 || abs(frames[63 * 2 + 1] + level) > 2)
+        fail("step response doesn't settle", frames[63 * 2], frames[63 * 2 + 1]);
+
+    printf("low-pass %dHz: alpha %d/32768, step response within %.1f of the exact one, settles at %d/%d of %d\n",
+        FILTER_CUTOFF, filter.alpha, worst, frames[63 * 2], frames[63 * 2 + 1], level);
+}
+
+int main(int argc, char **argv)
+{
+    int percent = argc > 1 ? atoi(argv[1]) : 100;
+    int32_t volume = percent * 0x8000 / 100;
+    unsigned seed = 1;
+
+    // Full scale noise over a sine, some of it clips at volumes above 100%
+    for (size_t i = 0; i < SAMPLE_RATE; i++)
+    {
+        int sine = 24000 * sin(2 * M_PI * 440 * i / SAMPLE_RATE);
+        source[i * 2 + 0] = sine + (int)(rand_r(&seed) % 16384) - 8192;
+        source[i * 2 + 1] = -sine + (int)(rand_r(&seed) % 16384) - 8192;
+    }
+
+    for (int p = 0; p <= 150; p++)
+        check_conversions(p);
+    check_filter();
+
+    printf("one second of %dHz stereo at %d%% volume, samples/us (best of %d):\n", SAMPLE_RATE, percent, RUNS);
+    printf("  speaker  float %7.1f  fixed %7.1f\n", time_float(speaker_float, percent * 0.01f),
+        time_fixed(rg_audio_convert_speaker, volume));
+    printf("  ext DAC  float %7.1f  fixed %7.1f\n", time_float(ext_dac_float, percent * 0.01f),
+        time_fixed(rg_audio_convert_ext_dac, volume));
+
+    rg_audio_filter_t filter;
+    rg_audio_filter_init(&filter, FILTER_CUTOFF, SAMPLE_RATE);
+    double best = 1e30;
+    for (int run = 0; run < RUNS; run++)
+    {
+        memcpy(buffer, source, sizeof(buffer));
+        double start = now_us();
+        rg_audio_filter_apply(&filter, buffer, SAMPLE_RATE);
+        double elapsed = now_us() - start;
+        best = elapsed < best ? elapsed : best;
+    }
+    printf("  low-pass               fixed %7.1f\n", SAMPLE_RATE * 2 / best);
+
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+// Simulates rg_audio_ring between a jittery emulator and an audio sink, in virtual time, with the
+// same waiting and setpoint rules as rg_audio_submit() and the same block size as audio_task. It
+// checks that after a warmup the fill level stays within bounds without underruns, that timer
+// paced producers never wait and that the rate converges to their clock drift, and that producers
+// paced by the audio back-pressure are played at 1:1 without queuing more than about a frame.
+//
+// Build (host):
+//   gcc -O2 -o audio-ring-sim tools/audio-ring-sim.c components/retro-go/rg_audio_ring.c -Icomponents/retro-go
+//
+// Usage:
+//   audio-ring-sim [seconds]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rg_audio_ring.h"
+
+// Same values as rg_audio.c
+#define SAMPLE_RATE 32000
+#define LATENCY_MS 40
+#define BLOCK_FRAMES 256
+#define WAIT_LEVEL(target) ((target) * 2)
+#define PACED_WAIT_LEVEL(frames) ((frames) + BLOCK_FRAMES)
+
+#define FRAME_RATE 60
+#define JITTER_US 8000     // Emulator frames are submitted up to this much early or late
+#define WARMUP_US 30000000 // Before that the fill level and the ratio are still settling
+
+typedef struct {
+    const char *name;
+    double drift;       // Producer clock error, +0.0045 produces 0.45% too many frames per second
+    bool back_pressure; // No timer, the producer runs as fast as rg_audio_submit() lets it
+} scenario_t;
+
+static int failures;
+
+static double jitter(unsigned *seed)
+{
+    return (rand_r(seed) / (double)RAND_MAX * 2 - 1) * JITTER_US;
+}
+
+static void check(bool condition, const char *name, const char *what)
+{
+    if (!condition)
+    {
+        printf("  FAILED: %s: %s\n", name, what);
+        failures++;
+    }
+}
+
+static void run(const scenario_t *sc, double duration_us)
+{
+    static int16_t frames[SAMPLE_RATE * 2], block[BLOCK_FRAMES * 2];
+    const size_t target = SAMPLE_RATE * LATENCY_MS / 1000;
+    const size_t per_frame = SAMPLE_RATE / FRAME_RATE; // Nominal, the actual count alternates
+    const double sink_period = BLOCK_FRAMES * 1e6 / SAMPLE_RATE;
+    const double frame_period = 1e6 / FRAME_RATE / (1 + sc->drift);
+    rg_audio_ring_t ring;
+    unsigned seed = 1234;
+
+    double t_sink = 0, t_prod = frame_period + jitter(&seed);
+    size_t pending = 0; // Frames of the current submit not written yet, the producer is blocked
+    bool waited = false, paced = false;
+    size_t wait_level = WAIT_LEVEL(target), unpaced_frames = 0, submitted = 0;
+    long produced = 0;
+    size_t fill_min = (size_t)-1, fill_max = 0;
+    uint32_t warm_underruns = 0, warm_waits = 0;
+    double step_sum = 0, fill_sum = 0;
+    long step_count = 0;
+
+    if (!rg_audio_ring_init(&ring, target * 4, target))
+    {
+        printf("allocation failed\n");
+        exit(1);
+    }
+
+    while (t_sink < duration_us)
+    {
+        if (t_prod <= t_sink)
+        {
+            // rg_audio_submit()
+            if (!pending)
+            {
+                pending = submitted = (produced + 1) * SAMPLE_RATE / FRAME_RATE - produced * SAMPLE_RATE / FRAME_RATE;
+                wait_level = paced ? PACED_WAIT_LEVEL(submitted) : WAIT_LEVEL(target);
+                waited = false;
+            }
+            while (pending && rg_audio_ring_fill(&ring) <= wait_level)
+                pending -= rg_audio_ring_write(&ring, frames, pending);
+
+            if (pending)
+            {
+                t_prod = t_sink + 1; // Blocked until the sink consumes a block
+                warm_waits += !waited && t_sink > WARMUP_US;
+                wait_level = PACED_WAIT_LEVEL(submitted);
+                waited = paced = true;
+                unpaced_frames = 0;
+                continue;
+            }
+            unpaced_frames += submitted;
+            if (unpaced_frames > SAMPLE_RATE)
+                paced = false;
+            rg_audio_ring_set_setpoint(&ring, paced ? wait_level + submitted / 2 : target);
+
+            produced++;
+            if (sc->back_pressure)
+                t_prod += 1e6 / FRAME_RATE / 4 + (jitter(&seed) + JITTER_US) / 2; // Emulation time
+            else
+                t_prod = produced * frame_period + frame_period + jitter(&seed);
+            if (t_prod <= t_sink)
+                t_prod = t_sink + 1;
+            continue;
+        }
+
+        // audio_task
+        uint32_t underruns = ring.underruns;
+        rg_audio_ring_read(&ring, block, BLOCK_FRAMES);
+        t_sink += sink_period;
+
+        if (t_sink > WARMUP_US)
+        {
+            size_t fill = rg_audio_ring_fill(&ring);
+            fill_min = fill < fill_min ? fill : fill_min;
+            fill_max = fill > fill_max ? fill : fill_max;
+            warm_underruns += ring.underruns - underruns;
+            fill_sum += fill;
+            step_sum += ring.step / 65536.0;
+            step_count++;
+        }
+    }
+
+    double ratio = step_sum / step_count;
+    double expected = sc->back_pressure ? 1.0 : 1 + sc->drift;
+
+    double fill_ms = fill_sum / step_count * 1000 / SAMPLE_RATE;
+
+    printf("%-20s fill %4zu..%-4zu (avg %4.1f ms)  underruns %2u (%u after warmup)  waits %5u  ratio %.4f (expected %.4f)\n",
+        sc->name, fill_min, fill_max, fill_ms, ring.underruns, warm_underruns, warm_waits, ratio, expected);
+
+    check(warm_underruns == 0, sc->name, "underruns after warmup");
+    check(fill_min > BLOCK_FRAMES, sc->name, "fill level dropped below one block");
+    check(fill_max < ring.capacity, sc->name, "ring overflowed");
+    check(sc->back_pressure || warm_waits == 0, sc->name, "timer paced producer had to wait");
+    check(!sc->back_pressure || fill_max <= PACED_WAIT_LEVEL(per_frame + 1) + per_frame + 1, sc->name,
+        "back-pressured producer queued more than one frame over the wait level");
+    check(ratio > expected - 0.0005 && ratio < expected + 0.0005, sc->name, "ratio didn't converge");
+
+    rg_audio_ring_free(&ring);
+}
+
+int main(int argc, char **argv)
+{
+    const scenario_t scenarios[] = {
+        {"timer, drift -0.45%", -0.0045, false},
+        {"timer, no drift", 0, false},
+        {"timer, drift +0.45%", +0.0045, false},
+        {"back-pressure", 0, true},
+    };
+    double seconds = argc > 1 ? atof(argv[1]) : 600;
+
+    printf("%.0f s at %d Hz, +-%d ms jitter, target %d frames\n", seconds, SAMPLE_RATE, JITTER_US / 1000,
+        SAMPLE_RATE * LATENCY_MS / 1000);
+
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        run(&scenarios[i], seconds * 1e6);
+
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,304 @@
+// Feeds scripted and random contact bounce traces to rg_debounce_update() and checks the edges
+// it reports. The scripted traces have exact expected edges. The random ones bounce on both the
+// press and the release of every key and are polled at irregular intervals, each physical press
+// must come out as exactly one press edge and one release edge, within the expected delays.
+// The short taps are sampled like input_task does and read at a core's irregular frame rate,
+// every tap that was sampled must be returned by at least one rg_debounce_read().
+//
+// Build (host):
+//   gcc -O2 -o debounce-trace tools/debounce-trace.c components/retro-go/rg_input_debounce.c -Icomponents/retro-go
+//
+// Usage:
+//   debounce-trace [random_presses_per_key]
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rg_input.h"
+
+#define RELEASE_DELAY 8000 // Same as INPUT_RELEASE_DELAY in rg_input.c
+#define MAX_BOUNCE 5000    // Longest bounce burst, it must stay below RELEASE_DELAY
+#define MIN_POLL 250       // Frame start reads come often, input_task reads every 10ms
+#define MAX_POLL 10000
+// A release is first seen up to one poll late and reported up to one poll after its delay expired
+#define MAX_RELEASE_LAG (MAX_POLL + RELEASE_DELAY + MAX_POLL)
+#define TASK_POLL 10000    // INPUT_POLL_INTERVAL in rg_input.c
+#define SYNC_MAX_AGE 2000  // INPUT_SYNC_MAX_AGE in rg_input.c
+#define MIN_CORE_READ 8000 // A 60Hz core reads the gamepad once per frame, slow frames and
+#define MAX_CORE_READ 33000 // catching up on skipped ones make that irregular
+
+typedef struct {
+    int64_t time;
+    uint32_t state;
+} step_t;
+
+typedef struct {
+    const char *name;
+    step_t raw[12];   // The raw state changes at these times, ends with {0, 0}
+    step_t edges[8];  // The debounced state must change exactly at these times, ends with {0, 0}
+} trace_t;
+
+static const trace_t traces[] = {
+    {
+        "clean press",
+        {{10000, RG_KEY_A}, {60000, 0}},
+        {{10000, RG_KEY_A}, {68000, 0}},
+    },
+    {
+        "bouncy press and release",
+        {{10000, RG_KEY_A}, {10300, 0}, {11000, RG_KEY_A}, {11600, 0}, {12000, RG_KEY_A},
+         {60000, 0}, {60500, RG_KEY_A}, {61000, 0}, {62000, RG_KEY_A}, {62500, 0}},
+        {{10000, RG_KEY_A}, {71000, 0}},
+    },
+    {
+        "short drop while held",
+        {{10000, RG_KEY_A}, {30000, 0}, {37000, RG_KEY_A}, {60000, 0}},
+        {{10000, RG_KEY_A}, {68000, 0}},
+    },
+    {
+        "tap shorter than the delay",
+        {{10000, RG_KEY_A}, {12000, 0}},
+        {{10000, RG_KEY_A}, {20000, 0}},
+    },
+    {
+        "double tap",
+        {{10000, RG_KEY_A}, {20000, 0}, {29000, RG_KEY_A}, {40000, 0}},
+        {{10000, RG_KEY_A}, {28000, 0}, {29000, RG_KEY_A}, {48000, 0}},
+    },
+    {
+        "two keys, one bouncing",
+        {{10000, RG_KEY_A | RG_KEY_B}, {20000, RG_KEY_B}, {21000, RG_KEY_A | RG_KEY_B},
+         {22000, RG_KEY_B}, {40000, 0}},
+        {{10000, RG_KEY_A | RG_KEY_B}, {30000, RG_KEY_B}, {48000, 0}},
+    },
+};
+
+static int failures;
+
+static void fail(const char *name, const char *what, int64_t a, int64_t b)
+{
+    printf("  FAILED: %s: %s (%lld, %lld)\n", name, what, (long long)a, (long long)b);
+    failures++;
+}
+
+static void run_trace(const trace_t *trace)
+{
+    rg_debounce_t db;
+    uint32_t raw = 0, prev = 0;
+    size_t step = 0, edge = 0;
+
+    rg_debounce_init(&db, RELEASE_DELAY);
+
+    for (int64_t now = 0; now <= 200000; now += 1000)
+    {
+        while (trace->raw[step].time && trace->raw[step].time <= now)
+            raw = trace->raw[step++].state;
+
+        uint32_t state = rg_debounce_update(&db, raw, now);
+        if (state == prev)
+            continue;
+
+        const step_t *expected = &trace->edges[edge];
+        if (!expected->time)
+            fail(trace->name, "unexpected edge", now, state);
+        else if (expected->time != now || expected->state != state)
+            fail(trace->name, "wrong edge", now, expected->time);
+        else
+            edge++;
+        prev = state;
+    }
+
+    if (trace->edges[edge].time)
+        fail(trace->name, "missing edge", trace->edges[edge].time, trace->edges[edge].state);
+
+    printf("%-26s %zu edges\n", trace->name, edge);
+}
+
+typedef struct {
+    int64_t changes[16]; // Times at which the contact toggles, starting closed
+    int count;
+    int64_t press_start, press_end; // First and last change of the press burst
+    int64_t release_start, release_end;
+} press_t;
+
+// One physical press: a burst of bounces, a hold, and another burst of bounces. Each bounce adds
+// two changes, so the press burst ends closed and the release burst ends open.
+static int64_t bounce(press_t *p, int64_t start, unsigned *seed)
+{
+    int64_t t = start;
+
+    p->changes[p->count++] = t;
+    while (t + 3000 - start <= MAX_BOUNCE && rand_r(seed) % 4)
+    {
+        p->changes[p->count++] = t += 100 + rand_r(seed) % 1400;
+        p->changes[p->count++] = t += 100 + rand_r(seed) % 1400;
+    }
+
+    return t;
+}
+
+static void make_press(press_t *p, int64_t start, unsigned *seed)
+{
+    p->count = 0;
+    p->press_start = start;
+    p->press_end = bounce(p, start, seed);
+    p->release_start = p->press_end + 10000 + rand_r(seed) % 200000;
+    p->release_end = bounce(p, p->release_start, seed);
+}
+
+static void run_random(int presses)
+{
+    press_t *keys[RG_KEY_COUNT];
+    int current[RG_KEY_COUNT] = {0}, change[RG_KEY_COUNT] = {0};
+    int press_edges[RG_KEY_COUNT] = {0}, release_edges[RG_KEY_COUNT] = {0};
+    int64_t worst_press = 0, worst_release = 0;
+    unsigned seed = 42;
+    rg_debounce_t db;
+    uint32_t prev = 0;
+
+    // Independent timelines per key, with enough time between presses that they can't merge
+    for (int k = 0; k < RG_KEY_COUNT; k++)
+    {
+        int64_t t = 1000 + rand_r(&seed) % 50000;
+        keys[k] = malloc(presses * sizeof(press_t));
+        for (int i = 0; i < presses; i++)
+        {
+            make_press(&keys[k][i], t, &seed);
+            t = keys[k][i].release_end + MAX_RELEASE_LAG + rand_r(&seed) % 100000;
+        }
+    }
+
+    rg_debounce_init(&db, RELEASE_DELAY);
+
+    for (int64_t now = 0;; now += MIN_POLL + rand_r(&seed) % (MAX_POLL - MIN_POLL))
+    {
+        uint32_t raw = 0;
+        bool done = true;
+
+        for (int k = 0; k < RG_KEY_COUNT; k++)
+        {
+            while (current[k] < presses)
+            {
+                const press_t *p = &keys[k][current[k]];
+                while (change[k] < p->count && p->changes[change[k]] <= now)
+                    change[k]++;
+                // Past the end of this press and of its release delay, move on to the next one
+                if (change[k] == p->count && now > p->release_end + MAX_RELEASE_LAG)
+                {
+                    current[k]++;
+                    change[k] = 0;
+                    continue;
+                }
+                if (change[k] & 1) // An odd number of changes means the contact is closed
+                    raw |= 1 << k;
+                break;
+            }
+            done = done && current[k] == presses;
+        }
+
+        if (done)
+            break;
+
+        uint32_t state = rg_debounce_update(&db, raw, now);
+
+        for (int k = 0; k < RG_KEY_COUNT; k++)
+        {
+            uint32_t key = 1 << k;
+            if ((state ^ prev) & key)
+            {
+                const press_t *p = &keys[k][current[k]];
+                if (state & key)
+                {
+                    // Reported on the first sample that sees the contact closed
+                    if (press_edges[k]++ != current[k] || now < p->press_start || now > p->press_end + MAX_POLL)
+                        fail("random", "bad press edge", k, now);
+                    if (now - p->press_start > worst_press)
+                        worst_press = now - p->press_start;
+                }
+                else
+                {
+                    // Reported once the contact was seen open for the whole delay
+                    if (release_edges[k]++ != current[k] || now < p->release_start + RELEASE_DELAY
+                        || now > p->release_end + MAX_RELEASE_LAG)
+                        fail("random", "bad release edge", k, now);
+                    if (now - p->release_end > worst_release)
+                        worst_release = now - p->release_end;
+                }
+            }
+        }
+        prev = state;
+    }
+
+    for (int k = 0; k < RG_KEY_COUNT; k++)
+    {
+        if (press_edges[k] != presses || release_edges[k] != presses)
+            fail("random", "edge count", press_edges[k], release_edges[k]);
+        free(keys[k]);
+    }
+
+    printf("%-26s %d presses per key on %d keys, worst delay %lld us on press, %lld us on release\n",
+        "random bounces", presses, RG_KEY_COUNT, (long long)worst_press, (long long)worst_release);
+}
+
+static void run_short_taps(int taps)
+{
+    int64_t tap_start = 0, tap_end = 0, last_sample = -TASK_POLL, next_read = 0;
+    int sampled = 0, reported = 0, missed_unlatched = 0, count = 0;
+    bool tap_sampled = false, tap_reported = false, tap_seen_unlatched = false;
+    unsigned seed = 7;
+    rg_debounce_t db;
+
+    rg_debounce_init(&db, RELEASE_DELAY);
+
+    for (int64_t now = 0; count <= taps; now += 100)
+    {
+        // Taps between 0.5ms and 9ms, far enough apart that each one's release is over
+        if (now >= tap_end + 50000 && now >= tap_start + 100000)
+        {
+            if (tap_sampled)
+            {
+                sampled++;
+                reported += tap_reported;
+                missed_unlatched += !tap_seen_unlatched;
+                if (!tap_reported)
+                    fail("short taps", "tap never read", tap_start, tap_end - tap_start);
+            }
+            tap_start = now + rand_r(&seed) % 20000;
+            tap_end = tap_start + 500 + rand_r(&seed) % 8500;
+            tap_sampled = tap_reported = tap_seen_unlatched = false;
+            count++;
+        }
+
+        uint32_t raw = (now >= tap_start && now < tap_end) ? RG_KEY_A : 0;
+
+        if (now % TASK_POLL == 0 || (now == next_read && now - last_sample > SYNC_MAX_AGE))
+        {
+            rg_debounce_update(&db, raw, now);
+            last_sample = now;
+            tap_sampled |= raw != 0;
+        }
+
+        if (now == next_read)
+        {
+            tap_seen_unlatched |= (db.state & RG_KEY_A) != 0;
+            tap_reported |= (rg_debounce_read(&db) & RG_KEY_A) != 0;
+            next_read += (MIN_CORE_READ + rand_r(&seed) % (MAX_CORE_READ - MIN_CORE_READ)) / 100 * 100;
+        }
+    }
+
+    printf("%-26s %d sampled, %d read, %d would be lost without the latch\n",
+        "short taps", sampled, reported, missed_unlatched);
+}
+
+int main(int argc, char **argv)
+{
+    for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++)
+        run_trace(&traces[i]);
+
+    run_random(argc > 1 ? atoi(argv[1]) : 10000);
+
+    run_short_taps(argc > 1 ? atoi(argv[1]) : 10000);
+
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,157 @@
+// Replays recorded frames through the line and tile frame diffs of rg_display and reports
+// how much data each of them would have sent to the LCD. It fails if the tile diff emits
+// rectangles that overlap, their common pixels would be sent twice.
+//
+// Build (host):
+//   gcc -O2 -o diff-replay tools/diff-replay.c components/retro-go/rg_display_diff.c -Icomponents/retro-go
+//
+// Usage:
+//   diff-replay frames.raw width height stride pixlen [setup_cost]
+//
+// frames.raw is simply consecutive dumps of an emulator's framebuffer (height * stride bytes each),
+// for example obtained by fwrite()ing update->buffer before each rg_display_queue_update() call.
+// setup_cost is the price of one LCD window in source pixels (see SPI_WINDOW_SETUP_COST).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rg_display.h"
+
+typedef struct {
+    long frames;
+    long empty;
+    long full;
+    long windows;
+    long long bytes;
+} replay_stats_t;
+
+static void print_stats(const char *name, const replay_stats_t *stats, int setup_cost)
+{
+    long long total = stats->bytes + (long long)stats->windows * setup_cost * 2;
+    printf("%-6s frames:%ld empty:%ld full:%ld windows:%ld pixel bytes:%lld total bytes (with setup):%lld (%lld/frame)\n",
+        name, stats->frames, stats->empty, stats->full, stats->windows, stats->bytes, total,
+        stats->frames ? total / stats->frames : 0);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 6)
+    {
+        fprintf(stderr, "usage: %s frames.raw width height stride pixlen [setup_cost]\n", argv[0]);
+        return 1;
+    }
+
+    rg_display_t display = {0};
+    display.source.width = atoi(argv[2]);
+    display.source.height = atoi(argv[3]);
+    display.source.stride = atoi(argv[4]);
+    display.source.pixlen = atoi(argv[5]);
+    int setup_cost = argc > 6 ? atoi(argv[6]) : 76; // GB at 320x240, the worst case
+    size_t frame_size = display.source.height * display.source.stride;
+
+    if (display.source.width < 4 || display.source.height < 2 || display.source.height > 256
+        || display.source.stride < display.source.width * display.source.pixlen
+        || (display.source.pixlen != 1 && display.source.pixlen != 2))
+    {
+        fprintf(stderr, "Invalid frame format\n");
+        return 1;
+    }
+
+    FILE *fp = fopen(argv[1], "rb");
+    if (!fp)
+    {
+        fprintf(stderr, "Unable to open '%s'\n", argv[1]);
+        return 1;
+    }
+
+    static rg_video_update_t updates[2];
+    updates[0].buffer = calloc(1, frame_size);
+    updates[1].buffer = calloc(1, frame_size);
+
+    const int full_bytes = display.source.width * display.source.height * 2;
+    replay_stats_t lines = {0}, tiles = {0};
+    int current = 0, overlaps = 0;
+
+    if (fread(updates[1].buffer, frame_size, 1, fp) != 1)
+    {
+        fprintf(stderr, "Need at least two frames\n");
+        return 1;
+    }
+
+    while (fread(updates[current].buffer, frame_size, 1, fp) == 1)
+    {
+        rg_video_update_t *update = &updates[current];
+        rg_video_update_t *previous = &updates[!current];
+
+        // RG_DISPLAY_UPDATE_PARTIAL
+        int threshold = (display.source.width * display.source.height) / 2;
+        int changed = rg_display_diff_lines(&display, update, previous, threshold);
+
+        lines.frames++;
+        if (changed == 0)
+            lines.empty++;
+        else if (changed >= threshold)
+        {
+            lines.full++;
+            lines.windows++;
+            lines.bytes += full_bytes;
+        }
+        else
+        {
+            rg_display_merge_lines(&display, update);
+            for (int y = 0; y < display.source.height; y += update->diff[y].repeat)
+            {
+                if (update->diff[y].width > 0)
+                {
+                    lines.windows++;
+                    lines.bytes += update->diff[y].width * update->diff[y].repeat * 2;
+                }
+            }
+        }
+
+        // RG_DISPLAY_UPDATE_SMART
+        int count = rg_display_diff_tiles(&display, update, previous, setup_cost);
+
+        tiles.frames++;
+        if (count == 0)
+            tiles.empty++;
+        else if (count < 0)
+        {
+            tiles.full++;
+            tiles.windows++;
+            tiles.bytes += full_bytes;
+        }
+        else
+        {
+            for (int i = 0; i < count; i++)
+            {
+                const rg_rect_diff_t *a = &update->rects[i];
+                tiles.bytes += a->width * a->height * 2;
+                for (int j = i + 1; j < count; j++)
+                {
+                    const rg_rect_diff_t *b = &update->rects[j];
+                    if (a->left < b->left + b->width && b->left < a->left + a->width
+                        && a->top < b->top + b->height && b->top < a->top + a->height)
+                    {
+                        printf("  FAILED: frame %ld: rect %d (%d,%d %dx%d) overlaps rect %d (%d,%d %dx%d)\n",
+                            tiles.frames, i, a->left, a->top, a->width, a->height,
+                            j, b->left, b->top, b->width, b->height);
+                        overlaps++;
+                    }
+                }
+            }
+            tiles.windows += count;
+        }
+
+        current = !current;
+    }
+
+    fclose(fp);
+
+    print_stats("lines", &lines, setup_cost);
+    print_stats("tiles", &tiles, setup_cost);
+
+    printf(overlaps ? "FAILED\n" : "OK\n");
+    return overlaps ? 1 : 0;
+}
@@ -0,0 +1,452 @@
+// Runs the gnuboy core headless for a number of frames and reports where the time goes: CPU
+// (with the timers and the LCD state machine), scanline rendering and sound mixing. A hash of
+// the framebuffer and of the audio is written for every frame, comparing them with a previous
+// run's tells if a change to the core is bit-exact.
+//
+// Without a ROM a small built-in program is used: tile and map setup, scrolling, a mid-frame
+// STAT interrupt, sprites, all sound channels, a timer interrupt, a busy checksum loop, LY
+// polling and HALT. It's enough to catch a broken opcode, real games are better for timings.
+//
+// Build (host):
+//   gcc -O2 -DIS_LITTLE_ENDIAN -o gnuboy-bench tools/gnuboy-bench.c gnuboy-go/components/gnuboy/{cpu,hw,lcd,sound,gnuboy}.c -Ignuboy-go/components/gnuboy
+//
+// Usage:
+//   gnuboy-bench [-n frames] [-i input.txt] [-o hashes.txt] [-c reference.txt] [-p] [-t] [rom.gb]
+//
+// -p renders in paletted mode like main.c, frames are hashed as the 565 image they stand for so
+// the hashes can be compared with a 565 run.
+//
+// -t replaces the built-in program with a tile-heavy CGB scene (see write_tiles_rom), for when no
+// game is at hand to measure rendering with.
+//
+// The input file holds "<frame> <buttons>" lines, the buttons (A B SELECT START UP DOWN LEFT
+// RIGHT joined with '+', or '-' for none) stay pressed until the next line. Lines starting
+// with '#' are ignored.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "gnuboy.h"
+#include "hw.h"
+#include "lcd.h"
+#include "sound.h"
+
+#define AUDIO_SAMPLE_RATE 32000
+#define MAX_INPUTS 1024
+
+typedef struct
+{
+    int frame;
+    int pad;
+} input_t;
+
+static uint16_t framebuffers[2][GB_WIDTH * GB_HEIGHT];
+static uint16_t palettes[2][256];
+static uint16_t expanded[GB_WIDTH * GB_HEIGHT];
+static uint32_t clean_lines[2][5];
+static int current;
+
+static double render_time, render_start;
+static double mix_time, mix_start;
+
+static input_t inputs[MAX_INPUTS];
+static int inputs_count;
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void fail(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    fprintf(stderr, "FAILED: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ ((const uint8_t *)data)[i]) * 16777619;
+    return hash;
+}
+
+static void render_hook(int begin)
+{
+    if (begin)
+        render_start = now_us();
+    else
+        render_time += now_us() - render_start;
+}
+
+static void mix_hook(int begin)
+{
+    if (begin)
+        mix_start = now_us();
+    else
+        mix_time += now_us() - mix_start;
+}
+
+// Same double buffering as main.c, the clean lines hints are computed like on the device
+static void vblank_callback(void)
+{
+    current ^= 1;
+    lcd.out.buffer = (byte *)framebuffers[current];
+    lcd.out.palette = palettes[current];
+    lcd.out.clean_lines = clean_lines[current];
+    memset(clean_lines[current], 0, sizeof(clean_lines[current]));
+}
+
+// Same pixels as the GB_PIXEL_565_BE output
+static const uint16_t *expand_frame(int index)
+{
+    const uint8_t *src = (const uint8_t *)framebuffers[index];
+
+    for (int i = 0; i < GB_WIDTH * GB_HEIGHT; i++)
+    {
+        uint16_t color = palettes[index][src[i]];
+        expanded[i] = (color << 8) | (color >> 8);
+    }
+    return expanded;
+}
+
+static void load_inputs(const char *filename)
+{
+    static const char *names[8] = {"RIGHT", "LEFT", "UP", "DOWN", "A", "B", "SELECT", "START"};
+    char line[256], buttons[200];
+    FILE *fp = fopen(filename, "r");
+
+    if (!fp)
+        fail("%s", filename);
+
+    while (fgets(line, sizeof(line), fp))
+    {
+        input_t *input = &inputs[inputs_count];
+
+        if (line[0] == '#' || sscanf(line, "%d %199s", &input->frame, buttons) != 2)
+            continue;
+        if (inputs_count == MAX_INPUTS)
+            fail("more than %d input lines", MAX_INPUTS);
+
+        input->pad = 0;
+        for (char *name = strtok(buttons, "+"); name && strcmp(name, "-"); name = strtok(NULL, "+"))
+        {
+            int i = 0;
+            while (i < 8 && strcasecmp(name, names[i]))
+                i++;
+            if (i == 8)
+                fail("unknown button '%s'", name);
+            input->pad |= 1 << i; // Same order as gb_padbtn_t
+        }
+        inputs_count++;
+    }
+    fclose(fp);
+}
+
+// The built-in program, assembled by hand
+static uint8_t rom[0x8000];
+static int pc;
+
+#define EMIT(...) emit(sizeof((int[]){__VA_ARGS__}) / sizeof(int), __VA_ARGS__)
+
+static void emit(int count, ...)
+{
+    va_list ap;
+    va_start(ap, count);
+    while (count--)
+        rom[pc++] = va_arg(ap, int);
+    va_end(ap);
+}
+
+static void jr_back(int opcode, int target)
+{
+    EMIT(opcode, (uint8_t)(target - (pc + 2)));
+}
+
+static int jr_forward(int opcode)
+{
+    EMIT(opcode, 0);
+    return pc - 1;
+}
+
+static void jr_land(int from)
+{
+    rom[from] = pc - (from + 1);
+}
+
+static const char *save_rom(const char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp || fwrite(rom, sizeof(rom), 1, fp) != 1)
+        fail("%s", filename);
+    fclose(fp);
+    return filename;
+}
+
+static const char *write_builtin_rom(void)
+{
+    static char filename[] = "/tmp/gnuboy-bench.gb";
+    int loop, main, odd, skip;
+
+    // Vectors: vblank, stat, timer, entry point
+    pc = 0x40; EMIT(0xC3, 0x00, 0x04);
+    pc = 0x48; EMIT(0xC3, 0x80, 0x04);
+    pc = 0x50; EMIT(0xC3, 0xC0, 0x04);
+    pc = 0x100; EMIT(0x00, 0xC3, 0x50, 0x01);
+    memcpy(rom + 0x134, "GNUBOY BENCH", 12);
+
+    pc = 0x150;
+    EMIT(0xF3, 0x31, 0xFE, 0xFF);               // DI; LD SP,FFFE
+    EMIT(0xAF, 0xE0, 0x40);                     // LCD off
+    EMIT(0x21, 0x00, 0x80, 0x01, 0x00, 0x10);   // Tiles: 4KB from 8000
+    loop = pc;
+    EMIT(0x7D, 0xAC, 0x07, 0x81, 0x22);         // LD A,L; XOR H; RLCA; ADD A,C; LD (HL+),A
+    EMIT(0x0B, 0x78, 0xB1); jr_back(0x20, loop);
+    EMIT(0x21, 0x00, 0x98, 0x01, 0x00, 0x08);   // Both maps: 2KB from 9800
+    loop = pc;
+    EMIT(0x7D, 0x84, 0x22);                     // LD A,L; ADD A,H; LD (HL+),A
+    EMIT(0x0B, 0x78, 0xB1); jr_back(0x20, loop);
+    EMIT(0x21, 0x00, 0xFE, 0x0E, 0x00);         // 40 sprites, C = index
+    loop = pc;
+    EMIT(0x79, 0x07, 0x07, 0x07, 0x81, 0x81, 0x81, 0x81, 0xE6, 0x7F, 0xC6, 0x10, 0x22); // y
+    EMIT(0x79, 0x07, 0x07, 0xC6, 0x08, 0x22);   // x
+    EMIT(0x79, 0x22);                           // tile
+    EMIT(0x79, 0x0F, 0x0F, 0x0F, 0xE6, 0xF0, 0x22); // flips and priority
+    EMIT(0x0C, 0x79, 0xFE, 40); jr_back(0x20, loop);
+    EMIT(0x3E, 0xE4, 0xE0, 0x47, 0x3E, 0xD2, 0xE0, 0x48, 0x3E, 0x1B, 0xE0, 0x49); // BGP, OBP0, OBP1
+    EMIT(0x3E, 100, 0xE0, 0x4A, 0x3E, 87, 0xE0, 0x4B); // WY, WX
+    EMIT(0x3E, 0x80, 0xE0, 0x26, 0x3E, 0x77, 0xE0, 0x24, 0x3E, 0xFF, 0xE0, 0x25); // Sound on
+    EMIT(0x3E, 0x80, 0xE0, 0x11, 0x3E, 0xF3, 0xE0, 0x12, 0x3E, 0x00, 0xE0, 0x13, 0x3E, 0x87, 0xE0, 0x14);
+    EMIT(0x3E, 0x40, 0xE0, 0x16, 0x3E, 0xA5, 0xE0, 0x17, 0x3E, 0x80, 0xE0, 0x18, 0x3E, 0x86, 0xE0, 0x19);
+    EMIT(0x3E, 0x80, 0xE0, 0x1A, 0x3E, 0x20, 0xE0, 0x1C, 0x3E, 0x40, 0xE0, 0x1D, 0x3E, 0x87, 0xE0, 0x1E);
+    EMIT(0x3E, 0xF1, 0xE0, 0x21, 0x3E, 0x35, 0xE0, 0x22, 0x3E, 0x80, 0xE0, 0x23);
+    EMIT(0x3E, 0x00, 0xE0, 0x06, 0x3E, 0x04, 0xE0, 0x07); // TMA, TAC: 4096Hz
+    EMIT(0x3E, 72, 0xE0, 0x45, 0x3E, 0x40, 0xE0, 0x41);   // STAT interrupt at LY 72
+    EMIT(0xAF, 0xEA, 0x10, 0xC0, 0xEA, 0x11, 0xC0, 0xEA, 0x12, 0xC0, 0xE0, 0x0F);
+    EMIT(0x3E, 0x07, 0xE0, 0xFF);               // IE: vblank, stat, timer
+    EMIT(0x3E, 0xF3, 0xE0, 0x40, 0xFB);         // LCD on, EI
+
+    main = pc;
+    EMIT(0xFA, 0x10, 0xC0, 0xE6, 0x01, 0xC6, 0x01, 0x47); // B = 1 or 2: 256 or 512 iterations
+    EMIT(0x0E, 0x00, 0x21, 0x00, 0x00, 0x11, 0x00, 0x00);
+    loop = pc;
+    EMIT(0x2A, 0x83, 0x5F, 0xCB, 0x37, 0xAA, 0x57, 0xCB, 0x03); // Checksum the ROM
+    EMIT(0x0B, 0x78, 0xB1); jr_back(0x20, loop);
+    EMIT(0x7A, 0xEA, 0x00, 0xC0, 0x7B, 0xEA, 0x01, 0xC0, 0xEA, 0xF0, 0x87);
+    EMIT(0xFA, 0x10, 0xC0, 0xE6, 0x01);
+    odd = jr_forward(0x20);
+    loop = pc;
+    EMIT(0xF0, 0x44, 0xFE, 0x90); jr_back(0x20, loop); // Even frames: poll LY for 144
+    jr_back(0x18, main);
+    jr_land(odd);
+    EMIT(0xFA, 0x10, 0xC0, 0x47);
+    loop = pc;
+    EMIT(0x76, 0x00, 0xFA, 0x10, 0xC0, 0xB8); jr_back(0x28, loop); // Odd frames: HALT until the next
+    jr_back(0x18, main);
+
+    pc = 0x400; // VBlank
+    EMIT(0xF5, 0xE5, 0xC5, 0x21, 0x10, 0xC0, 0x34, 0x7E); // Frame counter
+    EMIT(0xE0, 0x43, 0xCB, 0x3F, 0xE0, 0x42);   // SCX, SCY
+    EMIT(0x6F, 0x26, 0x80, 0x77);               // Animate tile data
+    EMIT(0xFA, 0x10, 0xC0, 0xEA, 0x01, 0xFE);   // Move a sprite
+    EMIT(0xE0, 0x13, 0xE6, 0x1F);               // Sweep channel 1, retrigger every 32 frames
+    skip = jr_forward(0x20);
+    EMIT(0x3E, 0x87, 0xE0, 0x14);
+    jr_land(skip);
+    EMIT(0x3E, 0x20, 0xE0, 0x00, 0xF0, 0x00, 0x2F, 0xE6, 0x0F, 0x47); // Pad: directions
+    EMIT(0x3E, 0x10, 0xE0, 0x00, 0xF0, 0x00, 0x2F, 0xE6, 0x0F, 0xCB, 0x37, 0xB0); // and buttons
+    EMIT(0xEA, 0x11, 0xC0, 0x47, 0xF0, 0x47, 0xA8, 0xE0, 0x47); // Pressed buttons flip BGP
+    EMIT(0x3E, 0x30, 0xE0, 0x00);
+    EMIT(0xC1, 0xE1, 0xF1, 0xD9);
+
+    pc = 0x480; // STAT
+    EMIT(0xF5, 0xF0, 0x42, 0xC6, 0x20, 0xE0, 0x42, 0xF1, 0xD9);
+
+    pc = 0x4C0; // Timer
+    EMIT(0xF5, 0xFA, 0x12, 0xC0, 0x3C, 0xEA, 0x12, 0xC0, 0xF1, 0xD9);
+
+    return save_rom(filename);
+}
+
+// A CGB scene closer to what games draw: tile data only changes for a few animated tiles, the
+// background and the window use tiles from both banks with half of them flipped, 40 sprites, half
+// of them x-flipped. The CPU does little more than scrolling so that rendering dominates.
+static const char *write_tiles_rom(void)
+{
+    static char filename[] = "/tmp/gnuboy-bench-tiles.gb";
+    int loop, skip;
+
+    // Vectors: vblank, entry point
+    pc = 0x40; EMIT(0xC3, 0x00, 0x04);
+    pc = 0x100; EMIT(0x00, 0xC3, 0x50, 0x01);
+    memcpy(rom + 0x134, "GNUBOY TILES", 12);
+    rom[0x143] = 0x80;                          // CGB
+
+    pc = 0x150;
+    EMIT(0xF3, 0x31, 0xFE, 0xFF);               // DI; LD SP,FFFE
+    EMIT(0xAF, 0xE0, 0x40);                     // LCD off
+    EMIT(0x3E, 0x01, 0xE0, 0x4F);               // VRAM bank 1
+    EMIT(0x21, 0x00, 0x80, 0x01, 0x00, 0x18);   // Tiles: 6KB from 8000
+    loop = pc;
+    EMIT(0x7D, 0x81, 0x0F, 0xAC, 0x22);         // LD A,L; ADD A,C; RRCA; XOR H; LD (HL+),A
+    EMIT(0x0B, 0x78, 0xB1); jr_back(0x20, loop);
+    EMIT(0x21, 0x00, 0x98, 0x01, 0x00, 0x08);   // Attributes of both maps: 2KB from 9800
+    loop = pc;
+    EMIT(0x7D, 0xAC, 0x0F, 0xE6, 0x6F, 0x22);   // Palette, bank, x and y flips, no priority
+    EMIT(0x0B, 0x78, 0xB1); jr_back(0x20, loop);
+    EMIT(0xAF, 0xE0, 0x4F);                     // VRAM bank 0
+    EMIT(0x21, 0x00, 0x80, 0x01, 0x00, 0x18);
+    loop = pc;
+    EMIT(0x7D, 0xAC, 0x07, 0x81, 0x22);         // LD A,L; XOR H; RLCA; ADD A,C; LD (HL+),A
+    EMIT(0x0B, 0x78, 0xB1); jr_back(0x20, loop);
+    EMIT(0x21, 0x00, 0x98, 0x01, 0x00, 0x08);   // Both maps
+    loop = pc;
+    EMIT(0x7D, 0x84, 0x22);                     // LD A,L; ADD A,H; LD (HL+),A
+    EMIT(0x0B, 0x78, 0xB1); jr_back(0x20, loop);
+    EMIT(0x3E, 0x80, 0xE0, 0x68, 0x06, 64);     // BG palettes, auto-increment
+    loop = pc;
+    EMIT(0x78, 0x07, 0x07, 0xA8, 0xE0, 0x69, 0x05); jr_back(0x20, loop);
+    EMIT(0x3E, 0x80, 0xE0, 0x6A, 0x06, 64);     // OBJ palettes
+    loop = pc;
+    EMIT(0x78, 0x0F, 0xA8, 0xE0, 0x6B, 0x05); jr_back(0x20, loop);
+    EMIT(0x21, 0x00, 0xFE, 0x0E, 0x00);         // 40 sprites, C = index
+    loop = pc;
+    EMIT(0x79, 0x07, 0x07, 0x07, 0x81, 0x81, 0x81, 0x81, 0xE6, 0x7F, 0xC6, 0x10, 0x22); // y
+    EMIT(0x79, 0x07, 0x07, 0xC6, 0x08, 0x22);   // x
+    EMIT(0x79, 0x81, 0x81, 0x22);               // tile
+    EMIT(0x79, 0xCB, 0x37, 0x07, 0xE6, 0x20, 0x57, 0x79, 0xE6, 0x0F, 0xB2, 0x22); // Odd ones x-flipped
+    EMIT(0x0C, 0x79, 0xFE, 40); jr_back(0x20, loop);
+    EMIT(0x3E, 112, 0xE0, 0x4A, 0x3E, 7, 0xE0, 0x4B); // Window on the last 32 lines
+    EMIT(0xAF, 0xEA, 0x10, 0xC0, 0xE0, 0x0F);
+    EMIT(0x3E, 0x01, 0xE0, 0xFF);               // IE: vblank
+    EMIT(0x3E, 0xF3, 0xE0, 0x40, 0xFB);         // LCD on, EI
+    loop = pc;
+    EMIT(0x76, 0x00); jr_back(0x18, loop);      // HALT
+
+    pc = 0x400; // VBlank
+    EMIT(0xF5, 0xE5, 0xC5, 0x21, 0x10, 0xC0, 0x34, 0x7E); // Frame counter
+    EMIT(0xE0, 0x43, 0xCB, 0x3F, 0xE0, 0x42);   // SCX, SCY
+    EMIT(0xFA, 0x10, 0xC0, 0xEA, 0x01, 0xFE);   // Move a sprite
+    EMIT(0xE6, 0x07);                           // Every 8 frames, invert the next of 32 tiles
+    skip = jr_forward(0x20);
+    EMIT(0xFA, 0x10, 0xC0, 0x6F, 0x26, 0x40, 0x29, 0x06, 16);
+    loop = pc;
+    EMIT(0x7E, 0x2F, 0x22, 0x05); jr_back(0x20, loop);
+    jr_land(skip);
+    EMIT(0xC1, 0xE1, 0xF1, 0xD9);
+
+    return save_rom(filename);
+}
+
+int main(int argc, char **argv)
+{
+    const char *romfile = NULL, *inputfile = NULL, *hashfile = NULL, *reffile = NULL;
+    int frames = 3600;
+    int format = GB_PIXEL_565_BE;
+    int tiles = 0;
+    FILE *hashes = NULL, *reference = NULL;
+    uint32_t total_hash = 2166136261;
+    double total_time = 0;
+    int next_input = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            inputfile = argv[++i];
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            hashfile = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            reffile = argv[++i];
+        else if (strcmp(argv[i], "-p") == 0)
+            format = GB_PIXEL_PALETTED;
+        else if (strcmp(argv[i], "-t") == 0)
+            tiles = 1;
+        else if (argv[i][0] != '-' && !romfile)
+            romfile = argv[i];
+        else
+            fail("usage: %s [-n frames] [-i input.txt] [-o hashes.txt] [-c reference.txt] [-p] [-t] [rom.gb]", argv[0]);
+    }
+
+    if (inputfile)
+        load_inputs(inputfile);
+    if (hashfile && !(hashes = fopen(hashfile, "w")))
+        fail("%s", hashfile);
+    if (reffile && !(reference = fopen(reffile, "r")))
+        fail("%s", reffile);
+
+    gnuboy_init(AUDIO_SAMPLE_RATE, true, format, vblank_callback);
+    lcd.out.render_hook = render_hook;
+    snd.output.mix_hook = mix_hook;
+    vblank_callback();
+
+    if (!romfile)
+        romfile = tiles ? write_tiles_rom() : write_builtin_rom();
+    if (gnuboy_load_rom(romfile) < 0)
+        fail("gnuboy_load_rom");
+
+    gnuboy_set_palette(GB_PALETTE_GBC);
+    gnuboy_reset(true);
+    gnuboy_set_time(0, 0, 0, 0);
+
+    for (int frame = 0; frame < frames; frame++)
+    {
+        while (next_input < inputs_count && inputs[next_input].frame <= frame)
+            gnuboy_set_pad(inputs[next_input++].pad);
+
+        double start = now_us();
+        gnuboy_run(true);
+        total_time += now_us() - start;
+
+        // The frame that just completed is in the buffer the callback swapped away from
+        const uint16_t *pixels = framebuffers[current ^ 1];
+        if (format == GB_PIXEL_PALETTED)
+            pixels = expand_frame(current ^ 1);
+        uint32_t video = fnv1a(2166136261, pixels, sizeof(framebuffers[0]));
+        uint32_t audio = fnv1a(2166136261, snd.output.buf, snd.output.pos * sizeof(n16));
+        total_hash = fnv1a(total_hash, &video, 4);
+        total_hash = fnv1a(total_hash, &audio, 4);
+
+        if (hashes)
+            fprintf(hashes, "%d %08X %08X\n", frame, video, audio);
+
+        if (reference)
+        {
+            uint32_t ref_video, ref_audio;
+            int ref_frame;
+            if (fscanf(reference, "%d %x %x", &ref_frame, &ref_video, &ref_audio) != 3)
+                fail("%s ends before frame %d", reffile, frame);
+            if (ref_frame != frame || ref_video != video || ref_audio != audio)
+                fail("frame %d differs: video %08X/%08X audio %08X/%08X", frame, video, ref_video, audio, ref_audio);
+        }
+    }
+
+    double cpu_time = total_time - render_time - mix_time;
+
+    printf("%d frames in %.1f ms, %.0f fps, hash %08X%s\n", frames, total_time / 1000,
+        frames / total_time * 1e6, total_hash, reference ? ", identical to the reference" : "");
+    printf("%-10s %10s %12s %12s\n", "subsystem", "ms", "us/frame", "fps alone");
+    printf("%-10s %10.1f %12.1f %12.0f\n", "cpu", cpu_time / 1000, cpu_time / frames, frames / cpu_time * 1e6);
+    printf("%-10s %10.1f %12.1f %12.0f\n", "render", render_time / 1000, render_time / frames, frames / render_time * 1e6);
+    printf("%-10s %10.1f %12.1f %12.0f\n", "mix", mix_time / 1000, mix_time / frames, frames / mix_time * 1e6);
+    if (lcd.out.pal_overflow)
+        printf("%d palette changes didn't fit in the paletted frames\n", lcd.out.pal_overflow);
+
+    if (hashes)
+        fclose(hashes);
+    if (reference)
+        fclose(reference);
+    gnuboy_free_rom();
+    return 0;
+}
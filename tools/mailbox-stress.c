@@ -0,0 +1,146 @@
+// Stress test of rg_mailbox on the host: a producer thread posts numbered items from a pool of
+// three as fast as it can while a consumer thread takes them, holds them for a random time and
+// checks them. It fails if an item is torn (rewritten by the producer while the consumer holds
+// it), if items come out of order, or if the skipped flag doesn't match the items that were lost.
+//
+// Build (host):
+//   gcc -O2 -pthread -o mailbox-stress tools/mailbox-stress.c components/retro-go/rg_mailbox.c -Icomponents/retro-go
+//
+// Usage:
+//   mailbox-stress [posts]
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rg_mailbox.h"
+
+#define POOL_SIZE 3
+#define ITEM_WORDS 64
+
+typedef struct {
+    long seq;
+    long data[ITEM_WORDS];
+} item_t;
+
+static rg_mailbox_t mailbox;
+static item_t pool[POOL_SIZE];
+static long posts = 2000000;
+static atomic_bool producer_done;
+
+static long posted_dropped, taken, taken_skipped, lost_items;
+
+static void fail(const char *message, long a, long b)
+{
+    fprintf(stderr, "FAILED: %s (%ld, %ld)\n", message, a, b);
+    exit(1);
+}
+
+static void check_item(const item_t *item)
+{
+    for (int i = 0; i < ITEM_WORDS; i++)
+        if (item->data[i] != item->seq)
+            fail("torn item", item->seq, item->data[i]);
+}
+
+static void *producer(void *arg)
+{
+    item_t *last = NULL;
+    unsigned seed = 1;
+
+    for (long seq = 1; seq <= posts; seq++)
+    {
+        // The last posted item may still be waiting to be taken and the consumer may hold another
+        // one, with a pool of three there is always one that is free.
+        item_t *item = NULL;
+        for (int i = 0; i < POOL_SIZE && !item; i++)
+            if (&pool[i] != last && !rg_mailbox_busy(&mailbox, &pool[i]))
+                item = &pool[i];
+        if (!item)
+            fail("no free item", seq, 0);
+
+        item->seq = seq;
+        for (int i = 0; i < ITEM_WORDS; i++)
+            item->data[i] = seq;
+
+        if (rg_mailbox_post(&mailbox, item))
+            posted_dropped++;
+        last = item;
+
+        if (rand_r(&seed) % 64 == 0)
+            sched_yield();
+    }
+
+    atomic_store(&producer_done, true);
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    long prev = 0;
+    unsigned seed = 2;
+
+    while (!atomic_load(&producer_done) || rg_mailbox_pending(&mailbox))
+    {
+        bool skipped;
+        item_t *item = rg_mailbox_take(&mailbox, &skipped);
+
+        if (!item)
+        {
+            sched_yield();
+            continue;
+        }
+
+        long seq = item->seq;
+        check_item(item);
+
+        if (seq <= prev)
+            fail("out of order", prev, seq);
+        if (skipped != (seq > prev + 1))
+            fail("skipped flag doesn't match the lost items", prev, seq);
+
+        taken++;
+        taken_skipped += skipped;
+        lost_items += seq - prev - 1;
+        prev = seq;
+
+        // Hold the item for a while, the producer must not touch it
+        for (int spin = rand_r(&seed) % 2000; spin > 0; spin--)
+            __asm__ volatile("");
+        check_item(item);
+        if (item->seq != seq)
+            fail("item rewritten while held", seq, item->seq);
+
+        rg_mailbox_release(&mailbox);
+    }
+
+    if (prev != posts)
+        fail("last item never taken", prev, posts);
+
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t threads[2];
+
+    if (argc > 1)
+        posts = atol(argv[1]);
+
+    rg_mailbox_init(&mailbox);
+    pthread_create(&threads[0], NULL, consumer, NULL);
+    pthread_create(&threads[1], NULL, producer, NULL);
+    pthread_join(threads[1], NULL);
+    pthread_join(threads[0], NULL);
+
+    if (taken + lost_items != posts)
+        fail("items unaccounted for", taken + lost_items, posts);
+    if (posted_dropped != lost_items)
+        fail("dropped items reported by post don't match", posted_dropped, lost_items);
+
+    printf("%ld posts, %ld taken, %ld dropped, %ld takes flagged as skipped: OK\n",
+        posts, taken, lost_items, taken_skipped);
+    return 0;
+}
@@ -0,0 +1,268 @@
+// Compares the two ways rg_gui can load a PNG cover: the full decoder (whole file in memory,
+// RGB888 image, RGB565 copy, resized copy) and the row decoder (RGB565 rows box filtered during
+// decode). A synthetic cover is encoded with lupng itself, or a PNG file can be given. The peak
+// heap counts every allocation made through the LuUserContext plus the buffers rg_gui makes,
+// zlib's own inflate state (~40KB) is the same for both and isn't counted.
+//
+// Build (host):
+//   gcc -O2 -o png-bench tools/png-bench.c components/lupng/lupng.c -Icomponents/lupng -lz
+//
+// Usage:
+//   png-bench [file.png] [max_width] [max_height]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lupng.h"
+
+#define ITERATIONS 20
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} mem_stream_t;
+
+typedef struct
+{
+    int width, height;
+    uint16_t *data;
+} image_t;
+
+static size_t heap_current, heap_peak;
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "FAILED: %s\n", what);
+    exit(1);
+}
+
+static void *counted_alloc(size_t size, void *arg)
+{
+    size_t *ptr = calloc(1, size + sizeof(size_t));
+    if (!ptr)
+        return NULL;
+    *ptr = size;
+    heap_current += size;
+    if (heap_current > heap_peak)
+        heap_peak = heap_current;
+    return ptr + 1;
+}
+
+static void counted_free(void *ptr, void *arg)
+{
+    if (!ptr)
+        return;
+    size_t *base = (size_t *)ptr - 1;
+    heap_current -= *base;
+    free(base);
+}
+
+static size_t mem_read(void *ptr, size_t size, size_t count, void *arg)
+{
+    mem_stream_t *stream = arg;
+    size_t total = size * count;
+    if (total > stream->size - stream->pos)
+        total = stream->size - stream->pos;
+    memcpy(ptr, stream->data + stream->pos, total);
+    stream->pos += total;
+    return total / size;
+}
+
+static void init_context(LuUserContext *ctx, mem_stream_t *stream)
+{
+    luUserContextInitDefault(ctx);
+    ctx->readProc = mem_read;
+    ctx->readProcUserPtr = stream;
+    ctx->allocProc = counted_alloc;
+    ctx->freeProc = counted_free;
+}
+
+static size_t mem_write(const void *ptr, size_t size, size_t count, void *arg)
+{
+    mem_stream_t *stream = arg;
+    size_t total = size * count;
+    stream->data = realloc((void *)stream->data, stream->pos + total);
+    memcpy((uint8_t *)stream->data + stream->pos, ptr, total);
+    stream->pos += total;
+    return count;
+}
+
+// A cover-like picture: gradients and some detail so that the compressed size is realistic
+static void *generate_png(int width, int height, size_t *size)
+{
+    LuImage *img = luImageCreate(width, height, 3, 8, NULL, NULL);
+    if (!img)
+        fail("luImageCreate");
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t *row = img->data + y * img->pitch;
+        for (int x = 0; x < width; x++, row += 3)
+        {
+            row[0] = x * 255 / width;
+            row[1] = y * 255 / height;
+            row[2] = ((x / 8 + y / 8) & 1) ? 200 : (x * y) & 0xFF;
+        }
+    }
+    mem_stream_t stream = {0};
+    LuUserContext ctx;
+    luUserContextInitDefault(&ctx);
+    ctx.writeProc = mem_write;
+    ctx.writeProcUserPtr = &stream;
+    ctx.warnProc = NULL; // It tries a palette first
+    if (luPngWriteUC(&ctx, img) != PNG_OK)
+        fail("luPngWriteUC");
+    luImageRelease(img, NULL);
+    *size = stream.pos;
+    return (void *)stream.data;
+}
+
+// The previous rg_image_load_from_file: copy the file, decode, convert, resize
+static image_t load_full(const uint8_t *file, size_t file_size, int max_width, int max_height)
+{
+    LuUserContext ctx;
+    image_t out = {0};
+
+    uint8_t *copy = counted_alloc(file_size, NULL);
+    memcpy(copy, file, file_size);
+    mem_stream_t stream = {copy, file_size, 0};
+    init_context(&ctx, &stream);
+
+    LuImage *png = luPngReadUC(&ctx);
+    if (!png)
+        fail("luPngReadUC");
+
+    uint16_t *rgb565 = counted_alloc(png->width * png->height * 2, NULL);
+    for (int i = 0; i < png->width * png->height; i++)
+    {
+        const uint8_t *src = png->data + i * png->channels;
+        rgb565[i] = ((src[0] >> 3) << 11) | ((src[1] >> 2) << 5) | (src[2] >> 3);
+    }
+
+    out.width = png->width;
+    out.height = png->height;
+    if (max_width && out.width > max_width)
+    {
+        out.height = out.height * max_width / out.width;
+        out.width = max_width;
+    }
+    if (max_height && out.height > max_height)
+    {
+        out.width = out.width * max_height / out.height;
+        out.height = max_height;
+    }
+    out.data = counted_alloc(out.width * out.height * 2, NULL);
+    float step_x = (float)png->width / out.width, step_y = (float)png->height / out.height;
+    for (int y = 0; y < out.height; y++)
+        for (int x = 0; x < out.width; x++)
+            out.data[y * out.width + x] = rgb565[(int)(y * step_y) * png->width + (int)(x * step_x)];
+
+    counted_free(rgb565, NULL);
+    luImageRelease(png, &ctx);
+    counted_free(copy, NULL);
+    return out;
+}
+
+static int on_size(void *arg, int32_t width, int32_t height)
+{
+    image_t *img = arg;
+    img->width = width;
+    img->height = height;
+    img->data = counted_alloc(width * height * 2, NULL);
+    return img->data == NULL;
+}
+
+static int on_row(void *arg, int32_t row, const uint16_t *pixels)
+{
+    image_t *img = arg;
+    memcpy(img->data + row * img->width, pixels, img->width * 2);
+    return 0;
+}
+
+// The row decoder, reading the file in small pieces like rg_gui does with fread
+static image_t load_rows(const uint8_t *file, size_t file_size, int max_width, int max_height)
+{
+    LuUserContext ctx;
+    image_t out = {0};
+    mem_stream_t stream = {file, file_size, 0};
+    LuRowReader reader = {max_width, max_height, on_size, on_row, &out};
+
+    init_context(&ctx, &stream);
+    if (luPngReadRowsUC(&ctx, &reader) != PNG_OK)
+        fail("luPngReadRowsUC");
+    return out;
+}
+
+static void bench(const char *name, image_t (*load)(const uint8_t *, size_t, int, int),
+                  const uint8_t *file, size_t file_size, int max_width, int max_height, image_t *result)
+{
+    double start = now_us();
+    for (int i = 0; i < ITERATIONS; i++)
+    {
+        heap_peak = heap_current = 0;
+        *result = load(file, file_size, max_width, max_height);
+        if (i < ITERATIONS - 1)
+            counted_free(result->data, NULL);
+    }
+    printf("%-14s %4dx%-4d %8.2f ms  peak heap %7zu bytes\n", name, result->width, result->height,
+        (now_us() - start) / ITERATIONS / 1000, heap_peak);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filename = argc > 1 && strcmp(argv[1], "-") ? argv[1] : NULL;
+    int max_width = argc > 2 ? atoi(argv[2]) : 160;
+    int max_height = argc > 3 ? atoi(argv[3]) : 168;
+    uint8_t *file = NULL;
+    size_t file_size = 0;
+    image_t full, rows;
+
+    if (filename)
+    {
+        FILE *fp = fopen(filename, "rb");
+        if (!fp)
+            fail(filename);
+        fseek(fp, 0, SEEK_END);
+        file_size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        file = malloc(file_size);
+        if (fread(file, file_size, 1, fp) != 1)
+            fail("fread");
+        fclose(fp);
+    }
+    else
+    {
+        file = generate_png(320, 240, &file_size);
+    }
+    printf("input: %s, %zu bytes\n", filename ? filename : "generated 320x240 RGB", file_size);
+
+    // Same size: both decoders must agree on every pixel
+    bench("full", load_full, file, file_size, 0, 0, &full);
+    bench("rows", load_rows, file, file_size, 0, 0, &rows);
+    if (full.width != rows.width || full.height != rows.height
+        || memcmp(full.data, rows.data, full.width * full.height * 2) != 0)
+        fail("full size output differs");
+    counted_free(full.data, NULL);
+    counted_free(rows.data, NULL);
+
+    // Downscaled: the sizes must agree, the pixels differ (box filter vs nearest neighbour)
+    bench("full+resize", load_full, file, file_size, max_width, max_height, &full);
+    bench("rows+box", load_rows, file, file_size, max_width, max_height, &rows);
+    if (full.width != rows.width || full.height != rows.height)
+        fail("downscaled size differs");
+    counted_free(full.data, NULL);
+    counted_free(rows.data, NULL);
+
+    free(file);
+    return 0;
+}
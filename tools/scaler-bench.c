@@ -0,0 +1,214 @@
+// Benchmarks the line scaler of rg_display against the per-pixel accumulator loop it replaced,
+// scaling common source sizes to the full 320x240 screen, and checks that both sample the same
+// source columns for every partial rectangle write_rect can be asked to draw. It also times the
+// per-format SCALE_LINE specializations against a single scaler testing the format per pixel,
+// with and without the horizontal filter (fused vs a second pass), and checks they match.
+//
+// Build (host):
+//   gcc -O3 -o scaler-bench tools/scaler-bench.c components/retro-go/rg_display_scale.c -Icomponents/retro-go
+//
+// Usage:
+//   scaler-bench [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rg_display.h"
+
+#define SCREEN_WIDTH 320
+#define SCREEN_HEIGHT 240
+
+static rg_display_column_t columns[SCREEN_WIDTH];
+static uint16_t palette[256], output[SCREEN_WIDTH], expected[SCREEN_WIDTH];
+static int failures;
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void fail(const char *what, int a, int b)
+{
+    printf("  FAILED: %s (%d, %d)\n", what, a, b);
+    failures++;
+}
+
+// What write_rect did for every line before the column tables, starting from source column left
+static void scale_line_accumulator(uint16_t *dst, const void *src, const uint16_t *palette, int format,
+                                   int left, int width, int x_inc, int scaled_left)
+{
+    const uint8_t *src8 = (const uint8_t *)src + left;
+    const uint16_t *src16 = (const uint16_t *)src + left;
+
+    for (int x = 0, x_acc = (x_inc * scaled_left) % SCREEN_WIDTH; x < width;)
+    {
+        uint16_t pixel;
+
+        if (format & RG_PIXEL_PAL)
+            pixel = palette[src8[x]];
+        else if (format & RG_PIXEL_LE)
+            pixel = (src16[x] << 8) | (src16[x] >> 8);
+        else
+            pixel = src16[x];
+
+        *(dst++) = pixel;
+
+        x_acc += x_inc;
+        while (x_acc >= SCREEN_WIDTH) {
+            x_acc -= SCREEN_WIDTH;
+            ++x;
+        }
+    }
+}
+
+// The column scaler before it was specialized, the format is tested for every pixel
+static void scale_line_generic(uint16_t *dst, const void *src, const uint16_t *palette, int format,
+                               const rg_display_column_t *columns, int width)
+{
+    const uint8_t *src8 = src;
+    const uint16_t *src16 = src;
+
+    for (int x = 0; x < width; ++x)
+    {
+        int src_x = columns[x].src_x;
+
+        if (format & RG_PIXEL_PAL)
+            dst[x] = palette[src8[src_x]];
+        else if (format & RG_PIXEL_LE)
+            dst[x] = (src16[src_x] << 8) | (src16[src_x] >> 8);
+        else
+            dst[x] = src16[src_x];
+    }
+}
+
+// And its horizontal filter, a second pass over the scaled line with the same packed blend
+static void filter_line_generic(uint16_t *dst, const rg_display_column_t *columns, int width)
+{
+    for (int x = 1; x < width - 1; ++x)
+    {
+        uint32_t a = dst[x - 1], b = dst[x + 1];
+        if (!columns[x].blend || a == b)
+        {
+            if (columns[x].blend)
+                dst[x] = a;
+            continue;
+        }
+        a = ((a & 0x00FF00FF) << 8) | ((a >> 8) & 0x00FF00FF);
+        b = ((b & 0x00FF00FF) << 8) | ((b >> 8) & 0x00FF00FF);
+        uint32_t v = (a & b) + (((a ^ b) & 0xF7DEF7DE) >> 1);
+        dst[x] = ((v & 0x00FF00FF) << 8) | ((v >> 8) & 0x00FF00FF);
+    }
+}
+
+// Same rounding as write_rect
+static int scaled(int x, int x_inc)
+{
+    return (SCREEN_WIDTH * x + (x_inc - 1)) / x_inc;
+}
+
+static void check_partial_rects(const void *frame, int src_width, int format)
+{
+    const int x_inc = src_width; // Full screen, see update_viewport_scaling
+    rg_display_scale_line_t scale_line = rg_display_get_line_scaler(format, false);
+
+    for (int left = 0; left < src_width; left++)
+    {
+        for (int width = 1; left + width <= src_width; width++)
+        {
+            int scaled_left = scaled(left, x_inc);
+            int scaled_width = scaled(left + width, x_inc) - scaled_left;
+
+            scale_line_accumulator(expected, frame, palette, format, left, width, x_inc, scaled_left);
+            scale_line(output, frame, palette, &columns[scaled_left], scaled_width);
+            if (memcmp(output, expected, scaled_width * 2))
+            {
+                fail("columns differ from the accumulator loop", left, width);
+                return;
+            }
+        }
+    }
+}
+
+static void bench(int src_width, int src_height, int format, const char *name, int frames)
+{
+    const int pixlen = (format & RG_PIXEL_PAL) ? 1 : 2;
+    const int x_inc = src_width;
+    const int stride = src_width * pixlen;
+    uint8_t *frame = malloc(stride * src_height);
+    rg_display_scale_line_t scale_line = rg_display_get_line_scaler(format, false);
+    rg_display_scale_line_t scale_line_filtered = rg_display_get_line_scaler(format, true);
+    double start, accumulator, generic, specialized, generic_filtered, specialized_filtered;
+
+    for (int i = 0; i < stride * src_height; i++)
+        frame[i] = rand();
+
+    rg_display_scale_columns(columns, SCREEN_WIDTH, 0, x_inc, src_width);
+    check_partial_rects(frame, src_width, format);
+
+    // One scaled line per screen line, the source line is picked like the vertical scaler would.
+    // Best of five runs.
+#define TIME_LINES(result, ...)                                                             \
+    result = 1e30;                                                                          \
+    for (int run = 0; run < 5; run++)                                                       \
+    {                                                                                       \
+        start = now_us();                                                                   \
+        for (int f = 0; f < frames / 5; f++)                                                \
+            for (int y = 0; y < SCREEN_HEIGHT; y++)                                         \
+            {                                                                               \
+                const uint8_t *line = frame + (y * src_height / SCREEN_HEIGHT) * stride;    \
+                __VA_ARGS__;                                                                \
+            }                                                                               \
+        double elapsed = (now_us() - start) * 1000 / (frames / 5 * SCREEN_HEIGHT);          \
+        result = elapsed < result ? elapsed : result;                                       \
+    }
+
+    TIME_LINES(accumulator, scale_line_accumulator(output, line, palette, format, 0, src_width, x_inc, 0));
+    TIME_LINES(generic, scale_line_generic(output, line, palette, format, columns, SCREEN_WIDTH));
+    TIME_LINES(specialized, scale_line(output, line, palette, columns, SCREEN_WIDTH));
+    TIME_LINES(generic_filtered, scale_line_generic(output, line, palette, format, columns, SCREEN_WIDTH);
+                                 filter_line_generic(output, columns, SCREEN_WIDTH));
+    TIME_LINES(specialized_filtered, scale_line_filtered(output, line, palette, columns, SCREEN_WIDTH));
+
+    // The fused filter must give the same result as the second pass
+    for (int y = 0; y < src_height; y++)
+    {
+        scale_line_generic(expected, frame + y * stride, palette, format, columns, SCREEN_WIDTH);
+        filter_line_generic(expected, columns, SCREEN_WIDTH);
+        scale_line_filtered(output, frame + y * stride, palette, columns, SCREEN_WIDTH);
+        if (memcmp(output, expected, sizeof(output)))
+        {
+            fail("fused filter differs from the second pass", src_width, y);
+            break;
+        }
+    }
+
+    printf("%3dx%-3d %-6s  %6.1f  %6.1f  %6.1f  (%.2fx)     %6.1f  %6.1f  (%.2fx)\n",
+        src_width, src_height, name, accumulator, generic, specialized, generic / specialized,
+        generic_filtered, specialized_filtered, generic_filtered / specialized_filtered);
+
+    free(frame);
+}
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 2000;
+
+    for (int i = 0; i < 256; i++)
+        palette[i] = rand();
+
+    printf("Scaling to %dx%d, %d frames each, ns/line\n", SCREEN_WIDTH, SCREEN_HEIGHT, frames);
+    printf("                accumu- columns                          filter X\n");
+    printf("                lator   generic special.              2 passes  fused\n");
+    bench(160, 144, RG_PIXEL_565_BE, "565_BE", frames);
+    bench(160, 144, RG_PIXEL_PAL565_BE, "PAL565", frames);
+    bench(256, 240, RG_PIXEL_565_LE, "565_LE", frames);
+    bench(256, 240, RG_PIXEL_PAL565_BE, "PAL565", frames);
+    bench(256, 240, RG_PIXEL_565_BE, "565_BE", frames);
+
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+// Measures the settings store (rg_kvstore) on the host: startup load of one app's namespace and
+// saving a single changed key, with a config similar to 20 apps' worth of settings. It also
+// checks that a torn write at the end of the log is detected and doesn't lose older records.
+//
+// Build (host):
+//   gcc -O2 -o settings-bench tools/settings-bench.c components/retro-go/rg_kvstore.c -Icomponents/retro-go
+//
+// To compare against the previous whole-file cJSON approach, add ESP-IDF's cJSON:
+//   -DWITH_CJSON $IDF_PATH/components/json/cJSON/cJSON.c -I$IDF_PATH/components/json/cJSON
+//
+// Usage:
+//   settings-bench [iterations] [workdir]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rg_kvstore.h"
+
+#ifdef WITH_CJSON
+#include <cJSON.h>
+#endif
+
+#define APPS 20
+#define KEYS_PER_APP 12
+#define GLOBAL_KEYS 10
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void fill_store(rg_kvstore_t *kv)
+{
+    char ns[32], key[32], value[128];
+
+    for (int i = 0; i < GLOBAL_KEYS; i++)
+    {
+        sprintf(key, "GlobalKey%d", i);
+        rg_kv_set_int32(kv, "", key, i * 7);
+    }
+    rg_kv_set_string(kv, "", "RomFilePath", "/sd/roms/gbc/Some Long Game Name (USA, Europe) (Rev 1).gbc");
+
+    for (int app = 0; app < APPS; app++)
+    {
+        sprintf(ns, "emulator-%d", app);
+        for (int i = 0; i < KEYS_PER_APP; i++)
+        {
+            sprintf(key, "Setting%d", i);
+            if (i % 4 == 3)
+            {
+                sprintf(value, "/sd/roms/app%d/folder %d/file.rom", app, i);
+                rg_kv_set_string(kv, ns, key, value);
+            }
+            else
+                rg_kv_set_int32(kv, ns, key, app * 100 + i);
+        }
+    }
+}
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "FAILED: %s\n", what);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+    const char *workdir = argc > 2 ? argv[2] : "/tmp";
+    char path[512], temp[512];
+    rg_kvstore_t kv;
+    FILE *fp, *in, *out;
+
+    snprintf(path, sizeof(path), "%s/settings-bench.kv", workdir);
+    snprintf(temp, sizeof(temp), "%s/settings-bench.kv.new", workdir);
+    unlink(path);
+
+    // Build the initial, compacted, log
+    rg_kv_init(&kv);
+    fill_store(&kv);
+    if (!(out = fopen(path, "wb")) || !rg_kv_compact(&kv, NULL, out))
+        fail("initial write");
+    fclose(out);
+    printf("log: %zu bytes, %zu keys\n", kv.log_size, kv.count);
+    rg_kv_free(&kv);
+
+    // Startup: load the global namespace and one app's
+    double start = now_us();
+    for (int i = 0; i < iterations; i++)
+    {
+        fp = fopen(path, "rb");
+        rg_kv_load(&kv, fp, "emulator-7");
+        fclose(fp);
+    }
+    printf("init (one namespace): %.1f us, %zu keys loaded\n", (now_us() - start) / iterations, kv.count);
+
+    const rg_kv_entry_t *entry = rg_kv_get(&kv, "emulator-7", "Setting3");
+    if (!entry || entry->type != RG_KV_STRING || strcmp(entry->value_str, "/sd/roms/app7/folder 3/file.rom"))
+        fail("load value");
+    if (rg_kv_get(&kv, "emulator-8", "Setting0"))
+        fail("namespace filter");
+
+    // Save: one key changed per save, like a menu toggle. Compacts as rg_settings_save() would.
+    int compactions = 0;
+    double compaction_time = 0;
+    start = now_us();
+    for (int i = 0; i < iterations; i++)
+    {
+        rg_kv_set_int32(&kv, "emulator-7", "Setting0", i);
+        if (rg_kv_needs_compaction(&kv))
+        {
+            double t = now_us();
+            in = fopen(path, "rb");
+            out = fopen(temp, "wb");
+            if (!rg_kv_compact(&kv, in, out))
+                fail("compaction");
+            fclose(in);
+            fclose(out);
+            unlink(path);
+            rename(temp, path);
+            compaction_time += now_us() - t;
+            compactions++;
+        }
+        else
+        {
+            fp = fopen(path, "ab");
+            if (!rg_kv_flush(&kv, fp))
+                fail("flush");
+            fclose(fp);
+        }
+    }
+    printf("save (one key): %.1f us, %d compactions (%.1f us each)\n", (now_us() - start) / iterations,
+        compactions, compactions ? compaction_time / compactions : 0);
+
+    // Everything must have survived, including the other namespaces
+    fp = fopen(path, "rb");
+    rg_kv_load(&kv, fp, NULL);
+    fclose(fp);
+    entry = rg_kv_get(&kv, "emulator-7", "Setting0");
+    if (!entry || entry->value_int != iterations - 1 || kv.count != GLOBAL_KEYS + 1 + APPS * KEYS_PER_APP)
+        fail("values after saves");
+
+    // Torn write: the last record is cut short
+    fp = fopen(path, "ab");
+    rg_kv_set_int32(&kv, "", "Torn", 1234);
+    rg_kv_flush(&kv, fp);
+    fclose(fp);
+    truncate(path, kv.log_size - 3);
+    fp = fopen(path, "rb");
+    rg_kv_load(&kv, fp, "emulator-7");
+    fclose(fp);
+    entry = rg_kv_get(&kv, "emulator-7", "Setting0");
+    if (!kv.damaged || rg_kv_get(&kv, "", "Torn") || !entry || entry->value_int != iterations - 1)
+        fail("torn write");
+    printf("torn write: detected, older records intact\n");
+
+    rg_kv_free(&kv);
+
+#ifdef WITH_CJSON
+    // The previous approach: parse everything at init, print everything on save
+    rg_kv_init(&kv);
+    fill_store(&kv);
+    cJSON *root = cJSON_CreateObject();
+    size_t iterator = 0;
+    while ((entry = rg_kv_next(&kv, &iterator)))
+    {
+        cJSON *parent = root;
+        if (entry->ns[0] && !(parent = cJSON_GetObjectItem(root, entry->ns)))
+            parent = cJSON_AddObjectToObject(root, entry->ns);
+        if (entry->type == RG_KV_INT32)
+            cJSON_AddNumberToObject(parent, entry->key, entry->value_int);
+        else
+            cJSON_AddStringToObject(parent, entry->key, entry->value_str);
+    }
+    char *json = cJSON_Print(root);
+    cJSON_Delete(root);
+    rg_kv_free(&kv);
+
+    start = now_us();
+    for (int i = 0; i < iterations; i++)
+        cJSON_Delete(cJSON_Parse(json));
+    printf("cJSON init: %.1f us (%zu bytes)\n", (now_us() - start) / iterations, strlen(json));
+
+    root = cJSON_Parse(json);
+    snprintf(temp, sizeof(temp), "%s/settings-bench.json", workdir);
+    start = now_us();
+    for (int i = 0; i < iterations; i++)
+    {
+        char *buffer = cJSON_Print(root);
+        fp = fopen(temp, "wb");
+        fputs(buffer, fp);
+        fclose(fp);
+        cJSON_free(buffer);
+    }
+    printf("cJSON save: %.1f us\n", (now_us() - start) / iterations);
+    cJSON_Delete(root);
+    free(json);
+    unlink(temp);
+#endif
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,227 @@
+// Renders a screen of the launcher's ROM list (14 lines, 320 pixels wide) with every font type,
+// once with the renderer rg_gui had before the glyph cache (walk the font data and decode bits on
+// every character) and once with rg_gui_text.c. Both must produce the same pixels.
+//
+// Build (host):
+//   gcc -O2 -o text-bench tools/text-bench.c components/retro-go/rg_gui_text.c components/retro-go/fonts/*.c -Icomponents/retro-go
+//
+// Usage:
+//   text-bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "rg_gui.h"
+#include "fonts/fonts.h"
+
+#define SCREEN_WIDTH 320
+#define LIST_LINES 14
+
+static const char *list[LIST_LINES] = {
+    "Legend of Zelda, The - Link's Awakening DX (USA, Europe) (Rev 2)",
+    "Pokemon - Crystal Version (USA, Europe) (Rev 1)",
+    "Super Mario Land 2 - 6 Golden Coins (USA, Europe) (Rev 2)",
+    "Tetris DX (World)",
+    "Kirby's Dream Land 2 (USA, Europe)",
+    "Metroid II - Return of Samus (World)",
+    "Wario Land II (USA, Europe)",
+    "Donkey Kong Country (USA, Europe) (En,Fr,De,Es,It)",
+    "Shantae (USA)",
+    "Dragon Warrior Monsters 2 - Cobi's Journey (USA)",
+    "Mega Man Xtreme 2 (USA, Europe)",
+    "Harvest Moon 3 GBC (USA)",
+    "Bionic Commando - Elite Forces (USA, Australia)",
+    "Survival Kids (USA)",
+};
+
+static uint16_t buffer[SCREEN_WIDTH * 24];
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// The previous get_glyph(), as it was in rg_gui.c
+static rg_glyph_t legacy_get_glyph(const rg_font_t *font, int points, int c)
+{
+    rg_glyph_t out = {
+        .width  = font->width ? font->width : 8,
+        .height = font->height,
+        .bitmap = {0},
+    };
+
+    if (c == '\n')
+    {
+        out.width = 0;
+    }
+    else if (font->type == 0)
+    {
+        if (c < font->chars)
+        {
+            for (int y = 0; y < font->height; y++)
+                out.bitmap[y] = font->data[(c * font->height) + y];
+        }
+    }
+    else
+    {
+        int charCode, adjYOffset, width, height, xOffset, xDelta;
+        const uint8_t *data = font->data;
+        do {
+            charCode = *data++;
+            adjYOffset = *data++;
+            width = *data++;
+            height = *data++;
+            xOffset = *data++;
+            xOffset = xOffset < 0x80 ? xOffset : -(0xFF - xOffset);
+            xDelta = *data++;
+
+            if (c != charCode && charCode != 0xFF && width != 0)
+                data += (((width * height) - 1) / 8) + 1;
+        } while ((c != charCode) && (charCode != 0xFF));
+
+        if (c == charCode)
+        {
+            out.width = ((width > xDelta) ? width : xDelta);
+
+            int ch = 0, mask = 0x80;
+
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    if (((x + (y * width)) % 8) == 0) {
+                        mask = 0x80;
+                        ch = *data++;
+                    }
+                    if ((ch & mask) != 0)
+                        out.bitmap[adjYOffset + y] |= (1 << (xOffset + x));
+                    mask >>= 1;
+                }
+            }
+        }
+    }
+
+    if (points && points != font->height)
+    {
+        float scale = (float)points / font->height;
+        rg_glyph_t out2 = out;
+        out.height = points;
+        for (int y = 0; y < out.height; y++)
+            out.bitmap[y] = out2.bitmap[(int)(y / scale)];
+    }
+
+    return out;
+}
+
+// The previous rg_gui_draw_text(), single line, without the rg_display_write()
+static void legacy_draw_line(const rg_font_t *font, int points, const char *text, int draw_width,
+                             uint16_t color_fg, uint16_t color_bg)
+{
+    int x_offset = 0;
+
+    for (size_t p = 0; p < draw_width * points; p++)
+        buffer[p] = color_bg;
+
+    while (x_offset < draw_width)
+    {
+        rg_glyph_t glyph = legacy_get_glyph(font, points, *text++);
+
+        if (draw_width - x_offset < glyph.width)
+            break;
+
+        for (int y = 0; y < points; y++)
+        {
+            uint16_t *output = &buffer[x_offset + (draw_width * y)];
+            for (int x = 0; x < glyph.width; x++)
+                output[x] = (glyph.bitmap[y] & (1 << x)) ? color_fg : color_bg;
+        }
+
+        x_offset += glyph.width;
+
+        if (*text == 0 || *text == '\n')
+            break;
+    }
+}
+
+// As in rg_gui.c
+static void fill_pixels(uint16_t *buffer, uint16_t color, size_t count)
+{
+    uint32_t color32 = (color << 16) | color;
+
+    if (((uintptr_t)buffer & 2) && count)
+    {
+        *buffer++ = color;
+        count--;
+    }
+    for (size_t i = 0; i < count / 2; i++)
+        ((uint32_t *)buffer)[i] = color32;
+    if (count & 1)
+        buffer[count - 1] = color;
+}
+
+// What rg_gui_draw_text() does now for the same line
+static void cached_draw_line(const rg_glyph_cache_t *cache, const char *text, int draw_width,
+                             uint16_t color_fg, uint16_t color_bg)
+{
+    const char *end = rg_glyph_cache_fit(cache, text, draw_width, NULL);
+
+    fill_pixels(buffer, color_bg, draw_width * cache->height);
+
+    rg_glyph_cache_draw(cache, buffer, draw_width, 0, text, end - text, color_fg);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    static uint16_t expected[SCREEN_WIDTH * 24];
+
+    printf("%-12s %6s %12s %12s %8s\n", "font", "points", "legacy (us)", "cached (us)", "speedup");
+
+    for (int type = 0; type < fonts_count; type++)
+    {
+        const rg_font_t *font = fonts[type];
+        int points = (type < 3) ? (8 + type * 4) : font->height; // As rg_gui_set_font_type()
+        rg_glyph_cache_t cache = {0};
+        double start, legacy, cached, build;
+
+        start = now_us();
+        if (!rg_glyph_cache_init(&cache, font, points))
+        {
+            fprintf(stderr, "FAILED: rg_glyph_cache_init\n");
+            return 1;
+        }
+        build = now_us() - start;
+
+        for (int line = 0; line < LIST_LINES; line++)
+        {
+            legacy_draw_line(font, points, list[line], SCREEN_WIDTH, 0xFFFF, 0x0010);
+            memcpy(expected, buffer, sizeof(buffer));
+            cached_draw_line(&cache, list[line], SCREEN_WIDTH, 0xFFFF, 0x0010);
+            if (memcmp(expected, buffer, SCREEN_WIDTH * points * 2) != 0)
+            {
+                fprintf(stderr, "FAILED: font %d line %d differs\n", type, line);
+                return 1;
+            }
+        }
+
+        start = now_us();
+        for (int i = 0; i < iterations; i++)
+            for (int line = 0; line < LIST_LINES; line++)
+                legacy_draw_line(font, points, list[line], SCREEN_WIDTH, 0xFFFF, 0x0010);
+        legacy = (now_us() - start) / iterations;
+
+        start = now_us();
+        for (int i = 0; i < iterations; i++)
+            for (int line = 0; line < LIST_LINES; line++)
+                cached_draw_line(&cache, list[line], SCREEN_WIDTH, 0xFFFF, 0x0010);
+        cached = (now_us() - start) / iterations;
+
+        printf("%-12s %6d %12.1f %12.1f %7.1fx  (cache built in %.0f us)\n", font->name, points,
+            legacy, cached, legacy / cached, build);
+        rg_glyph_cache_free(&cache);
+    }
+
+    return 0;
+}